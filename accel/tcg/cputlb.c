@@ -938,6 +938,65 @@ void tlb_reset_dirty(CPUState *cpu, uintptr_t start, uintptr_t length)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
+#ifdef XBOX
+/* Called with tlb_c.lock held */
+static bool tlb_flush_host_range_locked(CPUTLBEntry *ent, uintptr_t start,
+                                        uintptr_t length)
+{
+    const uint64_t cmp[3] = {
+        ent->addr_read, tlb_addr_write(ent), ent->addr_code
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(cmp); i++) {
+        if (cmp[i] == -1) {
+            continue;
+        }
+        uintptr_t host = (cmp[i] & TARGET_PAGE_MASK) + ent->addend;
+        if ((host - start) < length) {
+            memset(ent, -1, sizeof(*ent));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Drop every entry of @cpu's TLB which maps a page of the host range
+ * [start, start + length). Unlike tlb_flush_page this does not need the
+ * guest virtual addresses the range is mapped at.
+ *
+ * Must be called while @cpu is not running guest code, e.g. from
+ * async_safe_run_on_cpu.
+ */
+void tlb_flush_host_range(CPUState *cpu, uintptr_t start, uintptr_t length)
+{
+    int mmu_idx;
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+        CPUTLBDescFast *fast = cpu_tlb_fast(cpu, mmu_idx);
+        unsigned int n = tlb_n_entries(fast);
+        unsigned int i;
+
+        for (i = 0; i < n; i++) {
+            if (tlb_flush_host_range_locked(&fast->table[i], start, length)) {
+                tlb_n_used_entries_dec(cpu, mmu_idx);
+            }
+        }
+
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            if (tlb_flush_host_range_locked(&desc->vtable[i], start,
+                                            length)) {
+                tlb_n_used_entries_dec(cpu, mmu_idx);
+            }
+        }
+    }
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+}
+#endif
+
 /* Called with tlb_c.lock held */
 static inline void tlb_set_dirty1_locked(CPUTLBEntry *tlb_entry,
                                          vaddr addr)
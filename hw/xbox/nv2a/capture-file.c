@@ -0,0 +1,144 @@
+/*
+ * QEMU Geforce NV2A method stream capture file format
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture-file.h"
+
+static void put_le32(void *p, uint32_t v)
+{
+    uint8_t *b = p;
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+}
+
+static uint32_t get_le32(const void *p)
+{
+    const uint8_t *b = p;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+bool nv2a_capture_write_header(FILE *f, const NV2ACaptureHeader *header)
+{
+    NV2ACaptureHeader out = *header;
+
+    put_le32(&out.magic, header->magic);
+    put_le32(&out.version, header->version);
+    put_le32(&out.vram_size, header->vram_size);
+    put_le32(&out.ramin_size, header->ramin_size);
+
+    return fwrite(&out, sizeof(out), 1, f) == 1;
+}
+
+/* Returns false if the header is truncated or not from this version */
+bool nv2a_capture_read_header(FILE *f, NV2ACaptureHeader *header)
+{
+    if (fread(header, sizeof(*header), 1, f) != 1) {
+        return false;
+    }
+
+    header->magic = get_le32(&header->magic);
+    header->version = get_le32(&header->version);
+    header->vram_size = get_le32(&header->vram_size);
+    header->ramin_size = get_le32(&header->ramin_size);
+    header->snapshot_name[sizeof(header->snapshot_name) - 1] = '\0';
+
+    return header->magic == NV2A_CAPTURE_MAGIC &&
+           header->version == NV2A_CAPTURE_VERSION;
+}
+
+bool nv2a_capture_write_packet(FILE *f, uint32_t type, const void *data0,
+                               size_t size0, const void *data1, size_t size1)
+{
+    uint32_t tag[2];
+
+    put_le32(&tag[0], type);
+    put_le32(&tag[1], size0 + size1);
+
+    return fwrite(tag, sizeof(tag), 1, f) == 1 &&
+           (!size0 || fwrite(data0, size0, 1, f) == 1) &&
+           (!size1 || fwrite(data1, size1, 1, f) == 1);
+}
+
+NV2ACaptureReadResult nv2a_capture_read_packet(FILE *f,
+                                               NV2ACapturePacket *packet)
+{
+    uint32_t tag[2];
+
+    if (fread(tag, sizeof(tag), 1, f) != 1) {
+        return feof(f) && !ferror(f) ? NV2A_CAPTURE_READ_END :
+                                       NV2A_CAPTURE_READ_INVALID;
+    }
+
+    uint32_t type = get_le32(&tag[0]);
+    uint32_t size = get_le32(&tag[1]);
+    if (size % sizeof(uint32_t)) {
+        return NV2A_CAPTURE_READ_INVALID;
+    }
+    if (size > packet->buffer_size) {
+        uint32_t *words = realloc(packet->words, size);
+        if (!words) {
+            return NV2A_CAPTURE_READ_INVALID;
+        }
+        packet->words = words;
+        packet->buffer_size = size;
+    }
+    if (size && fread(packet->words, size, 1, f) != 1) {
+        return NV2A_CAPTURE_READ_INVALID;
+    }
+
+    packet->type = type;
+    packet->num_words = size / sizeof(uint32_t);
+
+    return NV2A_CAPTURE_READ_OK;
+}
+
+void nv2a_capture_packet_free(NV2ACapturePacket *packet)
+{
+    free(packet->words);
+    memset(packet, 0, sizeof(*packet));
+}
+
+void nv2a_replay_report_begin(NV2AReplayReport *report, FILE *f)
+{
+    memset(report, 0, sizeof(*report));
+    report->file = f;
+
+    fprintf(f, "frame,ms");
+    for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+        fprintf(f, ",%s", nv2a_profile_get_counter_name(i));
+    }
+    fprintf(f, "\n");
+}
+
+void nv2a_replay_report_frame(NV2AReplayReport *report, double ms,
+                              const int *counters)
+{
+    fprintf(report->file, "%u,%.3f", report->num_frames, ms);
+    for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+        fprintf(report->file, ",%d", counters[i]);
+        report->counter_totals[i] += counters[i];
+    }
+    fprintf(report->file, "\n");
+
+    report->num_frames++;
+}
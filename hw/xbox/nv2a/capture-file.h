@@ -0,0 +1,96 @@
+/*
+ * QEMU Geforce NV2A method stream capture file format
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_CAPTURE_FILE_H
+#define HW_XBOX_NV2A_CAPTURE_FILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debug.h"
+
+/*
+ * A capture is anchored to a VM snapshot taken when it starts, so it only
+ * has to record what happens afterwards. The file is a stream of packets,
+ * each a little-endian { type, payload size in bytes } pair followed by the
+ * payload:
+ *
+ *   METHOD        Method ring record exactly as executed by the puller
+ *   PGRAPH_WRITE  { addr, val } MMIO write to PGRAPH
+ *   VRAM, RAMIN   { offset, data } pages dirtied since the previous batch
+ *
+ * Nothing here depends on the rest of QEMU, so the format can be tested on
+ * its own.
+ */
+
+#define NV2A_CAPTURE_MAGIC 0x5432564e /* 'NV2T' */
+#define NV2A_CAPTURE_VERSION 1
+#define NV2A_CAPTURE_SNAPSHOT_NAME_LEN 64
+
+enum NV2ACapturePacketType {
+    NV2A_CAPTURE_METHOD = 1,
+    NV2A_CAPTURE_PGRAPH_WRITE = 2,
+    NV2A_CAPTURE_VRAM = 3,
+    NV2A_CAPTURE_RAMIN = 4,
+};
+
+/* Stored little-endian, converted on read and write */
+typedef struct NV2ACaptureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vram_size;
+    uint32_t ramin_size;
+    char snapshot_name[NV2A_CAPTURE_SNAPSHOT_NAME_LEN];
+} NV2ACaptureHeader;
+
+typedef enum NV2ACaptureReadResult {
+    NV2A_CAPTURE_READ_OK,
+    NV2A_CAPTURE_READ_END,
+    NV2A_CAPTURE_READ_INVALID,
+} NV2ACaptureReadResult;
+
+typedef struct NV2ACapturePacket {
+    uint32_t type;
+    uint32_t *words;      /* Payload, as stored in the file */
+    size_t num_words;
+    size_t buffer_size;   /* Allocated size of words, in bytes */
+} NV2ACapturePacket;
+
+/* Per-frame CSV report written while replaying */
+typedef struct NV2AReplayReport {
+    FILE *file;
+    unsigned int num_frames;
+    uint64_t counter_totals[NV2A_PROF__COUNT];
+} NV2AReplayReport;
+
+bool nv2a_capture_write_header(FILE *f, const NV2ACaptureHeader *header);
+bool nv2a_capture_read_header(FILE *f, NV2ACaptureHeader *header);
+bool nv2a_capture_write_packet(FILE *f, uint32_t type, const void *data0,
+                               size_t size0, const void *data1, size_t size1);
+NV2ACaptureReadResult nv2a_capture_read_packet(FILE *f,
+                                               NV2ACapturePacket *packet);
+void nv2a_capture_packet_free(NV2ACapturePacket *packet);
+
+void nv2a_replay_report_begin(NV2AReplayReport *report, FILE *f);
+void nv2a_replay_report_frame(NV2AReplayReport *report, double ms,
+                              const int *counters);
+
+#endif
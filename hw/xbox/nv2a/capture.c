@@ -0,0 +1,495 @@
+/*
+ * QEMU Geforce NV2A method stream capture and replay
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv2a_int.h"
+#include "qemu/cutils.h"
+#include "migration/snapshot.h"
+#include "ui/xemu-notifications.h"
+
+#define NV2A_CAPTURE_BUFFER_SIZE (1 * MiB)
+#define NV2A_REPLAY_BATCH_SIZE 256 /* Packets replayed per FIFO iteration */
+
+static void capture_write_packet(NV2AState *d, uint32_t type,
+                                 const void *data0, size_t size0,
+                                 const void *data1, size_t size1)
+{
+    if (!nv2a_capture_write_packet(d->capture.file, type, data0, size0, data1,
+                                   size1)) {
+        error_report("nv2a: Failed to write capture: %s", strerror(errno));
+        nv2a_capture_end(d);
+    }
+}
+
+/* Called with the BQL held */
+static void capture_set_logging(NV2AState *d, bool log)
+{
+    if (d->capture.logging == log) {
+        return;
+    }
+
+    memory_region_set_log(d->vram, log, DIRTY_MEMORY_NV2A_CAPTURE);
+    memory_region_set_log(&d->ramin, log, DIRTY_MEMORY_NV2A_CAPTURE);
+    d->capture.logging = log;
+}
+
+/* Captures that end on the FIFO threads stop dirty logging from here, as
+ * changing it requires the BQL. A capture cannot begin while this runs.
+ */
+static void capture_stop_logging_bh(void *opaque)
+{
+    NV2AState *d = opaque;
+
+    qemu_mutex_lock(&d->pgraph.lock);
+    bool capturing = d->capture.file != NULL;
+    qemu_mutex_unlock(&d->pgraph.lock);
+
+    if (!capturing) {
+        capture_set_logging(d, false);
+    }
+}
+
+void nv2a_capture_init(NV2AState *d)
+{
+    d->capture.stop_logging_bh = qemu_bh_new(capture_stop_logging_bh, d);
+}
+
+/* Called after the FIFO threads have exited */
+void nv2a_capture_finalize(NV2AState *d)
+{
+    nv2a_capture_end(d);
+    qemu_bh_delete(d->capture.stop_logging_bh);
+    d->capture.stop_logging_bh = NULL;
+}
+
+static void capture_sync_region(NV2AState *d, MemoryRegion *mr,
+                                const uint8_t *ptr, uint32_t type)
+{
+    hwaddr size = memory_region_size(mr);
+    DirtyBitmapSnapshot *snap = memory_region_snapshot_and_clear_dirty(
+        mr, 0, size, DIRTY_MEMORY_NV2A_CAPTURE);
+
+    /* Coalesce runs of dirty pages into a single packet */
+    hwaddr run_start = size;
+    for (hwaddr addr = 0; addr <= size && d->capture.file;
+         addr += TARGET_PAGE_SIZE) {
+        bool dirty = addr < size &&
+                     memory_region_snapshot_get_dirty(mr, snap, addr,
+                                                      TARGET_PAGE_SIZE);
+        if (dirty) {
+            if (run_start == size) {
+                run_start = addr;
+            }
+        } else if (run_start != size) {
+            uint32_t offset;
+            stl_le_p(&offset, run_start);
+            capture_write_packet(d, type, &offset, sizeof(offset),
+                                 ptr + run_start, addr - run_start);
+            run_start = size;
+        }
+    }
+
+    g_free(snap);
+}
+
+/* Called with the pgraph lock held, before a batch of methods is executed */
+void nv2a_capture_sync_memory(NV2AState *d)
+{
+    capture_sync_region(d, d->vram, d->vram_ptr, NV2A_CAPTURE_VRAM);
+    capture_sync_region(d, &d->ramin, d->ramin_ptr, NV2A_CAPTURE_RAMIN);
+}
+
+void nv2a_capture_method(NV2AState *d, uint32_t header, uint32_t *parameters,
+                         size_t num_words)
+{
+    uint32_t record_header;
+    stl_le_p(&record_header, header);
+
+    /* Ring words are already stored little-endian */
+    capture_write_packet(d, NV2A_CAPTURE_METHOD, &record_header,
+                         sizeof(record_header), parameters,
+                         num_words * sizeof(uint32_t));
+
+    if (d->capture.file && d->capture.frames_remaining == 0) {
+        nv2a_capture_end(d);
+    }
+}
+
+void nv2a_capture_pgraph_write(NV2AState *d, uint32_t addr, uint32_t val)
+{
+    uint32_t data[2];
+    stl_le_p(&data[0], addr);
+    stl_le_p(&data[1], val);
+    capture_write_packet(d, NV2A_CAPTURE_PGRAPH_WRITE, data, sizeof(data),
+                         NULL, 0);
+}
+
+/* Called when the snapshot anchoring a capture is taken, with the FIFO locked
+ * and halted so nothing executes between the snapshot and the first packet.
+ */
+void nv2a_capture_begin(NV2AState *d)
+{
+    g_autofree char *path = d->capture.pending_path;
+    d->capture.pending_path = NULL;
+
+    if (!path) {
+        return;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        error_report("nv2a: Failed to open capture file %s: %s", path,
+                     strerror(errno));
+        goto fail;
+    }
+    setvbuf(f, NULL, _IOFBF, NV2A_CAPTURE_BUFFER_SIZE);
+
+    NV2ACaptureHeader header = {
+        .magic = NV2A_CAPTURE_MAGIC,
+        .version = NV2A_CAPTURE_VERSION,
+        .vram_size = memory_region_size(d->vram),
+        .ramin_size = memory_region_size(&d->ramin),
+    };
+    pstrcpy(header.snapshot_name, sizeof(header.snapshot_name),
+            d->capture.snapshot_name);
+
+    if (!nv2a_capture_write_header(f, &header)) {
+        error_report("nv2a: Failed to write capture: %s", strerror(errno));
+        fclose(f);
+        goto fail;
+    }
+
+    /* The snapshot holds everything up to now */
+    capture_set_logging(d, true);
+    memory_region_reset_dirty(d->vram, 0, memory_region_size(d->vram),
+                              DIRTY_MEMORY_NV2A_CAPTURE);
+    memory_region_reset_dirty(&d->ramin, 0, memory_region_size(&d->ramin),
+                              DIRTY_MEMORY_NV2A_CAPTURE);
+
+    d->capture.file = f;
+    return;
+
+fail:
+    g_free(d->capture.snapshot_name);
+    d->capture.snapshot_name = NULL;
+}
+
+/* Called with the pgraph lock held, or after the FIFO threads have exited */
+void nv2a_capture_end(NV2AState *d)
+{
+    if (!d->capture.file) {
+        return;
+    }
+
+    if (fclose(d->capture.file)) {
+        error_report("nv2a: Failed to write capture: %s", strerror(errno));
+    }
+    d->capture.file = NULL;
+    g_free(d->capture.snapshot_name);
+    d->capture.snapshot_name = NULL;
+
+    if (bql_locked()) {
+        capture_set_logging(d, false);
+    } else {
+        qemu_bh_schedule(d->capture.stop_logging_bh);
+    }
+
+    xemu_queue_notification("NV2A capture finished");
+}
+
+static void replay_frame(NV2AState *d)
+{
+    NV2AReplayState *r = &d->replay;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    nv2a_replay_report_frame(&r->report, (now - r->frame_start_time) / 1e6,
+                             g_nv2a_stats.frame_working.counters);
+    r->frame_start_time = now;
+}
+
+/* Called at NV097_FLIP_STALL, before the frame counters are reset */
+void nv2a_capture_flip_stall(NV2AState *d)
+{
+    if (d->capture.file && d->capture.frames_remaining > 0) {
+        d->capture.frames_remaining--;
+    }
+    if (d->replay.file) {
+        replay_frame(d);
+    }
+}
+
+static bool replay_method(NV2AState *d, uint32_t *words, size_t num_words)
+{
+    PGRAPHState *pg = &d->pgraph;
+    size_t pos = 0;
+
+    qemu_mutex_lock(&pg->lock);
+
+    /* Flips were completed by the recorded PGRAPH writes, don't wait */
+    pg->waiting_for_flip = false;
+
+    while (pos < num_words) {
+        uint32_t header = ldl_le_p(&words[pos]);
+        uint32_t count = (header >> 18) & 0x7ff;
+        uint32_t needed = (header & 0x1ffc) ? count : 2;
+        if (!count || needed > num_words - pos - 1) {
+            qemu_mutex_unlock(&pg->lock);
+            return false;
+        }
+
+        uint32_t next =
+            pfifo_execute_record(d, &words[pos], num_words - pos - 1);
+        if (!next) {
+            /* The recorded channel switch did not match, skip the record */
+            pg->waiting_for_context_switch = false;
+            break;
+        }
+        pos += next;
+    }
+
+    qemu_mutex_unlock(&pg->lock);
+
+    return true;
+}
+
+static bool replay_memory(MemoryRegion *mr, uint8_t *ptr, uint32_t *words,
+                          size_t size)
+{
+    if (size < sizeof(uint32_t)) {
+        return false;
+    }
+
+    hwaddr offset = ldl_le_p(&words[0]);
+    size_t len = size - sizeof(uint32_t);
+    if (offset + len > memory_region_size(mr)) {
+        return false;
+    }
+
+    memcpy(ptr + offset, &words[1], len);
+    memory_region_set_dirty(mr, offset, len);
+
+    return true;
+}
+
+/* Replays the next packet, returns false at the end of the capture */
+static bool replay_packet(NV2AState *d)
+{
+    NV2AReplayState *r = &d->replay;
+
+    switch (nv2a_capture_read_packet(r->file, &r->packet)) {
+    case NV2A_CAPTURE_READ_OK:
+        break;
+    case NV2A_CAPTURE_READ_END:
+        return false;
+    default:
+        goto invalid;
+    }
+
+    uint32_t *words = r->packet.words;
+    size_t num_words = r->packet.num_words;
+    size_t size = num_words * sizeof(uint32_t);
+
+    switch (r->packet.type) {
+    case NV2A_CAPTURE_METHOD:
+        if (!replay_method(d, words, num_words)) {
+            goto invalid;
+        }
+        return true;
+    case NV2A_CAPTURE_PGRAPH_WRITE:
+        if (num_words != 2) {
+            goto invalid;
+        }
+        bql_lock();
+        pgraph_write(d, ldl_le_p(&words[0]), ldl_le_p(&words[1]), 4);
+        bql_unlock();
+        return true;
+    case NV2A_CAPTURE_VRAM:
+        if (!replay_memory(d->vram, d->vram_ptr, words, size)) {
+            goto invalid;
+        }
+        return true;
+    case NV2A_CAPTURE_RAMIN:
+        if (!replay_memory(&d->ramin, d->ramin_ptr, words, size)) {
+            goto invalid;
+        }
+        return true;
+    default:
+        break;
+    }
+
+invalid:
+    error_report("nv2a: Truncated or invalid packet in capture, "
+                 "stopping replay");
+    return false;
+}
+
+/* Called by the FIFO thread with the pfifo lock held, in place of the puller.
+ * Returns true while there is more to replay.
+ */
+bool nv2a_replay_run(NV2AState *d)
+{
+    bool more = true;
+
+    qemu_mutex_unlock(&d->pfifo.lock);
+    for (int i = 0; more && i < NV2A_REPLAY_BATCH_SIZE; i++) {
+        more = replay_packet(d);
+    }
+    qemu_mutex_lock(&d->pfifo.lock);
+
+    if (!more) {
+        nv2a_replay_end(d);
+    }
+
+    return more;
+}
+
+/* Called with the pfifo lock held, or after the FIFO threads have exited */
+void nv2a_replay_end(NV2AState *d)
+{
+    NV2AReplayState *r = &d->replay;
+
+    if (!r->file) {
+        return;
+    }
+
+    int64_t elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - r->start_time;
+    unsigned int frames = MAX(r->report.num_frames, 1);
+
+    info_report("nv2a: Replayed %u frames in %.3f ms (%.3f ms/frame)",
+                r->report.num_frames, elapsed / 1e6, elapsed / 1e6 / frames);
+    for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+        if (r->report.counter_totals[i]) {
+            info_report("nv2a:   %s: %.1f/frame",
+                        nv2a_profile_get_counter_name(i),
+                        (double)r->report.counter_totals[i] / frames);
+        }
+    }
+
+    fclose(r->file);
+    fclose(r->report.file);
+    nv2a_capture_packet_free(&r->packet);
+    memset(r, 0, sizeof(*r));
+
+    xemu_queue_notification("NV2A replay finished, reload a snapshot to "
+                            "continue");
+}
+
+static bool nv2a_dbg_is_busy(NV2AState *d)
+{
+    qemu_mutex_lock(&d->pfifo.lock);
+    qemu_mutex_lock(&d->pgraph.lock);
+    bool busy = d->capture.file || d->capture.pending_path || d->replay.file;
+    qemu_mutex_unlock(&d->pgraph.lock);
+    qemu_mutex_unlock(&d->pfifo.lock);
+
+    if (busy) {
+        xemu_queue_error_message("An NV2A capture or replay is already "
+                                 "in progress");
+    }
+    return busy;
+}
+
+void nv2a_dbg_capture_frames(const char *path, int num_frames)
+{
+    NV2AState *d = g_nv2a;
+
+    if (nv2a_dbg_is_busy(d)) {
+        return;
+    }
+
+    g_autofree char *base = g_path_get_basename(path);
+    g_autofree char *name = g_strdup_printf("nv2a-trace-%s", base);
+    name[MIN(strlen(name), NV2A_CAPTURE_SNAPSHOT_NAME_LEN - 1)] = '\0';
+
+    qemu_mutex_lock(&d->pgraph.lock);
+    d->capture.pending_path = g_strdup(path);
+    d->capture.snapshot_name = g_strdup(name);
+    d->capture.frames_remaining = MAX(num_frames, 1);
+    qemu_mutex_unlock(&d->pgraph.lock);
+
+    /* The capture starts from the VM state change into RUN_STATE_SAVE_VM */
+    Error *err = NULL;
+    if (!save_snapshot(name, true, NULL, false, NULL, &err)) {
+        xemu_queue_error_message(error_get_pretty(err));
+        error_free(err);
+
+        qemu_mutex_lock(&d->pgraph.lock);
+        nv2a_capture_end(d);
+        g_free(d->capture.pending_path);
+        d->capture.pending_path = NULL;
+        qemu_mutex_unlock(&d->pgraph.lock);
+    }
+}
+
+void nv2a_dbg_replay(const char *path)
+{
+    NV2AState *d = g_nv2a;
+    NV2ACaptureHeader header;
+    Error *err = NULL;
+
+    if (nv2a_dbg_is_busy(d)) {
+        return;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        xemu_queue_error_message("Failed to open NV2A capture");
+        return;
+    }
+
+    if (!nv2a_capture_read_header(f, &header) ||
+        header.vram_size != memory_region_size(d->vram) ||
+        header.ramin_size != memory_region_size(&d->ramin)) {
+        xemu_queue_error_message("Invalid NV2A capture for this machine");
+        fclose(f);
+        return;
+    }
+
+    g_autofree char *report_path = g_strdup_printf("%s.csv", path);
+    FILE *report = fopen(report_path, "w");
+    if (!report) {
+        xemu_queue_error_message("Failed to create NV2A replay report");
+        fclose(f);
+        return;
+    }
+    /* Leave the VM stopped, the FIFO stays halted while the replay runs */
+    bool vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_RESTORE_VM);
+    if (!load_snapshot(header.snapshot_name, NULL, false, NULL, &err)) {
+        xemu_queue_error_message(error_get_pretty(err));
+        error_free(err);
+        fclose(report);
+        fclose(f);
+        if (vm_running) {
+            vm_start();
+        }
+        return;
+    }
+
+    qemu_mutex_lock(&d->pfifo.lock);
+    qemu_mutex_lock(&d->pgraph.lock);
+    memset(&g_nv2a_stats.frame_working, 0,
+           sizeof(g_nv2a_stats.frame_working));
+    d->replay.file = f;
+    nv2a_replay_report_begin(&d->replay.report, report);
+    d->replay.start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    d->replay.frame_start_time = d->replay.start_time;
+    pfifo_kick(d);
+    qemu_mutex_unlock(&d->pgraph.lock);
+    qemu_mutex_unlock(&d->pfifo.lock);
+}
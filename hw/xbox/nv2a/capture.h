@@ -0,0 +1,56 @@
+/*
+ * QEMU Geforce NV2A method stream capture and replay
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_CAPTURE_H
+#define HW_XBOX_NV2A_CAPTURE_H
+
+#include "capture-file.h"
+
+typedef struct NV2ACaptureState {
+    FILE *file;           /* Open while capturing */
+    char *pending_path;   /* Armed until the snapshot is saved */
+    char *snapshot_name;
+    int frames_remaining;
+    bool logging;         /* Dirty logging enabled, changed with the BQL */
+    QEMUBH *stop_logging_bh;
+} NV2ACaptureState;
+
+typedef struct NV2AReplayState {
+    FILE *file;           /* Open while replaying */
+    NV2ACapturePacket packet;
+    NV2AReplayReport report;
+    int64_t start_time;
+    int64_t frame_start_time;
+} NV2AReplayState;
+
+typedef struct NV2AState NV2AState;
+
+void nv2a_capture_init(NV2AState *d);
+void nv2a_capture_finalize(NV2AState *d);
+void nv2a_capture_begin(NV2AState *d);
+void nv2a_capture_end(NV2AState *d);
+void nv2a_capture_sync_memory(NV2AState *d);
+void nv2a_capture_method(NV2AState *d, uint32_t header, uint32_t *parameters,
+                         size_t num_words);
+void nv2a_capture_pgraph_write(NV2AState *d, uint32_t addr, uint32_t val);
+void nv2a_capture_flip_stall(NV2AState *d);
+bool nv2a_replay_run(NV2AState *d);
+void nv2a_replay_end(NV2AState *d);
+
+#endif
@@ -68,6 +68,13 @@
 
 #endif
 
+/* Traces every method parameter executed by PGRAPH. Define to 0 to strip
+ * method tracing from the dispatch loop.
+ */
+#ifndef DEBUG_NV2A_METHOD_TRACE
+# define DEBUG_NV2A_METHOD_TRACE 1
+#endif
+
 #define NV2A_PROF_COUNTERS_XMAC \
     _X(NV2A_PROF_FINISH_VERTEX_BUFFER_DIRTY) \
     _X(NV2A_PROF_FINISH_SURFACE_CREATE) \
@@ -81,6 +88,7 @@
     _X(NV2A_PROF_CLEAR) \
     _X(NV2A_PROF_QUEUE_SUBMIT) \
     _X(NV2A_PROF_QUEUE_SUBMIT_AUX) \
+    _X(NV2A_PROF_FRAME_WAIT) \
     _X(NV2A_PROF_PIPELINE_NOTDIRTY) \
     _X(NV2A_PROF_PIPELINE_GEN) \
     _X(NV2A_PROF_PIPELINE_BIND) \
@@ -96,9 +104,12 @@
     _X(NV2A_PROF_SHADER_BIND_NOTDIRTY) \
     _X(NV2A_PROF_SHADER_UBO_DIRTY) \
     _X(NV2A_PROF_SHADER_UBO_NOTDIRTY) \
+    _X(NV2A_PROF_SHADER_COMPILE_PENDING) \
+    _X(NV2A_PROF_SHADER_UBERSHADER) \
     _X(NV2A_PROF_ATTR_BIND) \
     _X(NV2A_PROF_TEX_UPLOAD) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_1) \
+    _X(NV2A_PROF_GEOM_BUFFER_UPDATE_1_STALE) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_2) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_3) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_4) \
@@ -146,6 +157,9 @@ int nv2a_profile_get_counter_value(unsigned int cnt);
 void nv2a_profile_increment(void);
 void nv2a_profile_flip_stall(void);
 
+void nv2a_dbg_capture_frames(const char *path, int num_frames);
+void nv2a_dbg_replay(const char *path);
+
 static inline void nv2a_profile_inc_counter(enum NV2A_PROF_COUNTERS_ENUM cnt)
 {
     g_nv2a_stats.frame_working.counters[cnt] += 1;
@@ -232,11 +232,18 @@ static void nv2a_init_memory(NV2AState *d, MemoryRegion *ram)
     memory_region_set_log(d->vram, true, DIRTY_MEMORY_NV2A_TEX);
     memory_region_set_dirty(d->vram, 0, memory_region_size(d->vram));
 
+    /* Watch RAMHT writes for the pfifo handle cache */
+    memory_region_set_log(&d->ramin, true, DIRTY_MEMORY_NV2A);
+    pfifo_ramht_cache_init(d);
+
+    nv2a_capture_init(d);
     pgraph_init(d);
 
     /* fire up pfifo */
     qemu_thread_create(&d->pfifo.thread, "nv2a.pfifo_thread",
                        pfifo_thread, d, QEMU_THREAD_JOINABLE);
+    qemu_thread_create(&d->pfifo.pusher_thread, "nv2a.pfifo_pusher_thread",
+                       pfifo_pusher_thread, d, QEMU_THREAD_JOINABLE);
 }
 
 static void nv2a_init_vga(NV2AState *d)
@@ -297,7 +304,13 @@ static void nv2a_reset(NV2AState *d)
         qatomic_set(&d->pfifo.halt, false);
     }
 
+    nv2a_capture_end(d);
+    nv2a_replay_end(d);
+
     memset(d->pfifo.regs, 0, sizeof(d->pfifo.regs));
+    d->pfifo.method_ring.head = 0;
+    d->pfifo.method_ring.tail = 0;
+    pfifo_ramht_cache_invalidate(d);
     memset(d->pgraph.regs_, 0, sizeof(d->pgraph.regs_));
     memset(d->pvideo.regs, 0, sizeof(d->pvideo.regs));
 
@@ -356,6 +369,7 @@ static void nv2a_realize(PCIDevice *dev, Error **errp)
     qemu_mutex_init(&d->pfifo.lock);
     qemu_cond_init(&d->pfifo.fifo_cond);
     qemu_cond_init(&d->pfifo.fifo_idle_cond);
+    qemu_cond_init(&d->pfifo.pusher_cond);
 }
 
 static void nv2a_exitfn(PCIDevice *dev)
@@ -366,8 +380,13 @@ static void nv2a_exitfn(PCIDevice *dev)
     d->exiting = true;
 
     qemu_cond_broadcast(&d->pfifo.fifo_cond);
+    qemu_cond_broadcast(&d->pfifo.pusher_cond);
+    qemu_thread_join(&d->pfifo.pusher_thread);
     qemu_thread_join(&d->pfifo.thread);
 
+    nv2a_capture_finalize(d);
+    nv2a_replay_end(d);
+
     pgraph_destroy(&d->pgraph);
 }
 
@@ -392,6 +411,7 @@ static void nv2a_vm_state_change(void *opaque, bool running, RunState state)
         pgraph_pre_savevm_wait(d);
         bql_lock();
         nv2a_lock_fifo(d);
+        nv2a_capture_begin(d);
     } else if (state == RUN_STATE_RESTORE_VM) {
         nv2a_lock_fifo(d);
         qatomic_set(&d->pfifo.halt, true);
@@ -421,12 +441,17 @@ static int nv2a_pre_load(void *opaque)
 {
     NV2AState *d = opaque;
     nv2a_lock_fifo(d);
+    nv2a_capture_end(d);
+    d->pfifo.method_ring.head = 0;
+    d->pfifo.method_ring.tail = 0;
+    pfifo_ramht_cache_invalidate(d);
     return 0;
 }
 
 static int nv2a_post_load(void *opaque, int version_id)
 {
     NV2AState *d = opaque;
+    d->pgraph.launch_program = NULL;
     qatomic_set(&d->pgraph.flush_pending, true);
     nv2a_unlock_fifo(d);
     return 0;
@@ -442,6 +467,38 @@ const VMStateDescription vmstate_nv2a_pgraph_vertex_attributes = {
     }
 };
 
+static bool nv2a_pfifo_method_ring_needed(void *opaque)
+{
+    NV2AState *d = opaque;
+    return d->pfifo.method_ring.head != d->pfifo.method_ring.tail;
+}
+
+static int nv2a_pfifo_method_ring_post_load(void *opaque, int version_id)
+{
+    NV2AState *d = opaque;
+    if (d->pfifo.method_ring.head >= PFIFO_METHOD_RING_SIZE ||
+        d->pfifo.method_ring.tail >= PFIFO_METHOD_RING_SIZE) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// Methods already taken from the pushbuffer but not yet executed
+static const VMStateDescription vmstate_nv2a_pfifo_method_ring = {
+    .name = "nv2a/pfifo/method-ring",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = nv2a_pfifo_method_ring_needed,
+    .post_load = nv2a_pfifo_method_ring_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(pfifo.method_ring.head, NV2AState),
+        VMSTATE_UINT32(pfifo.method_ring.tail, NV2AState),
+        VMSTATE_UINT32_ARRAY(pfifo.method_ring.words, NV2AState,
+                             PFIFO_METHOD_RING_SIZE),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static const VMStateDescription vmstate_nv2a = {
     .name = "nv2a",
     .version_id = 3,
@@ -566,6 +623,10 @@ static const VMStateDescription vmstate_nv2a = {
         VMSTATE_BOOL(pgraph.waiting_for_context_switch, NV2AState),
         VMSTATE_END_OF_LIST()
     },
+    .subsections = (const VMStateDescription * const []) {
+        &vmstate_nv2a_pfifo_method_ring,
+        NULL
+    },
 };
 
 static void nv2a_class_init(ObjectClass *klass, const void *data)
@@ -50,6 +50,8 @@
 #include "nv2a.h"
 #include "pgraph/pgraph.h"
 #include "debug.h"
+#include "capture.h"
+#include "ramht.h"
 #include "nv2a_regs.h"
 
 #define NV2A_DEVICE(obj) OBJECT_CHECK(NV2AState, (obj), "nv2a")
@@ -67,6 +69,14 @@ typedef struct DMAObject {
     hwaddr limit;
 } DMAObject;
 
+#define PFIFO_METHOD_RING_SIZE 0x4000 /* In words */
+
+typedef struct PFIFOMethodRing {
+    uint32_t words[PFIFO_METHOD_RING_SIZE];
+    uint32_t head; /* Written by the pusher */
+    uint32_t tail; /* Written by the puller */
+} PFIFOMethodRing;
+
 typedef struct NV2AState {
     /*< private >*/
     PCIDevice parent_obj;
@@ -103,6 +113,11 @@ typedef struct NV2AState {
         QemuCond fifo_idle_cond;
         bool fifo_kick;
         bool halt;
+        QemuThread pusher_thread;
+        QemuCond pusher_cond;
+        bool pusher_kick;
+        PFIFOMethodRing method_ring;
+        RAMHTCache ramht_cache;
     } pfifo;
 
     struct {
@@ -150,6 +165,9 @@ typedef struct NV2AState {
         uint8_t palette[256*3];
     } puserdac;
 
+    NV2ACaptureState capture;
+    NV2AReplayState replay;
+
 } NV2AState;
 
 typedef struct NV2ABlockInfo {
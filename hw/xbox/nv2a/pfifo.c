@@ -21,16 +21,7 @@
 
 #include "nv2a_int.h"
 
-typedef struct RAMHTEntry {
-    uint32_t handle;
-    hwaddr instance;
-    enum FIFOEngine engine;
-    unsigned int channel_id : 5;
-    bool valid;
-} RAMHTEntry;
-
 static void pfifo_run_pusher(NV2AState *d);
-static uint32_t ramht_hash(NV2AState *d, uint32_t handle);
 static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle);
 
 /* PFIFO - MMIO and DMA FIFO submission to PGRAPH and VPE */
@@ -79,6 +70,10 @@ void pfifo_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
         d->pfifo.enabled_interrupts = val;
         nv2a_update_irq(d);
         break;
+    case NV_PFIFO_RAMHT:
+        d->pfifo.regs[addr] = val;
+        pfifo_ramht_cache_invalidate(d);
+        break;
     default:
         d->pfifo.regs[addr] = val;
         break;
@@ -89,10 +84,17 @@ void pfifo_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
     qemu_mutex_unlock(&d->pfifo.lock);
 }
 
+static void pfifo_kick_pusher(NV2AState *d)
+{
+    d->pfifo.pusher_kick = true;
+    qemu_cond_broadcast(&d->pfifo.pusher_cond);
+}
+
 void pfifo_kick(NV2AState *d)
 {
     d->pfifo.fifo_kick = true;
     qemu_cond_broadcast(&d->pfifo.fifo_cond);
+    pfifo_kick_pusher(d);
 }
 
 static bool can_fifo_access(NV2AState *d) {
@@ -100,6 +102,69 @@ static bool can_fifo_access(NV2AState *d) {
            NV_PGRAPH_FIFO_ACCESS;
 }
 
+/*
+ * The pusher decodes the pushbuffer into the method ring and the puller
+ * executes it. Each record is a method header in pushbuffer format followed
+ * by its parameters, with jumps and calls already resolved and object handles
+ * already looked up, so that PGRAPH can look ahead into the ring the same way
+ * it would into the pushbuffer. SET_OBJECT records carry the channel of the
+ * object as a second parameter.
+ */
+#define PFIFO_RING_WRAP 0xffffffff
+#define PFIFO_PULLER_BATCH_SIZE 256 /* Records executed per pgraph lock */
+
+static uint32_t pfifo_ring_header(uint32_t method, uint32_t subchannel,
+                                  uint32_t count, bool inc)
+{
+    return (inc ? 0 : 0x40000000) | (count << 18) | (subchannel << 13) |
+           method;
+}
+
+static bool pfifo_ring_is_empty(NV2AState *d)
+{
+    PFIFOMethodRing *ring = &d->pfifo.method_ring;
+    return qatomic_read(&ring->head) == qatomic_read(&ring->tail);
+}
+
+/* Returns where to write a record of num_words, or NULL if the ring is full */
+static uint32_t *pfifo_ring_reserve(NV2AState *d, size_t num_words)
+{
+    PFIFOMethodRing *ring = &d->pfifo.method_ring;
+    uint32_t head = ring->head;
+    uint32_t tail = qatomic_load_acquire(&ring->tail);
+
+    if (head < tail) {
+        return head + num_words < tail ? &ring->words[head] : NULL;
+    }
+
+    if (head + num_words < PFIFO_METHOD_RING_SIZE ||
+        (head + num_words == PFIFO_METHOD_RING_SIZE && tail > 0)) {
+        return &ring->words[head];
+    }
+
+    /* Records are contiguous, continue at the start of the ring */
+    if (num_words < tail) {
+        ring->words[head] = PFIFO_RING_WRAP;
+        return &ring->words[0];
+    }
+
+    return NULL;
+}
+
+static void pfifo_ring_publish(NV2AState *d, uint32_t *end)
+{
+    PFIFOMethodRing *ring = &d->pfifo.method_ring;
+
+    qatomic_store_release(&ring->head,
+                          (end - ring->words) % PFIFO_METHOD_RING_SIZE);
+    d->pfifo.regs[NV_PFIFO_CACHE1_STATUS] &= ~NV_PFIFO_CACHE1_STATUS_LOW_MARK;
+
+    if (!d->pfifo.fifo_kick) {
+        d->pfifo.fifo_kick = true;
+        qemu_cond_broadcast(&d->pfifo.fifo_cond);
+    }
+}
+
 /* If NV097_FLIP_STALL was executed, check if the flip has completed.
  * This will usually happen in the VSYNC interrupt handler.
  */
@@ -122,124 +187,129 @@ static bool is_flip_stall_complete(NV2AState *d)
     return false;
 }
 
+/* Called with the pgraph lock held */
 static bool pfifo_stall_for_flip(NV2AState *d)
 {
-    bool should_stall = false;
-
     if (qatomic_read(&d->pgraph.waiting_for_flip)) {
-        qemu_mutex_lock(&d->pgraph.lock);
         if (!is_flip_stall_complete(d)) {
-            should_stall = true;
-        } else {
-            d->pgraph.waiting_for_flip = false;
+            return true;
         }
-        qemu_mutex_unlock(&d->pgraph.lock);
+        d->pgraph.waiting_for_flip = false;
     }
 
-    return should_stall;
+    return false;
 }
 
 static bool pfifo_puller_should_stall(NV2AState *d)
 {
+    uint32_t pull0 = qatomic_read(&d->pfifo.regs[NV_PFIFO_CACHE1_PULL0]);
+
     return pfifo_stall_for_flip(d) || qatomic_read(&d->pgraph.waiting_for_nop) ||
            qatomic_read(&d->pgraph.waiting_for_context_switch) ||
-           !can_fifo_access(d);
+           !can_fifo_access(d) ||
+           !GET_MASK(pull0, NV_PFIFO_CACHE1_PULL0_ACCESS);
 }
 
-static ssize_t pfifo_run_puller(NV2AState *d, uint32_t method_entry,
-                                uint32_t parameter, uint32_t *parameters,
-                                size_t num_words_available,
-                                size_t max_lookahead_words)
+/* Executes one method record with the pgraph lock held. Returns the offset of
+ * the next record, which is a requeued header if some parameters were left
+ * unconsumed, or 0 if the record is blocked on a context switch.
+ */
+uint32_t pfifo_execute_record(NV2AState *d, uint32_t *record,
+                              size_t max_lookahead_words)
 {
-    if (pfifo_puller_should_stall(d)) {
-        return -1;
+    PGRAPHState *pg = &d->pgraph;
+
+    uint32_t header = ldl_le_p(record);
+    uint32_t method = header & 0x1ffc;
+    uint32_t subchannel = (header >> 13) & 7;
+    uint32_t count = (header >> 18) & 0x7ff;
+    bool inc = !(header & 0x40000000);
+    uint32_t *parameters = record + 1;
+
+    if (method == 0) {
+        // Switch contexts if necessary
+        pgraph_context_switch(d, ldl_le_p(&parameters[1]));
+        if (pg->waiting_for_context_switch) {
+            return 0;
+        }
+        pgraph_method(d, subchannel, 0, ldl_le_p(&parameters[0]),
+                      parameters, 1, 1, inc);
+        if (unlikely(d->capture.file)) {
+            nv2a_capture_method(d, header, parameters, 2);
+        }
+        return 3;
     }
 
-    uint32_t *pull0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL0];
-    uint32_t *pull1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL1];
-    uint32_t *engine_reg = &d->pfifo.regs[NV_PFIFO_CACHE1_ENGINE];
-    uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
-    ssize_t num_proc = -1;
+    int num_proc =
+        pgraph_method(d, subchannel, method, ldl_le_p(&parameters[0]),
+                      parameters, count, max_lookahead_words, inc);
+    assert(num_proc > 0);
 
-    // TODO think more about locking
+    if ((uint32_t)num_proc >= count) {
+        if (unlikely(d->capture.file)) {
+            nv2a_capture_method(d, header, parameters, num_proc);
+        }
+        return 1 + num_proc;
+    }
 
-    if (!GET_MASK(*pull0, NV_PFIFO_CACHE1_PULL0_ACCESS) ||
-        (*status & NV_PFIFO_CACHE1_STATUS_LOW_MARK)) {
-        return -1;
+    if (unlikely(d->capture.file)) {
+        nv2a_capture_method(d,
+                            pfifo_ring_header(method, subchannel, num_proc,
+                                              inc),
+                            parameters, num_proc);
     }
 
-    uint32_t method = method_entry & 0x1FFC;
-    uint32_t subchannel =
-        GET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_SUBCHANNEL);
-    bool inc = !GET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_TYPE);
+    /* Requeue the remaining parameters in place */
+    stl_le_p(&record[num_proc],
+             pfifo_ring_header(inc ? method + 4 * num_proc : method,
+                               subchannel, count - num_proc, inc));
+    return num_proc;
+}
 
-    if (method == 0) {
-        RAMHTEntry entry = ramht_lookup(d, parameter);
-        assert(entry.valid);
-        // assert(entry.channel_id == state->channel_id);
-        assert(entry.engine == ENGINE_GRAPHICS);
+/* Executes a batch of queued methods, returns true if the ring was advanced */
+static bool pfifo_run_puller(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PFIFOMethodRing *ring = &d->pfifo.method_ring;
+    bool progress = false;
 
-        /* the engine is bound to the subchannel */
-        assert(subchannel < 8);
-        SET_MASK(*engine_reg, 3 << (4*subchannel), entry.engine);
-        SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, entry.engine);
+    qemu_mutex_lock(&pg->lock);
 
-        // TODO: this is fucked
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
+    if (unlikely(d->capture.file)) {
+        nv2a_capture_sync_memory(d);
+    }
 
-        // Switch contexts if necessary
-        if (can_fifo_access(d)) {
-            pgraph_context_switch(d, entry.channel_id);
-            if (!d->pgraph.waiting_for_context_switch) {
-                num_proc =
-                    pgraph_method(d, subchannel, 0, entry.instance, parameters,
-                                  num_words_available, max_lookahead_words, inc);
-            }
-        }
+    for (int i = 0; i < PFIFO_PULLER_BATCH_SIZE; i++) {
+        uint32_t tail = ring->tail;
+        uint32_t head = qatomic_load_acquire(&ring->head);
 
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
-
-    } else if (method >= 0x100) {
-        // method passed to engine
-
-        /* methods that take objects.
-         * TODO: Check this range is correct for the nv2a */
-        if (method >= 0x180 && method < 0x200) {
-            //bql_lock();
-            RAMHTEntry entry = ramht_lookup(d, parameter);
-            assert(entry.valid);
-            // assert(entry.channel_id == state->channel_id);
-            parameter = entry.instance;
-            //bql_unlock();
+        if (tail == head || pfifo_puller_should_stall(d)) {
+            break;
         }
 
-        enum FIFOEngine engine = GET_MASK(*engine_reg, 3 << (4*subchannel));
-        assert(engine == ENGINE_GRAPHICS);
-        SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, engine);
+        uint32_t *record = &ring->words[tail];
 
-        // TODO: this is fucked
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
+        if (ldl_le_p(record) == PFIFO_RING_WRAP) {
+            qatomic_store_release(&ring->tail, 0);
+            progress = true;
+            continue;
+        }
 
-        if (can_fifo_access(d)) {
-            num_proc =
-                pgraph_method(d, subchannel, method, parameter, parameters,
-                              num_words_available, max_lookahead_words, inc);
+        size_t max_lookahead_words =
+            (head > tail ? head : PFIFO_METHOD_RING_SIZE) - tail - 1;
+        uint32_t next = pfifo_execute_record(d, record, max_lookahead_words);
+        if (!next) {
+            break;
         }
 
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
-    } else {
-        assert(!"Unrecognized pfifo puller method");
+        qatomic_store_release(&ring->tail,
+                              (tail + next) % PFIFO_METHOD_RING_SIZE);
+        progress = true;
     }
 
-    if (num_proc > 0) {
-        *status |= NV_PFIFO_CACHE1_STATUS_LOW_MARK;
-    }
+    qemu_mutex_unlock(&pg->lock);
 
-    return num_proc;
+    return progress;
 }
 
 static bool pfifo_pusher_should_stall(NV2AState *d)
@@ -252,13 +322,14 @@ static void pfifo_run_pusher(NV2AState *d)
 {
     uint32_t *push0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PUSH0];
     uint32_t *push1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1];
+    uint32_t *pull1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL1];
+    uint32_t *engine_reg = &d->pfifo.regs[NV_PFIFO_CACHE1_ENGINE];
     uint32_t *dma_subroutine = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_SUBROUTINE];
     uint32_t *dma_state = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE];
     uint32_t *dma_push = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUSH];
     uint32_t *dma_get = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET];
     uint32_t *dma_put = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUT];
     uint32_t *dma_dcount = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DCOUNT];
-    uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
 
     if (!GET_MASK(*push0, NV_PFIFO_CACHE1_PUSH0_ACCESS) ||
         !GET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS) ||
@@ -327,32 +398,79 @@ static void pfifo_run_pusher(NV2AState *d)
             d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DATA_SHADOW] = word;
 
             assert((method & 3) == 0);
-            uint32_t method_entry = 0;
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_ADDRESS, method >> 2);
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_TYPE, method_type);
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_SUBCHANNEL,
-                     method_subchannel);
-
-            *status &= ~NV_PFIFO_CACHE1_STATUS_LOW_MARK;
-
-            ssize_t num_words_processed =
-                pfifo_run_puller(d, method_entry, word, word_ptr,
-                                 MIN(method_count, num_words_available),
-                                 num_words_available);
-            if (num_words_processed < 0) {
+            bool inc = method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC;
+            size_t num_words = MIN(method_count, num_words_available);
+            uint32_t *record;
+            uint32_t *end;
+
+            if (method == 0) {
+                record = pfifo_ring_reserve(d, 3);
+                if (!record) {
+                    break;
+                }
+
+                RAMHTEntry entry = ramht_lookup(d, word);
+                assert(entry.valid);
+                // assert(entry.channel_id == state->channel_id);
+                assert(entry.engine == ENGINE_GRAPHICS);
+
+                /* the engine is bound to the subchannel */
+                assert(method_subchannel < 8);
+                SET_MASK(*engine_reg, 3 << (4*method_subchannel), entry.engine);
+                SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, entry.engine);
+
+                num_words = 1;
+                stl_le_p(&record[0],
+                         pfifo_ring_header(0, method_subchannel, 2, inc));
+                stl_le_p(&record[1], entry.instance);
+                stl_le_p(&record[2], entry.channel_id);
+                end = record + 3;
+            } else if (method >= 0x100) {
+                // method passed to engine
+                record = pfifo_ring_reserve(d, 1 + num_words);
+                if (!record) {
+                    break;
+                }
+
+                enum FIFOEngine engine =
+                    GET_MASK(*engine_reg, 3 << (4*method_subchannel));
+                assert(engine == ENGINE_GRAPHICS);
+                SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, engine);
+
+                stl_le_p(&record[0], pfifo_ring_header(method, method_subchannel,
+                                                       num_words, inc));
+                memcpy(&record[1], word_ptr, num_words * 4);
+
+                /* methods that take objects.
+                 * TODO: Check this range is correct for the nv2a */
+                for (size_t i = 0; i < num_words; i++) {
+                    uint32_t m = inc ? method + 4 * i : method;
+                    if (m >= 0x180 && m < 0x200) {
+                        RAMHTEntry entry =
+                            ramht_lookup(d, ldl_le_p(&record[1 + i]));
+                        assert(entry.valid);
+                        // assert(entry.channel_id == state->channel_id);
+                        stl_le_p(&record[1 + i], entry.instance);
+                    }
+                }
+                end = record + 1 + num_words;
+            } else {
+                assert(!"Unrecognized pfifo puller method");
                 break;
             }
 
-            dma_get_v += (num_words_processed-1)*4;
+            pfifo_ring_publish(d, end);
 
-            if (method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC) {
+            dma_get_v += (num_words-1)*4;
+
+            if (inc) {
                 SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
-                         (method + 4*num_words_processed) >> 2);
+                         (method + 4*num_words) >> 2);
             }
             SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
-                     method_count - MIN(method_count, num_words_processed));
+                     method_count - num_words);
 
-            (*dma_dcount) += num_words_processed;
+            (*dma_dcount) += num_words;
         } else {
             /* no command active - this is the first word of a new one */
             d->pfifo.regs[NV_PFIFO_CACHE1_DMA_RSVD_SHADOW] = word;
@@ -449,6 +567,7 @@ static void pfifo_run_pusher(NV2AState *d)
     }
 }
 
+/* Executes queued methods, owns the renderer */
 void *pfifo_thread(void *arg)
 {
     NV2AState *d = (NV2AState *)arg;
@@ -463,8 +582,26 @@ void *pfifo_thread(void *arg)
 
         pgraph_process_pending(d);
 
-        if (!d->pfifo.halt) {
-            pfifo_run_pusher(d);
+        if (d->replay.file) {
+            // Replay owns PGRAPH until the capture is exhausted
+            if (nv2a_replay_run(d)) {
+                d->pfifo.fifo_kick = true;
+            }
+        } else if (!d->pfifo.halt) {
+            qemu_mutex_unlock(&d->pfifo.lock);
+            bool progress = pfifo_run_puller(d);
+            qemu_mutex_lock(&d->pfifo.lock);
+
+            if (progress) {
+                // Ring space was freed and more methods may be ready
+                d->pfifo.fifo_kick = true;
+                pfifo_kick_pusher(d);
+            }
+        }
+
+        if (pfifo_ring_is_empty(d)) {
+            d->pfifo.regs[NV_PFIFO_CACHE1_STATUS] |=
+                NV_PFIFO_CACHE1_STATUS_LOW_MARK;
         }
 
         pgraph_process_pending_reports(d);
@@ -487,52 +624,66 @@ void *pfifo_thread(void *arg)
     return NULL;
 }
 
-static uint32_t ramht_hash(NV2AState *d, uint32_t handle)
+/* Decodes the pushbuffer into the method ring */
+void *pfifo_pusher_thread(void *arg)
 {
-    unsigned int ramht_size =
-        1 << (GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT], NV_PFIFO_RAMHT_SIZE)+12);
+    NV2AState *d = (NV2AState *)arg;
+
+    rcu_register_thread();
 
-    /* XXX: Think this is different to what nouveau calculates... */
-    unsigned int bits = ctz32(ramht_size)-1;
+    qemu_mutex_lock(&d->pfifo.lock);
+    while (!d->exiting) {
+        d->pfifo.pusher_kick = false;
 
-    uint32_t hash = 0;
-    while (handle) {
-        hash ^= (handle & ((1 << bits) - 1));
-        handle >>= bits;
+        if (!d->pfifo.halt) {
+            pfifo_run_pusher(d);
+        }
+
+        if (!d->pfifo.pusher_kick) {
+            qemu_cond_wait(&d->pfifo.pusher_cond, &d->pfifo.lock);
+        }
     }
+    qemu_mutex_unlock(&d->pfifo.lock);
 
-    unsigned int channel_id = GET_MASK(d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1],
-                                       NV_PFIFO_CACHE1_PUSH1_CHID);
-    hash ^= channel_id << (bits - 4);
+    rcu_unregister_thread();
 
-    return hash;
+    return NULL;
 }
 
-
-static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle)
+static bool ramht_test_and_clear_dirty(void *opaque, uint32_t offset,
+                                       uint32_t size)
 {
-    hwaddr ramht_size =
-        1 << (GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT], NV_PFIFO_RAMHT_SIZE)+12);
-
-    uint32_t hash = ramht_hash(d, handle);
-    assert(hash * 8 < ramht_size);
-
-    hwaddr ramht_address =
-        GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT],
-                 NV_PFIFO_RAMHT_BASE_ADDRESS) << 12;
-
-    assert(ramht_address + hash * 8 < memory_region_size(&d->ramin));
+    NV2AState *d = opaque;
+    return memory_region_test_and_clear_dirty(&d->ramin, offset, size,
+                                              DIRTY_MEMORY_NV2A);
+}
 
-    uint8_t *entry_ptr = d->ramin_ptr + ramht_address + hash * 8;
+void pfifo_ramht_cache_init(NV2AState *d)
+{
+    d->pfifo.ramht_cache.test_and_clear_dirty = ramht_test_and_clear_dirty;
+    d->pfifo.ramht_cache.opaque = d;
+    ramht_cache_invalidate(&d->pfifo.ramht_cache);
+}
 
-    uint32_t entry_handle = ldl_le_p((uint32_t*)entry_ptr);
-    uint32_t entry_context = ldl_le_p((uint32_t*)(entry_ptr + 4));
+void pfifo_ramht_cache_invalidate(NV2AState *d)
+{
+    ramht_cache_invalidate(&d->pfifo.ramht_cache);
+}
 
-    return (RAMHTEntry){
-        .handle = entry_handle,
-        .instance = (entry_context & NV_RAMHT_INSTANCE) << 4,
-        .engine = (entry_context & NV_RAMHT_ENGINE) >> 16,
-        .channel_id = (entry_context & NV_RAMHT_CHID) >> 24,
-        .valid = entry_context & NV_RAMHT_STATUS,
+/* Checks for guest writes to the table on every call, so a handle rebound
+ * while the pusher is running is seen by the next method that uses it */
+static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle)
+{
+    uint32_t ramht = d->pfifo.regs[NV_PFIFO_RAMHT];
+    RAMHTTable table = {
+        .ramin = d->ramin_ptr,
+        .ramin_size = memory_region_size(&d->ramin),
+        .address = GET_MASK(ramht, NV_PFIFO_RAMHT_BASE_ADDRESS) << 12,
+        .size = 1 << (GET_MASK(ramht, NV_PFIFO_RAMHT_SIZE) + 12),
     };
+    unsigned int channel_id = GET_MASK(d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1],
+                                       NV_PFIFO_CACHE1_PUSH1_CHID);
+
+    return ramht_cache_lookup(&d->pfifo.ramht_cache, &table, channel_id,
+                              handle);
 }
@@ -22,7 +22,9 @@
 #include "qemu/osdep.h"
 #include "hw/display/vga_int.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/pgraph/glsl/common.h"
 #include "hw/xbox/nv2a/pgraph/util.h"
+#include "qemu/fast-hash.h"
 #include "renderer.h"
 
 #include <math.h>
@@ -64,6 +66,7 @@ void pgraph_gl_init_display(NV2AState *d)
         "uniform vec2 display_size;\n"
         "uniform float line_offset;\n"
         "layout(location = 0) out vec4 out_Color;\n"
+        GLSL_YUV_SAMPLER
         "void main()\n"
         "{\n"
         "    vec2 texCoord = gl_FragCoord.xy/display_size;\n"
@@ -77,9 +80,9 @@ void pgraph_gl_init_display(NV2AState *d)
         "                           greaterThan(screenCoord, output_region.zw));\n"
         "        if (!any(clip) && (!pvideo_color_key_enable || out_Color.rgb == pvideo_color_key)) {\n"
         "            vec2 out_xy = (screenCoord - pvideo_pos.xy) * pvideo_scale.z;\n"
-        "            vec2 in_st = (pvideo_in_pos + out_xy * pvideo_scale.xy) / textureSize(pvideo_tex, 0);\n"
-        "            in_st.y *= -1.0;\n"
-        "            out_Color.rgba = texture(pvideo_tex, in_st);\n"
+        "            vec2 in_xy = pvideo_in_pos + out_xy * pvideo_scale.xy;\n"
+        "            in_xy.y = float(textureSize(pvideo_tex, 0).y) - in_xy.y;\n"
+        "            out_Color.rgba = textureYuv(pvideo_tex, in_xy, false, true);\n"
         "        }\n"
         "    }\n"
         "}\n";
@@ -103,6 +106,7 @@ void pgraph_gl_init_display(NV2AState *d)
     glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
     glGenFramebuffers(1, &r->disp_rndr.fbo);
     glGenTextures(1, &r->disp_rndr.pvideo_tex);
+    r->disp_rndr.pvideo_width = 0;
     assert(glGetError() == GL_NO_ERROR);
 
     glo_set_current(g_nv2a_context_render);
@@ -135,25 +139,6 @@ void pgraph_gl_finalize_display(PGRAPHState *pg)
     glo_set_current(g_nv2a_context_render);
 }
 
-static uint8_t *convert_texture_data__CR8YB8CB8YA8(const uint8_t *data,
-                                                   unsigned int width,
-                                                   unsigned int height,
-                                                   unsigned int pitch)
-{
-    uint8_t *converted_data = (uint8_t *)g_malloc(width * height * 4);
-    int x, y;
-    for (y = 0; y < height; y++) {
-        const uint8_t *line = &data[y * pitch];
-        const uint32_t row_offset = y * width;
-        for (x = 0; x < width; x++) {
-            uint8_t *pixel = &converted_data[(row_offset + x) * 4];
-            convert_yuy2_to_rgb(line, x, &pixel[0], &pixel[1], &pixel[2]);
-            pixel[3] = 255;
-        }
-    }
-    return converted_data;
-}
-
 static float pvideo_calculate_scale(unsigned int din_dout,
                                            unsigned int output_size)
 {
@@ -260,14 +245,40 @@ static void render_display_pvideo_overlay(NV2AState *d)
 
     glActiveTexture(GL_TEXTURE0 + 1);
     glBindTexture(GL_TEXTURE_2D, r->disp_rndr.pvideo_tex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    uint8_t *tex_rgba = convert_texture_data__CR8YB8CB8YA8(
-        d->vram_ptr + base + offset, in_width, in_height, in_pitch);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, in_width, in_height, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, tex_rgba);
-    g_free(tex_rgba);
+
+    /* Packed YUY2 is uploaded as is, two pixels per texel, and converted by
+     * the display shader. Skip the upload if the frame has not changed. */
+    const uint8_t *src = d->vram_ptr + base + offset;
+    unsigned int tex_width = (in_width + 1) / 2;
+    uint64_t hash = fast_hash(src, in_pitch * in_height);
+    if (hash != r->disp_rndr.pvideo_hash ||
+        in_width != r->disp_rndr.pvideo_width ||
+        in_height != r->disp_rndr.pvideo_height ||
+        in_pitch != r->disp_rndr.pvideo_pitch) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        if (in_pitch % 4 == 0) {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, in_pitch / 4);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_width, in_height, 0,
+                         GL_BGRA, GL_UNSIGNED_BYTE, src);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        } else {
+            size_t row_size = tex_width * 4;
+            uint8_t *packed = g_malloc(row_size * in_height);
+            for (int y = 0; y < in_height; y++) {
+                memcpy(&packed[y * row_size], &src[y * in_pitch], row_size);
+            }
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_width, in_height, 0,
+                         GL_BGRA, GL_UNSIGNED_BYTE, packed);
+            g_free(packed);
+        }
+        r->disp_rndr.pvideo_hash = hash;
+        r->disp_rndr.pvideo_width = in_width;
+        r->disp_rndr.pvideo_height = in_height;
+        r->disp_rndr.pvideo_pitch = in_pitch;
+    }
     glUniform1i(r->disp_rndr.pvideo_tex_loc, 1);
     glUniform2f(r->disp_rndr.pvideo_in_pos_loc, in_s / 16.f, in_t / 8.f);
     glUniform4f(r->disp_rndr.pvideo_pos_loc,
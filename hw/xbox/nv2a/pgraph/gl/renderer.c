@@ -101,6 +101,7 @@ static void pgraph_gl_finalize(NV2AState *d)
 
 static void pgraph_gl_flip_stall(NV2AState *d)
 {
+    pgraph_gl_prefetch_surface_downloads(d);
     NV2A_GL_DFRAME_TERMINATOR();
     glFinish();
 }
@@ -26,6 +26,7 @@
 #include "qemu/thread.h"
 #include "qemu/queue.h"
 #include "qemu/lru.h"
+#include "qemu/interval-tree.h"
 
 #include "hw/hw.h"
 
@@ -38,8 +39,27 @@
 #include "gloffscreen.h"
 #include "constants.h"
 
+/* Number of surface downloads that can be in flight at once */
+#define SURFACE_READBACK_RING_SIZE 4
+
+/* Granularity of memory buffer dirty checks and fence tracking */
+#define MEMORY_BUFFER_BLOCK_BITS 16
+/* Number of unsignaled memory buffer fences before waiting on the oldest */
+#define MEMORY_BUFFER_FENCE_RING_SIZE 64
+
+struct SurfaceBinding;
+
+typedef struct SurfaceReadback {
+    struct SurfaceBinding *surface;
+    int draw_time; /* Surface draw time when the readback was issued */
+    GLuint pbo;
+    size_t pbo_size;
+    GLsync fence;
+} SurfaceReadback;
+
 typedef struct SurfaceBinding {
     QTAILQ_ENTRY(SurfaceBinding) entry;
+    IntervalTreeNode itree; /* Keyed by VRAM range */
     MemAccessCallback *access_cb;
 
     hwaddr vram_addr;
@@ -61,6 +81,8 @@ typedef struct SurfaceBinding {
     bool draw_dirty;
     bool download_pending;
     bool upload_pending;
+    bool prefetch; /* Read by the CPU, start downloading at flip */
+    SurfaceReadback *readback;
 
     GLuint gl_buffer;
     SurfaceFormatInfo fmt;
@@ -155,10 +177,22 @@ typedef struct TextureKey {
 typedef struct TextureLruNode {
     LruNode node;
     TextureKey key;
+    TexturePageRange texture_pages;
+    TexturePageRange palette_pages;
     TextureBinding *binding;
     bool possibly_dirty;
 } TextureLruNode;
 
+/* Palette of an I8 texture that is resolved in the fragment shader */
+typedef struct PaletteBinding {
+    GLuint gl_texture;
+    hwaddr vram_offset;
+    size_t length;
+    TexturePageRange pages;
+    uint64_t data_hash;
+    bool possibly_dirty;
+} PaletteBinding;
+
 typedef struct QueryReport {
     QSIMPLEQ_ENTRY(QueryReport) entry;
     bool clear;
@@ -180,22 +214,36 @@ typedef struct PGRAPHGLState {
     VertexLruNode *element_cache_entries;
     GLuint gl_inline_array_buffer;
     GLuint gl_memory_buffer;
+    uint8_t *gl_memory_buffer_map; // Persistent mapping, NULL if unsupported
+    uint64_t *memory_buffer_block_fence; // Fence after last draw reading block
+    GLsync memory_buffer_fences[MEMORY_BUFFER_FENCE_RING_SIZE];
+    uint64_t memory_buffer_fence_seq; // Sequence of the next fence
+    uint64_t memory_buffer_fence_completed;
+    bool memory_buffer_unfenced;
+    hwaddr memory_buffer_synced_start, memory_buffer_synced_end;
     GLuint gl_vertex_array;
     GLuint gl_inline_buffer[NV2A_VERTEXSHADER_ATTRIBUTES];
 
     QTAILQ_HEAD(, SurfaceBinding) surfaces;
+    IntervalTreeRoot surface_tree;
     SurfaceBinding *color_binding, *zeta_binding;
     bool downloads_pending;
     QemuEvent downloads_complete;
     bool download_dirty_surfaces_pending;
     QemuEvent dirty_surfaces_download_complete; // common
+    SurfaceReadback readbacks[SURFACE_READBACK_RING_SIZE];
+    unsigned int next_readback;
 
     TextureBinding *texture_binding[NV2A_MAX_TEXTURES];
     Lru texture_cache;
     TextureLruNode *texture_cache_entries;
+    TexturePageHashes texture_page_hashes;
+    GLuint gl_texture_upload_buffer;
+    PaletteBinding palette_binding[NV2A_MAX_TEXTURES];
 
     Lru shader_cache;
     ShaderBinding *shader_cache_entries;
+    ShaderStateTracker shader_state;
     ShaderBinding *shader_binding;
     QemuMutex shader_cache_lock;
     QemuThread shader_disk_thread;
@@ -216,12 +264,22 @@ typedef struct PGRAPHGLState {
         GLuint tex_loc, surface_size_loc;
     } s2t_rndr;
 
+    /* Downscales and swizzles color surfaces ahead of download */
+    struct s2m_rndr {
+        GLuint fbo, vao, prog, tex, pbo;
+        GLint tex_loc, scale_loc, swizzle_loc, size_loc;
+        GLenum tex_internal_format;
+        unsigned int tex_width, tex_height;
+    } s2m_rndr;
+
     struct disp_rndr {
         GLuint fbo, vao, vbo, prog;
         GLuint display_size_loc;
         GLuint line_offset_loc;
         GLuint tex_loc;
         GLuint pvideo_tex;
+        uint64_t pvideo_hash;
+        int pvideo_width, pvideo_height, pvideo_pitch;
         GLint pvideo_enable_loc;
         GLint pvideo_tex_loc;
         GLint pvideo_in_pos_loc;
@@ -276,10 +334,12 @@ void pgraph_gl_finalize_textures(PGRAPHState *pg);
 void pgraph_gl_init_buffers(NV2AState *d);
 void pgraph_gl_finalize_buffers(PGRAPHState *pg);
 void pgraph_gl_process_pending_downloads(NV2AState *d);
+void pgraph_gl_prefetch_surface_downloads(NV2AState *d);
 void pgraph_gl_reload_surface_scale_factor(PGRAPHState *pg);
 void pgraph_gl_render_surface_to_texture(NV2AState *d, SurfaceBinding *surface, TextureBinding *texture, TextureShape *texture_shape, int texture_unit);
 void pgraph_gl_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta);
 void pgraph_gl_surface_download_if_dirty(NV2AState *d, SurfaceBinding *surface);
+void pgraph_gl_download_surfaces_in_range_if_dirty(NV2AState *d, hwaddr start, hwaddr size);
 SurfaceBinding *pgraph_gl_surface_get(NV2AState *d, hwaddr addr);
 SurfaceBinding *pgraph_gl_surface_get_within(NV2AState *d, hwaddr addr);
 void pgraph_gl_surface_invalidate(NV2AState *d, SurfaceBinding *e);
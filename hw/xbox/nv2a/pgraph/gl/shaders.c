@@ -101,6 +101,13 @@ static void set_texture_sampler_uniforms(ShaderBinding *binding)
         if (texSampLoc >= 0) {
             glUniform1i(texSampLoc, i);
         }
+
+        snprintf(samplerName, sizeof(samplerName), "palSamp%d", i);
+        GLint palSampLoc =
+            glGetUniformLocation(binding->gl_program, samplerName);
+        if (palSampLoc >= 0) {
+            glUniform1i(palSampLoc, NV2A_MAX_TEXTURES + i);
+        }
     }
 }
 
@@ -539,6 +546,7 @@ void pgraph_gl_init_shaders(PGRAPHState *pg)
 
     qemu_mutex_init(&r->shader_cache_lock);
     qemu_event_init(&r->shader_cache_writeback_complete, false);
+    pgraph_glsl_reset_shader_state_tracker(&r->shader_state);
 
     if (!shader_gl_vendor) {
         shader_gl_vendor = (const char *) glGetString(GL_VENDOR);
@@ -583,10 +591,12 @@ void pgraph_gl_finalize_shaders(PGRAPHState *pg)
 
     // Clear out shader cache
     pgraph_gl_shader_write_cache_reload_list(pg); // FIXME: also flushes, rename for clarity
+    lru_destroy(&r->shader_cache);
     free(r->shader_cache_entries);
     r->shader_cache_entries = NULL;
 
     lru_flush(&r->shader_module_cache);
+    lru_destroy(&r->shader_module_cache);
     g_free(r->shader_module_cache_entries);
     r->shader_module_cache_entries = NULL;
 
@@ -769,24 +779,21 @@ void pgraph_gl_bind_shaders(PGRAPHState *pg)
     PGRAPHGLState *r = pg->gl_renderer_state;
 
     bool binding_changed = false;
-    if (r->shader_binding &&
-        !pgraph_glsl_check_shader_state_dirty(pg, &r->shader_binding->state)) {
+    if (!pgraph_glsl_update_shader_state(pg, &r->shader_state) &&
+        r->shader_binding) {
         nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND_NOTDIRTY);
         goto update_uniforms;
     }
 
     ShaderBinding *old_binding = r->shader_binding;
-    ShaderState state = pgraph_glsl_get_shader_state(pg);
+    const ShaderState *state = &r->shader_state.state;
 
     NV2A_GL_DGROUP_BEGIN("%s (%s)", __func__,
-                         state.vsh.is_fixed_function ? "FF" : "PROG");
+                         state->vsh.is_fixed_function ? "FF" : "PROG");
 
     qemu_mutex_lock(&r->shader_cache_lock);
 
-    uint64_t shader_state_hash =
-        fast_hash((uint8_t *)&state, sizeof(ShaderState));
-
-    LruNode *node = lru_lookup(&r->shader_cache, shader_state_hash, &state);
+    LruNode *node = lru_lookup(&r->shader_cache, r->shader_state.hash, state);
     ShaderBinding *binding = container_of(node, ShaderBinding, node);
 
     if (!binding->initialized && !pgraph_gl_shader_load_from_memory(binding)) {
@@ -798,7 +805,6 @@ void pgraph_gl_bind_shaders(PGRAPHState *pg)
     }
     assert(binding->initialized);
     r->shader_binding = binding;
-    pg->program_data_dirty = false;
 
     qemu_mutex_unlock(&r->shader_cache_lock);
 
@@ -31,6 +31,7 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
                                        bool swizzle, bool flip, bool downscale,
                                        uint8_t *pixels);
 static void surface_get_dimensions(PGRAPHState *pg, unsigned int *width, unsigned int *height);
+static void surface_readback_release(SurfaceReadback *rb);
 
 void pgraph_gl_set_surface_scale_factor(NV2AState *d, unsigned int scale)
 {
@@ -108,6 +109,10 @@ void pgraph_gl_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta)
         r->color_binding->frame_time = pg->frame_time;
         r->color_binding->cleared = false;
 
+        /* Clears do not advance draw_time, drop any readback explicitly */
+        if (color && r->color_binding->readback) {
+            surface_readback_release(r->color_binding->readback);
+        }
     }
 
     if (r->zeta_binding) {
@@ -115,6 +120,9 @@ void pgraph_gl_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta)
         r->zeta_binding->frame_time = pg->frame_time;
         r->zeta_binding->cleared = false;
 
+        if (zeta && r->zeta_binding->readback) {
+            surface_readback_release(r->zeta_binding->readback);
+        }
     }
 }
 
@@ -171,6 +179,92 @@ static void finalize_render_to_texture(PGRAPHState *pg)
     r->s2t_rndr.fbo = 0;
 }
 
+static void init_surface_to_memory(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    const char *vs =
+        "#version 330\n"
+        "void main()\n"
+        "{\n"
+        "    float x = -1.0 + float((gl_VertexID & 1) << 2);\n"
+        "    float y = -1.0 + float((gl_VertexID & 2) << 1);\n"
+        "    gl_Position = vec4(x, y, 0, 1);\n"
+        "}\n";
+    /*
+     * Each fragment produces one pixel of the guest memory image. For
+     * swizzled surfaces the fragment's linear index is the swizzled offset,
+     * which is de-interleaved into surface coordinates in the same bit order
+     * as swizzle_rect. Downscaling picks the top-left sample of each block,
+     * matching the CPU path.
+     */
+    const char *fs =
+        "#version 330\n"
+        "uniform sampler2D tex;\n"
+        "uniform int scale;\n"
+        "uniform bool swizzle;\n"
+        "uniform uvec2 size;\n"
+        "layout(location = 0) out vec4 out_Color;\n"
+        "void main()\n"
+        "{\n"
+        "    uvec2 pos = uvec2(gl_FragCoord.xy);\n"
+        "    if (swizzle) {\n"
+        "        uint offset = pos.y * size.x + pos.x;\n"
+        "        pos = uvec2(0u);\n"
+        "        for (uint bit = 1u; bit < size.x || bit < size.y; bit <<= 1) {\n"
+        "            if (bit < size.x) {\n"
+        "                pos.x |= (offset & 1u) * bit;\n"
+        "                offset >>= 1;\n"
+        "            }\n"
+        "            if (bit < size.y) {\n"
+        "                pos.y |= (offset & 1u) * bit;\n"
+        "                offset >>= 1;\n"
+        "            }\n"
+        "        }\n"
+        "    }\n"
+        "    out_Color = texelFetch(tex, ivec2(pos) * scale, 0);\n"
+        "}\n";
+
+    r->s2m_rndr.prog = pgraph_gl_compile_shader(vs, fs);
+    r->s2m_rndr.tex_loc = glGetUniformLocation(r->s2m_rndr.prog, "tex");
+    r->s2m_rndr.scale_loc = glGetUniformLocation(r->s2m_rndr.prog, "scale");
+    r->s2m_rndr.swizzle_loc =
+        glGetUniformLocation(r->s2m_rndr.prog, "swizzle");
+    r->s2m_rndr.size_loc = glGetUniformLocation(r->s2m_rndr.prog, "size");
+
+    glGenVertexArrays(1, &r->s2m_rndr.vao);
+    glGenFramebuffers(1, &r->s2m_rndr.fbo);
+    glGenTextures(1, &r->s2m_rndr.tex);
+    glBindTexture(GL_TEXTURE_2D, r->s2m_rndr.tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    r->s2m_rndr.tex_internal_format = GL_NONE;
+    r->s2m_rndr.tex_width = 0;
+    r->s2m_rndr.tex_height = 0;
+    glGenBuffers(1, &r->s2m_rndr.pbo);
+}
+
+static void finalize_surface_to_memory(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    glDeleteProgram(r->s2m_rndr.prog);
+    r->s2m_rndr.prog = 0;
+
+    glDeleteVertexArrays(1, &r->s2m_rndr.vao);
+    r->s2m_rndr.vao = 0;
+
+    glDeleteFramebuffers(1, &r->s2m_rndr.fbo);
+    r->s2m_rndr.fbo = 0;
+
+    glDeleteTextures(1, &r->s2m_rndr.tex);
+    r->s2m_rndr.tex = 0;
+
+    glDeleteBuffers(1, &r->s2m_rndr.pbo);
+    r->s2m_rndr.pbo = 0;
+}
+
 static bool surface_to_texture_can_fastpath(SurfaceBinding *surface,
                                             TextureShape *shape)
 {
@@ -293,16 +387,25 @@ static void render_surface_to_texture_slow(NV2AState *d,
 
     size_t bufsize = width * height * surface->fmt.bytes_per_pixel;
 
-    uint8_t *buf = g_malloc(bufsize);
-    surface_download_to_buffer(d, surface, false, false, false, buf);
-
-    width = texture_shape->width;
-    height = texture_shape->height;
-    pgraph_apply_scaling_factor(pg, &width, &height);
+    unsigned int tex_width = texture_shape->width,
+                 tex_height = texture_shape->height;
+    pgraph_apply_scaling_factor(pg, &tex_width, &tex_height);
+    bufsize = MAX(bufsize, tex_width * tex_height * f->bytes_per_pixel);
 
-    glTexImage2D(texture->gl_target, 0, f->gl_internal_format, width, height, 0,
-                 f->gl_format, f->gl_type, buf);
-    g_free(buf);
+    /*
+     * Stage the pixels in a buffer object so the copy stays on the GPU
+     * instead of stalling on a readback to host memory.
+     */
+    PGRAPHGLState *r = pg->gl_renderer_state;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r->s2m_rndr.pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, bufsize, NULL, GL_STREAM_COPY);
+    surface_download_to_buffer(d, surface, false, false, false, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r->s2m_rndr.pbo);
+    glTexImage2D(texture->gl_target, 0, f->gl_internal_format, tex_width,
+                 tex_height, 0, f->gl_format, f->gl_type, NULL);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     glBindTexture(texture->gl_target, texture->gl_texture);
 }
 
@@ -421,6 +524,40 @@ static bool check_surface_overlaps_range(const SurfaceBinding *surface,
     return !(surface->vram_addr >= range_end || range_start >= surface_end);
 }
 
+static SurfaceBinding *surface_tree_first(PGRAPHGLState *r, hwaddr start,
+                                          hwaddr last)
+{
+    IntervalTreeNode *node =
+        interval_tree_iter_first(&r->surface_tree, start, last);
+    return node ? container_of(node, SurfaceBinding, itree) : NULL;
+}
+
+static SurfaceBinding *surface_tree_next(SurfaceBinding *surface, hwaddr start,
+                                         hwaddr last)
+{
+    IntervalTreeNode *node = interval_tree_iter_next(&surface->itree, start,
+                                                     last);
+    return node ? container_of(node, SurfaceBinding, itree) : NULL;
+}
+
+void pgraph_gl_download_surfaces_in_range_if_dirty(NV2AState *d, hwaddr start,
+                                                   hwaddr size)
+{
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+
+    if (!size) {
+        return;
+    }
+
+    hwaddr last = start + size - 1;
+    for (SurfaceBinding *surface = surface_tree_first(r, start, last); surface;
+         surface = surface_tree_next(surface, start, last)) {
+        if (check_surface_overlaps_range(surface, start, size)) {
+            pgraph_gl_surface_download_if_dirty(d, surface);
+        }
+    }
+}
+
 static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
                                     hwaddr len, bool write)
 {
@@ -430,8 +567,9 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
     PGRAPHGLState *r = d->pgraph.gl_renderer_state;
     bool wait_for_downloads = false;
 
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+    hwaddr last = addr + MAX(len, 1) - 1;
+    for (SurfaceBinding *surface = surface_tree_first(r, addr, last); surface;
+         surface = surface_tree_next(surface, addr, last)) {
         if (!check_surface_overlaps_range(surface, addr, len)) {
             continue;
         }
@@ -446,6 +584,7 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
 
         if (surface->draw_dirty) {
             surface->download_pending = true;
+            surface->prefetch = true;
             wait_for_downloads = true;
         }
 
@@ -499,8 +638,14 @@ static void invalidate_overlapping_surfaces(NV2AState *d, SurfaceBinding *surfac
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
+    hwaddr start = surface->vram_addr;
+    hwaddr last = start + MAX(surface->size, 1) - 1;
+
     SurfaceBinding *other_surface, *next_surface;
-    QTAILQ_FOREACH_SAFE(other_surface, &r->surfaces, entry, next_surface) {
+    for (other_surface = surface_tree_first(r, start, last); other_surface;
+         other_surface = next_surface) {
+        /* Find the successor before other_surface leaves the tree */
+        next_surface = surface_tree_next(other_surface, start, last);
         if (check_surfaces_overlap(surface, other_surface)) {
             trace_nv2a_pgraph_surface_evict_overlapping(
                 other_surface->vram_addr, other_surface->width, other_surface->height,
@@ -529,6 +674,12 @@ static SurfaceBinding *surface_put(NV2AState *d, hwaddr addr,
 
     QTAILQ_INSERT_TAIL(&r->surfaces, surface_out, entry);
 
+    /* Zero-sized surfaces still occupy their base address for lookups */
+    surface_out->itree.start = surface_out->vram_addr;
+    surface_out->itree.last =
+        surface_out->vram_addr + MAX(surface_out->size, 1) - 1;
+    interval_tree_insert(&surface_out->itree, &r->surface_tree);
+
     return surface_out;
 }
 
@@ -537,8 +688,8 @@ SurfaceBinding *pgraph_gl_surface_get(NV2AState *d, hwaddr addr)
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
+    for (SurfaceBinding *surface = surface_tree_first(r, addr, addr); surface;
+         surface = surface_tree_next(surface, addr, addr)) {
         if (surface->vram_addr == addr) {
             return surface;
         }
@@ -552,8 +703,8 @@ SurfaceBinding *pgraph_gl_surface_get_within(NV2AState *d, hwaddr addr)
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
+    for (SurfaceBinding *surface = surface_tree_first(r, addr, addr); surface;
+         surface = surface_tree_next(surface, addr, addr)) {
         if (addr >= surface->vram_addr &&
             addr < (surface->vram_addr + surface->size)) {
             return surface;
@@ -581,8 +732,13 @@ void pgraph_gl_surface_invalidate(NV2AState *d, SurfaceBinding *surface)
 
     unregister_cpu_access_callback(d, surface);
 
+    if (surface->readback) {
+        surface_readback_release(surface->readback);
+    }
+
     glDeleteTextures(1, &surface->gl_buffer);
 
+    interval_tree_remove(&surface->itree, &r->surface_tree);
     QTAILQ_REMOVE(&r->surfaces, surface, entry);
     g_free(surface);
 }
@@ -679,6 +835,104 @@ static void surface_copy_shrink_row(uint8_t *out, uint8_t *in,
     }
 }
 
+/*
+ * Downscale and/or swizzle a color surface on the GPU, then read back the
+ * result in its final guest memory layout.
+ */
+static void surface_download_to_buffer_gpu(NV2AState *d,
+                                           SurfaceBinding *surface,
+                                           bool swizzle, uint8_t *pixels)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    unsigned int width = surface->width, height = surface->height;
+
+    if (r->s2m_rndr.tex_internal_format != surface->fmt.gl_internal_format ||
+        r->s2m_rndr.tex_width != width || r->s2m_rndr.tex_height != height) {
+        glBindTexture(GL_TEXTURE_2D, r->s2m_rndr.tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, surface->fmt.gl_internal_format, width,
+                     height, 0, surface->fmt.gl_format, surface->fmt.gl_type,
+                     NULL);
+        r->s2m_rndr.tex_internal_format = surface->fmt.gl_internal_format;
+        r->s2m_rndr.tex_width = width;
+        r->s2m_rndr.tex_height = height;
+    }
+
+    /*
+     * Downloads can happen midway through configuring state for a clear or
+     * draw, so preserve everything this pass touches.
+     */
+    GLint saved_viewport[4], saved_active_texture, saved_texture;
+    GLboolean saved_color_mask[4];
+    glGetIntegerv(GL_VIEWPORT, saved_viewport);
+    glGetBooleanv(GL_COLOR_WRITEMASK, saved_color_mask);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &saved_active_texture);
+    GLboolean saved_scissor = glIsEnabled(GL_SCISSOR_TEST);
+    GLboolean saved_blend = glIsEnabled(GL_BLEND);
+    GLboolean saved_cull = glIsEnabled(GL_CULL_FACE);
+    GLboolean saved_dither = glIsEnabled(GL_DITHER);
+
+    glActiveTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &saved_texture);
+    glBindTexture(GL_TEXTURE_2D, surface->gl_buffer);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, r->s2m_rndr.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           r->s2m_rndr.tex, 0);
+    GLenum draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
+    glDrawBuffers(1, draw_buffers);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+    glBindVertexArray(r->s2m_rndr.vao);
+    glUseProgram(r->s2m_rndr.prog);
+    glUniform1i(r->s2m_rndr.tex_loc, 0);
+    glUniform1i(r->s2m_rndr.scale_loc, pg->surface_scale_factor);
+    glUniform1i(r->s2m_rndr.swizzle_loc, swizzle);
+    glUniform2ui(r->s2m_rndr.size_loc, width, height);
+
+    glViewport(0, 0, width, height);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DITHER);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    /* Swizzled output is tightly packed, linear output keeps the pitch */
+    glo_readpixels(surface->fmt.gl_format, surface->fmt.gl_type,
+                   surface->fmt.bytes_per_pixel,
+                   swizzle ? width * surface->fmt.bytes_per_pixel :
+                             surface->pitch,
+                   width, height, false, pixels);
+
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->gl_framebuffer);
+    glBindVertexArray(r->gl_vertex_array);
+    glUseProgram(r->shader_binding ? r->shader_binding->gl_program : 0);
+
+    glBindTexture(GL_TEXTURE_2D, saved_texture);
+    glActiveTexture(saved_active_texture);
+    glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2],
+               saved_viewport[3]);
+    glColorMask(saved_color_mask[0], saved_color_mask[1], saved_color_mask[2],
+                saved_color_mask[3]);
+    if (saved_scissor) {
+        glEnable(GL_SCISSOR_TEST);
+    }
+    if (saved_blend) {
+        glEnable(GL_BLEND);
+    }
+    if (saved_cull) {
+        glEnable(GL_CULL_FACE);
+    }
+    if (saved_dither) {
+        glEnable(GL_DITHER);
+    }
+}
+
 static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
                                        bool swizzle, bool flip, bool downscale,
                                        uint8_t *pixels)
@@ -698,6 +952,17 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
         surface->width, surface->height, surface->pitch,
         surface->fmt.bytes_per_pixel);
 
+    /*
+     * Color surfaces can be resampled through a shader. Depth and stencil
+     * cannot be written from a fragment shader, so zeta surfaces take the
+     * CPU path below.
+     */
+    if (surface->color && (swizzle || downscale) && !flip) {
+        assert(pg->surface_scale_factor == 1 || downscale);
+        surface_download_to_buffer_gpu(d, surface, swizzle, pixels);
+        return;
+    }
+
     /*  Bind destination surface to framebuffer */
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
                            0, 0);
@@ -715,9 +980,7 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
 
     uint8_t *swizzle_buf = pixels;
     if (swizzle) {
-        /* FIXME: Allocate big buffer up front and re-alloc if necessary.
-         * FIXME: Consider swizzle in shader
-         */
+        /* FIXME: Allocate big buffer up front and re-alloc if necessary. */
         assert(pg->surface_scale_factor == 1 || downscale);
         swizzle_buf = (uint8_t *)g_malloc(surface->size);
         gl_read_buf = swizzle_buf;
@@ -736,7 +999,7 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
         pg->surface_scale_factor * surface->width,
         pg->surface_scale_factor * surface->height, flip, gl_read_buf);
 
-    /* FIXME: Replace this with a hw accelerated version */
+    /* FIXME: Downscale zeta surfaces on the GPU as well */
     if (downscale) {
         assert(surface->pitch >= (surface->width * surface->fmt.bytes_per_pixel));
         uint8_t *out = swizzle_buf, *in = pg->scale_buf;
@@ -762,8 +1025,127 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
     bind_current_surface(d);
 }
 
+static void surface_download_complete(NV2AState *d, SurfaceBinding *surface)
+{
+    memory_region_set_client_dirty(d->vram, surface->vram_addr,
+                                   surface->pitch * surface->height,
+                                   DIRTY_MEMORY_VGA);
+    memory_region_set_client_dirty(d->vram, surface->vram_addr,
+                                   surface->pitch * surface->height,
+                                   DIRTY_MEMORY_NV2A_TEX);
+
+    surface->download_pending = false;
+    surface->draw_dirty = false;
+}
+
+/*
+ * Surfaces that can be read back straight into their guest memory layout,
+ * without any processing on the CPU, can be read into a pixel pack buffer
+ * and collected later.
+ */
+static bool surface_can_download_async(PGRAPHState *pg,
+                                       const SurfaceBinding *surface)
+{
+    return surface->color ||
+           !(surface->swizzle || pg->surface_scale_factor != 1);
+}
+
+/* Swizzled surfaces are read back tightly packed */
+static size_t surface_readback_pitch(const SurfaceBinding *surface)
+{
+    return surface->swizzle ? surface->width * surface->fmt.bytes_per_pixel :
+                              surface->pitch;
+}
+
+static void surface_readback_release(SurfaceReadback *rb)
+{
+    glDeleteSync(rb->fence);
+    rb->fence = 0;
+    rb->surface->readback = NULL;
+    rb->surface = NULL;
+}
+
+static void surface_readback_complete(NV2AState *d, SurfaceReadback *rb)
+{
+    SurfaceBinding *surface = rb->surface;
+
+    if (surface->draw_time != rb->draw_time || !surface->draw_dirty) {
+        /* Drawn to or overwritten since the readback was issued */
+        surface_readback_release(rb);
+        return;
+    }
+
+    glClientWaitSync(rb->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                     GL_TIMEOUT_IGNORED);
+
+    size_t row_size = surface->width * surface->fmt.bytes_per_pixel;
+    size_t pitch = surface_readback_pitch(surface);
+    size_t size = pitch * (surface->height - 1) + row_size;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    const uint8_t *in = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+                                         GL_MAP_READ_BIT);
+    assert(in != NULL);
+
+    /* Leave the bytes between rows of linear surfaces untouched */
+    uint8_t *out = d->vram_ptr + surface->vram_addr;
+    if (pitch == row_size) {
+        memcpy(out, in, size);
+    } else {
+        for (unsigned int y = 0; y < surface->height; y++) {
+            memcpy(out, in, row_size);
+            in += pitch;
+            out += pitch;
+        }
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    surface_readback_release(rb);
+    surface_download_complete(d, surface);
+}
+
+static void surface_readback_start(NV2AState *d, SurfaceBinding *surface)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    if (surface->readback) {
+        if (surface->readback->draw_time == surface->draw_time) {
+            return;
+        }
+        surface_readback_release(surface->readback);
+    }
+
+    SurfaceReadback *rb = &r->readbacks[r->next_readback];
+    r->next_readback = (r->next_readback + 1) % SURFACE_READBACK_RING_SIZE;
+    if (rb->surface) {
+        surface_readback_complete(d, rb);
+    }
+
+    size_t row_size = surface->width * surface->fmt.bytes_per_pixel;
+    size_t pitch = surface_readback_pitch(surface);
+    size_t size = pitch * (surface->height - 1) + row_size;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    if (rb->pbo_size < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        rb->pbo_size = size;
+    }
+    surface_download_to_buffer(d, surface, true, false, true, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb->surface = surface;
+    rb->draw_time = surface->draw_time;
+    surface->readback = rb;
+}
+
 static void surface_download(NV2AState *d, SurfaceBinding *surface, bool force)
 {
+    PGRAPHState *pg = &d->pgraph;
+
     if (!(surface->download_pending || force) || !surface->width ||
         !surface->height) {
         return;
@@ -773,18 +1155,15 @@ static void surface_download(NV2AState *d, SurfaceBinding *surface, bool force)
 
     nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD);
 
+    if (surface->draw_dirty && surface_can_download_async(pg, surface)) {
+        surface_readback_start(d, surface);
+        surface_readback_complete(d, surface->readback);
+        return;
+    }
+
     surface_download_to_buffer(d, surface, true, false, true,
                                d->vram_ptr + surface->vram_addr);
-
-    memory_region_set_client_dirty(d->vram, surface->vram_addr,
-                                   surface->pitch * surface->height,
-                                   DIRTY_MEMORY_VGA);
-    memory_region_set_client_dirty(d->vram, surface->vram_addr,
-                                   surface->pitch * surface->height,
-                                   DIRTY_MEMORY_NV2A_TEX);
-
-    surface->download_pending = false;
-    surface->draw_dirty = false;
+    surface_download_complete(d, surface);
 }
 
 void pgraph_gl_process_pending_downloads(NV2AState *d)
@@ -792,7 +1171,15 @@ void pgraph_gl_process_pending_downloads(NV2AState *d)
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
+    /* Issue every readback up front so they overlap on the GPU */
     SurfaceBinding *surface;
+    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+        if (surface->download_pending && surface->width && surface->height &&
+            surface_can_download_async(pg, surface)) {
+            surface_readback_start(d, surface);
+        }
+    }
+
     QTAILQ_FOREACH(surface, &r->surfaces, entry) {
         surface_download(d, surface, false);
     }
@@ -801,6 +1188,25 @@ void pgraph_gl_process_pending_downloads(NV2AState *d)
     qemu_event_set(&r->downloads_complete);
 }
 
+/*
+ * Start reading back surfaces the CPU has read before, so that by the time it
+ * touches them again the data is already on its way and the access callback
+ * does not have to stall on the GPU.
+ */
+void pgraph_gl_prefetch_surface_downloads(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    SurfaceBinding *surface;
+    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+        if (surface->prefetch && surface->draw_dirty && surface->width &&
+            surface->height && surface_can_download_async(pg, surface)) {
+            surface_readback_start(d, surface);
+        }
+    }
+}
+
 void pgraph_gl_download_dirty_surfaces(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -1065,6 +1471,8 @@ static void populate_surface_binding_entry_sized(NV2AState *d, bool color,
     entry->upload_pending = true;
     entry->download_pending = false;
     entry->draw_dirty = false;
+    entry->prefetch = false;
+    entry->readback = NULL;
     entry->dma_addr = dma.address;
     entry->dma_len = dma.limit;
     entry->frame_time = pg->frame_time;
@@ -1421,7 +1829,13 @@ void pgraph_gl_init_surfaces(PGRAPHState *pg)
     qemu_event_init(&r->downloads_complete, false);
     qemu_event_init(&r->dirty_surfaces_download_complete, false);
 
+    for (int i = 0; i < SURFACE_READBACK_RING_SIZE; i++) {
+        glGenBuffers(1, &r->readbacks[i].pbo);
+    }
+    r->next_readback = 0;
+
     init_render_to_texture(pg);
+    init_surface_to_memory(pg);
 }
 
 static void flush_surfaces(NV2AState *d)
@@ -1454,7 +1868,14 @@ void pgraph_gl_finalize_surfaces(PGRAPHState *pg)
     glDeleteFramebuffers(1, &r->gl_framebuffer);
     r->gl_framebuffer = 0;
 
+    for (int i = 0; i < SURFACE_READBACK_RING_SIZE; i++) {
+        glDeleteBuffers(1, &r->readbacks[i].pbo);
+        r->readbacks[i].pbo = 0;
+        r->readbacks[i].pbo_size = 0;
+    }
+
     finalize_render_to_texture(pg);
+    finalize_surface_to_memory(pg);
 }
 
 void pgraph_gl_surface_flush(NV2AState *d)
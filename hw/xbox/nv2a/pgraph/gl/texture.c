@@ -21,40 +21,42 @@
 
 #include "qemu/fast-hash.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
-#include "hw/xbox/nv2a/pgraph/swizzle.h"
-#include "hw/xbox/nv2a/pgraph/s3tc.h"
 #include "hw/xbox/nv2a/pgraph/texture.h"
 #include "debug.h"
 #include "renderer.h"
 
-static TextureBinding* generate_texture(const TextureShape s, const uint8_t *texture_data, const uint8_t *palette_data);
+static TextureBinding* generate_texture(PGRAPHState *pg, const TextureShape s,
+                                        const uint8_t *texture_data,
+                                        const uint8_t *palette_data);
 static void texture_binding_destroy(gpointer data);
 
-struct pgraph_texture_possibly_dirty_struct {
-    hwaddr addr, end;
-};
-
 static void mark_textures_possibly_dirty_visitor(Lru *lru, LruNode *node, void *opaque)
 {
-    struct pgraph_texture_possibly_dirty_struct *test =
-        (struct pgraph_texture_possibly_dirty_struct *)opaque;
+    TexturePageRange *pages = opaque;
 
     struct TextureLruNode *tnode = container_of(node, TextureLruNode, node);
     if (tnode->binding == NULL || tnode->possibly_dirty) {
         return;
     }
 
-    uintptr_t k_tex_addr = tnode->key.texture_vram_offset;
-    uintptr_t k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
-    bool overlapping = !(test->addr > k_tex_end || k_tex_addr > test->end);
+    tnode->possibly_dirty |=
+        pgraph_texture_page_ranges_overlap(tnode->texture_pages, *pages) ||
+        pgraph_texture_page_ranges_overlap(tnode->palette_pages, *pages);
+}
 
-    if (tnode->key.palette_length > 0) {
-        uintptr_t k_pal_addr = tnode->key.palette_vram_offset;
-        uintptr_t k_pal_end = k_pal_addr + tnode->key.palette_length - 1;
-        overlapping |= !(test->addr > k_pal_end || k_pal_addr > test->end);
-    }
+static void mark_textures_possibly_dirty(void *opaque, TexturePageRange pages)
+{
+    PGRAPHGLState *r = opaque;
 
-    tnode->possibly_dirty |= overlapping;
+    lru_visit_active(&r->texture_cache,
+                     mark_textures_possibly_dirty_visitor,
+                     &pages);
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        r->palette_binding[i].possibly_dirty |=
+            pgraph_texture_page_ranges_overlap(r->palette_binding[i].pages,
+                                               pages);
+    }
 }
 
 void pgraph_gl_mark_textures_possibly_dirty(NV2AState *d,
@@ -63,47 +65,27 @@ void pgraph_gl_mark_textures_possibly_dirty(NV2AState *d,
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
-    hwaddr end = TARGET_PAGE_ALIGN(addr + size) - 1;
-    addr &= TARGET_PAGE_MASK;
-    assert(end <= memory_region_size(d->vram));
-
-    struct pgraph_texture_possibly_dirty_struct test = {
-        .addr = addr,
-        .end = end,
-    };
+    assert(addr + size <= memory_region_size(d->vram));
 
-    lru_visit_active(&r->texture_cache,
-                     mark_textures_possibly_dirty_visitor,
-                     &test);
-}
-
-static bool check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
-{
-    hwaddr end = TARGET_PAGE_ALIGN(addr + size);
-    addr &= TARGET_PAGE_MASK;
-    assert(end < memory_region_size(d->vram));
-    return memory_region_test_and_clear_dirty(d->vram, addr, end - addr,
-                                              DIRTY_MEMORY_NV2A_TEX);
+    /* Contents may have changed without going through the dirty bitmap */
+    TexturePageRange pages = pgraph_texture_page_range(addr, size);
+    pgraph_texture_page_hashes_invalidate(&r->texture_page_hashes, pages);
+    mark_textures_possibly_dirty(r, pages);
 }
 
 // Check if any of the pages spanned by the a texture are dirty.
 static bool check_texture_possibly_dirty(NV2AState *d,
-                                         hwaddr texture_vram_offset,
-                                         unsigned int length,
-                                         hwaddr palette_vram_offset,
-                                         unsigned int palette_length)
+                                         TexturePageRange texture_pages,
+                                         TexturePageRange palette_pages)
 {
-    bool possibly_dirty = false;
-    if (check_texture_dirty(d, texture_vram_offset, length)) {
-        possibly_dirty = true;
-        pgraph_gl_mark_textures_possibly_dirty(d, texture_vram_offset, length);
-    }
-    if (palette_length && check_texture_dirty(d, palette_vram_offset,
-                                                     palette_length)) {
-        possibly_dirty = true;
-        pgraph_gl_mark_textures_possibly_dirty(d, palette_vram_offset,
-                                            palette_length);
-    }
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+
+    bool possibly_dirty = pgraph_texture_page_hashes_sync(
+        &r->texture_page_hashes, d->vram, texture_pages,
+        mark_textures_possibly_dirty, r);
+    possibly_dirty |= pgraph_texture_page_hashes_sync(
+        &r->texture_page_hashes, d->vram, palette_pages,
+        mark_textures_possibly_dirty, r);
     return possibly_dirty;
 }
 
@@ -202,6 +184,47 @@ static void apply_texture_parameters(PGRAPHGLState *r,
     }
 }
 
+/*
+ * Bind the palette of texture_idx to its palette texture unit, re-uploading it
+ * if the palette memory changed. Leaves texture unit texture_idx active.
+ */
+static void bind_palette_texture(NV2AState *d, int texture_idx,
+                                 hwaddr vram_offset, size_t length)
+{
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+    PaletteBinding *palette = &r->palette_binding[texture_idx];
+
+    bool resized = palette->length != length;
+    if (resized || palette->vram_offset != vram_offset) {
+        palette->vram_offset = vram_offset;
+        palette->length = length;
+        palette->pages = pgraph_texture_page_range(vram_offset, length);
+        palette->possibly_dirty = true;
+    }
+    palette->possibly_dirty |= check_texture_possibly_dirty(
+        d, palette->pages, (TexturePageRange){ 0, 0 });
+
+    glActiveTexture(GL_TEXTURE0 + NV2A_MAX_TEXTURES + texture_idx);
+    glBindTexture(GL_TEXTURE_2D, palette->gl_texture);
+
+    if (palette->possibly_dirty) {
+        uint64_t hash = pgraph_texture_page_hashes_hash(
+            &r->texture_page_hashes, d->vram_ptr, vram_offset, length);
+        if (resized || hash != palette->data_hash) {
+            ColorFormatInfo f = kelvin_color_format_gl_map
+                [NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8R8G8B8];
+            glTexImage2D(GL_TEXTURE_2D, 0, f.gl_internal_format, length / 4, 1,
+                         0, f.gl_format, f.gl_type,
+                         d->vram_ptr + vram_offset);
+            palette->data_hash = hash;
+            nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
+        }
+        palette->possibly_dirty = false;
+    }
+
+    glActiveTexture(GL_TEXTURE0 + texture_idx);
+}
+
 void pgraph_gl_bind_textures(NV2AState *d)
 {
     int i;
@@ -247,8 +270,18 @@ void pgraph_gl_bind_textures(NV2AState *d)
         assert((texture_vram_offset + length) < memory_region_size(d->vram));
         assert((palette_vram_offset + palette_length)
                < memory_region_size(d->vram));
+        if (pgraph_is_texture_palette_lookup_enabled(pg, i)) {
+            state = pgraph_get_texture_index_shape(state);
+            bind_palette_texture(d, i, palette_vram_offset, palette_length);
+        } else if (pgraph_is_texture_yuv_conversion_enabled(pg, i)) {
+            state = pgraph_get_texture_yuv_shape(state);
+        }
         bool is_indexed = (state.color_format ==
                 NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8);
+        TexturePageRange texture_pages =
+            pgraph_texture_page_range(texture_vram_offset, length);
+        TexturePageRange palette_pages = pgraph_texture_page_range(
+            palette_vram_offset, is_indexed ? palette_length : 0);
         bool possibly_dirty = false;
         bool possibly_dirty_checked = false;
 
@@ -260,11 +293,7 @@ void pgraph_gl_bind_textures(NV2AState *d)
                 reusable = true;
             } else if (!surface) {
                 possibly_dirty = check_texture_possibly_dirty(
-                        d,
-                        texture_vram_offset,
-                        length,
-                        palette_vram_offset,
-                        is_indexed ? palette_length : 0);
+                        d, texture_pages, palette_pages);
                 possibly_dirty_checked = true;
                 reusable = !possibly_dirty;
             }
@@ -302,15 +331,8 @@ void pgraph_gl_bind_textures(NV2AState *d)
             // FIXME: Restructure to support rendering surfaces to cubemap faces
 
             // Writeback any surfaces which this texture may index
-            hwaddr tex_vram_end = texture_vram_offset + length - 1;
-            QTAILQ_FOREACH(surface, &r->surfaces, entry) {
-                hwaddr surf_vram_end = surface->vram_addr + surface->size - 1;
-                bool overlapping = !(surface->vram_addr >= tex_vram_end
-                                     || texture_vram_offset >= surf_vram_end);
-                if (overlapping) {
-                    pgraph_gl_surface_download_if_dirty(d, surface);
-                }
-            }
+            pgraph_gl_download_surfaces_in_range_if_dirty(
+                d, texture_vram_offset, length);
         }
 
         TextureKey key;
@@ -332,11 +354,7 @@ void pgraph_gl_bind_textures(NV2AState *d)
 
         if (!surf_to_tex && !possibly_dirty_checked) {
             possibly_dirty |= check_texture_possibly_dirty(
-                    d,
-                    texture_vram_offset,
-                    length,
-                    palette_vram_offset,
-                    is_indexed ? palette_length : 0);
+                    d, key_out->texture_pages, key_out->palette_pages);
         }
 
         // Calculate hash of texture data, if necessary
@@ -345,9 +363,13 @@ void pgraph_gl_bind_textures(NV2AState *d)
 
         uint64_t tex_data_hash = 0;
         if (!surf_to_tex && possibly_dirty) {
-            tex_data_hash = fast_hash(texture_data, length);
+            tex_data_hash = pgraph_texture_page_hashes_hash(
+                &r->texture_page_hashes, d->vram_ptr, texture_vram_offset,
+                length);
             if (is_indexed) {
-                tex_data_hash ^= fast_hash(palette_data, palette_length);
+                tex_data_hash ^= pgraph_texture_page_hashes_hash(
+                    &r->texture_page_hashes, d->vram_ptr, palette_vram_offset,
+                    palette_length);
             }
         }
 
@@ -362,7 +384,8 @@ void pgraph_gl_bind_textures(NV2AState *d)
 
         if (key_out->binding == NULL) {
             // Must create the texture
-            key_out->binding = generate_texture(state, texture_data, palette_data);
+            key_out->binding = generate_texture(pg, state, texture_data,
+                                                palette_data);
             key_out->binding->data_hash = tex_data_hash;
             key_out->binding->scale = 1;
         } else {
@@ -406,38 +429,51 @@ void pgraph_gl_bind_textures(NV2AState *d)
     NV2A_GL_DGROUP_END();
 }
 
-static enum S3TC_DECOMPRESS_FORMAT
-gl_internal_format_to_s3tc_enum(GLint gl_internal_format)
+/*
+ * Stage all decoded levels in the texture upload buffer. Offsets into it are
+ * returned per face and level, for use as glTexImage pixel pointers while the
+ * buffer is bound.
+ */
+static void fill_texture_upload_buffer(PGRAPHGLState *r, TextureDecode *td,
+                                       size_t offsets[6][NV2A_MAX_TEXTURE_LEVELS])
 {
-    switch (gl_internal_format) {
-    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
-        return S3TC_DECOMPRESS_FORMAT_DXT1;
-    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-        return S3TC_DECOMPRESS_FORMAT_DXT3;
-    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
-        return S3TC_DECOMPRESS_FORMAT_DXT5;
-    default:
-        assert(!"Invalid gl_internal_format");
+    size_t size = 0;
+    for (int face = 0; face < td->num_faces; face++) {
+        for (int level = 0; level < td->num_levels; level++) {
+            offsets[face][level] = size;
+            size += td->levels[face][level].size;
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r->gl_texture_upload_buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    uint8_t *mapped = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    assert(mapped != NULL);
+
+    for (int face = 0; face < td->num_faces; face++) {
+        for (int level = 0; level < td->num_levels; level++) {
+            TextureDecodeLevel *l = &td->levels[face][level];
+            memcpy(mapped + offsets[face][level], l->data, l->size);
+        }
     }
+
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 }
 
+/* Upload one face from the bound texture upload buffer */
 static void upload_gl_texture(GLenum gl_target,
                               const TextureShape s,
-                              const uint8_t *texture_data,
-                              const uint8_t *palette_data)
+                              TextureDecode *td,
+                              int face,
+                              const size_t *offsets)
 {
     ColorFormatInfo f = kelvin_color_format_gl_map[s.color_format];
-    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
 
     unsigned int adjusted_width = s.width;
-    unsigned int adjusted_height = s.height;
-    unsigned int adjusted_pitch = s.pitch;
-    unsigned int adjusted_depth = s.depth;
     if (!f.linear && s.border) {
         adjusted_width = MAX(16, adjusted_width * 2);
-        adjusted_height = MAX(16, adjusted_height * 2);
-        adjusted_pitch = adjusted_width * (s.pitch / s.width);
-        adjusted_depth = MAX(16, s.depth * 2);
     }
 
     switch(gl_target) {
@@ -446,24 +482,12 @@ static void upload_gl_texture(GLenum gl_target,
         break;
     case GL_TEXTURE_2D:
         if (f.linear) {
-            /* Can't handle strides unaligned to pixels */
-            assert(s.pitch % f.bytes_per_pixel == 0);
-
-            uint8_t *converted = pgraph_convert_texture_data(
-                s, texture_data, palette_data, adjusted_width, adjusted_height, 1,
-                adjusted_pitch, 0, NULL);
-            glPixelStorei(GL_UNPACK_ROW_LENGTH,
-                          converted ? 0 : adjusted_pitch / f.bytes_per_pixel);
+            /* Decoded data has the row padding removed */
+            TextureDecodeLevel *l = &td->levels[face][0];
             glTexImage2D(GL_TEXTURE_2D, 0, f.gl_internal_format,
-                         adjusted_width, adjusted_height, 0,
+                         l->width, l->height, 0,
                          f.gl_format, f.gl_type,
-                         converted ? converted : texture_data);
-
-            if (converted) {
-              g_free(converted);
-            }
-
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+                         (const void *)offsets[0]);
             break;
         }
         /* fallthru */
@@ -473,24 +497,14 @@ static void upload_gl_texture(GLenum gl_target,
     case GL_TEXTURE_CUBE_MAP_NEGATIVE_Y:
     case GL_TEXTURE_CUBE_MAP_POSITIVE_Z:
     case GL_TEXTURE_CUBE_MAP_NEGATIVE_Z: {
-
-        unsigned int width = adjusted_width, height = adjusted_height;
-
         int level;
-        for (level = 0; level < s.levels; level++) {
-            width = MAX(width, 1);
-            height = MAX(height, 1);
+        for (level = 0; level < td->num_levels; level++) {
+            TextureDecodeLevel *l = &td->levels[face][level];
+            unsigned int width = l->width, height = l->height;
+            size_t pixel_offset = offsets[level];
 
             if (f.gl_format == 0) { /* compressed */
-                 // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
-                unsigned int block_size =
-                    f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
-                        8 : 16;
-                unsigned int physical_width = (width + 3) & ~3,
-                             physical_height = (height + 3) & ~3;
-                uint8_t *converted = s3tc_decompress_2d(
-                    gl_internal_format_to_s3tc_enum(f.gl_internal_format),
-                    texture_data, width, height);
+                unsigned int physical_width = (width + 3) & ~3;
                 unsigned int tex_width = width;
                 unsigned int tex_height = height;
 
@@ -508,8 +522,8 @@ static void upload_gl_texture(GLenum gl_target,
                 }
 
                 glTexImage2D(gl_target, level, GL_RGBA, tex_width, tex_height, 0,
-                             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, converted);
-                g_free(converted);
+                             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                             (const void *)pixel_offset);
                 if (s.cubemap && adjusted_width != s.width) {
                     glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
                     glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
@@ -517,17 +531,8 @@ static void upload_gl_texture(GLenum gl_target,
                         glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
                     }
                 }
-                texture_data +=
-                    physical_width / 4 * physical_height / 4 * block_size;
             } else {
                 unsigned int pitch = width * f.bytes_per_pixel;
-                uint8_t *unswizzled = (uint8_t*)g_malloc(height * pitch);
-                unswizzle_rect(texture_data, width, height,
-                               unswizzled, pitch, f.bytes_per_pixel);
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data, width, height, 1, pitch, 0,
-                    NULL);
-                uint8_t *pixel_data = converted ? converted : unswizzled;
                 unsigned int tex_width = width;
                 unsigned int tex_height = height;
 
@@ -538,98 +543,38 @@ static void upload_gl_texture(GLenum gl_target,
                     glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
                     tex_width = s.width;
                     tex_height = s.height;
-                    pixel_data += 4 * f.bytes_per_pixel + 4 * pitch;
+                    pixel_offset += 4 * f.bytes_per_pixel + 4 * pitch;
                 }
 
                 glTexImage2D(gl_target, level, f.gl_internal_format, tex_width,
                              tex_height, 0, f.gl_format, f.gl_type,
-                             pixel_data);
+                             (const void *)pixel_offset);
                 if (s.cubemap && s.border) {
                     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
                 }
-                if (converted) {
-                    g_free(converted);
-                }
-                g_free(unswizzled);
-
-                texture_data += width * height * f.bytes_per_pixel;
             }
-
-            width /= 2;
-            height /= 2;
         }
 
         break;
     }
     case GL_TEXTURE_3D: {
-
-        unsigned int width = adjusted_width;
-        unsigned int height = adjusted_height;
-        unsigned int depth = adjusted_depth;
-
         assert(f.linear == false);
 
         int level;
-        for (level = 0; level < s.levels; level++) {
-            if (f.gl_format == 0) { /* compressed */
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                unsigned int physical_width = (width + 3) & ~3,
-                             physical_height = (height + 3) & ~3;
-                depth = MAX(depth, 1);
-
-                unsigned int block_size;
-                if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-                    block_size = 8;
-                } else {
-                    block_size = 16;
-                }
-
-                size_t texture_size = physical_width/4 * physical_height/4 * depth * block_size;
+        for (level = 0; level < td->num_levels; level++) {
+            TextureDecodeLevel *l = &td->levels[face][level];
 
-                uint8_t *converted = s3tc_decompress_3d(
-                    gl_internal_format_to_s3tc_enum(f.gl_internal_format),
-                    texture_data, width, height, depth);
-
-                glTexImage3D(gl_target, level,  GL_RGBA8,
-                             width, height, depth, 0,
+            if (f.gl_format == 0) { /* compressed */
+                glTexImage3D(gl_target, level, GL_RGBA8,
+                             l->width, l->height, l->depth, 0,
                              GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
-                             converted);
-
-                g_free(converted);
-
-                texture_data += texture_size;
+                             (const void *)offsets[level]);
             } else {
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                depth = MAX(depth, 1);
-
-                unsigned int row_pitch = width * f.bytes_per_pixel;
-                unsigned int slice_pitch = row_pitch * height;
-                uint8_t *unswizzled = (uint8_t*)g_malloc(slice_pitch * depth);
-                unswizzle_box(texture_data, width, height, depth, unswizzled,
-                               row_pitch, slice_pitch, f.bytes_per_pixel);
-
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data, width, height, depth,
-                    row_pitch, slice_pitch, NULL);
-
                 glTexImage3D(gl_target, level, f.gl_internal_format,
-                             width, height, depth, 0,
+                             l->width, l->height, l->depth, 0,
                              f.gl_format, f.gl_type,
-                             converted ? converted : unswizzled);
-
-                if (converted) {
-                    g_free(converted);
-                }
-                g_free(unswizzled);
-
-                texture_data += width * height * depth * f.bytes_per_pixel;
+                             (const void *)offsets[level]);
             }
-
-            width /= 2;
-            height /= 2;
-            depth /= 2;
         }
         break;
     }
@@ -639,10 +584,12 @@ static void upload_gl_texture(GLenum gl_target,
     }
 }
 
-static TextureBinding* generate_texture(const TextureShape s,
+static TextureBinding* generate_texture(PGRAPHState *pg,
+                                        const TextureShape s,
                                         const uint8_t *texture_data,
                                         const uint8_t *palette_data)
 {
+    PGRAPHGLState *r = pg->gl_renderer_state;
     ColorFormatInfo f = kelvin_color_format_gl_map[s.color_format];
 
     /* Create a new opengl texture */
@@ -681,52 +628,30 @@ static TextureBinding* generate_texture(const TextureShape s,
                    s.dimensionality, s.cubemap ? " (Cubemap)" : "",
                    s.width, s.height, s.depth);
 
-    if (gl_target == GL_TEXTURE_CUBE_MAP) {
-        unsigned int block_size;
-        if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-            block_size = 8;
-        } else {
-            block_size = 16;
-        }
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
 
-        size_t length = 0;
-        unsigned int w = s.width;
-        unsigned int h = s.height;
-        if (!f.linear && s.border) {
-            w = MAX(16, w * 2);
-            h = MAX(16, h * 2);
-        }
+    /* Levels are decoded in parallel, then uploaded through a PBO */
+    TextureDecode *td = pgraph_decode_texture(pg, s, texture_data,
+                                              palette_data, false);
+    size_t offsets[6][NV2A_MAX_TEXTURE_LEVELS];
+    fill_texture_upload_buffer(r, td, offsets);
 
-        int level;
-        for (level = 0; level < s.levels; level++) {
-            if (f.gl_format == 0) {
-                length += w/4 * h/4 * block_size;
-            } else {
-                length += w * h * f.bytes_per_pixel;
-            }
-
-            w /= 2;
-            h /= 2;
+    if (gl_target == GL_TEXTURE_CUBE_MAP) {
+        static const GLenum face_targets[6] = {
+            GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
+            GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+            GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+        };
+        for (int face = 0; face < 6; face++) {
+            upload_gl_texture(face_targets[face], s, td, face, offsets[face]);
         }
-
-        length = (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
-
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-                          s, texture_data + 0 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-                          s, texture_data + 1 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-                          s, texture_data + 2 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-                          s, texture_data + 3 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-                          s, texture_data + 4 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
-                          s, texture_data + 5 * length, palette_data);
     } else {
-        upload_gl_texture(gl_target, s, texture_data, palette_data);
+        upload_gl_texture(gl_target, s, td, 0, offsets[0]);
     }
 
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    pgraph_free_texture_decode(td);
+
     /* Linear textures don't support mipmapping */
     if (!f.linear) {
         glTexParameteri(gl_target, GL_TEXTURE_BASE_LEVEL,
@@ -774,6 +699,10 @@ static void texture_cache_entry_init(Lru *lru, LruNode *node, const void *key)
     TextureLruNode *tnode = container_of(node, TextureLruNode, node);
     memcpy(&tnode->key, key, sizeof(TextureKey));
 
+    tnode->texture_pages = pgraph_texture_page_range(
+        tnode->key.texture_vram_offset, tnode->key.texture_length);
+    tnode->palette_pages = pgraph_texture_page_range(
+        tnode->key.palette_vram_offset, tnode->key.palette_length);
     tnode->binding = NULL;
     tnode->possibly_dirty = false;
 }
@@ -811,6 +740,24 @@ void pgraph_gl_init_textures(NV2AState *d)
     r->texture_cache.init_node = texture_cache_entry_init;
     r->texture_cache.compare_nodes = texture_cache_entry_compare;
     r->texture_cache.post_node_evict = texture_cache_entry_post_evict;
+
+    pgraph_texture_page_hashes_init(&r->texture_page_hashes,
+                                    memory_region_size(d->vram));
+
+    glGenBuffers(1, &r->gl_texture_upload_buffer);
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        PaletteBinding *palette = &r->palette_binding[i];
+        memset(palette, 0, sizeof(*palette));
+        glGenTextures(1, &palette->gl_texture);
+        glBindTexture(GL_TEXTURE_2D, palette->gl_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void pgraph_gl_finalize_textures(PGRAPHState *pg)
@@ -822,7 +769,18 @@ void pgraph_gl_finalize_textures(PGRAPHState *pg)
     }
 
     lru_flush(&r->texture_cache);
+    lru_destroy(&r->texture_cache);
     free(r->texture_cache_entries);
 
     r->texture_cache_entries = NULL;
+
+    pgraph_texture_page_hashes_finalize(&r->texture_page_hashes);
+
+    glDeleteBuffers(1, &r->gl_texture_upload_buffer);
+    r->gl_texture_upload_buffer = 0;
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        glDeleteTextures(1, &r->palette_binding[i].gl_texture);
+        r->palette_binding[i].gl_texture = 0;
+    }
 }
@@ -24,41 +24,116 @@
 #include "debug.h"
 #include "renderer.h"
 
-static void update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size,
-                                 bool quick)
+/*
+ * With GL_ARB_buffer_storage the memory buffer is a persistent, coherent
+ * mapping that mirrors VRAM. Blocks are copied into it directly, so a block
+ * read by a draw that may still be executing must not be overwritten until
+ * the fence that follows that draw has signaled.
+ */
+static void insert_memory_buffer_fence(PGRAPHGLState *r);
+
+static void wait_memory_buffer_fence(PGRAPHGLState *r, uint64_t seq)
+{
+    if (seq <= r->memory_buffer_fence_completed) {
+        return;
+    }
+    if (seq == r->memory_buffer_fence_seq) {
+        insert_memory_buffer_fence(r);
+    }
+    while (r->memory_buffer_fence_completed < seq) {
+        uint64_t next = r->memory_buffer_fence_completed + 1;
+        GLsync fence =
+            r->memory_buffer_fences[next % MEMORY_BUFFER_FENCE_RING_SIZE];
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                         GL_TIMEOUT_IGNORED);
+        glDeleteSync(fence);
+        r->memory_buffer_fence_completed = next;
+    }
+}
+
+static void insert_memory_buffer_fence(PGRAPHGLState *r)
+{
+    uint64_t outstanding =
+        r->memory_buffer_fence_seq - 1 - r->memory_buffer_fence_completed;
+    if (outstanding == MEMORY_BUFFER_FENCE_RING_SIZE) {
+        wait_memory_buffer_fence(r, r->memory_buffer_fence_completed + 1);
+    }
+
+    r->memory_buffer_fences[r->memory_buffer_fence_seq %
+                            MEMORY_BUFFER_FENCE_RING_SIZE] =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->memory_buffer_fence_seq++;
+    r->memory_buffer_unfenced = false;
+}
+
+/* Blocks in [addr, end) are read by the next draw */
+static void mark_memory_buffer_in_use(PGRAPHGLState *r, hwaddr addr,
+                                      hwaddr end)
+{
+    if (!r->gl_memory_buffer_map) {
+        return;
+    }
+
+    for (hwaddr b = addr >> MEMORY_BUFFER_BLOCK_BITS;
+         b <= (end - 1) >> MEMORY_BUFFER_BLOCK_BITS; b++) {
+        r->memory_buffer_block_fence[b] = r->memory_buffer_fence_seq;
+    }
+    r->memory_buffer_unfenced = true;
+}
+
+static void upload_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size)
+{
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+
+    if (r->gl_memory_buffer_map) {
+        for (hwaddr b = addr >> MEMORY_BUFFER_BLOCK_BITS;
+             b <= (addr + size - 1) >> MEMORY_BUFFER_BLOCK_BITS; b++) {
+            wait_memory_buffer_fence(r, r->memory_buffer_block_fence[b]);
+        }
+        memcpy(r->gl_memory_buffer_map + addr, d->vram_ptr + addr, size);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, addr, size, d->vram_ptr + addr);
+    }
+}
+
+/*
+ * Bring the pages of [addr, addr + size) up to date, copying only the blocks
+ * whose NV2A dirty bits are set. Dirty bits are only cleared for the
+ * requested pages.
+ */
+static void update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size)
 {
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
-    glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
-
     hwaddr end = TARGET_PAGE_ALIGN(addr + size);
     addr &= TARGET_PAGE_MASK;
     assert(end < memory_region_size(d->vram));
 
-    static hwaddr last_addr, last_end;
-    if (quick && (addr >= last_addr) && (end <= last_end)) {
+    /* Attributes of a draw commonly share one vertex buffer */
+    if (addr >= r->memory_buffer_synced_start &&
+        end <= r->memory_buffer_synced_end) {
         return;
     }
-    last_addr = addr;
-    last_end = end;
-
-    size = end - addr;
-    if (memory_region_test_and_clear_dirty(d->vram, addr, size,
-                                           DIRTY_MEMORY_NV2A)) {
-        glBufferSubData(GL_ARRAY_BUFFER, addr, size,
-                        d->vram_ptr + addr);
-        nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1);
+    r->memory_buffer_synced_start = addr;
+    r->memory_buffer_synced_end = end;
+
+    while (addr < end) {
+        hwaddr block_end =
+            MIN(end, ROUND_UP(addr + 1, 1 << MEMORY_BUFFER_BLOCK_BITS));
+        if (memory_region_test_and_clear_dirty(d->vram, addr, block_end - addr,
+                                               DIRTY_MEMORY_NV2A)) {
+            upload_memory_buffer(d, addr, block_end - addr);
+            nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1);
+        }
+        addr = block_end;
     }
 }
 
 void pgraph_gl_update_entire_memory_buffer(NV2AState *d)
 {
-    PGRAPHState *pg = &d->pgraph;
-    PGRAPHGLState *r = pg->gl_renderer_state;
-
-    glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, memory_region_size(d->vram), d->vram_ptr);
+    upload_memory_buffer(d, 0, memory_region_size(d->vram));
 }
 
 void pgraph_gl_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
@@ -69,7 +144,6 @@ void pgraph_gl_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
-    bool updated_memory_buffer = false;
     unsigned int num_elements = max_element - min_element + 1;
 
     if (inline_data) {
@@ -81,6 +155,16 @@ void pgraph_gl_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
 
     pg->compressed_attrs = 0;
 
+    /* Fence the draws that read the memory buffer since the last fence */
+    if (r->memory_buffer_unfenced) {
+        insert_memory_buffer_fence(r);
+    }
+    r->memory_buffer_synced_start = r->memory_buffer_synced_end = 0;
+
+    /* Marked once all attributes are uploaded, uploads wait on older draws */
+    hwaddr in_use[NV2A_VERTEXSHADER_ATTRIBUTES][2];
+    int num_in_use = 0;
+
     for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
         VertexAttribute *attr = &pg->vertex_attributes[i];
 
@@ -155,9 +239,11 @@ void pgraph_gl_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
             attrib_data_addr = attr_data + attr->offset - d->vram_ptr;
             stride = attr->stride;
             start = attrib_data_addr + min_element * stride;
-            update_memory_buffer(d, start, num_elements * stride,
-                                        updated_memory_buffer);
-            updated_memory_buffer = true;
+            update_memory_buffer(d, start, num_elements * stride);
+            in_use[num_in_use][0] = start;
+            in_use[num_in_use][1] = start + num_elements * stride;
+            num_in_use++;
+            glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
         }
 
         uint32_t provoking_element_index = provoking_element - min_element;
@@ -192,6 +278,10 @@ void pgraph_gl_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
         pgraph_update_inline_value(attr, last_entry);
     }
 
+    for (int i = 0; i < num_in_use; i++) {
+        mark_memory_buffer_in_use(r, in_use[i][0], in_use[i][1]);
+    }
+
     NV2A_GL_DGROUP_END();
 }
 
@@ -274,8 +364,25 @@ void pgraph_gl_init_buffers(NV2AState *d)
 
     glGenBuffers(1, &r->gl_memory_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
-    glBufferData(GL_ARRAY_BUFFER, memory_region_size(d->vram),
-                 NULL, GL_DYNAMIC_DRAW);
+    hwaddr vram_size = memory_region_size(d->vram);
+    r->gl_memory_buffer_map = NULL;
+    if (glo_check_extension("GL_ARB_buffer_storage")) {
+        GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, vram_size, NULL, flags);
+        r->gl_memory_buffer_map =
+            glMapBufferRange(GL_ARRAY_BUFFER, 0, vram_size, flags);
+        assert(r->gl_memory_buffer_map != NULL);
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, vram_size, NULL, GL_DYNAMIC_DRAW);
+    }
+    r->memory_buffer_block_fence = g_malloc0_n(
+        DIV_ROUND_UP(vram_size, 1 << MEMORY_BUFFER_BLOCK_BITS),
+        sizeof(uint64_t));
+    r->memory_buffer_fence_seq = 1;
+    r->memory_buffer_fence_completed = 0;
+    r->memory_buffer_unfenced = false;
+    r->memory_buffer_synced_start = r->memory_buffer_synced_end = 0;
 
     glGenVertexArrays(1, &r->gl_vertex_array);
     glBindVertexArray(r->gl_vertex_array);
@@ -293,6 +400,7 @@ void pgraph_gl_finalize_buffers(PGRAPHState *pg)
     }
     glDeleteBuffers(element_cache_size, element_cache_buffers);
     lru_flush(&r->element_cache);
+    lru_destroy(&r->element_cache);
 
     g_free(r->element_cache_entries);
     r->element_cache_entries = NULL;
@@ -303,6 +411,19 @@ void pgraph_gl_finalize_buffers(PGRAPHState *pg)
     glDeleteBuffers(1, &r->gl_inline_array_buffer);
     r->gl_inline_array_buffer = 0;
 
+    while (r->memory_buffer_fence_completed + 1 < r->memory_buffer_fence_seq) {
+        r->memory_buffer_fence_completed++;
+        glDeleteSync(r->memory_buffer_fences[r->memory_buffer_fence_completed %
+                                             MEMORY_BUFFER_FENCE_RING_SIZE]);
+    }
+    g_free(r->memory_buffer_block_fence);
+    r->memory_buffer_block_fence = NULL;
+
+    if (r->gl_memory_buffer_map) {
+        glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        r->gl_memory_buffer_map = NULL;
+    }
     glDeleteBuffers(1, &r->gl_memory_buffer);
     r->gl_memory_buffer = 0;
 
@@ -97,6 +97,43 @@ typedef struct UniformInfo {
 
 #define GLSL_DEFINE(a, b) "#define " stringify(a) " " b "\n"
 
+/*
+ * Samples packed YUY2 or UYVY data stored as one B8G8R8A8 texel per pair of
+ * pixels. coord is in pixels. Uses the same integer BT.601 conversion as
+ * convert_yuy2_to_rgb.
+ */
+#define GLSL_YUV_SAMPLER                                                      \
+    "vec3 yuvToRgb(vec3 yuv) {\n"                                             \
+    "    vec3 c = floor(yuv * 255.0 + 0.5) - vec3(16.0, 128.0, 128.0);\n"     \
+    "    vec3 rgb = vec3(298.0 * c.x + 409.0 * c.z,\n"                        \
+    "                    298.0 * c.x - 100.0 * c.y - 208.0 * c.z,\n"          \
+    "                    298.0 * c.x + 516.0 * c.y);\n"                       \
+    "    return clamp(floor((rgb + 128.0) / 256.0), 0.0, 255.0) / 255.0;\n"   \
+    "}\n"                                                                     \
+    "vec3 texelFetchYuv(sampler2D samp, ivec2 p, bool uyvy) {\n"              \
+    "    ivec2 size = textureSize(samp, 0);\n"                                \
+    "    p = clamp(p, ivec2(0), ivec2(size.x * 2 - 1, size.y - 1));\n"        \
+    "    vec4 t = texelFetch(samp, ivec2(p.x / 2, p.y), 0);\n"                \
+    "    bool odd = (p.x & 1) != 0;\n"                                        \
+    "    if (uyvy) {\n"                                                       \
+    "        return yuvToRgb(vec3(odd ? t.a : t.g, t.b, t.r));\n"             \
+    "    }\n"                                                                 \
+    "    return yuvToRgb(vec3(odd ? t.r : t.b, t.g, t.a));\n"                 \
+    "}\n"                                                                     \
+    "vec4 textureYuv(sampler2D samp, vec2 coord, bool uyvy, bool linear) {\n" \
+    "    if (!linear) {\n"                                                    \
+    "        return vec4(texelFetchYuv(samp, ivec2(floor(coord)), uyvy), 1.0);\n" \
+    "    }\n"                                                                 \
+    "    vec2 p = coord - 0.5;\n"                                             \
+    "    ivec2 i = ivec2(floor(p));\n"                                        \
+    "    vec2 f = p - floor(p);\n"                                            \
+    "    vec3 c0 = mix(texelFetchYuv(samp, i, uyvy),\n"                       \
+    "                  texelFetchYuv(samp, i + ivec2(1, 0), uyvy), f.x);\n"   \
+    "    vec3 c1 = mix(texelFetchYuv(samp, i + ivec2(0, 1), uyvy),\n"         \
+    "                  texelFetchYuv(samp, i + ivec2(1, 1), uyvy), f.x);\n"   \
+    "    return vec4(mix(c0, c1, f.y), 1.0);\n"                               \
+    "}\n"
+
 MString *pgraph_glsl_get_vtx_header(MString *out, bool location, bool smooth,
                                     bool in, bool prefix, bool array);
 
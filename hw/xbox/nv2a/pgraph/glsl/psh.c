@@ -125,6 +125,18 @@ void pgraph_glsl_set_psh_state(PGRAPHState *pg, PshState *state)
         unsigned int color_format = GET_MASK(tex_fmt, NV_PGRAPH_TEXFMT0_COLOR);
         BasicColorFormatInfo f = kelvin_color_format_info_map[color_format];
         state->rect_tex[i] = f.linear;
+        state->palette_tex[i] = pgraph_is_texture_palette_lookup_enabled(pg, i);
+        if (pgraph_is_texture_yuv_conversion_enabled(pg, i)) {
+            state->yuv_tex[i] =
+                color_format ==
+                        NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_CR8YB8CB8YA8 ?
+                    YUV_FORMAT_YUY2 :
+                    YUV_FORMAT_UYVY;
+            uint32_t filter = pgraph_reg_r(pg, NV_PGRAPH_TEXFILTER0 + i * 4);
+            state->yuv_tex_linear[i] =
+                GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MAG) !=
+                NV_PGRAPH_TEXFILTER0_MAG_BOX_LOD0;
+        }
         state->tex_x8y24[i] =
             color_format ==
                 NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_DEPTH_X8_Y24_FIXED ||
@@ -231,6 +243,125 @@ void pgraph_glsl_set_psh_state(PGRAPHState *pg, PshState *state)
     }
 }
 
+/* Bits of the ubershader texFlags uniform, one word per stage */
+#define PSH_UBER_TEX_RECT (1 << 0)
+#define PSH_UBER_TEX_ALPHAKILL (1 << 1)
+#define PSH_UBER_TEX_COLORKEY_SHIFT 2
+#define PSH_UBER_TEX_CLIP_GEQUAL_SHIFT 4
+
+/* Bits of the ubershader uberFlags uniform */
+#define PSH_UBER_WINDOW_CLIP_EXCLUSIVE (1 << 0)
+#define PSH_UBER_DEPTH_CLIPPING (1 << 1)
+#define PSH_UBER_Z_PERSPECTIVE (1 << 2)
+#define PSH_UBER_POINT_SPRITE (1 << 3)
+#define PSH_UBER_ALPHA_FUNC_SHIFT 4
+#define PSH_UBER_DEPTH_FORMAT_SHIFT 8
+
+/*
+ * Pick the sampler the ubershader declares for a stage. Returns false if the
+ * stage uses a texture mode or format that only a specialized shader handles.
+ */
+static bool get_psh_uber_sampler(const PshState *state, int i,
+                                 enum PshUberSampler *sampler)
+{
+    enum PS_TEXTUREMODES mode = (state->shader_stage_program >> (i * 5)) & 0x1f;
+    bool special_format = state->palette_tex[i] || state->shadow_map[i] ||
+                          state->tex_x8y24[i];
+    bool border = state->border_logical_size[i][0] != 0.0f;
+
+    switch (mode) {
+    case PS_TEXTUREMODES_NONE:
+    case PS_TEXTUREMODES_PASSTHRU:
+    case PS_TEXTUREMODES_CLIPPLANE:
+        *sampler = PSH_UBER_SAMPLER_NONE;
+        return true;
+    case PS_TEXTUREMODES_PROJECT2D:
+        if (special_format || border ||
+            state->yuv_tex[i] != YUV_FORMAT_NONE ||
+            state->conv_tex[i] != CONVOLUTION_FILTER_DISABLED) {
+            return false;
+        }
+        /* fall through */
+    case PS_TEXTUREMODES_PROJECT3D:
+        if (special_format || border) {
+            return false;
+        }
+        if (state->dim_tex[i] == 3) {
+            *sampler = PSH_UBER_SAMPLER_3D;
+        } else if (state->dim_tex[i] == 2 && state->tex_cubemap[i] &&
+                   mode == PS_TEXTUREMODES_PROJECT2D) {
+            *sampler = PSH_UBER_SAMPLER_CUBE;
+        } else if (state->dim_tex[i] == 2) {
+            *sampler = PSH_UBER_SAMPLER_2D;
+        } else {
+            return false;
+        }
+        return *sampler == PSH_UBER_SAMPLER_2D || !state->rect_tex[i];
+    case PS_TEXTUREMODES_CUBEMAP:
+        if (state->palette_tex[i] || state->shadow_map[i] ||
+            state->dim_tex[i] != 2) {
+            return false;
+        }
+        *sampler = state->tex_cubemap[i] ? PSH_UBER_SAMPLER_CUBE :
+                                           PSH_UBER_SAMPLER_2D;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Reduce a state to the key of the ubershader that can draw it, which only
+ * depends on the sampler of each stage. Everything else the ubershader reads
+ * from uniforms. Returns false if the state needs a specialized shader.
+ */
+bool pgraph_glsl_set_psh_ubershader_state(const PshState *state,
+                                          PshState *uber_state)
+{
+    /* Interpolation qualifiers have to match the vertex shader outputs */
+    if (!state->smooth_shading) {
+        return false;
+    }
+
+    unsigned int variant = 0;
+    for (int i = 3; i >= 0; i--) {
+        enum PshUberSampler sampler;
+        if (!get_psh_uber_sampler(state, i, &sampler)) {
+            return false;
+        }
+        variant = variant * PSH_UBER_SAMPLER__COUNT + sampler;
+    }
+
+    pgraph_glsl_init_psh_ubershader_state(uber_state, variant);
+    return true;
+}
+
+void pgraph_glsl_init_psh_ubershader_state(PshState *uber_state,
+                                           unsigned int variant)
+{
+    assert(variant < PSH_UBERSHADER_NUM_VARIANTS);
+
+    memset(uber_state, 0, sizeof(*uber_state));
+    uber_state->uber_combiners = true;
+    uber_state->smooth_shading = true;
+    for (int i = 0; i < 4; i++) {
+        uber_state->uber_samplers[i] = variant % PSH_UBER_SAMPLER__COUNT;
+        variant /= PSH_UBER_SAMPLER__COUNT;
+    }
+}
+
+unsigned int pgraph_glsl_get_psh_ubershader_variant(const PshState *uber_state)
+{
+    assert(uber_state->uber_combiners);
+
+    unsigned int variant = 0;
+    for (int i = 3; i >= 0; i--) {
+        variant = variant * PSH_UBER_SAMPLER__COUNT +
+                  uber_state->uber_samplers[i];
+    }
+    return variant;
+}
+
 struct InputInfo {
     int reg, mod, chan;
 };
@@ -795,6 +926,20 @@ static void apply_convolution_filter(const struct PixelShader *ps, MString *vars
         "}\n", tex, tex, tex, tex, tex_remap, tex);
 }
 
+/* Replace the raw index fetched for an I8 texture by its palette entry */
+static void apply_palette_lookup(struct PixelShader *ps, MString *vars, int tex)
+{
+    if (!ps->state->palette_tex[tex]) {
+        return;
+    }
+
+    mstring_append_fmt(
+        vars,
+        "t%d = texelFetch(palSamp%d, ivec2(min(int(t%d.r * 255.0 + 0.5), "
+        "textureSize(palSamp%d, 0).x - 1), 0), 0);\n",
+        tex, tex, tex, tex);
+}
+
 static void define_colorkey_comparator(MString *preflight)
 {
     // clang-format off
@@ -808,6 +953,372 @@ static void define_colorkey_comparator(MString *preflight)
     // clang-format on
 }
 
+static void define_yuv_sampler(MString *preflight)
+{
+    mstring_append(preflight, GLSL_YUV_SAMPLER);
+}
+
+/*
+ * Register combiner interpreter. Registers are indexed by PS_REGISTER value,
+ * combinerStages holds the input/output words of each stage and combinerFinal
+ * holds COMBINESPECFOG0/1 and COMBINECTL. Mirrors add_stage_code and
+ * add_final_stage_code.
+ */
+static void define_combiner_interpreter(MString *preflight)
+{
+    // clang-format off
+    mstring_append(
+        preflight,
+        "vec4 cRegs[16];\n"
+        "vec4 combinerReg(int reg, int stage) {\n"
+        "    bool fc = stage == 8;\n"
+        "    if (reg == 1) {\n"
+        "        return consts[(fc || (combinerFinal.z & 0x1000) != 0) ? stage * 2 : 0];\n"
+        "    } else if (reg == 2) {\n"
+        "        return consts[(fc || (combinerFinal.z & 0x10000) != 0) ? stage * 2 + 1 : 1];\n"
+        "    }\n"
+        "    return cRegs[reg];\n"
+        "}\n"
+        "vec4 combinerInput(int sel, int stage) {\n"
+        "    vec4 v = combinerReg(sel & 0xf, stage);\n"
+        "    switch (sel & 0xe0) {\n"
+        "    case 0x00: return max(v, 0.0);\n"
+        "    case 0x20: return 1.0 - clamp(v, 0.0, 1.0);\n"
+        "    case 0x40: return 2.0 * max(v, 0.0) - 1.0;\n"
+        "    case 0x60: return -2.0 * max(v, 0.0) + 1.0;\n"
+        "    case 0x80: return max(v, 0.0) - 0.5;\n"
+        "    case 0xa0: return -max(v, 0.0) + 0.5;\n"
+        "    case 0xc0: return v;\n"
+        "    default: return -v;\n"
+        "    }\n"
+        "}\n"
+        "vec3 combinerInputRgb(int sel, int stage) {\n"
+        "    vec4 v = combinerInput(sel, stage);\n"
+        "    return (sel & 0x10) != 0 ? v.aaa : v.rgb;\n"
+        "}\n"
+        "float combinerInputAlpha(int sel, int stage) {\n"
+        "    vec4 v = combinerInput(sel, stage);\n"
+        "    return (sel & 0x10) != 0 ? v.a : v.b;\n"
+        "}\n"
+        /* Output mapping as (bias, scale) */
+        "vec2 combinerMapping(int flags) {\n"
+        "    switch (flags & 0x38) {\n"
+        "    case 0x08: return vec2(-0.5, 1.0);\n"
+        "    case 0x10: return vec2(0.0, 2.0);\n"
+        "    case 0x18: return vec2(-0.5, 2.0);\n"
+        "    case 0x20: return vec2(0.0, 4.0);\n"
+        "    case 0x30: return vec2(0.0, 0.5);\n"
+        "    default: return vec2(0.0, 1.0);\n"
+        "    }\n"
+        "}\n"
+        "void combinerStage(int stage) {\n"
+        "    ivec4 s = combinerStages[stage];\n"
+        "    int rgbFlags = (s.y >> 12) & 0xff;\n"
+        "    int alphaFlags = (s.w >> 12) & 0xff;\n"
+        "    vec3 a = combinerInputRgb((s.x >> 24) & 0xff, stage);\n"
+        "    vec3 b = combinerInputRgb((s.x >> 16) & 0xff, stage);\n"
+        "    vec3 c = combinerInputRgb((s.x >> 8) & 0xff, stage);\n"
+        "    vec3 d = combinerInputRgb(s.x & 0xff, stage);\n"
+        "    float aA = combinerInputAlpha((s.z >> 24) & 0xff, stage);\n"
+        "    float aB = combinerInputAlpha((s.z >> 16) & 0xff, stage);\n"
+        "    float aC = combinerInputAlpha((s.z >> 8) & 0xff, stage);\n"
+        "    float aD = combinerInputAlpha(s.z & 0xff, stage);\n"
+        "    vec4 ab = vec4((rgbFlags & 2) != 0 ? vec3(dot(a, b)) : a * b, aA * aB);\n"
+        "    vec4 cd = vec4((rgbFlags & 1) != 0 ? vec3(dot(c, d)) : c * d, aC * aD);\n"
+        "    bool mux = (combinerFinal.z & 0x100) != 0 ?\n"
+        "        cRegs[12].a >= 0.5 : (uint(cRegs[12].a * 255.0) & 1u) == 1u;\n"
+        "    vec4 muxSum = vec4(\n"
+        "        (rgbFlags & 4) != 0 ? (mux ? cd.rgb : ab.rgb) : ab.rgb + cd.rgb,\n"
+        "        (alphaFlags & 4) != 0 ? (mux ? cd.a : ab.a) : ab.a + cd.a);\n"
+        "    vec2 rgbMap = combinerMapping(rgbFlags);\n"
+        "    vec2 alphaMap = combinerMapping(alphaFlags);\n"
+        "    vec4 bias = vec4(rgbMap.xxx, alphaMap.x);\n"
+        "    vec4 scale = vec4(rgbMap.yyy, alphaMap.y);\n"
+        "    ab = clamp((ab + bias) * scale, -1.0, 1.0);\n"
+        "    cd = clamp((cd + bias) * scale, -1.0, 1.0);\n"
+        "    muxSum = clamp((muxSum + bias) * scale, -1.0, 1.0);\n"
+        "    int dst = (s.y >> 4) & 0xf;\n"
+        "    if (dst != 0) {\n"
+        "        cRegs[dst].rgb = ab.rgb;\n"
+        "        if ((rgbFlags & 0x80) != 0) cRegs[dst].a = ab.b;\n"
+        "    }\n"
+        "    dst = s.y & 0xf;\n"
+        "    if (dst != 0) {\n"
+        "        cRegs[dst].rgb = cd.rgb;\n"
+        "        if ((rgbFlags & 0x40) != 0) cRegs[dst].a = cd.b;\n"
+        "    }\n"
+        "    dst = (s.y >> 8) & 0xf;\n"
+        "    if (dst != 0) cRegs[dst].rgb = muxSum.rgb;\n"
+        "    dst = (s.w >> 4) & 0xf;\n"
+        "    if (dst != 0) cRegs[dst].a = ab.a;\n"
+        "    dst = s.w & 0xf;\n"
+        "    if (dst != 0) cRegs[dst].a = cd.a;\n"
+        "    dst = (s.w >> 8) & 0xf;\n"
+        "    if (dst != 0) cRegs[dst].a = muxSum.a;\n"
+        "}\n"
+        "void combinerFinalStage() {\n"
+        "    int f0 = combinerFinal.x;\n"
+        "    int f1 = combinerFinal.y;\n"
+        "    vec3 sumV1 = (f1 & 0x40) != 0 ? 1.0 - cRegs[5].rgb : cRegs[5].rgb;\n"
+        "    vec3 sumR0 = (f1 & 0x20) != 0 ? 1.0 - cRegs[12].rgb : cRegs[12].rgb;\n"
+        "    vec3 sum = sumV1 + sumR0;\n"
+        "    if ((f1 & 0x80) != 0) sum = clamp(sum, 0.0, 1.0);\n"
+        "    cRegs[14] = vec4(sum, 0.0);\n"
+        "    vec3 e = combinerInputRgb((f1 >> 24) & 0xff, 8);\n"
+        "    vec3 f = combinerInputRgb((f1 >> 16) & 0xff, 8);\n"
+        "    cRegs[15] = vec4(e * f, 0.0);\n"
+        "    vec3 a = combinerInputRgb((f0 >> 24) & 0xff, 8);\n"
+        "    vec3 b = combinerInputRgb((f0 >> 16) & 0xff, 8);\n"
+        "    vec3 c = combinerInputRgb((f0 >> 8) & 0xff, 8);\n"
+        "    vec3 d = combinerInputRgb(f0 & 0xff, 8);\n"
+        "    fragColor.rgb = d + mix(c, b, a);\n"
+        "    fragColor.a = combinerInputAlpha((f1 >> 8) & 0xff, 8);\n"
+        "}\n");
+    // clang-format on
+}
+
+static void add_combiner_interpreter_code(struct PixelShader *ps)
+{
+    mstring_append_fmt(
+        ps->code,
+        "// Combiners\n"
+        "for (int i = 0; i < 16; i++) cRegs[i] = vec4(0.0);\n"
+        "cRegs[3] = pFog;\n"
+        "cRegs[4] = v0;\n"
+        "cRegs[5] = v1;\n"
+        "cRegs[8] = t0;\n"
+        "cRegs[9] = t1;\n"
+        "cRegs[10] = t2;\n"
+        "cRegs[11] = t3;\n"
+        "cRegs[12].a = texMode[0] != %d ? t0.a : 1.0;\n"
+        "int numStages = min(combinerFinal.z & 0xff, 8);\n"
+        "for (int i = 0; i < numStages; i++) {\n"
+        "    combinerStage(i);\n"
+        "}\n"
+        "if (combinerFinal.x != 0 || combinerFinal.y != 0) {\n"
+        "    combinerFinalStage();\n"
+        "}\n",
+        PS_TEXTUREMODES_NONE);
+}
+
+/* Interpolates zvalue, the fragment depth before clipping, for w-buffering */
+static const char *z_perspective_code =
+    "vec2 unscaled_xy = gl_FragCoord.xy / surfaceScale;\n"
+    "precise float bc0 = area(unscaled_xy, vtxPos1.xy, vtxPos2.xy);\n"
+    "precise float bc1 = area(unscaled_xy, vtxPos2.xy, vtxPos0.xy);\n"
+    "precise float bc2 = area(unscaled_xy, vtxPos0.xy, vtxPos1.xy);\n"
+    "bc0 /= vtxPos0.w;\n"
+    "bc1 /= vtxPos1.w;\n"
+    "bc2 /= vtxPos2.w;\n"
+    "float inv_bcsum = 1.0 / (bc0 + bc1 + bc2);\n"
+    // Denominator can be zero in case the rasterized primitive is a
+    // point or a degenerate line or triangle.
+    "if (isinf(inv_bcsum)) {\n"
+    "  inv_bcsum = 0.0;\n"
+    "}\n"
+    "bc1 *= inv_bcsum;\n"
+    "bc2 *= inv_bcsum;\n"
+    "precise float zvalue = vtxPos0.w + (bc1*(vtxPos1.w - vtxPos0.w) + bc2*(vtxPos2.w - vtxPos0.w));\n"
+    // If GPU clipping is inaccurate, the point gl_FragCoord.xy might
+    // be above the horizon of the plane of a rasterized triangle
+    // making the interpolated w-coordinate above zero or negative. We
+    // should prevent such wrapping through infinity by clamping to
+    // infinity.
+    "if (zvalue > 0.0) {\n"
+    "  float zslopeofs = depthFactor*triMZ*zvalue*zvalue;\n"
+    "  zvalue += depthOffset;\n"
+    "  zvalue += zslopeofs;\n"
+    "} else {\n"
+    "  zvalue = uintBitsToFloat(0x7F7FFFFFu);\n"
+    "}\n"
+    "if (isnan(zvalue)) {\n"
+    "  zvalue = uintBitsToFloat(0x7F7FFFFFu);\n"
+    "}\n";
+
+/* Interpolates zvalue for z-buffering */
+static const char *z_linear_code =
+    "vec2 unscaled_xy = gl_FragCoord.xy / surfaceScale;\n"
+    "precise float bc0 = area(unscaled_xy, vtxPos1.xy, vtxPos2.xy);\n"
+    "precise float bc1 = area(unscaled_xy, vtxPos2.xy, vtxPos0.xy);\n"
+    "precise float bc2 = area(unscaled_xy, vtxPos0.xy, vtxPos1.xy);\n"
+    "float inv_bcsum = 1.0 / (bc0 + bc1 + bc2);\n"
+    // Denominator can be zero in case the rasterized primitive is a
+    // point or a degenerate line or triangle.
+    "if (isinf(inv_bcsum)) {\n"
+    "  inv_bcsum = 0.0;\n"
+    "}\n"
+    "bc1 *= inv_bcsum;\n"
+    "bc2 *= inv_bcsum;\n"
+    "precise float zvalue = vtxPos0.z + (bc1*(vtxPos1.z - vtxPos0.z) + bc2*(vtxPos2.z - vtxPos0.z));\n"
+    "zvalue += depthOffset;\n"
+    "zvalue += depthFactor*triMZ;\n";
+
+static void add_clip_code(struct PixelShader *ps, MString *clip)
+{
+    mstring_append_fmt(clip, "/*  Window-clip (%slusive) */\n",
+                       ps->state->window_clip_exclusive ? "Exc" : "Inc");
+    if (!ps->state->window_clip_exclusive) {
+        mstring_append(clip, "bool clipContained = false;\n");
+    }
+    mstring_append(clip, "vec2 coord = gl_FragCoord.xy - 0.5;\n"
+                         "for (int i = 0; i < 8; i++) {\n"
+                         "  bool outside = any(bvec4(\n"
+                         "      lessThan(coord, vec2(clipRegion[i].xy)),\n"
+                         "      greaterThanEqual(coord, vec2(clipRegion[i].zw))));\n"
+                         "  if (!outside) {\n");
+    if (ps->state->window_clip_exclusive) {
+        mstring_append(clip, "    discard;\n");
+    } else {
+        mstring_append(clip, "    clipContained = true;\n"
+                             "    break;\n");
+    }
+    mstring_append(clip, "  }\n"
+                         "}\n");
+    if (!ps->state->window_clip_exclusive) {
+        mstring_append(clip, "if (!clipContained) {\n"
+                             "  discard;\n"
+                             "}\n");
+    }
+
+    mstring_append(clip, ps->state->z_perspective ? z_perspective_code :
+                                                    z_linear_code);
+
+    /* Depth clipping */
+    if (ps->state->depth_clipping) {
+        mstring_append(
+            clip, "if (zvalue < clipRange.z || clipRange.w < zvalue) {\n"
+                  "  discard;\n"
+                  "}\n");
+    } else {
+        mstring_append(
+            clip, "zvalue = clamp(zvalue, clipRange.z, clipRange.w);\n");
+    }
+}
+
+static void define_uber_tex_norm(MString *preflight, int i)
+{
+    // clang-format off
+    mstring_append_fmt(
+        preflight,
+        "vec2 norm%d(vec2 coord) {\n"
+        "    if ((texFlags[%d] & %d) == 0) return coord;\n"
+        "    return coord / (textureSize(texSamp%d, 0) / texScale[%d]);\n"
+        "}\n"
+        "vec3 norm%d(vec3 coord) {\n"
+        "    return vec3(norm%d(coord.xy), coord.z);\n"
+        "}\n"
+        "vec4 norm%d(vec4 coord) {\n"
+        "    if ((texFlags[%d] & %d) == 0) return coord;\n"
+        "    return vec4(norm%d(coord.xy), 0, coord.w);\n"
+        "}\n",
+        i, i, PSH_UBER_TEX_RECT, i, i, i, i, i, i, PSH_UBER_TEX_RECT, i);
+    // clang-format on
+}
+
+/*
+ * Texture stage of the ubershader. The sampler is fixed by the variant, the
+ * texture mode and per-stage options are read from texMode and texFlags.
+ */
+static void add_uber_texture_code(struct PixelShader *ps, int i,
+                                  MString *preflight, MString *vars)
+{
+    enum PshUberSampler sampler = ps->state->uber_samplers[i];
+
+    mstring_append_fmt(vars, "vec4 t%d = vec4(0.0, 0.0, 0.0, 1.0);\n", i);
+
+    switch (sampler) {
+    case PSH_UBER_SAMPLER_NONE:
+        mstring_append_fmt(
+            vars,
+            "if (texMode[%d] == %d) {\n"
+            "  t%d = pT%d;\n"
+            "} else if (texMode[%d] == %d) {\n"
+            "  t%d = vec4(0.0);\n"
+            "  for (int j = 0; j < 4; j++) {\n"
+            "    bool gequal = (texFlags[%d] & (1 << (%d + j))) != 0;\n"
+            "    if (gequal ? pT%d[j] >= 0.0 : pT%d[j] < 0.0) { discard; };\n"
+            "  }\n"
+            "}\n",
+            i, PS_TEXTUREMODES_PASSTHRU, i, i, i, PS_TEXTUREMODES_CLIPPLANE,
+            i, i, PSH_UBER_TEX_CLIP_GEQUAL_SHIFT, i, i);
+        return;
+    case PSH_UBER_SAMPLER_2D:
+        define_uber_tex_norm(preflight, i);
+        mstring_append_fmt(
+            vars,
+            "if (texMode[%d] == %d) {\n"
+            "  t%d = texture(texSamp%d, remapCubeTo2D(pT%d.xyz));\n"
+            "} else if (texMode[%d] == %d) {\n"
+            "  t%d = textureProj(texSamp%d, norm%d(pT%d.xyzw));\n"
+            "} else {\n"
+            "  t%d = textureProj(texSamp%d, norm%d(pT%d.xyw));\n"
+            "}\n",
+            i, PS_TEXTUREMODES_CUBEMAP, i, i, i, i, PS_TEXTUREMODES_PROJECT3D,
+            i, i, i, i, i, i, i, i);
+        break;
+    case PSH_UBER_SAMPLER_3D:
+        mstring_append_fmt(
+            vars,
+            "if (texMode[%d] == %d) {\n"
+            "  t%d = textureProj(texSamp%d, pT%d.xyzw);\n"
+            "} else {\n"
+            "  t%d = textureProj(texSamp%d, vec4(pT%d.xy, 0.0, pT%d.w));\n"
+            "}\n",
+            i, PS_TEXTUREMODES_PROJECT3D, i, i, i, i, i, i, i);
+        break;
+    case PSH_UBER_SAMPLER_CUBE:
+        mstring_append_fmt(
+            vars,
+            "if (texMode[%d] == %d) {\n"
+            "  t%d = texture(texSamp%d, pT%d.xyz);\n"
+            "} else {\n"
+            "  t%d = texture(texSamp%d, remap2DToCube(pT%d.xyw));\n"
+            "}\n",
+            i, PS_TEXTUREMODES_CUBEMAP, i, i, i, i, i, i);
+        break;
+    default:
+        assert(!"Unknown ubershader sampler");
+        return;
+    }
+
+    static const char *sampler_types[] = {
+        [PSH_UBER_SAMPLER_2D] = "sampler2D",
+        [PSH_UBER_SAMPLER_3D] = "sampler3D",
+        [PSH_UBER_SAMPLER_CUBE] = "samplerCube",
+    };
+    if (ps->opts.vulkan) {
+        mstring_append_fmt(preflight, "layout(binding = %d) ",
+                           ps->opts.tex_binding + i);
+    }
+    mstring_append_fmt(preflight, "uniform %s texSamp%d;\n",
+                       sampler_types[sampler], i);
+
+    // clang-format off
+    mstring_append_fmt(
+        vars,
+        "if ((texFlags[%d] & %d) != 0 && t%d.a == 0.0) { discard; };\n"
+        "int colorKeyMode%d = (texFlags[%d] >> %d) & 3;\n"
+        "if (colorKeyMode%d != %d &&\n"
+        "    check_color_key(t%d, colorKey[%d], colorKeyMask[%d])) {\n"
+        "  if (colorKeyMode%d == %d) {\n"
+        "    discard;\n"
+        "  } else if (colorKeyMode%d == %d) {\n"
+        "    t%d.a = 0.0;\n"
+        "  } else {\n"
+        "    t%d = vec4(0.0);\n"
+        "  }\n"
+        "}\n",
+        i, PSH_UBER_TEX_ALPHAKILL, i,
+        i, i, PSH_UBER_TEX_COLORKEY_SHIFT,
+        i, COLOR_KEY_NONE,
+        i, i, i,
+        i, COLOR_KEY_DISCARD,
+        i, COLOR_KEY_KILL_ALPHA,
+        i,
+        i);
+    // clang-format on
+}
+
 static MString* psh_convert(struct PixelShader *ps)
 {
     MString *preflight = mstring_new();
@@ -827,6 +1338,13 @@ static MString* psh_convert(struct PixelShader *ps)
 
     const char *u = ps->opts.vulkan ? "" : "uniform ";
     for (int i = 0; i < ARRAY_SIZE(PshUniformInfo); i++) {
+        if (!ps->state->uber_combiners && (i == PshUniform_combinerFinal ||
+                                           i == PshUniform_combinerStages ||
+                                           i == PshUniform_texFlags ||
+                                           i == PshUniform_texMode ||
+                                           i == PshUniform_uberFlags)) {
+            continue;
+        }
         const UniformInfo *info = &PshUniformInfo[i];
         const char *type_str = uniform_element_type_to_str[info->type];
         if (info->count == 1) {
@@ -976,94 +1494,43 @@ static MString* psh_convert(struct PixelShader *ps)
         );
 
     MString *clip = mstring_new();
-    mstring_append_fmt(clip, "/*  Window-clip (%slusive) */\n",
-                       ps->state->window_clip_exclusive ? "Exc" : "Inc");
-    if (!ps->state->window_clip_exclusive) {
-        mstring_append(clip, "bool clipContained = false;\n");
-    }
-    mstring_append(clip, "vec2 coord = gl_FragCoord.xy - 0.5;\n"
-                         "for (int i = 0; i < 8; i++) {\n"
-                         "  bool outside = any(bvec4(\n"
-                         "      lessThan(coord, vec2(clipRegion[i].xy)),\n"
-                         "      greaterThanEqual(coord, vec2(clipRegion[i].zw))));\n"
-                         "  if (!outside) {\n");
-    if (ps->state->window_clip_exclusive) {
-        mstring_append(clip, "    discard;\n");
-    } else {
-        mstring_append(clip, "    clipContained = true;\n"
-                             "    break;\n");
-    }
-    mstring_append(clip, "  }\n"
-                         "}\n");
-    if (!ps->state->window_clip_exclusive) {
-        mstring_append(clip, "if (!clipContained) {\n"
-                             "  discard;\n"
-                             "}\n");
-    }
+    if (ps->state->uber_combiners) {
+        mstring_append_fmt(
+            preflight,
+            "float zPerspective() {\n%s  return zvalue;\n}\n"
+            "float zLinear() {\n%s  return zvalue;\n}\n",
+            z_perspective_code, z_linear_code);
+        define_colorkey_comparator(preflight);
 
-    if (ps->state->z_perspective) {
-        mstring_append(
+        mstring_append_fmt(
             clip,
-            "vec2 unscaled_xy = gl_FragCoord.xy / surfaceScale;\n"
-            "precise float bc0 = area(unscaled_xy, vtxPos1.xy, vtxPos2.xy);\n"
-            "precise float bc1 = area(unscaled_xy, vtxPos2.xy, vtxPos0.xy);\n"
-            "precise float bc2 = area(unscaled_xy, vtxPos0.xy, vtxPos1.xy);\n"
-            "bc0 /= vtxPos0.w;\n"
-            "bc1 /= vtxPos1.w;\n"
-            "bc2 /= vtxPos2.w;\n"
-            "float inv_bcsum = 1.0 / (bc0 + bc1 + bc2);\n"
-            // Denominator can be zero in case the rasterized primitive is a
-            // point or a degenerate line or triangle.
-            "if (isinf(inv_bcsum)) {\n"
-            "  inv_bcsum = 0.0;\n"
+            "/*  Window-clip */\n"
+            "bool clipContained = false;\n"
+            "vec2 coord = gl_FragCoord.xy - 0.5;\n"
+            "for (int i = 0; i < 8; i++) {\n"
+            "  bool outside = any(bvec4(\n"
+            "      lessThan(coord, vec2(clipRegion[i].xy)),\n"
+            "      greaterThanEqual(coord, vec2(clipRegion[i].zw))));\n"
+            "  if (!outside) {\n"
+            "    clipContained = true;\n"
+            "    break;\n"
+            "  }\n"
             "}\n"
-            "bc1 *= inv_bcsum;\n"
-            "bc2 *= inv_bcsum;\n"
-            "precise float zvalue = vtxPos0.w + (bc1*(vtxPos1.w - vtxPos0.w) + bc2*(vtxPos2.w - vtxPos0.w));\n"
-            // If GPU clipping is inaccurate, the point gl_FragCoord.xy might
-            // be above the horizon of the plane of a rasterized triangle
-            // making the interpolated w-coordinate above zero or negative. We
-            // should prevent such wrapping through infinity by clamping to
-            // infinity.
-            "if (zvalue > 0.0) {\n"
-            "  float zslopeofs = depthFactor*triMZ*zvalue*zvalue;\n"
-            "  zvalue += depthOffset;\n"
-            "  zvalue += zslopeofs;\n"
-            "} else {\n"
-            "  zvalue = uintBitsToFloat(0x7F7FFFFFu);\n"
+            "if (clipContained == ((uberFlags & %d) != 0)) {\n"
+            "  discard;\n"
             "}\n"
-            "if (isnan(zvalue)) {\n"
-            "  zvalue = uintBitsToFloat(0x7F7FFFFFu);\n"
-            "}\n");
+            "precise float zvalue = (uberFlags & %d) != 0 ? zPerspective() : zLinear();\n"
+            "if ((uberFlags & %d) != 0) {\n"
+            "  if (zvalue < clipRange.z || clipRange.w < zvalue) {\n"
+            "    discard;\n"
+            "  }\n"
+            "} else {\n"
+            "  zvalue = clamp(zvalue, clipRange.z, clipRange.w);\n"
+            "}\n",
+            PSH_UBER_WINDOW_CLIP_EXCLUSIVE, PSH_UBER_Z_PERSPECTIVE,
+            PSH_UBER_DEPTH_CLIPPING);
     } else {
-        mstring_append(
-            clip,
-            "vec2 unscaled_xy = gl_FragCoord.xy / surfaceScale;\n"
-            "precise float bc0 = area(unscaled_xy, vtxPos1.xy, vtxPos2.xy);\n"
-            "precise float bc1 = area(unscaled_xy, vtxPos2.xy, vtxPos0.xy);\n"
-            "precise float bc2 = area(unscaled_xy, vtxPos0.xy, vtxPos1.xy);\n"
-            "float inv_bcsum = 1.0 / (bc0 + bc1 + bc2);\n"
-            // Denominator can be zero in case the rasterized primitive is a
-            // point or a degenerate line or triangle.
-            "if (isinf(inv_bcsum)) {\n"
-            "  inv_bcsum = 0.0;\n"
-            "}\n"
-            "bc1 *= inv_bcsum;\n"
-            "bc2 *= inv_bcsum;\n"
-            "precise float zvalue = vtxPos0.z + (bc1*(vtxPos1.z - vtxPos0.z) + bc2*(vtxPos2.z - vtxPos0.z));\n"
-            "zvalue += depthOffset;\n"
-            "zvalue += depthFactor*triMZ;\n");
-    }
-
-    /* Depth clipping */
-    if (ps->state->depth_clipping) {
-        mstring_append(
-            clip, "if (zvalue < clipRange.z || clipRange.w < zvalue) {\n"
-                  "  discard;\n"
-                  "}\n");
-    } else {
-        mstring_append(
-            clip, "zvalue = clamp(zvalue, clipRange.z, clipRange.w);\n");
+        add_clip_code(ps, clip);
     }
 
     MString *vars = mstring_new();
@@ -1075,7 +1542,12 @@ static MString* psh_convert(struct PixelShader *ps)
     mstring_append(vars, "vec4 pT0 = vtxT0;\n");
     mstring_append(vars, "vec4 pT1 = vtxT1;\n");
     mstring_append(vars, "vec4 pT2 = vtxT2;\n");
-    if (ps->state->point_sprite) {
+    if (ps->state->uber_combiners) {
+        mstring_append_fmt(vars,
+                           "vec4 pT3 = (uberFlags & %d) != 0 ? "
+                           "vec4(gl_PointCoord, 1.0, 1.0) : vtxT3;\n",
+                           PSH_UBER_POINT_SPRITE);
+    } else if (ps->state->point_sprite) {
         assert(!ps->state->rect_tex[3]);
         mstring_append(vars, "vec4 pT3 = vec4(gl_PointCoord, 1.0, 1.0);\n");
     } else {
@@ -1091,8 +1563,13 @@ static MString* psh_convert(struct PixelShader *ps)
     ps->code = mstring_new();
 
     bool color_key_comparator_defined = false;
+    bool yuv_sampler_defined = false;
 
     for (int i = 0; i < 4; i++) {
+        if (ps->state->uber_combiners) {
+            add_uber_texture_code(ps, i, preflight, vars);
+            continue;
+        }
 
         const char *sampler_type = get_sampler_type(ps, ps->tex_modes[i], i);
 
@@ -1125,6 +1602,18 @@ static MString* psh_convert(struct PixelShader *ps)
                                 vars,
                                 "vec4 t%d = texture(texSamp%d, remap2DToCube(%s(pT%d.xyw)));\n",
                                 i, i, tex_remap, i);
+                        } else if (ps->state->yuv_tex[i] != YUV_FORMAT_NONE) {
+                            if (!yuv_sampler_defined) {
+                                define_yuv_sampler(preflight);
+                                yuv_sampler_defined = true;
+                            }
+                            mstring_append_fmt(
+                                vars,
+                                "vec4 t%d = textureYuv(texSamp%d, pT%d.xy / pT%d.w, %s, %s);\n",
+                                i, i, i, i,
+                                ps->state->yuv_tex[i] == YUV_FORMAT_UYVY ?
+                                    "true" : "false",
+                                ps->state->yuv_tex_linear[i] ? "true" : "false");
                         } else {
                             mstring_append_fmt(
                                 vars,
@@ -1234,6 +1723,7 @@ static MString* psh_convert(struct PixelShader *ps)
                 assert(!"Unhandled texture dimensions");
             }
 
+            apply_palette_lookup(ps, vars, i);
             mstring_append_fmt(vars, "t%d = t%d * (bumpScale[%d] * dsdtl%d.p + bumpOffset[%d]);\n",
                 i, i, i, i, i);
             break;
@@ -1374,6 +1864,17 @@ static MString* psh_convert(struct PixelShader *ps)
             }
             mstring_append_fmt(preflight, "uniform %s texSamp%d;\n", sampler_type, i);
 
+            if (ps->state->palette_tex[i]) {
+                if (ps->opts.vulkan) {
+                    mstring_append_fmt(preflight, "layout(binding = %d) ",
+                                       ps->opts.palette_binding + i);
+                }
+                mstring_append_fmt(preflight, "uniform sampler2D palSamp%d;\n", i);
+                if (ps->tex_modes[i] != PS_TEXTUREMODES_BUMPENVMAP_LUM) {
+                    apply_palette_lookup(ps, vars, i);
+                }
+            }
+
             /* As this means a texture fetch does happen, do alphakill */
             if (ps->state->alphakill[i]) {
                 mstring_append_fmt(vars, "if (t%d.a == 0.0) { discard; };\n",
@@ -1435,6 +1936,11 @@ static MString* psh_convert(struct PixelShader *ps)
         }
     }
 
+    if (ps->state->uber_combiners) {
+        define_combiner_interpreter(preflight);
+        add_combiner_interpreter_code(ps);
+    }
+
     for (int i = 0; i < ps->num_stages; i++) {
         ps->cur_stage = i;
         mstring_append_fmt(ps->code, "// Stage %d\n", i);
@@ -1453,7 +1959,29 @@ static MString* psh_convert(struct PixelShader *ps)
         add_final_stage_code(ps, ps->final_input);
     }
 
-    if (ps->state->alpha_test && ps->state->alpha_func != ALPHA_FUNC_ALWAYS) {
+    if (ps->state->uber_combiners) {
+        // clang-format off
+        mstring_append_fmt(
+            ps->code,
+            "int fragAlpha = int(round(fragColor.a * 255.0));\n"
+            "bool alphaPass;\n"
+            "switch ((uberFlags >> %d) & 7) {\n"
+            "case %d: alphaPass = false; break;\n"
+            "case %d: alphaPass = fragAlpha < alphaRef; break;\n"
+            "case %d: alphaPass = fragAlpha == alphaRef; break;\n"
+            "case %d: alphaPass = fragAlpha <= alphaRef; break;\n"
+            "case %d: alphaPass = fragAlpha > alphaRef; break;\n"
+            "case %d: alphaPass = fragAlpha != alphaRef; break;\n"
+            "case %d: alphaPass = fragAlpha >= alphaRef; break;\n"
+            "default: alphaPass = true; break;\n"
+            "}\n"
+            "if (!alphaPass) discard;\n",
+            PSH_UBER_ALPHA_FUNC_SHIFT, ALPHA_FUNC_NEVER, ALPHA_FUNC_LESS,
+            ALPHA_FUNC_EQUAL, ALPHA_FUNC_LEQUAL, ALPHA_FUNC_GREATER,
+            ALPHA_FUNC_NOTEQUAL, ALPHA_FUNC_GEQUAL);
+        // clang-format on
+    } else if (ps->state->alpha_test &&
+               ps->state->alpha_func != ALPHA_FUNC_ALWAYS) {
         if (ps->state->alpha_func == ALPHA_FUNC_NEVER) {
             mstring_append(ps->code, "discard;\n");
         } else {
@@ -1498,23 +2026,40 @@ static MString* psh_convert(struct PixelShader *ps)
      * due to rounding.)
      */
 
-    switch (ps->state->depth_format) {
-    case DEPTH_FORMAT_D16:
-        // 16-bit unsigned int
-        mstring_append(
-            ps->code,
-            "gl_FragDepth = floor(zvalue) / 65535.0;\n");
-        break;
-    case DEPTH_FORMAT_D24:
-        // 24-bit unsigned int
-        mstring_append(
+    if (ps->state->uber_combiners) {
+        mstring_append_fmt(
             ps->code,
-            "gl_FragDepth = uintBitsToFloat(floatBitsToUint(floor(zvalue) / 16777216.0) + 1u);\n");
-        break;
-    default:
-        // TODO: handle floating-point depth buffers properly
-        mstring_append(ps->code, "gl_FragDepth = zvalue / clipRange.y;\n");
-        break;
+            "switch ((uberFlags >> %d) & 3) {\n"
+            "case %d:\n"
+            "  gl_FragDepth = floor(zvalue) / 65535.0;\n"
+            "  break;\n"
+            "case %d:\n"
+            "  gl_FragDepth = uintBitsToFloat(floatBitsToUint(floor(zvalue) / 16777216.0) + 1u);\n"
+            "  break;\n"
+            "default:\n"
+            "  gl_FragDepth = zvalue / clipRange.y;\n"
+            "  break;\n"
+            "}\n",
+            PSH_UBER_DEPTH_FORMAT_SHIFT, DEPTH_FORMAT_D16, DEPTH_FORMAT_D24);
+    } else {
+        switch (ps->state->depth_format) {
+        case DEPTH_FORMAT_D16:
+            // 16-bit unsigned int
+            mstring_append(
+                ps->code,
+                "gl_FragDepth = floor(zvalue) / 65535.0;\n");
+            break;
+        case DEPTH_FORMAT_D24:
+            // 24-bit unsigned int
+            mstring_append(
+                ps->code,
+                "gl_FragDepth = uintBitsToFloat(floatBitsToUint(floor(zvalue) / 16777216.0) + 1u);\n");
+            break;
+        default:
+            // TODO: handle floating-point depth buffers properly
+            mstring_append(ps->code, "gl_FragDepth = zvalue / clipRange.y;\n");
+            break;
+        }
     }
 
     MString *final = mstring_new();
@@ -1644,6 +2189,26 @@ void pgraph_glsl_set_psh_uniform_values(PGRAPHState *pg,
             }
         }
     }
+    if (locs[PshUniform_combinerStages] != -1) {
+        for (int i = 0; i < 8; i++) {
+            values->combinerStages[i][0] =
+                pgraph_reg_r(pg, NV_PGRAPH_COMBINECOLORI0 + i * 4);
+            values->combinerStages[i][1] =
+                pgraph_reg_r(pg, NV_PGRAPH_COMBINECOLORO0 + i * 4);
+            values->combinerStages[i][2] =
+                pgraph_reg_r(pg, NV_PGRAPH_COMBINEALPHAI0 + i * 4);
+            values->combinerStages[i][3] =
+                pgraph_reg_r(pg, NV_PGRAPH_COMBINEALPHAO0 + i * 4);
+        }
+    }
+    if (locs[PshUniform_combinerFinal] != -1) {
+        values->combinerFinal[0][0] =
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINESPECFOG0);
+        values->combinerFinal[0][1] =
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINESPECFOG1);
+        values->combinerFinal[0][2] = pgraph_reg_r(pg, NV_PGRAPH_COMBINECTL);
+        values->combinerFinal[0][3] = 0;
+    }
     if (locs[PshUniform_alphaRef] != -1) {
         int alpha_ref = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0),
                                  NV_PGRAPH_CONTROL_0_ALPHAREF);
@@ -1789,3 +2354,43 @@ void pgraph_glsl_set_psh_uniform_values(PGRAPHState *pg,
         values->clipRegion[i][3] = y_max;
     }
 }
+
+/*
+ * Set the uniforms an ubershader reads in place of the state it was reduced
+ * from. The state is the full one of the draw, not the reduced key.
+ */
+void pgraph_glsl_set_psh_ubershader_uniform_values(const PshState *state,
+                                                   const PshUniformLocs locs,
+                                                   PshUniformValues *values)
+{
+    for (int i = 0; i < 4; i++) {
+        if (locs[PshUniform_texMode] != -1) {
+            values->texMode[i] = (state->shader_stage_program >> (i * 5)) & 0x1f;
+        }
+        if (locs[PshUniform_texFlags] != -1) {
+            int flags = (state->rect_tex[i] ? PSH_UBER_TEX_RECT : 0) |
+                        (state->alphakill[i] ? PSH_UBER_TEX_ALPHAKILL : 0) |
+                        (state->colorkey_mode[i]
+                         << PSH_UBER_TEX_COLORKEY_SHIFT);
+            for (int j = 0; j < 4; j++) {
+                if (state->compare_mode[i][j]) {
+                    flags |= 1 << (PSH_UBER_TEX_CLIP_GEQUAL_SHIFT + j);
+                }
+            }
+            values->texFlags[i] = flags;
+        }
+    }
+
+    if (locs[PshUniform_uberFlags] != -1) {
+        enum PshAlphaFunc alpha_func =
+            state->alpha_test ? state->alpha_func : ALPHA_FUNC_ALWAYS;
+        values->uberFlags[0] =
+            (state->window_clip_exclusive ? PSH_UBER_WINDOW_CLIP_EXCLUSIVE :
+                                            0) |
+            (state->depth_clipping ? PSH_UBER_DEPTH_CLIPPING : 0) |
+            (state->z_perspective ? PSH_UBER_Z_PERSPECTIVE : 0) |
+            (state->point_sprite ? PSH_UBER_POINT_SPRITE : 0) |
+            (alpha_func << PSH_UBER_ALPHA_FUNC_SHIFT) |
+            (state->depth_format << PSH_UBER_DEPTH_FORMAT_SHIFT);
+    }
+}
@@ -34,7 +34,35 @@ enum PshDepthFormat {
     DEPTH_FORMAT_F16,
 };
 
+enum PshYuvFormat {
+    YUV_FORMAT_NONE,
+    YUV_FORMAT_YUY2,
+    YUV_FORMAT_UYVY,
+};
+
+/* Sampler the ubershader declares for a texture stage */
+enum PshUberSampler {
+    PSH_UBER_SAMPLER_NONE,
+    PSH_UBER_SAMPLER_2D,
+    PSH_UBER_SAMPLER_3D,
+    PSH_UBER_SAMPLER_CUBE,
+    PSH_UBER_SAMPLER__COUNT,
+};
+
+/* One ubershader per combination of stage samplers */
+#define PSH_UBERSHADER_NUM_VARIANTS \
+    (PSH_UBER_SAMPLER__COUNT * PSH_UBER_SAMPLER__COUNT * \
+     PSH_UBER_SAMPLER__COUNT * PSH_UBER_SAMPLER__COUNT)
+
 typedef struct PshState {
+    /*
+     * Read the register combiners and the rest of the fixed function state
+     * from uniforms instead of specializing. Only uber_samplers and
+     * smooth_shading are set in such a state.
+     */
+    bool uber_combiners;
+    enum PshUberSampler uber_samplers[4];
+
     uint32_t combiner_control;
     uint32_t shader_stage_program;
     uint32_t other_stage_input;
@@ -54,6 +82,9 @@ typedef struct PshState {
     bool tex_x8y24[4];
     int dim_tex[4];
     bool tex_cubemap[4];
+    bool palette_tex[4];
+    enum PshYuvFormat yuv_tex[4];
+    bool yuv_tex_linear[4];
 
     float border_logical_size[4][3];
     float border_inv_real_size[4][3];
@@ -75,22 +106,32 @@ typedef struct PshState {
 } PshState;
 
 void pgraph_glsl_set_psh_state(PGRAPHState *pg, PshState *state);
-
-#define PSH_UNIFORM_DECL_X(S, DECL) \
-    DECL(S, alphaRef, int, 1)       \
-    DECL(S, bumpMat, mat2, 4)       \
-    DECL(S, bumpOffset, float, 4)   \
-    DECL(S, bumpScale, float, 4)    \
-    DECL(S, clipRange, vec4, 1)     \
-    DECL(S, clipRegion, ivec4, 8)   \
-    DECL(S, colorKey, uint, 4)      \
-    DECL(S, colorKeyMask, uint, 4)  \
-    DECL(S, consts, vec4, 18)       \
-    DECL(S, depthFactor, float, 1)  \
-    DECL(S, depthOffset, float, 1)  \
-    DECL(S, fogColor, vec4, 1)      \
-    DECL(S, surfaceScale, ivec2, 1) \
-    DECL(S, texScale, float, 4)
+bool pgraph_glsl_set_psh_ubershader_state(const PshState *state,
+                                          PshState *uber_state);
+void pgraph_glsl_init_psh_ubershader_state(PshState *uber_state,
+                                           unsigned int variant);
+unsigned int pgraph_glsl_get_psh_ubershader_variant(const PshState *uber_state);
+
+#define PSH_UNIFORM_DECL_X(S, DECL)   \
+    DECL(S, alphaRef, int, 1)         \
+    DECL(S, bumpMat, mat2, 4)         \
+    DECL(S, bumpOffset, float, 4)     \
+    DECL(S, bumpScale, float, 4)      \
+    DECL(S, clipRange, vec4, 1)       \
+    DECL(S, clipRegion, ivec4, 8)     \
+    DECL(S, colorKey, uint, 4)        \
+    DECL(S, colorKeyMask, uint, 4)    \
+    DECL(S, combinerFinal, ivec4, 1)  \
+    DECL(S, combinerStages, ivec4, 8) \
+    DECL(S, consts, vec4, 18)         \
+    DECL(S, depthFactor, float, 1)    \
+    DECL(S, depthOffset, float, 1)    \
+    DECL(S, fogColor, vec4, 1)        \
+    DECL(S, surfaceScale, ivec2, 1)   \
+    DECL(S, texFlags, int, 4)         \
+    DECL(S, texMode, int, 4)          \
+    DECL(S, texScale, float, 4)       \
+    DECL(S, uberFlags, int, 1)
 
 DECL_UNIFORM_TYPES(PshUniform, PSH_UNIFORM_DECL_X)
 
@@ -98,6 +139,7 @@ typedef struct GenPshGlslOptions {
     bool vulkan;
     int ubo_binding;
     int tex_binding;
+    int palette_binding;
 } GenPshGlslOptions;
 
 MString *pgraph_glsl_gen_psh(const PshState *state, GenPshGlslOptions opts);
@@ -105,5 +147,8 @@ MString *pgraph_glsl_gen_psh(const PshState *state, GenPshGlslOptions opts);
 void pgraph_glsl_set_psh_uniform_values(PGRAPHState *pg,
                                         const PshUniformLocs locs,
                                         PshUniformValues *values);
+void pgraph_glsl_set_psh_ubershader_uniform_values(const PshState *state,
+                                                  const PshUniformLocs locs,
+                                                  PshUniformValues *values);
 
 #endif
@@ -17,79 +17,155 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "qemu/fast-hash.h"
 #include "hw/xbox/nv2a/pgraph/pgraph.h"
 #include "shaders.h"
 
-ShaderState pgraph_glsl_get_shader_state(PGRAPHState *pg)
-{
-    pg->program_data_dirty = false; /* fixme */
+static const unsigned int vsh_regs[SHADER_STATE_VSH_REGS] = {
+    NV_PGRAPH_CONTROL_0, NV_PGRAPH_CONTROL_3, NV_PGRAPH_CSV0_C,
+    NV_PGRAPH_CSV0_D,    NV_PGRAPH_CSV1_A,    NV_PGRAPH_CSV1_B,
+    NV_PGRAPH_POINTSIZE,
+};
+
+static const unsigned int geom_regs[SHADER_STATE_GEOM_REGS] = {
+    NV_PGRAPH_CONTROL_0,
+    NV_PGRAPH_CONTROL_3,
+    NV_PGRAPH_SETUPRASTER,
+};
+
+#define COMBINER_STAGE_REGS(i)                                     \
+    NV_PGRAPH_COMBINEALPHAI0 + (i) * 4, NV_PGRAPH_COMBINEALPHAO0 + (i) * 4, \
+    NV_PGRAPH_COMBINECOLORI0 + (i) * 4, NV_PGRAPH_COMBINECOLORO0 + (i) * 4
+#define TEXTURE_STAGE_REGS(i)                                 \
+    NV_PGRAPH_TEXADDRESS0 + (i) * 4, NV_PGRAPH_TEXCTL0_0 + (i) * 4, \
+    NV_PGRAPH_TEXFILTER0 + (i) * 4, NV_PGRAPH_TEXFMT0 + (i) * 4
 
-    ShaderState state;
+static const unsigned int psh_regs[SHADER_STATE_PSH_REGS] = {
+    NV_PGRAPH_COMBINECTL,      NV_PGRAPH_COMBINESPECFOG0,
+    NV_PGRAPH_COMBINESPECFOG1, NV_PGRAPH_CONTROL_0,
+    NV_PGRAPH_CONTROL_3,       NV_PGRAPH_SETUPRASTER,
+    NV_PGRAPH_SHADERCLIPMODE,  NV_PGRAPH_SHADERCTL,
+    NV_PGRAPH_SHADERPROG,      NV_PGRAPH_SHADOWCTL,
+    NV_PGRAPH_ZCOMPRESSOCCLUDE,
+    COMBINER_STAGE_REGS(0),    COMBINER_STAGE_REGS(1),
+    COMBINER_STAGE_REGS(2),    COMBINER_STAGE_REGS(3),
+    COMBINER_STAGE_REGS(4),    COMBINER_STAGE_REGS(5),
+    COMBINER_STAGE_REGS(6),    COMBINER_STAGE_REGS(7),
+    TEXTURE_STAGE_REGS(0),     TEXTURE_STAGE_REGS(1),
+    TEXTURE_STAGE_REGS(2),     TEXTURE_STAGE_REGS(3),
+};
 
-    // We will hash it, so make sure any padding is zeroed
-    memset(&state, 0, sizeof(ShaderState));
+/*
+ * Registers are compared against their values at the last update rather than
+ * through regs_dirty, which not every renderer clears between draws.
+ */
+static bool update_reg_values(PGRAPHState *pg, const unsigned int *regs,
+                              uint32_t *values, size_t count)
+{
+    bool changed = false;
 
-    pgraph_glsl_set_vsh_state(pg, &state.vsh);
-    pgraph_glsl_set_geom_state(pg, &state.geom);
-    pgraph_glsl_set_psh_state(pg, &state.psh);
+    for (int i = 0; i < count; i++) {
+        uint32_t v = pgraph_reg_r(pg, regs[i]);
+        changed |= v != values[i];
+        values[i] = v;
+    }
 
-    return state;
+    return changed;
 }
 
-bool pgraph_glsl_check_shader_state_dirty(PGRAPHState *pg,
-                                          const ShaderState *state)
+static bool update_vsh_inputs(PGRAPHState *pg, ShaderStateVshInputs *inputs)
 {
-    if (pg->program_data_dirty) {
-        return true;
-    }
+    ShaderStateVshInputs cur;
+
+    memset(&cur, 0, sizeof(cur));
+    cur.surface_scale_factor = pg->surface_scale_factor;
+    cur.compressed_attrs = pg->compressed_attrs;
+    cur.uniform_attrs = pg->uniform_attrs;
+    cur.swizzle_attrs = pg->swizzle_attrs;
+    memcpy(cur.texture_matrix_enable, pg->texture_matrix_enable,
+           sizeof(cur.texture_matrix_enable));
+    cur.specular_power = pg->specular_power;
+    cur.specular_power_back = pg->specular_power_back;
+    memcpy(cur.point_params, pg->point_params, sizeof(cur.point_params));
 
-    unsigned int regs[] = {
-        NV_PGRAPH_COMBINECTL,      NV_PGRAPH_COMBINESPECFOG0,
-        NV_PGRAPH_COMBINESPECFOG1, NV_PGRAPH_CONTROL_0,
-        NV_PGRAPH_CONTROL_3,       NV_PGRAPH_CSV0_C,
-        NV_PGRAPH_CSV0_D,          NV_PGRAPH_CSV1_A,
-        NV_PGRAPH_CSV1_B,          NV_PGRAPH_POINTSIZE,
-        NV_PGRAPH_SETUPRASTER,     NV_PGRAPH_SHADERCLIPMODE,
-        NV_PGRAPH_SHADERCTL,       NV_PGRAPH_SHADERPROG,
-        NV_PGRAPH_SHADOWCTL,       NV_PGRAPH_ZCOMPRESSOCCLUDE,
-    };
-    for (int i = 0; i < ARRAY_SIZE(regs); i++) {
-        if (pgraph_is_reg_dirty(pg, regs[i])) {
-            return true;
-        }
+    if (!memcmp(&cur, inputs, sizeof(cur))) {
+        return false;
     }
+    *inputs = cur;
+    return true;
+}
 
-    int num_stages = pgraph_reg_r(pg, NV_PGRAPH_COMBINECTL) & 0xFF;
-    for (int i = 0; i < num_stages; i++) {
-        if (pgraph_is_reg_dirty(pg, NV_PGRAPH_COMBINEALPHAI0 + i * 4) ||
-            pgraph_is_reg_dirty(pg, NV_PGRAPH_COMBINEALPHAO0 + i * 4) ||
-            pgraph_is_reg_dirty(pg, NV_PGRAPH_COMBINECOLORI0 + i * 4) ||
-            pgraph_is_reg_dirty(pg, NV_PGRAPH_COMBINECOLORO0 + i * 4)) {
-            return true;
-        }
+/* Store a rebuilt stage state and its hash if it differs from the last one */
+static bool commit_stage_state(ShaderStateTracker *t, int stage, bool force,
+                               void *state, const void *new_state,
+                               size_t size)
+{
+    if (!force && !memcmp(state, new_state, size)) {
+        return false;
     }
 
-    if (pg->uniform_attrs != state->vsh.uniform_attrs ||
-        pg->swizzle_attrs != state->vsh.swizzle_attrs ||
-        pg->compressed_attrs != state->vsh.compressed_attrs ||
-        pg->primitive_mode != state->geom.primitive_mode ||
-        pg->surface_scale_factor != state->vsh.surface_scale_factor ||
-        pg->surface_shape.zeta_format != state->psh.surface_zeta_format) {
-        return true;
+    memcpy(state, new_state, size);
+    t->stage_hashes[stage] = fast_hash(new_state, size);
+    return true;
+}
+
+void pgraph_glsl_reset_shader_state_tracker(ShaderStateTracker *t)
+{
+    memset(t, 0, sizeof(*t));
+}
+
+bool pgraph_glsl_update_shader_state(PGRAPHState *pg, ShaderStateTracker *t)
+{
+    bool rebuild_all = !t->valid;
+    bool vsh_dirty = rebuild_all;
+    bool geom_dirty = rebuild_all;
+    bool psh_dirty = rebuild_all;
+
+    vsh_dirty |= pg->program_data_dirty;
+    pg->program_data_dirty = false;
+    vsh_dirty |= update_reg_values(pg, vsh_regs, t->vsh_regs,
+                                   ARRAY_SIZE(vsh_regs));
+    vsh_dirty |= update_vsh_inputs(pg, &t->vsh_inputs);
+
+    geom_dirty |= update_reg_values(pg, geom_regs, t->geom_regs,
+                                    ARRAY_SIZE(geom_regs));
+    geom_dirty |= pg->primitive_mode != t->primitive_mode;
+    t->primitive_mode = pg->primitive_mode;
+
+    psh_dirty |= update_reg_values(pg, psh_regs, t->psh_regs,
+                                   ARRAY_SIZE(psh_regs));
+    psh_dirty |= pg->surface_shape.zeta_format != t->surface_zeta_format;
+    t->surface_zeta_format = pg->surface_shape.zeta_format;
+
+    /* Stage states are hashed, so make sure any padding is zeroed */
+    bool changed = rebuild_all;
+    if (vsh_dirty) {
+        VshState vsh;
+        memset(&vsh, 0, sizeof(vsh));
+        pgraph_glsl_set_vsh_state(pg, &vsh);
+        changed |= commit_stage_state(t, 0, rebuild_all, &t->state.vsh, &vsh,
+                                      sizeof(vsh));
+    }
+    if (geom_dirty) {
+        GeomState geom;
+        memset(&geom, 0, sizeof(geom));
+        pgraph_glsl_set_geom_state(pg, &geom);
+        changed |= commit_stage_state(t, 1, rebuild_all, &t->state.geom,
+                                      &geom, sizeof(geom));
+    }
+    if (psh_dirty) {
+        PshState psh;
+        memset(&psh, 0, sizeof(psh));
+        pgraph_glsl_set_psh_state(pg, &psh);
+        changed |= commit_stage_state(t, 2, rebuild_all, &t->state.psh, &psh,
+                                      sizeof(psh));
     }
 
-    for (int i = 0; i < 4; i++) {
-        if (pgraph_is_reg_dirty(pg, NV_PGRAPH_TEXCTL0_0 + i * 4) ||
-            pgraph_is_reg_dirty(pg, NV_PGRAPH_TEXFILTER0 + i * 4) ||
-            pgraph_is_reg_dirty(pg, NV_PGRAPH_TEXFMT0 + i * 4)) {
-            return true;
-        }
-
-        if (pg->texture_matrix_enable[i] !=
-            state->vsh.fixed_function.texture_matrix_enable[i]) {
-            return true;
-        }
+    if (changed) {
+        t->hash = fast_hash((const uint8_t *)t->stage_hashes,
+                            sizeof(t->stage_hashes));
     }
+    t->valid = true;
 
-    return false;
+    return changed;
 }
@@ -32,9 +32,43 @@ typedef struct ShaderState {
 
 typedef struct PGRAPHState PGRAPHState;
 
-ShaderState pgraph_glsl_get_shader_state(PGRAPHState *pg);
+#define SHADER_STATE_VSH_REGS 7
+#define SHADER_STATE_GEOM_REGS 3
+#define SHADER_STATE_PSH_REGS (11 + 4 * 8 + 4 * 4)
 
-bool pgraph_glsl_check_shader_state_dirty(PGRAPHState *pg,
-                                          const ShaderState *state);
+/* Inputs of the vertex shader state that do not live in registers */
+typedef struct ShaderStateVshInputs {
+    unsigned int surface_scale_factor;
+    uint16_t compressed_attrs;
+    uint16_t uniform_attrs;
+    uint16_t swizzle_attrs;
+    bool texture_matrix_enable[4];
+    float specular_power;
+    float specular_power_back;
+    float point_params[8];
+} ShaderStateVshInputs;
+
+/*
+ * The shader state of the last draw. Each stage is rebuilt only when one of
+ * its inputs changed, and the state hash is combined from per-stage hashes.
+ */
+typedef struct ShaderStateTracker {
+    ShaderState state;
+    uint64_t hash;
+    uint64_t stage_hashes[3];
+    bool valid;
+
+    uint32_t vsh_regs[SHADER_STATE_VSH_REGS];
+    uint32_t geom_regs[SHADER_STATE_GEOM_REGS];
+    uint32_t psh_regs[SHADER_STATE_PSH_REGS];
+    ShaderStateVshInputs vsh_inputs;
+    unsigned int primitive_mode;
+    unsigned int surface_zeta_format;
+} ShaderStateTracker;
+
+void pgraph_glsl_reset_shader_state_tracker(ShaderStateTracker *t);
+
+/* Returns true if the tracked state differs from the previous call */
+bool pgraph_glsl_update_shader_state(PGRAPHState *pg, ShaderStateTracker *t);
 
 #endif
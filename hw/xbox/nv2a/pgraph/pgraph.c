@@ -24,6 +24,7 @@
 #include "hw/xbox/nv2a/nv2a_int.h"
 #include "ui/xemu-notifications.h"
 #include "ui/xemu-settings.h"
+#include "qemu/fast-hash.h"
 #include "util.h"
 #include "swizzle.h"
 #include "nv2a_vsh_emulator.h"
@@ -90,6 +91,10 @@ void pgraph_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
     qemu_mutex_lock(&d->pfifo.lock); // FIXME: Factor out fifo lock here
     qemu_mutex_lock(&pg->lock);
 
+    if (unlikely(d->capture.file)) {
+        nv2a_capture_pgraph_write(d, addr, val);
+    }
+
     switch (addr) {
     case NV_PGRAPH_INTR:
         pg->pending_interrupts &= ~val;
@@ -207,6 +212,111 @@ void pgraph_context_switch(NV2AState *d, unsigned int channel_id)
     }
 }
 
+#define VSH_PROGRAM_CACHE_SIZE 64
+
+struct VshProgramLruNode {
+    LruNode node;
+    unsigned int length; /* In tokens, up to and including the final one */
+    uint32_t tokens[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE];
+    Nv2aVshProgram program;
+};
+
+typedef struct VshProgramKey {
+    const uint32_t (*tokens)[VSH_TOKEN_SIZE];
+    unsigned int length;
+} VshProgramKey;
+
+static void vsh_program_cache_entry_init(Lru *lru, LruNode *node,
+                                         const void *key)
+{
+    VshProgramLruNode *entry = container_of(node, VshProgramLruNode, node);
+    const VshProgramKey *k = key;
+
+    entry->length = k->length;
+    memcpy(entry->tokens, k->tokens, k->length * sizeof(entry->tokens[0]));
+
+    Nv2aVshParseResult result = nv2a_vsh_parse_program(
+        &entry->program, entry->tokens[0], entry->length);
+    assert(result == NV2AVPR_SUCCESS);
+}
+
+static bool vsh_program_cache_entry_compare(Lru *lru, LruNode *node,
+                                            const void *key)
+{
+    VshProgramLruNode *entry = container_of(node, VshProgramLruNode, node);
+    const VshProgramKey *k = key;
+
+    return entry->length != k->length ||
+           memcmp(entry->tokens, k->tokens,
+                  k->length * sizeof(entry->tokens[0]));
+}
+
+static void vsh_program_cache_entry_post_evict(Lru *lru, LruNode *node)
+{
+    VshProgramLruNode *entry = container_of(node, VshProgramLruNode, node);
+    PGRAPHState *pg = container_of(lru, PGRAPHState, vsh_program_cache);
+
+    if (pg->launch_program == entry) {
+        pg->launch_program = NULL;
+    }
+    nv2a_vsh_program_destroy(&entry->program);
+}
+
+static void vsh_program_cache_init(PGRAPHState *pg)
+{
+    lru_init(&pg->vsh_program_cache);
+    pg->vsh_program_cache_entries =
+        g_malloc_n(VSH_PROGRAM_CACHE_SIZE, sizeof(VshProgramLruNode));
+    for (int i = 0; i < VSH_PROGRAM_CACHE_SIZE; i++) {
+        lru_add_free(&pg->vsh_program_cache,
+                     &pg->vsh_program_cache_entries[i].node);
+    }
+    pg->vsh_program_cache.init_node = vsh_program_cache_entry_init;
+    pg->vsh_program_cache.compare_nodes = vsh_program_cache_entry_compare;
+    pg->vsh_program_cache.post_node_evict = vsh_program_cache_entry_post_evict;
+    pg->launch_program = NULL;
+}
+
+static void vsh_program_cache_finalize(PGRAPHState *pg)
+{
+    lru_flush(&pg->vsh_program_cache);
+    lru_destroy(&pg->vsh_program_cache);
+    g_free(pg->vsh_program_cache_entries);
+    pg->vsh_program_cache_entries = NULL;
+}
+
+/*
+ * Look up the parsed form of the program starting at the given slot. Unless
+ * the program memory was written since, relaunching the same start slot does
+ * not even need to hash the program.
+ */
+static Nv2aVshProgram *get_launch_program(PGRAPHState *pg,
+                                          unsigned int program_start)
+{
+    if (pg->launch_program && pg->launch_program_start == program_start) {
+        return &pg->launch_program->program;
+    }
+
+    VshProgramKey key = {
+        .tokens = (const uint32_t (*)[VSH_TOKEN_SIZE])
+                      pg->program_data[program_start],
+        .length = 0,
+    };
+    while (program_start + key.length < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH) {
+        if (vsh_get_field(key.tokens[key.length++], FLD_FINAL)) {
+            break;
+        }
+    }
+
+    uint64_t hash = fast_hash((const uint8_t *)key.tokens,
+                              key.length * sizeof(key.tokens[0]));
+    LruNode *node = lru_lookup(&pg->vsh_program_cache, hash, &key);
+    pg->launch_program = container_of(node, VshProgramLruNode, node);
+    pg->launch_program_start = program_start;
+
+    return &pg->launch_program->program;
+}
+
 static const PGRAPHRenderer *renderers[CONFIG_DISPLAY_RENDERER__COUNT];
 
 void pgraph_renderer_register(const PGRAPHRenderer *renderer)
@@ -243,7 +353,12 @@ void pgraph_init(NV2AState *d)
         attribute->inline_buffer_populated = false;
     }
 
+    vsh_program_cache_init(pg);
     pgraph_clear_dirty_reg_map(pg);
+
+    /* The pgraph thread decodes alongside the workers */
+    pgraph_worker_pool_init(&pg->texture_decode_pool, "nv2a.tex_decode",
+                            MIN(4, MAX(0, (int)g_get_num_processors() - 2)));
 }
 
 void pgraph_clear_dirty_reg_map(PGRAPHState *pg)
@@ -351,6 +466,8 @@ void pgraph_destroy(PGRAPHState *pg)
        pg->renderer->ops.finalize(d);
     }
 
+    vsh_program_cache_finalize(pg);
+    pgraph_worker_pool_finalize(&pg->texture_decode_pool);
     qemu_mutex_destroy(&pg->lock);
 }
 
@@ -518,6 +635,7 @@ static void pgraph_method_log(unsigned int subchannel,
                               unsigned int graphics_class,
                               unsigned int method, uint32_t parameter)
 {
+#if DEBUG_NV2A_METHOD_TRACE
     const char *method_name = "?";
     static unsigned int last = 0;
     static unsigned int count = 0;
@@ -555,6 +673,33 @@ static void pgraph_method_log(unsigned int subchannel,
         count = 0;
     }
     last = method;
+#endif
+}
+
+/* Logs the parameters after the first of a run consumed by a bulk handler */
+static void pgraph_method_log_run(unsigned int subchannel, unsigned int method,
+                                  uint32_t *parameters, size_t count, bool inc)
+{
+#if DEBUG_NV2A_METHOD_TRACE
+    for (size_t i = 1; i < count; i++) {
+        pgraph_method_log(subchannel, NV_KELVIN_PRIMITIVE,
+                          inc ? method + 4 * i : method,
+                          ldl_le_p(parameters + i));
+    }
+#endif
+}
+
+/* Copies pushbuffer parameters to host order */
+static void pgraph_copy_parameters(void *dst, uint32_t *parameters,
+                                   size_t count)
+{
+#if HOST_BIG_ENDIAN
+    for (size_t i = 0; i < count; i++) {
+        ((uint32_t *)dst)[i] = ldl_le_p(parameters + i);
+    }
+#else
+    memcpy(dst, parameters, count * sizeof(uint32_t));
+#endif
 }
 
 static void pgraph_method_inc(MethodFunc handler, uint32_t end,
@@ -577,24 +722,6 @@ static void pgraph_method_inc(MethodFunc handler, uint32_t end,
     *num_words_consumed = count;
 }
 
-static void pgraph_method_non_inc(MethodFunc handler, METHOD_HANDLER_ARG_DECL)
-{
-    if (inc) {
-        handler(METHOD_HANDLER_ARGS);
-        return;
-    }
-
-    for (size_t i = 0; i < num_words_available; i++) {
-        parameter = ldl_le_p(parameters + i);
-        if (i) {
-            pgraph_method_log(subchannel, NV_KELVIN_PRIMITIVE, method,
-                              parameter);
-        }
-        handler(METHOD_HANDLER_ARGS);
-    }
-    *num_words_consumed = num_words_available;
-}
-
 #define METHOD_FUNC_NAME_INT(gclass, name) METHOD_FUNC_NAME(gclass, name##_int)
 #define DEF_METHOD_INT(gclass, name) DEF_METHOD(gclass, name##_int)
 #define DEF_METHOD(gclass, name) DEF_METHOD_PROTO(gclass, name)
@@ -609,14 +736,12 @@ static void pgraph_method_non_inc(MethodFunc handler, METHOD_HANDLER_ARG_DECL)
     }                                                          \
     DEF_METHOD_INT(gclass, name)
 
-#define DEF_METHOD_NON_INC(gclass, name)                          \
-    DEF_METHOD_INT(gclass, name);                                 \
-    DEF_METHOD(gclass, name)                                      \
-    {                                                             \
-        pgraph_method_non_inc(METHOD_FUNC_NAME_INT(gclass, name), \
-                              METHOD_HANDLER_ARGS);               \
-    }                                                             \
-    DEF_METHOD_INT(gclass, name)
+/* Number of parameters a bulk handler consumes from its method run */
+#define METHOD_RUN_LENGTH_INC(gclass, name)                         \
+    (inc ? MIN(num_words_available,                                \
+               (METHOD_RANGE_END_NAME(gclass, name) - method) / 4) \
+         : 1)
+#define METHOD_RUN_LENGTH_NON_INC (inc ? 1 : num_words_available)
 
 int pgraph_method(NV2AState *d, unsigned int subchannel,
                    unsigned int method, uint32_t parameter,
@@ -903,6 +1028,7 @@ DEF_METHOD(NV097, FLIP_STALL)
     trace_nv2a_pgraph_flip_stall();
     d->pgraph.renderer->ops.surface_update(d, false, true, true);
     d->pgraph.renderer->ops.flip_stall(d);
+    nv2a_capture_flip_stall(d);
     nv2a_profile_flip_stall();
     pg->waiting_for_flip = true;
 }
@@ -1056,6 +1182,7 @@ DEF_METHOD(NV097, SET_TEXTURE_ADDRESS)
 {
     int slot = (method - NV097_SET_TEXTURE_ADDRESS) / 64;
     pgraph_reg_w(pg, NV_PGRAPH_TEXADDRESS0 + slot * 4, parameter);
+    pg->texture_dirty[slot] = true;
 }
 
 DEF_METHOD(NV097, SET_CONTROL0)
@@ -1992,39 +2119,68 @@ DEF_METHOD_INC(NV097, SET_VIEWPORT_SCALE)
     pg->vsh_constants_dirty[NV_IGRAPH_XF_XFCTX_VPSCL] = true;
 }
 
-DEF_METHOD_INC(NV097, SET_TRANSFORM_PROGRAM)
+/* Loads whole runs of program tokens, advancing the load pointer per token */
+DEF_METHOD(NV097, SET_TRANSFORM_PROGRAM)
 {
+    size_t count = METHOD_RUN_LENGTH_INC(NV097, SET_TRANSFORM_PROGRAM);
     int slot = (method - NV097_SET_TRANSFORM_PROGRAM) / 4;
 
     int program_load = PG_GET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
                                 NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR);
 
-    assert(program_load < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
-    pg->program_data[program_load][slot%4] = parameter;
-    pg->program_data_dirty = true;
+    for (size_t i = 0; i < count;) {
+        unsigned int part = (slot + i) % 4;
+        size_t n = MIN(4 - part, count - i);
 
-    if (slot % 4 == 3) {
-        PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
-                 NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR, program_load+1);
+        assert(program_load < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
+        pgraph_copy_parameters(&pg->program_data[program_load][part],
+                               parameters + i, n);
+        i += n;
+        if (part + n == 4) {
+            program_load++;
+        }
     }
+
+    pg->program_data_dirty = true;
+    pg->launch_program = NULL;
+    PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
+             NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR, program_load);
+
+    pgraph_method_log_run(subchannel, method, parameters, count, inc);
+    *num_words_consumed = count;
 }
 
-DEF_METHOD_INC(NV097, SET_TRANSFORM_CONSTANT)
+/* Loads whole runs of constants, advancing the load pointer per constant */
+DEF_METHOD(NV097, SET_TRANSFORM_CONSTANT)
 {
+    size_t count = METHOD_RUN_LENGTH_INC(NV097, SET_TRANSFORM_CONSTANT);
     int slot = (method - NV097_SET_TRANSFORM_CONSTANT) / 4;
     int const_load = PG_GET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
                               NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR);
 
-    assert(const_load < NV2A_VERTEXSHADER_CONSTANTS);
-    // VertexShaderConstant *constant = &pg->constants[const_load];
-    pg->vsh_constants_dirty[const_load] |=
-        (parameter != pg->vsh_constants[const_load][slot%4]);
-    pg->vsh_constants[const_load][slot%4] = parameter;
-
-    if (slot % 4 == 3) {
-        PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
-                 NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, const_load+1);
+    for (size_t i = 0; i < count;) {
+        unsigned int part = (slot + i) % 4;
+        size_t n = MIN(4 - part, count - i);
+        uint32_t values[4];
+
+        assert(const_load < NV2A_VERTEXSHADER_CONSTANTS);
+        pgraph_copy_parameters(values, parameters + i, n);
+        uint32_t *constant = &pg->vsh_constants[const_load][part];
+        if (memcmp(constant, values, n * sizeof(uint32_t))) {
+            memcpy(constant, values, n * sizeof(uint32_t));
+            pg->vsh_constants_dirty[const_load] = true;
+        }
+        i += n;
+        if (part + n == 4) {
+            const_load++;
+        }
     }
+
+    PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
+             NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, const_load);
+
+    pgraph_method_log_run(subchannel, method, parameters, count, inc);
+    *num_words_consumed = count;
 }
 
 DEF_METHOD_INC(NV097, SET_VERTEX3F)
@@ -2683,29 +2839,46 @@ void pgraph_check_within_begin_end_block(PGRAPHState *pg)
     }
 }
 
-DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT16)
+DEF_METHOD(NV097, ARRAY_ELEMENT16)
 {
+    size_t count = METHOD_RUN_LENGTH_NON_INC;
+
     pgraph_check_within_begin_end_block(pg);
 
     if (pg->draw_arrays_length) {
         pgraph_expand_draw_arrays(d);
     }
 
-    assert(pg->inline_elements_length < NV2A_MAX_BATCH_LENGTH);
-    pg->inline_elements[pg->inline_elements_length++] = parameter & 0xFFFF;
-    pg->inline_elements[pg->inline_elements_length++] = parameter >> 16;
+    assert(pg->inline_elements_length + count * 2 <= NV2A_MAX_BATCH_LENGTH);
+    uint32_t *elements = &pg->inline_elements[pg->inline_elements_length];
+    for (size_t i = 0; i < count; i++) {
+        uint32_t pair = ldl_le_p(parameters + i);
+        elements[i * 2] = pair & 0xFFFF;
+        elements[i * 2 + 1] = pair >> 16;
+    }
+    pg->inline_elements_length += count * 2;
+
+    pgraph_method_log_run(subchannel, method, parameters, count, inc);
+    *num_words_consumed = count;
 }
 
-DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT32)
+DEF_METHOD(NV097, ARRAY_ELEMENT32)
 {
+    size_t count = METHOD_RUN_LENGTH_NON_INC;
+
     pgraph_check_within_begin_end_block(pg);
 
     if (pg->draw_arrays_length) {
         pgraph_expand_draw_arrays(d);
     }
 
-    assert(pg->inline_elements_length < NV2A_MAX_BATCH_LENGTH);
-    pg->inline_elements[pg->inline_elements_length++] = parameter;
+    assert(pg->inline_elements_length + count <= NV2A_MAX_BATCH_LENGTH);
+    pgraph_copy_parameters(&pg->inline_elements[pg->inline_elements_length],
+                           parameters, count);
+    pg->inline_elements_length += count;
+
+    pgraph_method_log_run(subchannel, method, parameters, count, inc);
+    *num_words_consumed = count;
 }
 
 DEF_METHOD(NV097, DRAW_ARRAYS)
@@ -2753,11 +2926,18 @@ DEF_METHOD(NV097, DRAW_ARRAYS)
     pg->draw_arrays_prevent_connect = false;
 }
 
-DEF_METHOD_NON_INC(NV097, INLINE_ARRAY)
+DEF_METHOD(NV097, INLINE_ARRAY)
 {
+    size_t count = METHOD_RUN_LENGTH_NON_INC;
+
     pgraph_check_within_begin_end_block(pg);
-    assert(pg->inline_array_length < NV2A_MAX_BATCH_LENGTH);
-    pg->inline_array[pg->inline_array_length++] = parameter;
+    assert(pg->inline_array_length + count <= NV2A_MAX_BATCH_LENGTH);
+    pgraph_copy_parameters(&pg->inline_array[pg->inline_array_length],
+                           parameters, count);
+    pg->inline_array_length += count;
+
+    pgraph_method_log_run(subchannel, method, parameters, count, inc);
+    *num_words_consumed = count;
 }
 
 DEF_METHOD_INC(NV097, SET_EYE_VECTOR)
@@ -2766,33 +2946,54 @@ DEF_METHOD_INC(NV097, SET_EYE_VECTOR)
     pgraph_reg_w(pg, NV_PGRAPH_EYEVEC0 + slot * 4, parameter);
 }
 
-DEF_METHOD_INC(NV097, SET_VERTEX_DATA2F_M)
-{
-    int slot = (method - NV097_SET_VERTEX_DATA2F_M) / 4;
-    unsigned int part = slot % 2;
-    slot /= 2;
-    VertexAttribute *attribute = &pg->vertex_attributes[slot];
-    pgraph_allocate_inline_buffer_vertices(pg, slot);
-    attribute->inline_value[part] = *(float*)&parameter;
-    /* FIXME: Should these really be set to 0.0 and 1.0 ? Conditions? */
-    attribute->inline_value[2] = 0.0;
-    attribute->inline_value[3] = 1.0;
-    if ((slot == 0) && (part == 1)) {
-        pgraph_finish_inline_buffer_vertex(pg);
+/* Copies whole attributes at a time, finishing a vertex on each position */
+DEF_METHOD(NV097, SET_VERTEX_DATA2F_M)
+{
+    size_t count = METHOD_RUN_LENGTH_INC(NV097, SET_VERTEX_DATA2F_M);
+    int index = (method - NV097_SET_VERTEX_DATA2F_M) / 4;
+
+    for (size_t i = 0; i < count;) {
+        unsigned int slot = (index + i) / 2;
+        unsigned int part = (index + i) % 2;
+        size_t n = MIN(2 - part, count - i);
+        VertexAttribute *attribute = &pg->vertex_attributes[slot];
+        pgraph_allocate_inline_buffer_vertices(pg, slot);
+        pgraph_copy_parameters(&attribute->inline_value[part], parameters + i,
+                               n);
+        /* FIXME: Should these really be set to 0.0 and 1.0 ? Conditions? */
+        attribute->inline_value[2] = 0.0;
+        attribute->inline_value[3] = 1.0;
+        i += n;
+        if ((slot == 0) && (part + n == 2)) {
+            pgraph_finish_inline_buffer_vertex(pg);
+        }
     }
+
+    pgraph_method_log_run(subchannel, method, parameters, count, inc);
+    *num_words_consumed = count;
 }
 
-DEF_METHOD_INC(NV097, SET_VERTEX_DATA4F_M)
+DEF_METHOD(NV097, SET_VERTEX_DATA4F_M)
 {
-    int slot = (method - NV097_SET_VERTEX_DATA4F_M) / 4;
-    unsigned int part = slot % 4;
-    slot /= 4;
-    VertexAttribute *attribute = &pg->vertex_attributes[slot];
-    pgraph_allocate_inline_buffer_vertices(pg, slot);
-    attribute->inline_value[part] = *(float*)&parameter;
-    if ((slot == 0) && (part == 3)) {
-        pgraph_finish_inline_buffer_vertex(pg);
+    size_t count = METHOD_RUN_LENGTH_INC(NV097, SET_VERTEX_DATA4F_M);
+    int index = (method - NV097_SET_VERTEX_DATA4F_M) / 4;
+
+    for (size_t i = 0; i < count;) {
+        unsigned int slot = (index + i) / 4;
+        unsigned int part = (index + i) % 4;
+        size_t n = MIN(4 - part, count - i);
+        VertexAttribute *attribute = &pg->vertex_attributes[slot];
+        pgraph_allocate_inline_buffer_vertices(pg, slot);
+        pgraph_copy_parameters(&attribute->inline_value[part], parameters + i,
+                               n);
+        i += n;
+        if ((slot == 0) && (part + n == 4)) {
+            pgraph_finish_inline_buffer_vertex(pg);
+        }
     }
+
+    pgraph_method_log_run(subchannel, method, parameters, count, inc);
+    *num_words_consumed = count;
 }
 
 DEF_METHOD_INC(NV097, SET_VERTEX_DATA2S)
@@ -2986,21 +3187,15 @@ DEF_METHOD(NV097, LAUNCH_TRANSFORM_PROGRAM)
 {
     unsigned int program_start = parameter;
     assert(program_start < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
-    Nv2aVshProgram program;
-    Nv2aVshParseResult result = nv2a_vsh_parse_program(
-            &program,
-            pg->program_data[program_start],
-            NV2A_MAX_TRANSFORM_PROGRAM_LENGTH - program_start);
-    assert(result == NV2AVPR_SUCCESS);
+    Nv2aVshProgram *program = get_launch_program(pg, program_start);
 
     Nv2aVshCPUXVSSExecutionState state_linkage;
     Nv2aVshExecutionState state = nv2a_vsh_emu_initialize_xss_execution_state(
             &state_linkage, (float*)pg->vsh_constants);
     memcpy(state_linkage.input_regs, pg->vertex_state_shader_v0, sizeof(pg->vertex_state_shader_v0));
 
-    nv2a_vsh_emu_execute_track_context_writes(&state, &program, pg->vsh_constants_dirty);
-
-    nv2a_vsh_program_destroy(&program);
+    nv2a_vsh_emu_execute_track_context_writes(&state, program,
+                                              pg->vsh_constants_dirty);
 }
 
 DEF_METHOD(NV097, SET_TRANSFORM_EXECUTION_MODE)
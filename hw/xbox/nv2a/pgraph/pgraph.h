@@ -27,17 +27,21 @@
 #include "qemu/bitmap.h"
 #include "qemu/units.h"
 #include "qemu/thread.h"
+#include "qemu/lru.h"
 #include "cpu.h"
 
 #include "surface.h"
 #include "texture.h"
 #include "util.h"
 #include "vsh_regs.h"
+#include "worker_pool.h"
 
 typedef struct NV2AState NV2AState;
 typedef struct PGRAPHNullState PGRAPHNullState;
 typedef struct PGRAPHGLState PGRAPHGLState;
 typedef struct PGRAPHVkState PGRAPHVkState;
+typedef struct VshProgramLruNode VshProgramLruNode;
+typedef struct PGRAPHSWState PGRAPHSWState;
 
 typedef struct VertexAttribute {
     bool dma_select;
@@ -168,6 +172,7 @@ typedef struct PGRAPHState {
 
     hwaddr dma_a, dma_b;
     bool texture_dirty[NV2A_MAX_TEXTURES];
+    PGRAPHWorkerPool texture_decode_pool;
 
     bool texture_matrix_enable[NV2A_MAX_TEXTURES];
 
@@ -189,6 +194,12 @@ typedef struct PGRAPHState {
     uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE];
     bool program_data_dirty;
 
+    /* Parsed programs run by LAUNCH_TRANSFORM_PROGRAM, keyed by content */
+    Lru vsh_program_cache;
+    VshProgramLruNode *vsh_program_cache_entries;
+    VshProgramLruNode *launch_program; /* Reset on program writes */
+    unsigned int launch_program_start;
+
     uint32_t vsh_constants[NV2A_VERTEXSHADER_CONSTANTS][4];
     bool vsh_constants_dirty[NV2A_VERTEXSHADER_CONSTANTS];
 
@@ -269,6 +280,7 @@ typedef struct PGRAPHState {
         PGRAPHNullState *null_renderer_state;
         PGRAPHGLState *gl_renderer_state;
         PGRAPHVkState *vk_renderer_state;
+        PGRAPHSWState *sw_renderer_state;
     };
 } PGRAPHState;
 
@@ -290,7 +302,12 @@ int pgraph_method(NV2AState *d, unsigned int subchannel, unsigned int method,
 void pgraph_check_within_begin_end_block(PGRAPHState *pg);
 
 void *pfifo_thread(void *arg);
+void *pfifo_pusher_thread(void *arg);
 void pfifo_kick(NV2AState *d);
+void pfifo_ramht_cache_init(NV2AState *d);
+void pfifo_ramht_cache_invalidate(NV2AState *d);
+uint32_t pfifo_execute_record(NV2AState *d, uint32_t *record,
+                              size_t max_lookahead_words);
 
 void pgraph_renderer_register(const PGRAPHRenderer *renderer);
 
@@ -23,121 +23,76 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "s3tc.h"
 
-static void decode_bc1_colors(uint16_t c0, uint16_t c1, uint8_t r[4],
-                              uint8_t g[4], uint8_t b[4], uint8_t a[16],
-                              bool transparent)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include "host/cpuinfo.h"
+#define S3TC_ACCEL_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define S3TC_ACCEL_NEON 1
+#endif
+
+/*
+ * A 4x4 block reduced to lookup tables. Colors are packed as little endian
+ * RGBA. For DXT3 and DXT5 the color alpha is zero and the alpha comes from
+ * alpha_bits instead: 4 bits per pixel for DXT3, 3 bit indices into alpha for
+ * DXT5.
+ */
+typedef struct S3tcBlock {
+    uint32_t colors[4];
+    uint32_t color_indices;
+    uint8_t alpha[8];
+    uint64_t alpha_bits;
+} S3tcBlock;
+
+typedef void (*S3tcBlockFunc)(enum S3TC_DECOMPRESS_FORMAT color_format,
+                              const S3tcBlock *b, uint8_t *dst, size_t pitch);
+
+static inline uint32_t pack_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
+    return r | (g << 8) | (b << 16) | ((uint32_t)a << 24);
+}
+
+static void decode_bc1_colors(uint16_t c0, uint16_t c1, uint32_t colors[4],
+                              bool transparent, uint8_t alpha)
+{
+    uint8_t r[4], g[4], b[4];
+
     r[0] = ((c0 & 0xF800) >> 8) * 0xFF / 0xF8,
     g[0] = ((c0 & 0x07E0) >> 3) * 0xFF / 0xFC,
-    b[0] = ((c0 & 0x001F) << 3) * 0xFF / 0xF8,
-    a[0] = 255;
+    b[0] = ((c0 & 0x001F) << 3) * 0xFF / 0xF8;
 
     r[1] = ((c1 & 0xF800) >> 8) * 0xFF / 0xF8,
     g[1] = ((c1 & 0x07E0) >> 3) * 0xFF / 0xFC,
-    b[1] = ((c1 & 0x001F) << 3) * 0xFF / 0xF8,
-    a[1] = 255;
+    b[1] = ((c1 & 0x001F) << 3) * 0xFF / 0xF8;
+
+    colors[0] = pack_rgba(r[0], g[0], b[0], alpha);
+    colors[1] = pack_rgba(r[1], g[1], b[1], alpha);
 
     if (transparent) {
         r[2] = (r[0]+r[1])/2;
         g[2] = (g[0]+g[1])/2;
         b[2] = (b[0]+b[1])/2;
-        a[2] = 255;
-
-        r[3] = 0;
-        g[3] = 0;
-        b[3] = 0;
-        a[3] = 0;
+        colors[2] = pack_rgba(r[2], g[2], b[2], alpha);
+        colors[3] = 0;
     } else {
         r[2] = (2*r[0]+r[1])/3;
         g[2] = (2*g[0]+g[1])/3,
         b[2] = (2*b[0]+b[1])/3;
-        a[2] = 255;
+        colors[2] = pack_rgba(r[2], g[2], b[2], alpha);
 
         r[3] = (r[0]+2*r[1])/3;
         g[3] = (g[0]+2*g[1])/3;
         b[3] = (b[0]+2*b[1])/3;
-        a[3] = 255;
-    }
-}
-
-static void write_block_to_texture(uint8_t *converted_data, uint32_t indices,
-                                   int i, int j, int width, int height,
-                                   int z_pos_factor, uint8_t r[4],
-                                   uint8_t g[4], uint8_t b[4], uint8_t a[16],
-                                   bool separate_alpha)
-{
-    int x0 = i * 4,
-        y0 = j * 4;
-
-    int x1 = x0 + 4,
-        y1 = y0 + 4;
-
-    for (int y = y0; y < y1 && y < height; y++) {
-        int y_index = 4 * (y - y0);
-        int z_plus_y_pos_factor = z_pos_factor + y * width;
-        for (int x = x0; x < x1 && x < width; x++) {
-            int xy_index = y_index + x - x0;
-            uint8_t index = (indices >> 2 * xy_index) & 0x03;
-            uint8_t alpha_index = separate_alpha ? xy_index : index;
-            uint8_t *p = converted_data + (z_plus_y_pos_factor + x) * 4;
-            *p++ = r[index];
-            *p++ = g[index];
-            *p++ = b[index];
-            *p++ = a[alpha_index];
-        }
+        colors[3] = pack_rgba(r[3], g[3], b[3], alpha);
     }
 }
 
-static void decompress_dxt1_block(const uint8_t block_data[8],
-                                  uint8_t *converted_data, int i, int j,
-                                  int width, int height, int z_pos_factor)
+static void decode_dxt5_alpha(uint8_t a0, uint8_t a1, uint8_t a_palette[8])
 {
-    uint16_t c0 = ((uint16_t*)block_data)[0],
-             c1 = ((uint16_t*)block_data)[1];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, c0 <= c1);
-
-    uint32_t indices = ((uint32_t*)block_data)[1];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, height, z_pos_factor,
-                           r, g, b, a, false);
-}
-
-static void decompress_dxt3_block(const uint8_t block_data[16],
-                                  uint8_t *converted_data, int i, int j,
-                                  int width, int height, int z_pos_factor)
-{
-    uint16_t c0 = ((uint16_t*)block_data)[4],
-             c1 = ((uint16_t*)block_data)[5];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, false);
-
-    uint64_t alpha = ((uint64_t*)block_data)[0];
-    for (int a_i=0; a_i < 16; a_i++) {
-        a[a_i] = (((alpha >> 4*a_i) & 0x0F) << 4) * 0xFF / 0xF0;
-    }
-
-    uint32_t indices = ((uint32_t*)block_data)[3];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, height, z_pos_factor,
-                           r, g, b, a, true);
-}
-
-static void decompress_dxt5_block(const uint8_t block_data[16],
-                                  uint8_t *converted_data, int i, int j,
-                                  int width, int height, int z_pos_factor)
-{
-    uint16_t c0 = ((uint16_t*)block_data)[4],
-             c1 = ((uint16_t*)block_data)[5];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, false);
-
-    uint64_t alpha = ((uint64_t*)block_data)[0];
-    uint8_t a0 = block_data[0];
-    uint8_t a1 = block_data[1];
-    uint8_t a_palette[8];
     a_palette[0] = a0;
     a_palette[1] = a1;
     if (a0 > a1) {
@@ -155,85 +110,294 @@ static void decompress_dxt5_block(const uint8_t block_data[16],
         a_palette[6] = 0;
         a_palette[7] = 255;
     }
-    for (int a_i = 0; a_i < 16; a_i++) {
-        a[a_i] = a_palette[(alpha >> (16+3*a_i)) & 0x07];
+}
+
+static void prepare_block(enum S3TC_DECOMPRESS_FORMAT color_format,
+                          const uint8_t *block_data, S3tcBlock *b)
+{
+    if (color_format == S3TC_DECOMPRESS_FORMAT_DXT1) {
+        uint16_t c0 = lduw_le_p(block_data), c1 = lduw_le_p(block_data + 2);
+        decode_bc1_colors(c0, c1, b->colors, c0 <= c1, 255);
+        b->color_indices = ldl_le_p(block_data + 4);
+        return;
+    }
+
+    uint16_t c0 = lduw_le_p(block_data + 8), c1 = lduw_le_p(block_data + 10);
+    decode_bc1_colors(c0, c1, b->colors, false, 0);
+    b->color_indices = ldl_le_p(block_data + 12);
+
+    if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
+        b->alpha_bits = ldq_le_p(block_data);
+    } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
+        decode_dxt5_alpha(block_data[0], block_data[1], b->alpha);
+        b->alpha_bits = ldq_le_p(block_data) >> 16;
+    } else {
+        assert(!"Invalid S3TC_DECOMPRESS_FORMAT");
     }
+}
 
-    uint32_t indices = ((uint32_t*)block_data)[3];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, height, z_pos_factor,
-                           r, g, b, a, true);
+static void decode_block_scalar(enum S3TC_DECOMPRESS_FORMAT color_format,
+                                const S3tcBlock *b, uint8_t *dst, size_t pitch)
+{
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int i = y * 4 + x;
+            uint32_t c = b->colors[(b->color_indices >> (2 * i)) & 3];
+            if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
+                /* Expanding 4 bits to 8 is a multiply by 17 */
+                c |= (uint32_t)((b->alpha_bits >> (4 * i)) & 0xF) * 17 << 24;
+            } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
+                c |= (uint32_t)b->alpha[(b->alpha_bits >> (3 * i)) & 7] << 24;
+            }
+            stl_le_p(dst + y * pitch + x * 4, c);
+        }
+    }
 }
 
-uint8_t *s3tc_decompress_3d(enum S3TC_DECOMPRESS_FORMAT color_format,
-                            const uint8_t *data, unsigned int width,
-                            unsigned int height, unsigned int depth)
+#ifdef S3TC_ACCEL_X86
+
+/* Selects one of four colors per 32-bit lane with compares */
+static void __attribute__((target("sse2")))
+decode_block_sse2(enum S3TC_DECOMPRESS_FORMAT color_format,
+                  const S3tcBlock *b, uint8_t *dst, size_t pitch)
+{
+    __m128i c0 = _mm_set1_epi32(b->colors[0]);
+    __m128i c1 = _mm_set1_epi32(b->colors[1]);
+    __m128i c2 = _mm_set1_epi32(b->colors[2]);
+    __m128i c3 = _mm_set1_epi32(b->colors[3]);
+
+    for (int y = 0; y < 4; y++) {
+        uint32_t ci = b->color_indices >> (8 * y);
+        __m128i idx = _mm_set_epi32((ci >> 6) & 3, (ci >> 4) & 3,
+                                    (ci >> 2) & 3, ci & 3);
+        __m128i c = _mm_or_si128(
+            _mm_or_si128(
+                _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(0)), c0),
+                _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(1)), c1)),
+            _mm_or_si128(
+                _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(2)), c2),
+                _mm_and_si128(_mm_cmpeq_epi32(idx, _mm_set1_epi32(3)), c3)));
+
+        if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
+            uint32_t ab = b->alpha_bits >> (16 * y);
+            __m128i a = _mm_set_epi32((ab >> 12) & 0xF, (ab >> 8) & 0xF,
+                                      (ab >> 4) & 0xF, ab & 0xF);
+            a = _mm_slli_epi32(_mm_or_si128(a, _mm_slli_epi32(a, 4)), 24);
+            c = _mm_or_si128(c, a);
+        } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
+            uint32_t ab = b->alpha_bits >> (12 * y);
+            __m128i a = _mm_set_epi32(
+                b->alpha[(ab >> 9) & 7], b->alpha[(ab >> 6) & 7],
+                b->alpha[(ab >> 3) & 7], b->alpha[ab & 7]);
+            c = _mm_or_si128(c, _mm_slli_epi32(a, 24));
+        }
+
+        _mm_storeu_si128((__m128i *)(dst + y * pitch), c);
+    }
+}
+
+/* Two rows at a time, palettes are indexed with a cross-lane permute */
+static void __attribute__((target("avx2")))
+decode_block_avx2(enum S3TC_DECOMPRESS_FORMAT color_format,
+                  const S3tcBlock *b, uint8_t *dst, size_t pitch)
+{
+    __m256i colors = _mm256_castsi128_si256(
+        _mm_loadu_si128((const __m128i *)b->colors));
+
+    for (int h = 0; h < 2; h++) {
+        __m256i idx = _mm256_and_si256(
+            _mm256_srlv_epi32(_mm256_set1_epi32(b->color_indices >> (16 * h)),
+                              _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14)),
+            _mm256_set1_epi32(3));
+        __m256i c = _mm256_permutevar8x32_epi32(colors, idx);
+
+        if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
+            __m256i a = _mm256_and_si256(
+                _mm256_srlv_epi32(
+                    _mm256_set1_epi32((uint32_t)(b->alpha_bits >> (32 * h))),
+                    _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28)),
+                _mm256_set1_epi32(0xF));
+            a = _mm256_slli_epi32(
+                _mm256_or_si256(a, _mm256_slli_epi32(a, 4)), 24);
+            c = _mm256_or_si256(c, a);
+        } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
+            __m256i a = _mm256_and_si256(
+                _mm256_srlv_epi32(
+                    _mm256_set1_epi32((uint32_t)(b->alpha_bits >> (24 * h))),
+                    _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21)),
+                _mm256_set1_epi32(7));
+            __m256i alpha = _mm256_slli_epi32(
+                _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64((const __m128i *)b->alpha)),
+                24);
+            c = _mm256_or_si256(c, _mm256_permutevar8x32_epi32(alpha, a));
+        }
+
+        _mm_storeu_si128((__m128i *)(dst + 2 * h * pitch),
+                         _mm256_castsi256_si128(c));
+        _mm_storeu_si128((__m128i *)(dst + (2 * h + 1) * pitch),
+                         _mm256_extracti128_si256(c, 1));
+    }
+}
+
+#endif /* S3TC_ACCEL_X86 */
+
+#ifdef S3TC_ACCEL_NEON
+
+/* Palettes are indexed with byte table lookups */
+static void decode_block_neon(enum S3TC_DECOMPRESS_FORMAT color_format,
+                              const S3tcBlock *b, uint8_t *dst, size_t pitch)
+{
+    const int32x4_t shift_2 = { 0, -2, -4, -6 };
+    const int32x4_t shift_3 = { 0, -3, -6, -9 };
+    const int32x4_t shift_4 = { 0, -4, -8, -12 };
+    uint8x16_t colors = vld1q_u8((const uint8_t *)b->colors);
+
+    for (int y = 0; y < 4; y++) {
+        uint32x4_t idx =
+            vandq_u32(vshlq_u32(vdupq_n_u32(b->color_indices >> (8 * y)),
+                                shift_2),
+                      vdupq_n_u32(3));
+        uint32x4_t sel = vmlaq_n_u32(vdupq_n_u32(0x03020100), idx, 0x04040404);
+        uint32x4_t c = vreinterpretq_u32_u8(
+            vqtbl1q_u8(colors, vreinterpretq_u8_u32(sel)));
+
+        if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
+            uint32x4_t a = vandq_u32(
+                vshlq_u32(vdupq_n_u32(b->alpha_bits >> (16 * y)), shift_4),
+                vdupq_n_u32(0xF));
+            a = vshlq_n_u32(vorrq_u32(a, vshlq_n_u32(a, 4)), 24);
+            c = vorrq_u32(c, a);
+        } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
+            uint32x4_t a = vandq_u32(
+                vshlq_u32(vdupq_n_u32(b->alpha_bits >> (12 * y)), shift_3),
+                vdupq_n_u32(7));
+            uint8x16_t alpha = vcombine_u8(vld1_u8(b->alpha), vdup_n_u8(0));
+            /* Out of range indices select zero for the color bytes */
+            a = vorrq_u32(vshlq_n_u32(a, 24), vdupq_n_u32(0x00FFFFFF));
+            c = vorrq_u32(c, vreinterpretq_u32_u8(
+                                 vqtbl1q_u8(alpha, vreinterpretq_u8_u32(a))));
+        }
+
+        vst1q_u8(dst + y * pitch, vreinterpretq_u8_u32(c));
+    }
+}
+
+#endif /* S3TC_ACCEL_NEON */
+
+static S3tcBlockFunc decode_block = decode_block_scalar;
+
+static void __attribute__((constructor)) init_accel(void)
+{
+#ifdef S3TC_ACCEL_X86
+    unsigned info = cpuinfo_init();
+
+    if (info & CPUINFO_AVX2) {
+        decode_block = decode_block_avx2;
+    } else if (info & CPUINFO_SSE2) {
+        decode_block = decode_block_sse2;
+    }
+#elif defined(S3TC_ACCEL_NEON)
+    decode_block = decode_block_neon;
+#endif
+}
+
+unsigned int s3tc_get_block_rows(unsigned int height, unsigned int depth)
+{
+    return (height + 3) / 4 * ((depth + 3) / 4);
+}
+
+void s3tc_decompress_block_rows(enum S3TC_DECOMPRESS_FORMAT color_format,
+                                const uint8_t *data, uint8_t *converted_data,
+                                unsigned int width, unsigned int height,
+                                unsigned int depth, unsigned int first_row,
+                                unsigned int num_rows)
 {
     assert(width > 0);
     assert(height > 0);
     assert(depth > 0);
-    unsigned int physical_width = (width + 3) & ~3,
-                 physical_height = (height + 3) & ~3;
-    int num_blocks_x = physical_width/4,
-        num_blocks_y = physical_height/4,
-        num_blocks_z = (depth + 3)/4;
-    uint8_t *converted_data = (uint8_t*)g_malloc(width * height * depth * 4);
-    int cur_depth = 0;
-    int sub_block_index = 0;
-    for (int k = 0; k < num_blocks_z; k++) {
-        int residual_depth = depth - cur_depth;
-        int block_depth = MIN(residual_depth, 4);
-        for (int j = 0; j < num_blocks_y; j++) {
-            for (int i = 0; i < num_blocks_x; i++) {
-                for (int slice = 0; slice < block_depth; slice++) {
-                    int z_pos_factor = (cur_depth + slice) * width * height;
-                    if (color_format == S3TC_DECOMPRESS_FORMAT_DXT1) {
-                        decompress_dxt1_block(data + 8 * sub_block_index, converted_data,
-                                              i, j, width, height, z_pos_factor);
-                    } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
-                        decompress_dxt3_block(data + 16 * sub_block_index, converted_data,
-                                              i, j, width, height, z_pos_factor);
-                    } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
-                        decompress_dxt5_block(data + 16 * sub_block_index, converted_data,
-                                              i, j, width, height, z_pos_factor);
-                    } else {
-                        assert(!"Invalid S3TC_DECOMPRESS_FORMAT");
+    assert(first_row + num_rows <= s3tc_get_block_rows(height, depth));
+
+    unsigned int num_blocks_x = (width + 3) / 4,
+                 num_blocks_y = (height + 3) / 4;
+    size_t block_size = color_format == S3TC_DECOMPRESS_FORMAT_DXT1 ? 8 : 16;
+    size_t pitch = width * 4, slice_pitch = pitch * height;
+
+    for (unsigned int row = first_row; row < first_row + num_rows; row++) {
+        /*
+         * Volumes are stored as groups of up to 4 slices. Within a group,
+         * the blocks of all slices at one position are stored together.
+         */
+        unsigned int k = row / num_blocks_y, j = row % num_blocks_y;
+        unsigned int z0 = k * 4, y0 = j * 4;
+        unsigned int block_depth = MIN(depth - z0, 4);
+        unsigned int block_height = MIN(height - y0, 4);
+        const uint8_t *src =
+            data + ((size_t)k * num_blocks_y * num_blocks_x * 4 +
+                    (size_t)j * num_blocks_x * block_depth) * block_size;
+
+        for (unsigned int i = 0; i < num_blocks_x; i++) {
+            unsigned int x0 = i * 4;
+            unsigned int block_width = MIN(width - x0, 4);
+            for (unsigned int slice = 0; slice < block_depth; slice++) {
+                S3tcBlock b;
+                prepare_block(color_format, src, &b);
+                src += block_size;
+
+                uint8_t *dst = converted_data + (z0 + slice) * slice_pitch +
+                               y0 * pitch + x0 * 4;
+                if (block_width == 4 && block_height == 4) {
+                    decode_block(color_format, &b, dst, pitch);
+                } else {
+                    uint8_t tmp[4 * 4 * 4];
+                    decode_block(color_format, &b, tmp, 16);
+                    for (unsigned int y = 0; y < block_height; y++) {
+                        memcpy(dst + y * pitch, tmp + y * 16, block_width * 4);
                     }
-                    sub_block_index++;
                 }
             }
         }
-        cur_depth += block_depth;
     }
-    return converted_data;
 }
 
-uint8_t *s3tc_decompress_2d(enum S3TC_DECOMPRESS_FORMAT color_format,
-                            const uint8_t *data, unsigned int width,
-                            unsigned int height)
+void s3tc_linearize_volume_blocks(const uint8_t *data, uint8_t *out,
+                                  size_t block_size, unsigned int width,
+                                  unsigned int height, unsigned int depth)
 {
-    assert(width > 0);
-    assert(height > 0);
-    unsigned int physical_width = (width + 3) & ~3,
-                 physical_height = (height + 3) & ~3;
-    int num_blocks_x = physical_width / 4, num_blocks_y = physical_height / 4;
-    uint8_t *converted_data = (uint8_t *)g_malloc(width * height * 4);
-    for (int j = 0; j < num_blocks_y; j++) {
-        for (int i = 0; i < num_blocks_x; i++) {
-            int block_index = j * num_blocks_x + i;
-            if (color_format == S3TC_DECOMPRESS_FORMAT_DXT1) {
-                decompress_dxt1_block(data + 8 * block_index,
-                                      converted_data, i, j, width, height, 0);
-            } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
-                decompress_dxt3_block(data + 16 * block_index,
-                                      converted_data, i, j, width, height, 0);
-            } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
-                decompress_dxt5_block(data + 16 * block_index,
-                                      converted_data, i, j, width, height, 0);
-            } else {
-                assert(!"Invalid S3TC_DECOMPRESS_FORMAT");
+    unsigned int num_blocks_x = (width + 3) / 4,
+                 num_blocks_y = (height + 3) / 4;
+    size_t slice_size = (size_t)num_blocks_x * num_blocks_y * block_size;
+
+    /* Same traversal as s3tc_decompress_block_rows */
+    for (unsigned int z0 = 0; z0 < depth; z0 += 4) {
+        unsigned int block_depth = MIN(depth - z0, 4);
+        for (unsigned int j = 0; j < num_blocks_y; j++) {
+            for (unsigned int i = 0; i < num_blocks_x; i++) {
+                for (unsigned int slice = 0; slice < block_depth; slice++) {
+                    memcpy(out + (z0 + slice) * slice_size +
+                               ((size_t)j * num_blocks_x + i) * block_size,
+                           data, block_size);
+                    data += block_size;
+                }
             }
         }
     }
+}
+
+uint8_t *s3tc_decompress_3d(enum S3TC_DECOMPRESS_FORMAT color_format,
+                            const uint8_t *data, unsigned int width,
+                            unsigned int height, unsigned int depth)
+{
+    uint8_t *converted_data = (uint8_t*)g_malloc(width * height * depth * 4);
+    s3tc_decompress_block_rows(color_format, data, converted_data, width,
+                               height, depth, 0,
+                               s3tc_get_block_rows(height, depth));
     return converted_data;
 }
+
+uint8_t *s3tc_decompress_2d(enum S3TC_DECOMPRESS_FORMAT color_format,
+                            const uint8_t *data, unsigned int width,
+                            unsigned int height)
+{
+    return s3tc_decompress_3d(color_format, data, width, height, 1);
+}
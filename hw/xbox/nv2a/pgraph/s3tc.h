@@ -33,6 +33,28 @@ enum S3TC_DECOMPRESS_FORMAT {
     S3TC_DECOMPRESS_FORMAT_DXT5,
 };
 
+/*
+ * Rows of 4x4 blocks in an image, each group of up to 4 slices of a volume
+ * counting separately. Disjoint ranges of rows can be decompressed in
+ * parallel.
+ */
+unsigned int s3tc_get_block_rows(unsigned int height, unsigned int depth);
+
+/* Decompress a range of block rows into a tightly packed RGBA8 image */
+void s3tc_decompress_block_rows(enum S3TC_DECOMPRESS_FORMAT color_format,
+                                const uint8_t *data, uint8_t *converted_data,
+                                unsigned int width, unsigned int height,
+                                unsigned int depth, unsigned int first_row,
+                                unsigned int num_rows);
+
+/*
+ * Copy volume blocks from the interleaved order of each 4 slice group into
+ * the slice after slice order used by host BC formats
+ */
+void s3tc_linearize_volume_blocks(const uint8_t *data, uint8_t *out,
+                                  size_t block_size, unsigned int width,
+                                  unsigned int height, unsigned int depth);
+
 uint8_t *s3tc_decompress_3d(enum S3TC_DECOMPRESS_FORMAT color_format,
                             const uint8_t *data, unsigned int width,
                             unsigned int height, unsigned int depth);
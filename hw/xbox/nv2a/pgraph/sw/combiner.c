@@ -0,0 +1,583 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Register combiner interpreter. The semantics follow the GLSL generated by
+ * glsl/psh.c so that images match the hardware accelerated renderers.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "hw/xbox/nv2a/pgraph/psh_regs.h"
+#include "pixel.h"
+
+/* Combiner register file, indexed by PS_REGISTER */
+enum {
+    NUM_REGS = 16,
+};
+
+typedef float Reg[4];
+
+static inline float sign1(float x)
+{
+    x *= 255.0f;
+    return (x - 128.0f) / 127.0f;
+}
+
+static inline float sign2(float x)
+{
+    x *= 255.0f;
+    return x >= 128.0f ? (x - 255.5f) / 127.5f : (x + 0.5f) / 127.5f;
+}
+
+static inline float sign3(float x)
+{
+    x *= 255.0f;
+    return x >= 128.0f ? (x - 256.0f) / 127.0f : x / 127.0f;
+}
+
+static void dotmap(unsigned int mode, const float *col, float out[3])
+{
+    switch (mode) {
+    case PS_DOTMAPPING_MINUS1_TO_1_D3D:
+        for (int i = 0; i < 3; i++) {
+            out[i] = sign1(col[i]);
+        }
+        break;
+    case PS_DOTMAPPING_MINUS1_TO_1_GL:
+        for (int i = 0; i < 3; i++) {
+            out[i] = sign2(col[i]);
+        }
+        break;
+    case PS_DOTMAPPING_MINUS1_TO_1:
+        for (int i = 0; i < 3; i++) {
+            out[i] = sign3(col[i]);
+        }
+        break;
+    case PS_DOTMAPPING_HILO_1: {
+        uint32_t hi = (uint32_t)(col[3] * 255.0f) << 8 |
+                      (uint32_t)(col[0] * 255.0f);
+        uint32_t lo = (uint32_t)(col[1] * 255.0f) << 8 |
+                      (uint32_t)(col[2] * 255.0f);
+        out[0] = hi / 65535.0f;
+        out[1] = lo / 65535.0f;
+        out[2] = 1.0f;
+        break;
+    }
+    default:
+        /* FIXME: HILO hemisphere modes */
+        memcpy(out, col, 3 * sizeof(float));
+        break;
+    }
+}
+
+static inline float dot3(const float *a, const float *b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void remap_cube_to_2d(const float *c, float uv[2])
+{
+    float ax = fabsf(c[0]), ay = fabsf(c[1]), az = fabsf(c[2]);
+
+    if (ax > ay && ax > az) {
+        uv[0] = c[0] > 0.0f ? -c[2] : c[2];
+        uv[1] = c[1];
+        uv[0] /= ax;
+        uv[1] /= ax;
+    } else if (ay > ax && ay > az) {
+        uv[0] = c[0];
+        uv[1] = c[1] > 0.0f ? -c[2] : c[2];
+        uv[0] /= ay;
+        uv[1] /= ay;
+    } else {
+        uv[0] = c[2] > 0.0f ? c[0] : -c[0];
+        uv[1] = c[1];
+        uv[0] /= az;
+        uv[1] /= az;
+    }
+}
+
+/* Samples a cube map stage, remapping the lookup for 2D textures */
+static void sample_cube(const SwCombinerState *cs, int i, const float *dir,
+                        float out[4])
+{
+    const SwSampler *s = &cs->samplers[i];
+
+    if (s->cubemap) {
+        pgraph_sw_sample_texture(s, dir, NULL, NULL, out);
+    } else {
+        float coord[3] = { 0.0f, 0.0f, 0.0f };
+        remap_cube_to_2d(dir, coord);
+        pgraph_sw_sample_texture(s, coord, NULL, NULL, out);
+    }
+}
+
+/* Samples with projected coordinates (x/w, y/w), as textureProj */
+static void sample_project(const SwCombinerState *cs, int i, const float *t,
+                           const float *t_dx, const float *t_dy, float out[4])
+{
+    const SwSampler *s = &cs->samplers[i];
+    float coord[3] = { t[0] / t[3], t[1] / t[3], 0.0f };
+
+    if (s->cubemap) {
+        /* See remap2DToCube */
+        float dir[3] = { 1.0f, coord[1], -coord[0] };
+        float len = sqrtf(dot3(dir, dir));
+        for (int j = 0; j < 3; j++) {
+            dir[j] /= len;
+        }
+        pgraph_sw_sample_texture(s, dir, NULL, NULL, out);
+        return;
+    }
+
+    float ddx[2], ddy[2];
+    for (int j = 0; j < 2; j++) {
+        ddx[j] = (t[j] + t_dx[j]) / (t[3] + t_dx[3]) - coord[j];
+        ddy[j] = (t[j] + t_dy[j]) / (t[3] + t_dy[3]) - coord[j];
+    }
+    pgraph_sw_sample_texture(s, coord, ddx, ddy, out);
+}
+
+static void sample_2d(const SwCombinerState *cs, int i, float u, float v,
+                      const float *t_dx, const float *t_dy, float out[4])
+{
+    float coord[3] = { u, v, 0.0f };
+    pgraph_sw_sample_texture(&cs->samplers[i], coord, t_dx, t_dy, out);
+}
+
+static bool check_color_key(const SwCombinerState *cs, int i,
+                            const float *texel)
+{
+    uint32_t c[4];
+    for (int j = 0; j < 4; j++) {
+        c[j] = (uint32_t)(texel[j] * 255.0f + 0.5f);
+    }
+    uint32_t color = (c[3] << 24) | (c[0] << 16) | (c[1] << 8) | c[2];
+    uint32_t mask = cs->color_key_mask[i];
+    return (color & mask) == (cs->color_key[i] & mask);
+}
+
+static bool is_texture_fetch(unsigned int mode)
+{
+    switch (mode) {
+    case PS_TEXTUREMODES_NONE:
+    case PS_TEXTUREMODES_PASSTHRU:
+    case PS_TEXTUREMODES_CLIPPLANE:
+    case PS_TEXTUREMODES_BRDF:
+    case PS_TEXTUREMODES_DOT_ZW:
+    case PS_TEXTUREMODES_DOTPRODUCT:
+    case PS_TEXTUREMODES_DOT_RFLCT_SPEC_CONST:
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* Evaluates the texture stages, returns false if the fragment is discarded */
+static bool compute_texture_stages(const SwCombinerState *cs, const float *var,
+                                   const float *var_dx, const float *var_dy,
+                                   Reg *t)
+{
+    float dot[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        const float *pt = &var[SW_VAR_T0 + i * 4];
+        const float *pt_dx = &var_dx[SW_VAR_T0 + i * 4];
+        const float *pt_dy = &var_dy[SW_VAR_T0 + i * 4];
+        const float *in = t[cs->input_tex[i] & 3];
+        float *out = t[i];
+        float m[3], v[3];
+
+        switch (cs->tex_mode[i]) {
+        case PS_TEXTUREMODES_PROJECT2D:
+            sample_project(cs, i, pt, pt_dx, pt_dy, out);
+            break;
+        case PS_TEXTUREMODES_PROJECT3D: {
+            /* FIXME: 3D textures and shadow map comparison */
+            sample_project(cs, i, pt, pt_dx, pt_dy, out);
+            break;
+        }
+        case PS_TEXTUREMODES_CUBEMAP:
+            sample_cube(cs, i, pt, out);
+            break;
+        case PS_TEXTUREMODES_PASSTHRU:
+            memcpy(out, pt, 4 * sizeof(float));
+            break;
+        case PS_TEXTUREMODES_CLIPPLANE:
+            for (int j = 0; j < 4; j++) {
+                bool ge = (cs->clip_mode >> (4 * i + j)) & 1;
+                if (ge ? pt[j] >= 0.0f : pt[j] < 0.0f) {
+                    return false;
+                }
+            }
+            memset(out, 0, 4 * sizeof(float));
+            break;
+        case PS_TEXTUREMODES_BUMPENVMAP:
+        case PS_TEXTUREMODES_BUMPENVMAP_LUM: {
+            float ds = sign3(in[2]), dt = sign3(in[1]);
+            const float *bm = cs->bump_mat[i];
+            float u = pt[0] + bm[0] * ds + bm[2] * dt;
+            float w = pt[1] + bm[1] * ds + bm[3] * dt;
+            sample_2d(cs, i, u, w, pt_dx, pt_dy, out);
+            if (cs->tex_mode[i] == PS_TEXTUREMODES_BUMPENVMAP_LUM) {
+                float scale = cs->bump_scale[i] * in[0] + cs->bump_offset[i];
+                for (int j = 0; j < 4; j++) {
+                    out[j] *= scale;
+                }
+            }
+            break;
+        }
+        case PS_TEXTUREMODES_DOT_ST:
+            dotmap(cs->dot_map[i], in, m);
+            dot[i] = dot3(pt, m);
+            sample_2d(cs, i, dot[i - 1], dot[i], NULL, NULL, out);
+            break;
+        case PS_TEXTUREMODES_DOT_ZW:
+            /* FIXME: Depth replacement */
+            dotmap(cs->dot_map[i], in, m);
+            dot[i] = dot3(pt, m);
+            memset(out, 0, 4 * sizeof(float));
+            break;
+        case PS_TEXTUREMODES_DOT_RFLCT_DIFF: {
+            dotmap(cs->dot_map[i], in, m);
+            dot[i] = dot3(pt, m);
+            float n_m[3];
+            dotmap(cs->dot_map[i + 1], t[cs->input_tex[i + 1] & 3], n_m);
+            v[0] = dot[i - 1];
+            v[1] = dot[i];
+            v[2] = dot3(&var[SW_VAR_T0 + (i + 1) * 4], n_m);
+            sample_cube(cs, i, v, out);
+            break;
+        }
+        case PS_TEXTUREMODES_DOT_RFLCT_SPEC: {
+            dotmap(cs->dot_map[i], in, m);
+            dot[i] = dot3(pt, m);
+            float n[3] = { dot[i - 2], dot[i - 1], dot[i] };
+            float e[3] = { var[SW_VAR_T0 + (i - 2) * 4 + 3],
+                           var[SW_VAR_T0 + (i - 1) * 4 + 3], pt[3] };
+            float k = 2.0f * dot3(n, e) / dot3(n, n);
+            for (int j = 0; j < 3; j++) {
+                v[j] = n[j] * k - e[j];
+            }
+            sample_cube(cs, i, v, out);
+            break;
+        }
+        case PS_TEXTUREMODES_DOT_STR_3D:
+            /* FIXME: 3D textures */
+            dotmap(cs->dot_map[i], in, m);
+            dot[i] = dot3(pt, m);
+            sample_2d(cs, i, dot[i - 2], dot[i - 1], NULL, NULL, out);
+            break;
+        case PS_TEXTUREMODES_DOT_STR_CUBE:
+            dotmap(cs->dot_map[i], in, m);
+            dot[i] = dot3(pt, m);
+            v[0] = dot[i - 2];
+            v[1] = dot[i - 1];
+            v[2] = dot[i];
+            sample_cube(cs, i, v, out);
+            break;
+        case PS_TEXTUREMODES_DPNDNT_AR:
+            sample_2d(cs, i, in[3], in[0], NULL, NULL, out);
+            break;
+        case PS_TEXTUREMODES_DPNDNT_GB:
+            sample_2d(cs, i, in[1], in[2], NULL, NULL, out);
+            break;
+        case PS_TEXTUREMODES_DOTPRODUCT:
+            dotmap(cs->dot_map[i], in, m);
+            dot[i] = dot3(pt, m);
+            memset(out, 0, 4 * sizeof(float));
+            break;
+        case PS_TEXTUREMODES_BRDF:
+        case PS_TEXTUREMODES_DOT_RFLCT_SPEC_CONST:
+            memset(out, 0, 4 * sizeof(float));
+            break;
+        default:
+            out[0] = out[1] = out[2] = 0.0f;
+            out[3] = 1.0f;
+            break;
+        }
+
+        if (!is_texture_fetch(cs->tex_mode[i])) {
+            continue;
+        }
+
+        if (cs->samplers[i].alpha_kill && out[3] == 0.0f) {
+            return false;
+        }
+
+        if (cs->color_key_mode[i] != COLOR_KEY_NONE &&
+            check_color_key(cs, i, out)) {
+            switch (cs->color_key_mode[i]) {
+            case COLOR_KEY_DISCARD:
+                return false;
+            case COLOR_KEY_KILL_ALPHA:
+                out[3] = 0.0f;
+                break;
+            case COLOR_KEY_KILL_COLOR_AND_ALPHA:
+                memset(out, 0, 4 * sizeof(float));
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+static inline float map_input(unsigned int mod, float x)
+{
+    switch (mod) {
+    case PS_INPUTMAPPING_UNSIGNED_IDENTITY: return MAX(x, 0.0f);
+    case PS_INPUTMAPPING_UNSIGNED_INVERT: return 1.0f - MIN(MAX(x, 0.0f), 1.0f);
+    case PS_INPUTMAPPING_EXPAND_NORMAL: return 2.0f * MAX(x, 0.0f) - 1.0f;
+    case PS_INPUTMAPPING_EXPAND_NEGATE: return -2.0f * MAX(x, 0.0f) + 1.0f;
+    case PS_INPUTMAPPING_HALFBIAS_NORMAL: return MAX(x, 0.0f) - 0.5f;
+    case PS_INPUTMAPPING_HALFBIAS_NEGATE: return -MAX(x, 0.0f) + 0.5f;
+    case PS_INPUTMAPPING_SIGNED_IDENTITY: return x;
+    case PS_INPUTMAPPING_SIGNED_NEGATE: return -x;
+    default: return x;
+    }
+}
+
+static inline float map_output(unsigned int mapping, float x)
+{
+    switch (mapping) {
+    case PS_COMBINEROUTPUT_BIAS: return x - 0.5f;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_1: return x * 2.0f;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_1_BIAS: return (x - 0.5f) * 2.0f;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_2: return x * 4.0f;
+    case PS_COMBINEROUTPUT_SHIFTRIGHT_1: return x / 2.0f;
+    default: return x;
+    }
+}
+
+static inline float clamp_signed(float x)
+{
+    return MIN(MAX(x, -1.0f), 1.0f);
+}
+
+static void get_input_rgb(Reg *regs, unsigned int value, float out[3])
+{
+    const float *reg = regs[value & 0xF];
+    unsigned int mod = value & 0xE0;
+
+    for (int i = 0; i < 3; i++) {
+        float x = (value & PS_CHANNEL_ALPHA) ? reg[3] : reg[i];
+        out[i] = map_input(mod, x);
+    }
+}
+
+static float get_input_alpha(Reg *regs, unsigned int value)
+{
+    const float *reg = regs[value & 0xF];
+    float x = (value & PS_CHANNEL_ALPHA) ? reg[3] : reg[2];
+    return map_input(value & 0xE0, x);
+}
+
+static inline bool is_writable(unsigned int reg)
+{
+    switch (reg) {
+    case PS_REGISTER_V0:
+    case PS_REGISTER_V1:
+    case PS_REGISTER_T0:
+    case PS_REGISTER_T1:
+    case PS_REGISTER_T2:
+    case PS_REGISTER_T3:
+    case PS_REGISTER_R0:
+    case PS_REGISTER_R1:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool mux_select(const SwCombinerState *cs, Reg *regs)
+{
+    float r0a = regs[PS_REGISTER_R0][3];
+    if (cs->flags & PS_COMBINERCOUNT_MUX_MSB) {
+        return r0a >= 0.5f;
+    }
+    return ((unsigned int)(r0a * 255.0f) & 1) == 1;
+}
+
+static void run_stage(const SwCombinerState *cs, int stage, Reg *regs)
+{
+    int c0 = (cs->flags & PS_COMBINERCOUNT_UNIQUE_C0) ? stage : 0;
+    int c1 = (cs->flags & PS_COMBINERCOUNT_UNIQUE_C1) ? stage : 0;
+    memcpy(regs[PS_REGISTER_C0], cs->constant0[c0], sizeof(Reg));
+    memcpy(regs[PS_REGISTER_C1], cs->constant1[c1], sizeof(Reg));
+
+    bool mux = mux_select(cs, regs);
+
+    /* RGB portion */
+    uint32_t in = cs->rgb_inputs[stage];
+    uint32_t out = cs->rgb_outputs[stage];
+    unsigned int flags = out >> 12;
+    unsigned int mapping = flags & 0x38;
+    float a[3], b[3], c[3], d[3];
+    get_input_rgb(regs, (in >> 24) & 0xFF, a);
+    get_input_rgb(regs, (in >> 16) & 0xFF, b);
+    get_input_rgb(regs, (in >> 8) & 0xFF, c);
+    get_input_rgb(regs, in & 0xFF, d);
+
+    float ab[3], cd[3], muxsum[3];
+    float ab_dot = dot3(a, b), cd_dot = dot3(c, d);
+    for (int i = 0; i < 3; i++) {
+        ab[i] = (flags & PS_COMBINEROUTPUT_AB_DOT_PRODUCT) ? ab_dot : a[i] * b[i];
+        cd[i] = (flags & PS_COMBINEROUTPUT_CD_DOT_PRODUCT) ? cd_dot : c[i] * d[i];
+        if (flags & PS_COMBINEROUTPUT_AB_CD_MUX) {
+            muxsum[i] = mux ? cd[i] : ab[i];
+        } else {
+            muxsum[i] = ab[i] + cd[i];
+        }
+        ab[i] = clamp_signed(map_output(mapping, ab[i]));
+        cd[i] = clamp_signed(map_output(mapping, cd[i]));
+        muxsum[i] = clamp_signed(map_output(mapping, muxsum[i]));
+    }
+
+    /* Alpha portion */
+    uint32_t alpha_in = cs->alpha_inputs[stage];
+    uint32_t alpha_out = cs->alpha_outputs[stage];
+    unsigned int alpha_mapping = (alpha_out >> 12) & 0x38;
+    float aa = get_input_alpha(regs, (alpha_in >> 24) & 0xFF);
+    float ba = get_input_alpha(regs, (alpha_in >> 16) & 0xFF);
+    float ca = get_input_alpha(regs, (alpha_in >> 8) & 0xFF);
+    float da = get_input_alpha(regs, alpha_in & 0xFF);
+    float ab_a = aa * ba, cd_a = ca * da;
+    float muxsum_a = ((alpha_out >> 12) & PS_COMBINEROUTPUT_AB_CD_MUX) ?
+                         (mux ? cd_a : ab_a) :
+                         ab_a + cd_a;
+    ab_a = clamp_signed(map_output(alpha_mapping, ab_a));
+    cd_a = clamp_signed(map_output(alpha_mapping, cd_a));
+    muxsum_a = clamp_signed(map_output(alpha_mapping, muxsum_a));
+
+    /* Outputs are written once both portions have read their inputs */
+    unsigned int ab_dst = (out >> 4) & 0xF, cd_dst = out & 0xF;
+    unsigned int muxsum_dst = (out >> 8) & 0xF;
+    if (is_writable(ab_dst)) {
+        memcpy(regs[ab_dst], ab, sizeof(ab));
+        if (flags & PS_COMBINEROUTPUT_AB_BLUE_TO_ALPHA) {
+            regs[ab_dst][3] = ab[2];
+        }
+    }
+    if (is_writable(cd_dst)) {
+        memcpy(regs[cd_dst], cd, sizeof(cd));
+        if (flags & PS_COMBINEROUTPUT_CD_BLUE_TO_ALPHA) {
+            regs[cd_dst][3] = cd[2];
+        }
+    }
+    if (is_writable(muxsum_dst)) {
+        memcpy(regs[muxsum_dst], muxsum, sizeof(muxsum));
+    }
+
+    ab_dst = (alpha_out >> 4) & 0xF;
+    cd_dst = alpha_out & 0xF;
+    muxsum_dst = (alpha_out >> 8) & 0xF;
+    if (is_writable(ab_dst)) {
+        regs[ab_dst][3] = ab_a;
+    }
+    if (is_writable(cd_dst)) {
+        regs[cd_dst][3] = cd_a;
+    }
+    if (is_writable(muxsum_dst)) {
+        regs[muxsum_dst][3] = muxsum_a;
+    }
+}
+
+static void run_final_stage(const SwCombinerState *cs, Reg *regs,
+                            float out[4])
+{
+    memcpy(regs[PS_REGISTER_C0], cs->constant0[8], sizeof(Reg));
+    memcpy(regs[PS_REGISTER_C1], cs->constant1[8], sizeof(Reg));
+
+    unsigned int flags = cs->final_inputs_1 & 0xFF;
+    const float *v1 = regs[PS_REGISTER_V1];
+    const float *r0 = regs[PS_REGISTER_R0];
+    float *sum = regs[PS_REGISTER_V1R0_SUM];
+    for (int i = 0; i < 3; i++) {
+        float x = (flags & PS_FINALCOMBINERSETTING_COMPLEMENT_V1) ?
+                      1.0f - v1[i] : v1[i];
+        float y = (flags & PS_FINALCOMBINERSETTING_COMPLEMENT_R0) ?
+                      1.0f - r0[i] : r0[i];
+        sum[i] = x + y;
+        if (flags & PS_FINALCOMBINERSETTING_CLAMP_SUM) {
+            sum[i] = MIN(MAX(sum[i], 0.0f), 1.0f);
+        }
+    }
+    sum[3] = 0.0f;
+
+    float e[3], f[3];
+    memset(regs[PS_REGISTER_EF_PROD], 0, sizeof(Reg));
+    get_input_rgb(regs, (cs->final_inputs_1 >> 24) & 0xFF, e);
+    get_input_rgb(regs, (cs->final_inputs_1 >> 16) & 0xFF, f);
+    for (int i = 0; i < 3; i++) {
+        regs[PS_REGISTER_EF_PROD][i] = e[i] * f[i];
+    }
+
+    float a[3], b[3], c[3], d[3];
+    get_input_rgb(regs, (cs->final_inputs_0 >> 24) & 0xFF, a);
+    get_input_rgb(regs, (cs->final_inputs_0 >> 16) & 0xFF, b);
+    get_input_rgb(regs, (cs->final_inputs_0 >> 8) & 0xFF, c);
+    get_input_rgb(regs, cs->final_inputs_0 & 0xFF, d);
+    for (int i = 0; i < 3; i++) {
+        out[i] = d[i] + c[i] * (1.0f - a[i]) + b[i] * a[i];
+    }
+    out[3] = get_input_alpha(regs, (cs->final_inputs_1 >> 8) & 0xFF);
+}
+
+/*
+ * Shades a fragment given its interpolated varyings and their screen space
+ * derivatives. Returns false if the fragment is discarded.
+ */
+bool pgraph_sw_shade_fragment(const SwCombinerState *cs, const float *var,
+                              const float *var_dx, const float *var_dy,
+                              const float pos[2], float out[4])
+{
+    Reg regs[NUM_REGS];
+    memset(regs, 0, sizeof(regs));
+
+    if (!compute_texture_stages(cs, var, var_dx, var_dy,
+                                &regs[PS_REGISTER_T0])) {
+        return false;
+    }
+
+    memcpy(regs[PS_REGISTER_V0], &var[SW_VAR_D0], sizeof(Reg));
+    memcpy(regs[PS_REGISTER_V1], &var[SW_VAR_D1], sizeof(Reg));
+    memcpy(regs[PS_REGISTER_FOG], cs->fog_color, 3 * sizeof(float));
+    regs[PS_REGISTER_FOG][3] = MIN(MAX(var[SW_VAR_FOG], 0.0f), 1.0f);
+    regs[PS_REGISTER_R0][3] = cs->tex_mode[0] != PS_TEXTUREMODES_NONE ?
+                                  regs[PS_REGISTER_T0][3] :
+                                  1.0f;
+
+    for (int i = 0; i < cs->num_stages; i++) {
+        run_stage(cs, i, regs);
+    }
+
+    if (cs->final_enabled) {
+        run_final_stage(cs, regs, out);
+    } else {
+        memcpy(out, regs[PS_REGISTER_R0], sizeof(Reg));
+    }
+
+    return true;
+}
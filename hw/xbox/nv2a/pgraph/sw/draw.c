@@ -0,0 +1,187 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "renderer.h"
+
+static SwVertex *reserve_vertices(PGRAPHSWState *r, size_t count)
+{
+    if (count > r->vertices_capacity) {
+        r->vertices_capacity = MAX(count, r->vertices_capacity * 2);
+        r->vertices =
+            g_realloc_n(r->vertices, r->vertices_capacity, sizeof(SwVertex));
+    }
+    return r->vertices;
+}
+
+static uint32_t *reserve_indices(PGRAPHSWState *r, size_t count)
+{
+    if (count > r->indices_capacity) {
+        r->indices_capacity = MAX(count, r->indices_capacity * 2);
+        r->indices =
+            g_realloc_n(r->indices, r->indices_capacity, sizeof(uint32_t));
+    }
+    return r->indices;
+}
+
+void pgraph_sw_draw_begin(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    NV2A_DPRINTF("sw draw_begin, primitive mode %d\n", pg->primitive_mode);
+
+    if (pg->zpass_pixel_count_enable) {
+        nv2a_profile_inc_counter(NV2A_PROF_QUERY);
+    }
+}
+
+void pgraph_sw_draw_end(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    uint32_t control_0 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0);
+    bool mask_alpha = control_0 & NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE;
+    bool mask_red = control_0 & NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE;
+    bool mask_green = control_0 & NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE;
+    bool mask_blue = control_0 & NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE;
+    bool color_write = mask_alpha || mask_red || mask_green || mask_blue;
+    bool depth_test = control_0 & NV_PGRAPH_CONTROL_0_ZENABLE;
+    bool stencil_test =
+        pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1) & NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE;
+    bool is_nop_draw = !(color_write || depth_test || stencil_test);
+
+    if (is_nop_draw) {
+        // FIXME: Check PGRAPH register 0x880. See pgraph_gl_draw_end.
+        return;
+    }
+
+    pgraph_sw_flush_draw(d);
+
+    pg->draw_time++;
+}
+
+static void draw_arrays(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    unsigned int first = pg->draw_arrays_min_start;
+    unsigned int count = pg->draw_arrays_max_count - first;
+
+    SwVertex *vertices = reserve_vertices(r, count);
+    pgraph_sw_process_vertices(d, first, count,
+                               pg->draw_arrays_max_count - 1, vertices);
+
+    /* Each segment is a separate primitive, as with glMultiDrawArrays */
+    for (int i = 0; i < pg->draw_arrays_length; i++) {
+        unsigned int segment_count = pg->draw_arrays_count[i];
+        uint32_t *indices = reserve_indices(r, segment_count);
+        for (unsigned int j = 0; j < segment_count; j++) {
+            indices[j] = pg->draw_arrays_start[i] - first + j;
+        }
+        pgraph_sw_draw_primitives(d, vertices, indices, segment_count);
+    }
+}
+
+static void draw_inline_elements(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    uint32_t min_element = (uint32_t)-1;
+    uint32_t max_element = 0;
+    for (int i = 0; i < pg->inline_elements_length; i++) {
+        max_element = MAX(pg->inline_elements[i], max_element);
+        min_element = MIN(pg->inline_elements[i], min_element);
+    }
+
+    unsigned int count = max_element - min_element + 1;
+    SwVertex *vertices = reserve_vertices(r, count);
+    pgraph_sw_process_vertices(
+        d, min_element, count,
+        pg->inline_elements[pg->inline_elements_length - 1], vertices);
+
+    uint32_t *indices = reserve_indices(r, pg->inline_elements_length);
+    for (int i = 0; i < pg->inline_elements_length; i++) {
+        indices[i] = pg->inline_elements[i] - min_element;
+    }
+    pgraph_sw_draw_primitives(d, vertices, indices,
+                              pg->inline_elements_length);
+}
+
+static void draw_inline(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    /* Upper bound, inline arrays pack at least one word per vertex */
+    size_t max_count = MAX(pg->inline_buffer_length, pg->inline_array_length);
+    SwVertex *vertices = reserve_vertices(r, max_count);
+    size_t count = pgraph_sw_process_inline_vertices(d, vertices);
+
+    uint32_t *indices = reserve_indices(r, count);
+    for (size_t i = 0; i < count; i++) {
+        indices[i] = i;
+    }
+    pgraph_sw_draw_primitives(d, vertices, indices, count);
+}
+
+void pgraph_sw_flush_draw(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    uint32_t control_0 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0);
+    bool stencil_test = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1) &
+                        NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE;
+    bool color = pgraph_color_write_enabled(pg);
+    bool zeta = (control_0 & NV_PGRAPH_CONTROL_0_ZENABLE) || stencil_test ||
+                pgraph_zeta_write_enabled(pg);
+
+    if (!pgraph_sw_surface_bind(d, color, zeta)) {
+        return;
+    }
+
+    pgraph_sw_setup_draw_state(d);
+
+    if (pg->draw_arrays_length) {
+        nv2a_profile_inc_counter(NV2A_PROF_DRAW_ARRAYS);
+        assert(pg->inline_elements_length == 0);
+        assert(pg->inline_buffer_length == 0);
+        assert(pg->inline_array_length == 0);
+        draw_arrays(d);
+    } else if (pg->inline_elements_length) {
+        nv2a_profile_inc_counter(NV2A_PROF_INLINE_ELEMENTS);
+        assert(pg->inline_buffer_length == 0);
+        assert(pg->inline_array_length == 0);
+        draw_inline_elements(d);
+    } else if (pg->inline_buffer_length) {
+        nv2a_profile_inc_counter(NV2A_PROF_INLINE_BUFFERS);
+        assert(pg->inline_array_length == 0);
+        draw_inline(d);
+    } else if (pg->inline_array_length) {
+        nv2a_profile_inc_counter(NV2A_PROF_INLINE_ARRAYS);
+        draw_inline(d);
+    } else {
+        NV2A_DPRINTF("EMPTY NV097_SET_BEGIN_END\n");
+        NV2A_UNCONFIRMED("EMPTY NV097_SET_BEGIN_END");
+    }
+
+    pgraph_sw_flush_triangles(d);
+    pgraph_sw_surface_unbind(d);
+}
@@ -0,0 +1,645 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "hw/xbox/nv2a/pgraph/psh_regs.h"
+#include "pixel.h"
+
+/* Sample grid extent that keeps edge function products within 64 bits */
+#define MAX_RASTER_COORD (SW_GUARD_BAND * 4)
+
+static inline uint32_t get_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void put_le16(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*
+ * Computes the depth plane of a primitive from its window space vertex
+ * positions, following calc_triz in the geometry shader. With w-buffering the
+ * plane interpolates 1/w.
+ */
+void pgraph_sw_calc_depth_plane(const SwDrawState *ds, const float *p0,
+                                const float *p1, const float *p2,
+                                SwPlane *plane, float *mz)
+{
+    float v0 = ds->z_perspective ? 1.0f / p0[3] : p0[2];
+    float v1 = ds->z_perspective ? 1.0f / p1[3] : p1[2];
+    float v2 = ds->z_perspective ? 1.0f / p2[3] : p2[2];
+
+    float dx1 = p1[0] - p0[0], dy1 = p1[1] - p0[1];
+    float dx2 = p2[0] - p0[0], dy2 = p2[1] - p0[1];
+    float det = dx1 * dy2 - dx2 * dy1;
+
+    plane->a = ((v1 - v0) * dy2 - (v2 - v0) * dy1) / det;
+    plane->b = ((v2 - v0) * dx1 - (v1 - v0) * dx2) / det;
+    plane->c = v0;
+    plane->x0 = p0[0];
+    plane->y0 = p0[1];
+
+    /* Points and degenerate primitives take the depth of the first vertex */
+    if (!isfinite(plane->a) || !isfinite(plane->b)) {
+        plane->a = 0.0f;
+        plane->b = 0.0f;
+    }
+
+    if (mz) {
+        *mz = MAX(fabsf(plane->a), fabsf(plane->b));
+    }
+}
+
+static inline bool is_top_left(int64_t a, int64_t b)
+{
+    return a > 0 || (a == 0 && b > 0);
+}
+
+/*
+ * Sets up the edge functions and interpolants of a triangle, returning false
+ * if it covers no samples within the scissor rectangle.
+ */
+bool pgraph_sw_setup_triangle(const SwDrawState *ds, const SwRasterVertex *v0,
+                              const SwRasterVertex *v1,
+                              const SwRasterVertex *v2, const SwPlane *plane,
+                              float mz, SwTriangle *t)
+{
+    /* Lines and points are not clipped to the guard band */
+    if (!(fabsf(v0->x) < MAX_RASTER_COORD && fabsf(v0->y) < MAX_RASTER_COORD &&
+          fabsf(v1->x) < MAX_RASTER_COORD && fabsf(v1->y) < MAX_RASTER_COORD &&
+          fabsf(v2->x) < MAX_RASTER_COORD && fabsf(v2->y) < MAX_RASTER_COORD)) {
+        return false;
+    }
+
+    int64_t x[3] = { llrintf(v0->x * 16.0f), llrintf(v1->x * 16.0f),
+                     llrintf(v2->x * 16.0f) };
+    int64_t y[3] = { llrintf(v0->y * 16.0f), llrintf(v1->y * 16.0f),
+                     llrintf(v2->y * 16.0f) };
+    const SwRasterVertex *v[3] = { v0, v1, v2 };
+
+    int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0) {
+        return false;
+    }
+    if (area < 0) {
+        /* Edge functions below assume positive orientation */
+        const SwRasterVertex *tv = v[1];
+        v[1] = v[2];
+        v[2] = tv;
+        int64_t tmp = x[1];
+        x[1] = x[2];
+        x[2] = tmp;
+        tmp = y[1];
+        y[1] = y[2];
+        y[2] = tmp;
+        area = -area;
+    }
+
+    /* Pixel centers are at +8 in 28.4 fixed point */
+    int min_x = (MIN(MIN(x[0], x[1]), x[2]) - 8 + 15) >> 4;
+    int min_y = (MIN(MIN(y[0], y[1]), y[2]) - 8 + 15) >> 4;
+    int max_x = (MAX(MAX(x[0], x[1]), x[2]) - 8) >> 4;
+    int max_y = (MAX(MAX(y[0], y[1]), y[2]) - 8) >> 4;
+    min_x = MAX(min_x, ds->scissor_x0);
+    min_y = MAX(min_y, ds->scissor_y0);
+    max_x = MIN(max_x, ds->scissor_x1 - 1);
+    max_y = MIN(max_y, ds->scissor_y1 - 1);
+    if (min_x > max_x || min_y > max_y) {
+        return false;
+    }
+
+    t->min_x = min_x;
+    t->min_y = min_y;
+    t->max_x = max_x;
+    t->max_y = max_y;
+
+    for (int i = 0; i < 3; i++) {
+        int a = (i + 1) % 3, b = (i + 2) % 3;
+        t->edge_a[i] = y[a] - y[b];
+        t->edge_b[i] = x[b] - x[a];
+        t->edge_c[i] = -(t->edge_a[i] * x[a] + t->edge_b[i] * y[a]);
+        if (!is_top_left(t->edge_a[i], t->edge_b[i])) {
+            t->edge_c[i] -= 1;
+        }
+        t->inv_w[i] = v[i]->inv_w;
+        memcpy(t->var[i], v[i]->var, sizeof(t->var[i]));
+    }
+    t->inv_area = 1.0f / (float)area;
+    t->z = *plane;
+    t->mz = mz;
+
+    return true;
+}
+
+static inline bool compare(unsigned int func, uint32_t a, uint32_t b)
+{
+    switch (func) {
+    case NV_PGRAPH_CONTROL_0_ZFUNC_NEVER: return false;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_LESS: return a < b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_EQUAL: return a == b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_LEQUAL: return a <= b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_GREATER: return a > b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_NOTEQUAL: return a != b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_GEQUAL: return a >= b;
+    default: return true;
+    }
+}
+
+static bool alpha_test(const SwDrawState *ds, float alpha)
+{
+    int a = (int)roundf(alpha * 255.0f);
+    switch (ds->alpha_func) {
+    case ALPHA_FUNC_NEVER: return false;
+    case ALPHA_FUNC_LESS: return a < ds->alpha_ref;
+    case ALPHA_FUNC_EQUAL: return a == ds->alpha_ref;
+    case ALPHA_FUNC_LEQUAL: return a <= ds->alpha_ref;
+    case ALPHA_FUNC_GREATER: return a > ds->alpha_ref;
+    case ALPHA_FUNC_NOTEQUAL: return a != ds->alpha_ref;
+    case ALPHA_FUNC_GEQUAL: return a >= ds->alpha_ref;
+    default: return true;
+    }
+}
+
+static uint8_t stencil_op(const SwDrawState *ds, unsigned int op,
+                          uint8_t value)
+{
+    switch (op) {
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_ZERO: return 0;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_REPLACE: return ds->stencil_ref;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_INCRSAT: return MIN(value + 1, 0xFF);
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_DECRSAT: return MAX(value - 1, 0);
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_INVERT: return ~value;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_INCR: return value + 1;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_DECR: return value - 1;
+    default: return value;
+    }
+}
+
+/* Converts a depth value to its integer zeta surface encoding */
+static uint32_t encode_depth(const SwDrawState *ds, float z)
+{
+    bool z16 = ds->zeta_format == NV097_SET_SURFACE_FORMAT_ZETA_Z16;
+    uint32_t max = z16 ? 0xFFFF : 0xFFFFFF;
+
+    if (!(z > 0.0f)) {
+        return 0;
+    }
+    if (!ds->float_depth) {
+        return MIN((uint32_t)floorf(z), max);
+    }
+
+    /* Inverse of convert_f16_to_float and convert_f24_to_float */
+    uint32_t bits = *(uint32_t *)&z;
+    if (z16) {
+        return bits < 0x3C000000 ? 0 : MIN((bits - 0x3C000000) >> 11, max);
+    }
+    return MIN(bits >> 7, max);
+}
+
+static void blend_factor(unsigned int factor, const float src[4],
+                         const float dst[4], const float constant[4],
+                         float out[4])
+{
+    for (int i = 0; i < 4; i++) {
+        switch (factor) {
+        case NV_PGRAPH_BLEND_SFACTOR_ZERO: out[i] = 0.0f; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE: out[i] = 1.0f; break;
+        case NV_PGRAPH_BLEND_SFACTOR_SRC_COLOR: out[i] = src[i]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_SRC_COLOR:
+            out[i] = 1.0f - src[i];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_SRC_ALPHA: out[i] = src[3]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_SRC_ALPHA:
+            out[i] = 1.0f - src[3];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_DST_ALPHA: out[i] = dst[3]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_DST_ALPHA:
+            out[i] = 1.0f - dst[3];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_DST_COLOR: out[i] = dst[i]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_DST_COLOR:
+            out[i] = 1.0f - dst[i];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_SRC_ALPHA_SATURATE:
+            out[i] = i == 3 ? 1.0f : MIN(src[3], 1.0f - dst[3]);
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_CONSTANT_COLOR: out[i] = constant[i]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_CONSTANT_COLOR:
+            out[i] = 1.0f - constant[i];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_CONSTANT_ALPHA: out[i] = constant[3]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_CONSTANT_ALPHA:
+            out[i] = 1.0f - constant[3];
+            break;
+        default:
+            out[i] = 0.0f;
+            break;
+        }
+    }
+}
+
+static void blend(const SwDrawState *ds, const float src[4],
+                  const float dst[4], float out[4])
+{
+    float sf[4], df[4];
+    blend_factor(ds->blend_sfactor, src, dst, ds->blend_color, sf);
+    blend_factor(ds->blend_dfactor, src, dst, ds->blend_color, df);
+
+    for (int i = 0; i < 4; i++) {
+        float s = src[i] * sf[i], d = dst[i] * df[i];
+        switch (ds->blend_eqn) {
+        case 0: out[i] = s - d; break;
+        case 1: case 5: out[i] = d - s; break;
+        case 3: out[i] = MIN(src[i], dst[i]); break;
+        case 4: out[i] = MAX(src[i], dst[i]); break;
+        default: out[i] = s + d; break;
+        }
+        out[i] = MIN(MAX(out[i], 0.0f), 1.0f);
+    }
+}
+
+static bool window_clip_test(const SwDrawState *ds, int x, int y)
+{
+    for (int i = 0; i < 8; i++) {
+        const SwClipRegion *c = &ds->window_clip[i];
+        bool outside = x < c->x_min || y < c->y_min || x >= c->x_max ||
+                       y >= c->y_max;
+        if (!outside) {
+            return !ds->window_clip_exclusive;
+        }
+    }
+    return ds->window_clip_exclusive;
+}
+
+static inline void interpolate(const SwTriangle *t, const float w[3], int first,
+                               int count, float *out)
+{
+    for (int i = first; i < first + count; i++) {
+        out[i] = w[0] * t->var[0][i] + w[1] * t->var[1][i] +
+                 w[2] * t->var[2][i];
+    }
+}
+
+/* Perspective correct interpolation weights from edge function values */
+static inline bool get_weights(const SwTriangle *t, const float e[3],
+                               float w[3])
+{
+    float sum = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        w[i] = e[i] * t->inv_area * t->inv_w[i];
+        sum += w[i];
+    }
+    if (sum == 0.0f) {
+        return false;
+    }
+    float inv_sum = 1.0f / sum;
+    for (int i = 0; i < 3; i++) {
+        w[i] *= inv_sum;
+    }
+    return true;
+}
+
+static bool shade_pixel(const SwDrawState *ds, const SwSurface *color,
+                        const SwSurface *zeta, const SwTriangle *t, int x,
+                        int y, const float e[3])
+{
+    if (!window_clip_test(ds, x, y)) {
+        return false;
+    }
+
+    /* Depth, see the fragment shader prologue in glsl/psh.c */
+    float ux = (x + 0.5f) / ds->aa_x, uy = (y + 0.5f) / ds->aa_y;
+    float zvalue = t->z.c + t->z.a * (ux - t->z.x0) + t->z.b * (uy - t->z.y0);
+    if (ds->z_perspective) {
+        zvalue = 1.0f / zvalue;
+        if (zvalue > 0.0f) {
+            float zslopeofs = ds->depth_factor * t->mz * zvalue * zvalue;
+            zvalue += ds->depth_offset;
+            zvalue += zslopeofs;
+        } else {
+            zvalue = FLT_MAX;
+        }
+        if (isnan(zvalue)) {
+            zvalue = FLT_MAX;
+        }
+    } else {
+        zvalue += ds->depth_offset;
+        zvalue += ds->depth_factor * t->mz;
+    }
+    if (ds->depth_clipping) {
+        if (zvalue < ds->clip_min || ds->clip_max < zvalue) {
+            return false;
+        }
+    } else {
+        zvalue = MIN(MAX(zvalue, ds->clip_min), ds->clip_max);
+    }
+
+    float w[3], w_dx[3], w_dy[3];
+    float var[SW_NUM_VARYINGS];
+    float var_dx[SW_NUM_VARYINGS], var_dy[SW_NUM_VARYINGS];
+    if (!get_weights(t, e, w)) {
+        w[0] = 1.0f;
+        w[1] = w[2] = 0.0f;
+    }
+    interpolate(t, w, 0, SW_NUM_VARYINGS, var);
+
+    /* Texture coordinate derivatives for level of detail selection */
+    float ex[3], ey[3];
+    for (int i = 0; i < 3; i++) {
+        ex[i] = e[i] + t->edge_a[i] * 16;
+        ey[i] = e[i] + t->edge_b[i] * 16;
+    }
+    int num_tex = NV2A_MAX_TEXTURES * 4;
+    if (get_weights(t, ex, w_dx) && get_weights(t, ey, w_dy)) {
+        interpolate(t, w_dx, SW_VAR_T0, num_tex, var_dx);
+        interpolate(t, w_dy, SW_VAR_T0, num_tex, var_dy);
+        for (int i = SW_VAR_T0; i < SW_VAR_T0 + num_tex; i++) {
+            var_dx[i] -= var[i];
+            var_dy[i] -= var[i];
+        }
+    } else {
+        memset(&var_dx[SW_VAR_T0], 0, num_tex * sizeof(float));
+        memset(&var_dy[SW_VAR_T0], 0, num_tex * sizeof(float));
+    }
+
+    float pos[2] = { ux, uy };
+    float frag[4];
+    if (!pgraph_sw_shade_fragment(&ds->combiner, var, var_dx, var_dy, pos,
+                                  frag)) {
+        return false;
+    }
+
+    if (ds->alpha_test && !alpha_test(ds, frag[3])) {
+        return false;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        frag[i] = MIN(MAX(frag[i], 0.0f), 1.0f);
+    }
+
+    if (ds->depth_test || ds->stencil_test) {
+        uint8_t *zp = zeta->data + y * zeta->pitch + x * zeta->bytes_per_pixel;
+        bool z24 = ds->zeta_format == NV097_SET_SURFACE_FORMAT_ZETA_Z24S8;
+        uint32_t stored = z24 ? get_le32(zp) : get_le16(zp);
+        uint32_t stored_z = z24 ? stored >> 8 : stored;
+        uint8_t stencil = z24 ? stored & 0xFF : 0;
+        uint32_t z = encode_depth(ds, zvalue);
+        uint8_t new_stencil = stencil;
+        bool pass = true;
+
+        if (ds->stencil_test &&
+            !compare(ds->stencil_func, ds->stencil_ref & ds->stencil_mask_read,
+                     stencil & ds->stencil_mask_read)) {
+            new_stencil = stencil_op(ds, ds->stencil_op_fail, stencil);
+            pass = false;
+        } else if (ds->depth_test && !compare(ds->depth_func, z, stored_z)) {
+            new_stencil = stencil_op(ds, ds->stencil_op_zfail, stencil);
+            pass = false;
+        } else {
+            new_stencil = stencil_op(ds, ds->stencil_op_zpass, stencil);
+        }
+
+        uint32_t out = stored;
+        if (ds->stencil_write) {
+            uint8_t mask = ds->stencil_mask_write;
+            out = (out & ~(uint32_t)mask) | (new_stencil & mask);
+        }
+        if (pass && ds->depth_write) {
+            out = z24 ? (z << 8) | (out & 0xFF) : z;
+        }
+        if (out != stored) {
+            if (z24) {
+                put_le32(zp, out);
+            } else {
+                put_le16(zp, out);
+            }
+        }
+        if (!pass) {
+            return false;
+        }
+    }
+
+    if (ds->write_r || ds->write_g || ds->write_b || ds->write_a) {
+        uint8_t *cp =
+            color->data + y * color->pitch + x * color->bytes_per_pixel;
+        if (ds->blend) {
+            float dst[4], out[4];
+            pgraph_sw_unpack_color(color, cp, dst);
+            blend(ds, frag, dst, out);
+            pgraph_sw_pack_color(color, cp, out, ds);
+        } else {
+            pgraph_sw_pack_color(color, cp, frag, ds);
+        }
+    }
+
+    return true;
+}
+
+/* Shades the samples of a triangle within [x0, x1] x [y0, y1] */
+void pgraph_sw_rasterize_triangle(const SwDrawState *ds,
+                                  const SwSurface *color,
+                                  const SwSurface *zeta, const SwTriangle *t,
+                                  int x0, int y0, int x1, int y1,
+                                  uint64_t *samples)
+{
+    x0 = MAX(x0, t->min_x);
+    y0 = MAX(y0, t->min_y);
+    x1 = MIN(x1, t->max_x);
+    y1 = MIN(y1, t->max_y);
+
+    int64_t px = (int64_t)x0 * 16 + 8;
+    for (int y = y0; y <= y1; y++) {
+        int64_t py = (int64_t)y * 16 + 8;
+        int64_t e[3];
+        for (int i = 0; i < 3; i++) {
+            e[i] = t->edge_a[i] * px + t->edge_b[i] * py + t->edge_c[i];
+        }
+        for (int x = x0; x <= x1; x++) {
+            if ((e[0] | e[1] | e[2]) >= 0) {
+                float ef[3] = { e[0], e[1], e[2] };
+                if (shade_pixel(ds, color, zeta, t, x, y, ef)) {
+                    (*samples)++;
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                e[i] += t->edge_a[i] * 16;
+            }
+        }
+    }
+}
+
+void pgraph_sw_unpack_color(const SwSurface *s, const uint8_t *p,
+                            float rgba[4])
+{
+    uint32_t v;
+
+    switch (s->format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        v = get_le16(p);
+        rgba[0] = ((v >> 10) & 0x1F) / 31.0f;
+        rgba[1] = ((v >> 5) & 0x1F) / 31.0f;
+        rgba[2] = (v & 0x1F) / 31.0f;
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        v = get_le16(p);
+        rgba[0] = ((v >> 11) & 0x1F) / 31.0f;
+        rgba[1] = ((v >> 5) & 0x3F) / 63.0f;
+        rgba[2] = (v & 0x1F) / 31.0f;
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8:
+        v = get_le32(p);
+        rgba[0] = ((v >> 16) & 0xFF) / 255.0f;
+        rgba[1] = ((v >> 8) & 0xFF) / 255.0f;
+        rgba[2] = (v & 0xFF) / 255.0f;
+        if (s->format == NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8) {
+            rgba[3] = (v >> 24) / 255.0f;
+        } else if (s->format == NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8 ||
+                   s->format == NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8) {
+            rgba[3] = ((v >> 24) & 0x7F) / 127.0f;
+        } else {
+            rgba[3] = 1.0f;
+        }
+        break;
+    // FIXME: Map channel color, follows the GL renderer for now
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        rgba[0] = p[0] / 255.0f;
+        rgba[1] = 0.0f;
+        rgba[2] = 0.0f;
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        rgba[0] = p[0] / 255.0f;
+        rgba[1] = p[1] / 255.0f;
+        rgba[2] = 0.0f;
+        rgba[3] = 1.0f;
+        break;
+    default:
+        assert(!"Invalid color surface format");
+        break;
+    }
+}
+
+static inline uint32_t float_to_unorm(float v, unsigned int max)
+{
+    v = MIN(MAX(v, 0.0f), 1.0f);
+    return (uint32_t)(v * max + 0.5f);
+}
+
+void pgraph_sw_pack_color(const SwSurface *s, uint8_t *p, const float rgba[4],
+                          const SwDrawState *ds)
+{
+    uint32_t r = 0, g = 0, b = 0, a = 0;
+    uint32_t v, mask;
+
+    switch (s->format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        r = float_to_unorm(rgba[0], 31) << 10;
+        g = float_to_unorm(rgba[1], 31) << 5;
+        b = float_to_unorm(rgba[2], 31);
+        a = (s->format == NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5) ?
+                0x8000 : 0;
+        mask = (ds->write_r ? 0x7C00 : 0) | (ds->write_g ? 0x03E0 : 0) |
+               (ds->write_b ? 0x001F : 0) | (ds->write_a ? 0x8000 : 0);
+        v = get_le16(p);
+        put_le16(p, (v & ~mask) | ((r | g | b | a) & mask));
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        r = float_to_unorm(rgba[0], 31) << 11;
+        g = float_to_unorm(rgba[1], 63) << 5;
+        b = float_to_unorm(rgba[2], 31);
+        mask = (ds->write_r ? 0xF800 : 0) | (ds->write_g ? 0x07E0 : 0) |
+               (ds->write_b ? 0x001F : 0);
+        v = get_le16(p);
+        put_le16(p, (v & ~mask) | ((r | g | b) & mask));
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8:
+        r = float_to_unorm(rgba[0], 255) << 16;
+        g = float_to_unorm(rgba[1], 255) << 8;
+        b = float_to_unorm(rgba[2], 255);
+        switch (s->format) {
+        case NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8:
+            a = float_to_unorm(rgba[3], 255) << 24;
+            break;
+        case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8:
+            a = float_to_unorm(rgba[3], 127) << 24;
+            break;
+        case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8:
+            a = 0x80000000 | (float_to_unorm(rgba[3], 127) << 24);
+            break;
+        case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+            a = 0xFF000000;
+            break;
+        default:
+            break;
+        }
+        mask = (ds->write_r ? 0x00FF0000 : 0) | (ds->write_g ? 0x0000FF00 : 0) |
+               (ds->write_b ? 0x000000FF : 0) | (ds->write_a ? 0xFF000000 : 0);
+        v = get_le32(p);
+        put_le32(p, (v & ~mask) | ((r | g | b | a) & mask));
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        if (ds->write_r) {
+            p[0] = float_to_unorm(rgba[0], 255);
+        }
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        if (ds->write_r) {
+            p[0] = float_to_unorm(rgba[0], 255);
+        }
+        if (ds->write_g) {
+            p[1] = float_to_unorm(rgba[1], 255);
+        }
+        break;
+    default:
+        assert(!"Invalid color surface format");
+        break;
+    }
+}
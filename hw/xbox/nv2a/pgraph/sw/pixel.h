@@ -0,0 +1,228 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_SW_PIXEL_H
+#define HW_XBOX_NV2A_PGRAPH_SW_PIXEL_H
+
+/*
+ * The pixel pipeline of the software renderer: triangle setup, rasterization,
+ * the register combiners, texture sampling and the per-sample tests, blending
+ * and surface writes. It works on state captured at the start of a draw.
+ *
+ * Nothing here depends on the rest of QEMU, so the pipeline can be tested on
+ * its own.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hw/xbox/nv2a/nv2a_regs.h"
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define SW_MAX_TEXTURE_LEVELS 13
+
+/* Screen space extent, in unscaled pixels, beyond which geometry is clipped */
+#define SW_GUARD_BAND 16384.0f
+
+/* Offsets into SwVertex::var */
+enum {
+    SW_VAR_D0 = 0,
+    SW_VAR_D1 = 4,
+    SW_VAR_T0 = 8,
+    SW_VAR_FOG = 24,
+    SW_NUM_VARYINGS = 25,
+};
+
+typedef struct SwSurface {
+    bool bound;
+    uint64_t vram_addr;
+    size_t size;
+    unsigned int width, height;
+    unsigned int pitch;
+    unsigned int bytes_per_pixel;
+    unsigned int format;
+    bool swizzle;
+    bool dirty; /* Written by the current draw or clear */
+
+    /* Points into VRAM, or at the staging copy of a swizzled surface */
+    uint8_t *data;
+    uint8_t *staging;
+    size_t staging_size;
+} SwSurface;
+
+typedef struct SwTextureLevel {
+    unsigned int width, height;
+    const uint32_t *texels; /* RGBA8, red in the least significant byte */
+} SwTextureLevel;
+
+typedef struct SwTexture {
+    uint64_t data_hash;
+    unsigned int num_faces;
+    unsigned int num_levels;
+    uint32_t *data;
+    size_t data_size;
+    SwTextureLevel levels[6][SW_MAX_TEXTURE_LEVELS];
+} SwTexture;
+
+typedef struct SwSampler {
+    const SwTexture *texture;
+    bool cubemap;
+    bool rect; /* Linear textures are addressed in texels */
+    bool alpha_kill;
+    unsigned int min_filter, mag_filter;
+    unsigned int addr_u, addr_v;
+    float lod_bias;
+    float min_lod, max_lod;
+    float border_color[4];
+} SwSampler;
+
+typedef struct SwCombinerState {
+    int num_stages;
+    uint32_t flags;
+    uint32_t rgb_inputs[8], rgb_outputs[8];
+    uint32_t alpha_inputs[8], alpha_outputs[8];
+    float constant0[9][4], constant1[9][4];
+    bool final_enabled;
+    uint32_t final_inputs_0, final_inputs_1;
+    float fog_color[3];
+
+    unsigned int tex_mode[NV2A_MAX_TEXTURES];
+    unsigned int input_tex[NV2A_MAX_TEXTURES];
+    unsigned int dot_map[NV2A_MAX_TEXTURES];
+    uint32_t clip_mode;
+    unsigned int color_key_mode[NV2A_MAX_TEXTURES];
+    uint32_t color_key[NV2A_MAX_TEXTURES];
+    uint32_t color_key_mask[NV2A_MAX_TEXTURES];
+    float bump_mat[NV2A_MAX_TEXTURES][4];
+    float bump_scale[NV2A_MAX_TEXTURES];
+    float bump_offset[NV2A_MAX_TEXTURES];
+    SwSampler samplers[NV2A_MAX_TEXTURES];
+} SwCombinerState;
+
+typedef struct SwClipRegion {
+    int x_min, y_min, x_max, y_max;
+} SwClipRegion;
+
+/* Fixed function pixel pipeline state captured at the start of a draw */
+typedef struct SwDrawState {
+    unsigned int aa_x, aa_y;
+    int scissor_x0, scissor_y0, scissor_x1, scissor_y1;
+
+    bool window_clip_exclusive;
+    SwClipRegion window_clip[8];
+
+    /* Extent of the bound surfaces, in samples */
+    int width, height;
+
+    bool z_perspective;
+    bool depth_clipping;
+    bool float_depth;
+    unsigned int zeta_format;
+    float clip_min, clip_max;
+    float depth_offset, depth_factor;
+
+    bool depth_test, depth_write;
+    unsigned int depth_func;
+
+    bool stencil_test, stencil_write;
+    unsigned int stencil_func;
+    uint8_t stencil_ref, stencil_mask_read, stencil_mask_write;
+    unsigned int stencil_op_fail, stencil_op_zfail, stencil_op_zpass;
+
+    bool alpha_test;
+    unsigned int alpha_func;
+    int alpha_ref;
+
+    bool write_r, write_g, write_b, write_a;
+
+    bool blend;
+    unsigned int blend_eqn, blend_sfactor, blend_dfactor;
+    float blend_color[4];
+
+    bool smooth_shading;
+    bool first_vertex_is_provoking;
+    unsigned int polygon_mode;
+    bool cull_enable;
+    unsigned int cull_face;
+    bool front_face_cw;
+
+    bool count_samples;
+    SwCombinerState combiner;
+} SwDrawState;
+
+/* Attribute plane in unscaled pixels, v(x, y) = c + a*(x - x0) + b*(y - y0) */
+typedef struct SwPlane {
+    float a, b, c;
+    float x0, y0;
+} SwPlane;
+
+/* A triangle ready for rasterization, screen coordinates in 28.4 fixed point */
+typedef struct SwTriangle {
+    int min_x, min_y, max_x, max_y;
+    int64_t edge_a[3], edge_b[3], edge_c[3];
+    float inv_area;
+
+    SwPlane z;
+    float mz;
+    float inv_w[3];
+    float var[3][SW_NUM_VARYINGS];
+} SwTriangle;
+
+typedef struct SwRasterVertex {
+    float x, y; /* Sample grid position */
+    float inv_w;
+    const float *var;
+} SwRasterVertex;
+
+/* pixel.c */
+void pgraph_sw_calc_depth_plane(const SwDrawState *ds, const float *p0,
+                                const float *p1, const float *p2,
+                                SwPlane *plane, float *mz);
+bool pgraph_sw_setup_triangle(const SwDrawState *ds, const SwRasterVertex *v0,
+                              const SwRasterVertex *v1,
+                              const SwRasterVertex *v2, const SwPlane *plane,
+                              float mz, SwTriangle *t);
+void pgraph_sw_rasterize_triangle(const SwDrawState *ds,
+                                  const SwSurface *color,
+                                  const SwSurface *zeta, const SwTriangle *t,
+                                  int x0, int y0, int x1, int y1,
+                                  uint64_t *samples);
+void pgraph_sw_unpack_color(const SwSurface *s, const uint8_t *p,
+                            float rgba[4]);
+void pgraph_sw_pack_color(const SwSurface *s, uint8_t *p, const float rgba[4],
+                          const SwDrawState *ds);
+
+/* combiner.c */
+bool pgraph_sw_shade_fragment(const SwCombinerState *cs, const float *var,
+                              const float *var_dx, const float *var_dy,
+                              const float pos[2], float out[4]);
+
+/* sampler.c */
+void pgraph_sw_sample_texture(const SwSampler *s, const float coord[3],
+                              const float *ddx, const float *ddy,
+                              float out[4]);
+
+#endif
@@ -0,0 +1,843 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/xbox/nv2a/pgraph/vsh_regs.h"
+#include "hw/xbox/nv2a/pgraph/psh_regs.h"
+#include "renderer.h"
+#include <math.h>
+
+#define MIN_CLIP_W 1.0e-7f
+
+/* Maximum vertex count after clipping a triangle against 5 planes */
+#define MAX_CLIP_VERTICES 8
+
+typedef struct ClipVertex {
+    float pos[4]; /* Homogeneous x, y, w and the unused z */
+    float var[SW_NUM_VARYINGS];
+} ClipVertex;
+
+typedef struct TileJob {
+    PGRAPHSWState *r;
+    const int *tiles;
+} TileJob;
+
+static void get_anti_aliasing_factors(PGRAPHState *pg, unsigned int *aa_x,
+                                      unsigned int *aa_y)
+{
+    *aa_x = 1;
+    *aa_y = 1;
+    pgraph_apply_anti_aliasing_factor(pg, aa_x, aa_y);
+}
+
+static float reg_float(PGRAPHState *pg, unsigned int reg)
+{
+    uint32_t v = pgraph_reg_r(pg, reg);
+    return *(float *)&v;
+}
+
+static void setup_depth_state(PGRAPHState *pg, PGRAPHSWState *r,
+                              SwDrawState *ds)
+{
+    uint32_t control_0 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0);
+    uint32_t control_1 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1);
+    uint32_t control_2 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_2);
+    uint32_t raster = pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER);
+
+    ds->z_perspective = control_0 & NV_PGRAPH_CONTROL_0_Z_PERSPECTIVE_ENABLE;
+    ds->depth_clipping = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_ZCOMPRESSOCCLUDE),
+                                  NV_PGRAPH_ZCOMPRESSOCCLUDE_ZCLAMP_EN) ==
+                         NV_PGRAPH_ZCOMPRESSOCCLUDE_ZCLAMP_EN_CULL;
+    ds->float_depth = pg->surface_shape.z_format;
+    ds->zeta_format = pg->surface_shape.zeta_format;
+    ds->clip_min = reg_float(pg, NV_PGRAPH_ZCLIPMIN);
+    ds->clip_max = reg_float(pg, NV_PGRAPH_ZCLIPMAX);
+
+    /* Polygon offset, see pgraph_glsl_set_psh_uniform_values */
+    ds->depth_offset = 0.0f;
+    ds->depth_factor = 0.0f;
+    if (pg->primitive_mode >= PRIM_TYPE_TRIANGLES) {
+        uint32_t polygon_mode =
+            GET_MASK(raster, NV_PGRAPH_SETUPRASTER_FRONTFACEMODE);
+        if ((polygon_mode == NV_PGRAPH_SETUPRASTER_FRONTFACEMODE_FILL &&
+             (raster & NV_PGRAPH_SETUPRASTER_POFFSETFILLENABLE)) ||
+            (polygon_mode == NV_PGRAPH_SETUPRASTER_FRONTFACEMODE_LINE &&
+             (raster & NV_PGRAPH_SETUPRASTER_POFFSETLINEENABLE)) ||
+            (polygon_mode == NV_PGRAPH_SETUPRASTER_FRONTFACEMODE_POINT &&
+             (raster & NV_PGRAPH_SETUPRASTER_POFFSETPOINTENABLE))) {
+            ds->depth_offset = reg_float(pg, NV_PGRAPH_ZOFFSETBIAS);
+            ds->depth_factor = reg_float(pg, NV_PGRAPH_ZOFFSETFACTOR);
+        }
+    }
+
+    /* Without a zeta surface the depth and stencil tests always pass */
+    bool zeta = r->zeta_binding.bound;
+    ds->depth_test = zeta && (control_0 & NV_PGRAPH_CONTROL_0_ZENABLE);
+    ds->depth_write = ds->depth_test &&
+                      (control_0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE);
+    ds->depth_func = GET_MASK(control_0, NV_PGRAPH_CONTROL_0_ZFUNC);
+
+    ds->stencil_test =
+        zeta && ds->zeta_format == NV097_SET_SURFACE_FORMAT_ZETA_Z24S8 &&
+        (control_1 & NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE);
+    ds->stencil_write = ds->stencil_test &&
+                        (control_0 & NV_PGRAPH_CONTROL_0_STENCIL_WRITE_ENABLE);
+    ds->stencil_func = GET_MASK(control_1, NV_PGRAPH_CONTROL_1_STENCIL_FUNC);
+    ds->stencil_ref = GET_MASK(control_1, NV_PGRAPH_CONTROL_1_STENCIL_REF);
+    ds->stencil_mask_read =
+        GET_MASK(control_1, NV_PGRAPH_CONTROL_1_STENCIL_MASK_READ);
+    ds->stencil_mask_write =
+        GET_MASK(control_1, NV_PGRAPH_CONTROL_1_STENCIL_MASK_WRITE);
+    ds->stencil_op_fail =
+        GET_MASK(control_2, NV_PGRAPH_CONTROL_2_STENCIL_OP_FAIL);
+    ds->stencil_op_zfail =
+        GET_MASK(control_2, NV_PGRAPH_CONTROL_2_STENCIL_OP_ZFAIL);
+    ds->stencil_op_zpass =
+        GET_MASK(control_2, NV_PGRAPH_CONTROL_2_STENCIL_OP_ZPASS);
+}
+
+static void setup_color_state(PGRAPHState *pg, PGRAPHSWState *r,
+                              SwDrawState *ds)
+{
+    uint32_t control_0 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0);
+    uint32_t blend = pgraph_reg_r(pg, NV_PGRAPH_BLEND);
+    bool color = r->color_binding.bound;
+
+    ds->alpha_test = control_0 & NV_PGRAPH_CONTROL_0_ALPHATESTENABLE;
+    ds->alpha_func = GET_MASK(control_0, NV_PGRAPH_CONTROL_0_ALPHAFUNC);
+    ds->alpha_ref = GET_MASK(control_0, NV_PGRAPH_CONTROL_0_ALPHAREF);
+
+    ds->write_r = color && (control_0 & NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE);
+    ds->write_g = color && (control_0 & NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE);
+    ds->write_b = color && (control_0 & NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE);
+    ds->write_a = color && (control_0 & NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE);
+
+    ds->blend = color && (blend & NV_PGRAPH_BLEND_EN);
+    ds->blend_eqn = GET_MASK(blend, NV_PGRAPH_BLEND_EQN);
+    ds->blend_sfactor = GET_MASK(blend, NV_PGRAPH_BLEND_SFACTOR);
+    ds->blend_dfactor = GET_MASK(blend, NV_PGRAPH_BLEND_DFACTOR);
+    pgraph_argb_pack32_to_rgba_float(pgraph_reg_r(pg, NV_PGRAPH_BLENDCOLOR),
+                                     ds->blend_color);
+
+    if (blend & NV_PGRAPH_BLEND_LOGICOP_ENABLE) {
+        NV2A_UNIMPLEMENTED("Blend logic op");
+    }
+    if (control_0 & NV_PGRAPH_CONTROL_0_DITHERENABLE) {
+        /* FIXME: Dithering */
+    }
+}
+
+static uint32_t get_colorkey_mask(unsigned int color_format)
+{
+    switch (color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X8R8G8B8:
+        return 0x00FFFFFF;
+
+    default:
+        return 0xFFFFFFFF;
+    }
+}
+
+static void setup_combiner(NV2AState *d, SwCombinerState *cs)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    uint32_t combine_ctl = pgraph_reg_r(pg, NV_PGRAPH_COMBINECTL);
+    uint32_t shader_prog = pgraph_reg_r(pg, NV_PGRAPH_SHADERPROG);
+    uint32_t other_stage_input = pgraph_reg_r(pg, NV_PGRAPH_SHADERCTL);
+
+    cs->num_stages = MIN(combine_ctl & 0xFF, 8);
+    cs->flags = combine_ctl >> 8;
+    for (int i = 0; i < cs->num_stages; i++) {
+        cs->rgb_inputs[i] = pgraph_reg_r(pg, NV_PGRAPH_COMBINECOLORI0 + i * 4);
+        cs->rgb_outputs[i] = pgraph_reg_r(pg, NV_PGRAPH_COMBINECOLORO0 + i * 4);
+        cs->alpha_inputs[i] =
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINEALPHAI0 + i * 4);
+        cs->alpha_outputs[i] =
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINEALPHAO0 + i * 4);
+    }
+
+    cs->final_inputs_0 = pgraph_reg_r(pg, NV_PGRAPH_COMBINESPECFOG0);
+    cs->final_inputs_1 = pgraph_reg_r(pg, NV_PGRAPH_COMBINESPECFOG1);
+    cs->final_enabled = cs->final_inputs_0 || cs->final_inputs_1;
+
+    for (int i = 0; i < 9; i++) {
+        uint32_t constant[2];
+        if (i == 8) {
+            constant[0] = pgraph_reg_r(pg, NV_PGRAPH_SPECFOGFACTOR0);
+            constant[1] = pgraph_reg_r(pg, NV_PGRAPH_SPECFOGFACTOR1);
+        } else {
+            constant[0] = pgraph_reg_r(pg, NV_PGRAPH_COMBINEFACTOR0 + i * 4);
+            constant[1] = pgraph_reg_r(pg, NV_PGRAPH_COMBINEFACTOR1 + i * 4);
+        }
+        pgraph_argb_pack32_to_rgba_float(constant[0], cs->constant0[i]);
+        pgraph_argb_pack32_to_rgba_float(constant[1], cs->constant1[i]);
+    }
+
+    uint32_t fog_color = pgraph_reg_r(pg, NV_PGRAPH_FOGCOLOR);
+    cs->fog_color[0] = GET_MASK(fog_color, NV_PGRAPH_FOGCOLOR_RED) / 255.0f;
+    cs->fog_color[1] = GET_MASK(fog_color, NV_PGRAPH_FOGCOLOR_GREEN) / 255.0f;
+    cs->fog_color[2] = GET_MASK(fog_color, NV_PGRAPH_FOGCOLOR_BLUE) / 255.0f;
+
+    cs->dot_map[0] = 0;
+    cs->dot_map[1] = (other_stage_input >> 0) & 0xF;
+    cs->dot_map[2] = (other_stage_input >> 4) & 0xF;
+    cs->dot_map[3] = (other_stage_input >> 8) & 0xF;
+    cs->input_tex[0] = 0;
+    cs->input_tex[1] = 0;
+    cs->input_tex[2] = (other_stage_input >> 16) & 0xF;
+    cs->input_tex[3] = (other_stage_input >> 20) & 0xF;
+    cs->clip_mode = pgraph_reg_r(pg, NV_PGRAPH_SHADERCLIPMODE);
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        cs->tex_mode[i] = (shader_prog >> (i * 5)) & 0x1F;
+        switch (cs->tex_mode[i]) {
+        case PS_TEXTUREMODES_BUMPENVMAP:
+        case PS_TEXTUREMODES_BUMPENVMAP_LUM:
+        case PS_TEXTUREMODES_DPNDNT_AR:
+        case PS_TEXTUREMODES_DPNDNT_GB:
+            assert(i >= 1);
+            break;
+        case PS_TEXTUREMODES_BRDF:
+        case PS_TEXTUREMODES_DOT_ST:
+        case PS_TEXTUREMODES_DOT_ZW:
+            assert(i >= 2);
+            break;
+        case PS_TEXTUREMODES_DOT_RFLCT_DIFF:
+            assert(i == 2);
+            break;
+        case PS_TEXTUREMODES_DOT_RFLCT_SPEC:
+        case PS_TEXTUREMODES_DOT_STR_3D:
+        case PS_TEXTUREMODES_DOT_STR_CUBE:
+        case PS_TEXTUREMODES_DOT_RFLCT_SPEC_CONST:
+            assert(i == 3);
+            break;
+        case PS_TEXTUREMODES_DOTPRODUCT:
+            assert(i == 1 || i == 2);
+            break;
+        default:
+            break;
+        }
+        if (cs->dot_map[i] > PS_DOTMAPPING_HILO_1) {
+            NV2A_UNIMPLEMENTED("Dot Mapping mode %d", cs->dot_map[i]);
+        }
+
+        uint32_t ctl_0 = pgraph_reg_r(pg, NV_PGRAPH_TEXCTL0_0 + i * 4);
+        uint32_t fmt = pgraph_reg_r(pg, NV_PGRAPH_TEXFMT0 + i * 4);
+        bool enabled = pgraph_is_texture_stage_active(pg, i) &&
+                       (ctl_0 & NV_PGRAPH_TEXCTL0_0_ENABLE);
+        cs->color_key_mode[i] =
+            enabled ? GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_COLORKEYMODE) :
+                      COLOR_KEY_NONE;
+        cs->color_key[i] = pgraph_reg_r(pg, NV_PGRAPH_COLORKEYCOLOR0 + i * 4);
+        cs->color_key_mask[i] =
+            get_colorkey_mask(GET_MASK(fmt, NV_PGRAPH_TEXFMT0_COLOR));
+
+        /* Bump luminance only during stages 1 - 3 */
+        if (i > 0) {
+            cs->bump_mat[i][0] = reg_float(pg, NV_PGRAPH_BUMPMAT00 + 4 * (i - 1));
+            cs->bump_mat[i][1] = reg_float(pg, NV_PGRAPH_BUMPMAT01 + 4 * (i - 1));
+            cs->bump_mat[i][2] = reg_float(pg, NV_PGRAPH_BUMPMAT10 + 4 * (i - 1));
+            cs->bump_mat[i][3] = reg_float(pg, NV_PGRAPH_BUMPMAT11 + 4 * (i - 1));
+            cs->bump_scale[i] =
+                reg_float(pg, NV_PGRAPH_BUMPSCALE1 + (i - 1) * 4);
+            cs->bump_offset[i] =
+                reg_float(pg, NV_PGRAPH_BUMPOFFSET1 + (i - 1) * 4);
+        }
+    }
+
+    pgraph_sw_bind_textures(d, cs);
+}
+
+void pgraph_sw_setup_draw_state(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+    SwDrawState *ds = &r->draw;
+
+    get_anti_aliasing_factors(pg, &ds->aa_x, &ds->aa_y);
+
+    ds->width = pg->surface_binding_dim.width;
+    ds->height = pg->surface_binding_dim.height;
+
+    unsigned int x = pg->surface_shape.clip_x, y = pg->surface_shape.clip_y;
+    unsigned int w = pg->surface_shape.clip_width,
+                 h = pg->surface_shape.clip_height;
+    pgraph_apply_anti_aliasing_factor(pg, &x, &y);
+    pgraph_apply_anti_aliasing_factor(pg, &w, &h);
+    ds->scissor_x0 = MIN(x, ds->width);
+    ds->scissor_y0 = MIN(y, ds->height);
+    ds->scissor_x1 = MIN(x + w, ds->width);
+    ds->scissor_y1 = MIN(y + h, ds->height);
+
+    uint32_t raster = pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER);
+    ds->window_clip_exclusive = raster & NV_PGRAPH_SETUPRASTER_WINDOWCLIPTYPE;
+    for (int i = 0; i < 8; i++) {
+        uint32_t cx = pgraph_reg_r(pg, NV_PGRAPH_WINDOWCLIPX0 + i * 4);
+        uint32_t cy = pgraph_reg_r(pg, NV_PGRAPH_WINDOWCLIPY0 + i * 4);
+        unsigned int x_min = GET_MASK(cx, NV_PGRAPH_WINDOWCLIPX0_XMIN);
+        unsigned int x_max = GET_MASK(cx, NV_PGRAPH_WINDOWCLIPX0_XMAX) + 1;
+        unsigned int y_min = GET_MASK(cy, NV_PGRAPH_WINDOWCLIPY0_YMIN);
+        unsigned int y_max = GET_MASK(cy, NV_PGRAPH_WINDOWCLIPY0_YMAX) + 1;
+        pgraph_apply_anti_aliasing_factor(pg, &x_min, &y_min);
+        pgraph_apply_anti_aliasing_factor(pg, &x_max, &y_max);
+        ds->window_clip[i] = (SwClipRegion){ x_min, y_min, x_max, y_max };
+    }
+
+    uint32_t control_3 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_3);
+    ds->smooth_shading = GET_MASK(control_3, NV_PGRAPH_CONTROL_3_SHADEMODE) ==
+                         NV_PGRAPH_CONTROL_3_SHADEMODE_SMOOTH;
+    ds->first_vertex_is_provoking =
+        GET_MASK(control_3, NV_PGRAPH_CONTROL_3_PROVOKING_VERTEX) ==
+        NV_PGRAPH_CONTROL_3_PROVOKING_VERTEX_FIRST;
+    ds->polygon_mode = GET_MASK(raster, NV_PGRAPH_SETUPRASTER_FRONTFACEMODE);
+    ds->cull_enable = raster & NV_PGRAPH_SETUPRASTER_CULLENABLE;
+    ds->cull_face = GET_MASK(raster, NV_PGRAPH_SETUPRASTER_CULLCTRL);
+    ds->front_face_cw = raster & NV_PGRAPH_SETUPRASTER_FRONTFACE;
+
+    if (GET_MASK(raster, NV_PGRAPH_SETUPRASTER_FRONTFACEMODE) !=
+        GET_MASK(raster, NV_PGRAPH_SETUPRASTER_BACKFACEMODE)) {
+        /* FIXME: Missing support for 2-sided-poly mode */
+        NV2A_UNIMPLEMENTED("Differing front and back polygon modes");
+    }
+
+    setup_depth_state(pg, r, ds);
+    setup_color_state(pg, r, ds);
+
+    ds->count_samples = pg->zpass_pixel_count_enable;
+
+    setup_combiner(d, &ds->combiner);
+
+    /* Size the tile grid to the bound surfaces */
+    r->tiles_x = (ds->width + SW_TILE_SIZE - 1) / SW_TILE_SIZE;
+    r->tiles_y = (ds->height + SW_TILE_SIZE - 1) / SW_TILE_SIZE;
+    size_t num_tiles = r->tiles_x * r->tiles_y;
+    if (num_tiles > r->bins_capacity) {
+        r->bins = g_realloc_n(r->bins, num_tiles, sizeof(SwTileBin));
+        memset(&r->bins[r->bins_capacity], 0,
+               (num_tiles - r->bins_capacity) * sizeof(SwTileBin));
+        r->tile_sample_counts =
+            g_realloc_n(r->tile_sample_counts, num_tiles, sizeof(uint64_t));
+        r->bins_capacity = num_tiles;
+    }
+    for (size_t i = 0; i < num_tiles; i++) {
+        r->bins[i].count = 0;
+        r->tile_sample_counts[i] = 0;
+    }
+    r->num_triangles = 0;
+}
+
+static SwTriangle *alloc_triangle(PGRAPHSWState *r)
+{
+    if (r->num_triangles == r->triangles_capacity) {
+        r->triangles_capacity = MAX(1024, r->triangles_capacity * 2);
+        r->triangles = g_realloc_n(r->triangles, r->triangles_capacity,
+                                   sizeof(SwTriangle));
+    }
+    return &r->triangles[r->num_triangles];
+}
+
+static void bin_triangle(PGRAPHSWState *r, uint32_t index,
+                         const SwTriangle *t)
+{
+    int tx0 = t->min_x / SW_TILE_SIZE, tx1 = t->max_x / SW_TILE_SIZE;
+    int ty0 = t->min_y / SW_TILE_SIZE, ty1 = t->max_y / SW_TILE_SIZE;
+
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            SwTileBin *bin = &r->bins[ty * r->tiles_x + tx];
+            if (bin->count == bin->capacity) {
+                bin->capacity = MAX(64, bin->capacity * 2);
+                bin->triangles = g_realloc_n(bin->triangles, bin->capacity,
+                                             sizeof(uint32_t));
+            }
+            bin->triangles[bin->count++] = index;
+        }
+    }
+}
+
+static void setup_triangle(NV2AState *d, const SwRasterVertex *v0,
+                           const SwRasterVertex *v1, const SwRasterVertex *v2,
+                           const SwPlane *plane, float mz)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+
+    if (r->num_triangles == SW_MAX_BATCH_TRIANGLES) {
+        pgraph_sw_flush_triangles(d);
+    }
+
+    SwTriangle *t = alloc_triangle(r);
+    if (!pgraph_sw_setup_triangle(&r->draw, v0, v1, v2, plane, mz, t)) {
+        return;
+    }
+
+    bin_triangle(r, r->num_triangles, t);
+    r->num_triangles++;
+}
+
+static float clip_distance(const float *pos, int plane)
+{
+    switch (plane) {
+    case 0: return pos[3] - MIN_CLIP_W;
+    case 1: return pos[0] + SW_GUARD_BAND * pos[3];
+    case 2: return SW_GUARD_BAND * pos[3] - pos[0];
+    case 3: return pos[1] + SW_GUARD_BAND * pos[3];
+    case 4: return SW_GUARD_BAND * pos[3] - pos[1];
+    default: g_assert_not_reached();
+    }
+}
+
+static int clip_polygon(ClipVertex *in, int n, ClipVertex *tmp)
+{
+    ClipVertex *src = in, *dst = tmp;
+
+    for (int plane = 0; plane < 5 && n > 0; plane++) {
+        int out_n = 0;
+        for (int i = 0; i < n; i++) {
+            const ClipVertex *a = &src[i], *b = &src[(i + 1) % n];
+            float da = clip_distance(a->pos, plane);
+            float db = clip_distance(b->pos, plane);
+            if (da >= 0.0f) {
+                dst[out_n++] = *a;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                float t = da / (da - db);
+                ClipVertex *c = &dst[out_n++];
+                for (int j = 0; j < 4; j++) {
+                    c->pos[j] = a->pos[j] + t * (b->pos[j] - a->pos[j]);
+                }
+                for (int j = 0; j < SW_NUM_VARYINGS; j++) {
+                    c->var[j] = a->var[j] + t * (b->var[j] - a->var[j]);
+                }
+            }
+        }
+        ClipVertex *swap = src;
+        src = dst;
+        dst = swap;
+        n = out_n;
+    }
+
+    if (src != in) {
+        memcpy(in, src, n * sizeof(ClipVertex));
+    }
+    return n;
+}
+
+static void to_clip_vertex(const SwVertex *v, ClipVertex *c)
+{
+    float w = v->pos[3];
+    c->pos[0] = v->pos[0] * w;
+    c->pos[1] = v->pos[1] * w;
+    c->pos[2] = 0.0f;
+    c->pos[3] = w;
+    memcpy(c->var, v->var, sizeof(c->var));
+}
+
+static bool is_culled(const SwDrawState *ds, float area)
+{
+    if (!ds->cull_enable) {
+        return false;
+    }
+    bool front = ds->front_face_cw ? area < 0.0f : area > 0.0f;
+    switch (ds->cull_face) {
+    case NV_PGRAPH_SETUPRASTER_CULLCTRL_FRONT:
+        return front;
+    case NV_PGRAPH_SETUPRASTER_CULLCTRL_BACK:
+        return !front;
+    case NV_PGRAPH_SETUPRASTER_CULLCTRL_FRONT_AND_BACK:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void emit_filled_triangle(NV2AState *d, const SwVertex *v0,
+                                 const SwVertex *v1, const SwVertex *v2)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+    const SwDrawState *ds = &r->draw;
+
+    ClipVertex poly[MAX_CLIP_VERTICES], tmp[MAX_CLIP_VERTICES];
+    to_clip_vertex(v0, &poly[0]);
+    to_clip_vertex(v1, &poly[1]);
+    to_clip_vertex(v2, &poly[2]);
+
+    int n = 3;
+    for (int i = 0; i < 3; i++) {
+        for (int plane = 0; plane < 5; plane++) {
+            if (clip_distance(poly[i].pos, plane) < 0.0f) {
+                n = clip_polygon(poly, 3, tmp);
+                goto clipped;
+            }
+        }
+    }
+clipped:
+    if (n < 3) {
+        return;
+    }
+
+    SwRasterVertex rv[MAX_CLIP_VERTICES];
+    for (int i = 0; i < n; i++) {
+        rv[i].inv_w = 1.0f / poly[i].pos[3];
+        rv[i].x = poly[i].pos[0] * rv[i].inv_w * ds->aa_x;
+        rv[i].y = poly[i].pos[1] * rv[i].inv_w * ds->aa_y;
+        rv[i].var = poly[i].var;
+    }
+
+    float area = 0.0f;
+    for (int i = 0; i < n; i++) {
+        const SwRasterVertex *a = &rv[i], *b = &rv[(i + 1) % n];
+        area += a->x * b->y - b->x * a->y;
+    }
+    if (is_culled(ds, area)) {
+        return;
+    }
+
+    SwPlane plane;
+    float mz;
+    pgraph_sw_calc_depth_plane(ds, v0->pos, v1->pos, v2->pos, &plane, &mz);
+
+    for (int i = 1; i + 1 < n; i++) {
+        setup_triangle(d, &rv[0], &rv[i], &rv[i + 1], &plane, mz);
+    }
+}
+
+/*
+ * Lines are drawn as one sample wide quads. Like emit_line in the geometry
+ * shader, the depth plane is constant across the width of the line.
+ */
+static void emit_line(NV2AState *d, const SwVertex *v0, const SwVertex *v1,
+                      float mz)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+    const SwDrawState *ds = &r->draw;
+
+    ClipVertex line[2];
+    to_clip_vertex(v0, &line[0]);
+    to_clip_vertex(v1, &line[1]);
+
+    /* Only the w plane matters here, the guard band is handled by the scissor */
+    float d0 = clip_distance(line[0].pos, 0);
+    float d1 = clip_distance(line[1].pos, 0);
+    if (d0 < 0.0f && d1 < 0.0f) {
+        return;
+    }
+    if (d0 < 0.0f || d1 < 0.0f) {
+        float t = d0 / (d0 - d1);
+        ClipVertex *c = d0 < 0.0f ? &line[0] : &line[1];
+        for (int j = 0; j < 4; j++) {
+            c->pos[j] = line[0].pos[j] + t * (line[1].pos[j] - line[0].pos[j]);
+        }
+        for (int j = 0; j < SW_NUM_VARYINGS; j++) {
+            c->var[j] = line[0].var[j] + t * (line[1].var[j] - line[0].var[j]);
+        }
+    }
+
+    float x[2], y[2], inv_w[2];
+    for (int i = 0; i < 2; i++) {
+        inv_w[i] = 1.0f / line[i].pos[3];
+        x[i] = line[i].pos[0] * inv_w[i] * ds->aa_x;
+        y[i] = line[i].pos[1] * inv_w[i] * ds->aa_y;
+    }
+
+    float dx = x[1] - x[0], dy = y[1] - y[0];
+    float len = sqrtf(dx * dx + dy * dy);
+    if (!(len > 0.0f) || !isfinite(len)) {
+        return;
+    }
+    float nx = -dy / len * 0.5f, ny = dx / len * 0.5f;
+
+    SwRasterVertex rv[4] = {
+        { x[0] - nx, y[0] - ny, inv_w[0], line[0].var },
+        { x[0] + nx, y[0] + ny, inv_w[0], line[0].var },
+        { x[1] - nx, y[1] - ny, inv_w[1], line[1].var },
+        { x[1] + nx, y[1] + ny, inv_w[1], line[1].var },
+    };
+
+    float p2[4] = { v0->pos[0] - (v1->pos[1] - v0->pos[1]),
+                    v0->pos[1] + (v1->pos[0] - v0->pos[0]), v0->pos[2],
+                    v0->pos[3] };
+    SwPlane plane;
+    pgraph_sw_calc_depth_plane(ds, v0->pos, v1->pos, p2, &plane, NULL);
+
+    setup_triangle(d, &rv[0], &rv[2], &rv[1], &plane, mz);
+    setup_triangle(d, &rv[1], &rv[2], &rv[3], &plane, mz);
+}
+
+static void emit_point(NV2AState *d, const SwVertex *v)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+    const SwDrawState *ds = &r->draw;
+
+    if (v->pos[3] < MIN_CLIP_W) {
+        return;
+    }
+
+    /* FIXME: Point sprite texture coordinates */
+    float x = v->pos[0] * ds->aa_x, y = v->pos[1] * ds->aa_y;
+    float half = MAX(v->point_size, 1.0f) * 0.5f;
+    float inv_w = 1.0f / v->pos[3];
+
+    SwRasterVertex rv[4] = {
+        { x - half, y - half, inv_w, v->var },
+        { x + half, y - half, inv_w, v->var },
+        { x - half, y + half, inv_w, v->var },
+        { x + half, y + half, inv_w, v->var },
+    };
+
+    SwPlane plane;
+    pgraph_sw_calc_depth_plane(ds, v->pos, v->pos, v->pos, &plane, NULL);
+
+    setup_triangle(d, &rv[0], &rv[1], &rv[2], &plane, 0.0f);
+    setup_triangle(d, &rv[1], &rv[3], &rv[2], &plane, 0.0f);
+}
+
+static void emit_triangle(NV2AState *d, const SwVertex *v0,
+                          const SwVertex *v1, const SwVertex *v2,
+                          const SwVertex *provoking)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+    const SwDrawState *ds = &r->draw;
+    SwVertex flat[3];
+
+    if (!ds->smooth_shading) {
+        const SwVertex *src[3] = { v0, v1, v2 };
+        for (int i = 0; i < 3; i++) {
+            flat[i] = *src[i];
+            memcpy(&flat[i].var[SW_VAR_D0], &provoking->var[SW_VAR_D0],
+                   8 * sizeof(float));
+        }
+        v0 = &flat[0];
+        v1 = &flat[1];
+        v2 = &flat[2];
+    }
+
+    switch (ds->polygon_mode) {
+    case NV_PGRAPH_SETUPRASTER_FRONTFACEMODE_LINE: {
+        /* FIXME: Face culling of polygon outlines */
+        SwPlane plane;
+        float mz;
+        pgraph_sw_calc_depth_plane(ds, v0->pos, v1->pos, v2->pos, &plane, &mz);
+        if (!isfinite(mz)) {
+            mz = 0.0f;
+        }
+        emit_line(d, v0, v1, mz);
+        emit_line(d, v1, v2, mz);
+        emit_line(d, v2, v0, mz);
+        break;
+    }
+    case NV_PGRAPH_SETUPRASTER_FRONTFACEMODE_POINT:
+        emit_point(d, v0);
+        emit_point(d, v1);
+        emit_point(d, v2);
+        break;
+    default:
+        emit_filled_triangle(d, v0, v1, v2);
+        break;
+    }
+}
+
+static void emit_line_primitive(NV2AState *d, const SwVertex *v0,
+                                const SwVertex *v1)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+    const SwDrawState *ds = &r->draw;
+
+    if (!ds->smooth_shading) {
+        const SwVertex *provoking = ds->first_vertex_is_provoking ? v0 : v1;
+        SwVertex flat[2] = { *v0, *v1 };
+        for (int i = 0; i < 2; i++) {
+            memcpy(&flat[i].var[SW_VAR_D0], &provoking->var[SW_VAR_D0],
+                   8 * sizeof(float));
+        }
+        emit_line(d, &flat[0], &flat[1], 0.0f);
+    } else {
+        emit_line(d, v0, v1, 0.0f);
+    }
+}
+
+/*
+ * Assembles primitives following the vertex orders and provoking vertices the
+ * geometry shader uses for the GL and Vulkan renderers.
+ */
+void pgraph_sw_draw_primitives(NV2AState *d, const SwVertex *vertices,
+                               const uint32_t *indices, size_t num_indices)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+    bool first = r->draw.first_vertex_is_provoking;
+
+#define V(i) (&vertices[indices[i]])
+
+    switch (pg->primitive_mode) {
+    case PRIM_TYPE_POINTS:
+        for (size_t i = 0; i < num_indices; i++) {
+            emit_point(d, V(i));
+        }
+        break;
+    case PRIM_TYPE_LINES:
+        for (size_t i = 0; i + 1 < num_indices; i += 2) {
+            emit_line_primitive(d, V(i), V(i + 1));
+        }
+        break;
+    case PRIM_TYPE_LINE_STRIP:
+    case PRIM_TYPE_LINE_LOOP:
+        for (size_t i = 0; i + 1 < num_indices; i++) {
+            emit_line_primitive(d, V(i), V(i + 1));
+        }
+        if (pg->primitive_mode == PRIM_TYPE_LINE_LOOP && num_indices > 2) {
+            emit_line_primitive(d, V(num_indices - 1), V(0));
+        }
+        break;
+    case PRIM_TYPE_TRIANGLES:
+        for (size_t i = 0; i + 2 < num_indices; i += 3) {
+            emit_triangle(d, V(i), V(i + 1), V(i + 2),
+                          first ? V(i) : V(i + 2));
+        }
+        break;
+    case PRIM_TYPE_TRIANGLE_STRIP:
+        for (size_t i = 0; i + 2 < num_indices; i++) {
+            const SwVertex *provoking = first ? V(i) : V(i + 2);
+            if (i & 1) {
+                emit_triangle(d, V(i + 1), V(i), V(i + 2), provoking);
+            } else {
+                emit_triangle(d, V(i), V(i + 1), V(i + 2), provoking);
+            }
+        }
+        break;
+    case PRIM_TYPE_TRIANGLE_FAN:
+        for (size_t i = 1; i + 1 < num_indices; i++) {
+            emit_triangle(d, V(0), V(i), V(i + 1), first ? V(i) : V(i + 1));
+        }
+        break;
+    case PRIM_TYPE_QUADS:
+        for (size_t i = 0; i + 3 < num_indices; i += 4) {
+            emit_triangle(d, V(i + 1), V(i + 2), V(i), V(i + 3));
+            emit_triangle(d, V(i + 2), V(i + 3), V(i), V(i + 3));
+        }
+        break;
+    case PRIM_TYPE_QUAD_STRIP:
+        for (size_t i = 0; i + 3 < num_indices; i += 2) {
+            emit_triangle(d, V(i), V(i + 1), V(i + 2), V(i + 3));
+            emit_triangle(d, V(i + 2), V(i + 1), V(i + 3), V(i + 3));
+        }
+        break;
+    case PRIM_TYPE_POLYGON:
+        if (r->draw.polygon_mode == NV_PGRAPH_SETUPRASTER_FRONTFACEMODE_LINE) {
+            for (size_t i = 0; i < num_indices; i++) {
+                emit_line_primitive(d, V(i), V((i + 1) % num_indices));
+            }
+        } else {
+            for (size_t i = 1; i + 1 < num_indices; i++) {
+                emit_triangle(d, V(0), V(i), V(i + 1), V(0));
+            }
+        }
+        break;
+    default:
+        assert(!"Invalid primitive_mode");
+        break;
+    }
+
+#undef V
+}
+
+static void tile_job(void *opaque, int index)
+{
+    TileJob *job = opaque;
+    PGRAPHSWState *r = job->r;
+    int tile = job->tiles[index];
+    const SwTileBin *bin = &r->bins[tile];
+
+    int x0 = (tile % r->tiles_x) * SW_TILE_SIZE;
+    int y0 = (tile / r->tiles_x) * SW_TILE_SIZE;
+    int x1 = x0 + SW_TILE_SIZE - 1;
+    int y1 = y0 + SW_TILE_SIZE - 1;
+
+    uint64_t samples = 0;
+    for (size_t i = 0; i < bin->count; i++) {
+        pgraph_sw_rasterize_triangle(&r->draw, &r->color_binding,
+                                     &r->zeta_binding,
+                                     &r->triangles[bin->triangles[i]], x0, y0,
+                                     x1, y1, &samples);
+    }
+    r->tile_sample_counts[tile] += samples;
+}
+
+void pgraph_sw_flush_triangles(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    if (r->num_triangles == 0) {
+        return;
+    }
+
+    int num_tiles = r->tiles_x * r->tiles_y;
+    g_autofree int *tiles = g_malloc_n(num_tiles, sizeof(int));
+    int num_active = 0;
+    for (int i = 0; i < num_tiles; i++) {
+        if (r->bins[i].count) {
+            tiles[num_active++] = i;
+        }
+    }
+
+    TileJob job = { .r = r, .tiles = tiles };
+    pgraph_sw_parallel_for(r, num_active, tile_job, &job);
+
+    for (int i = 0; i < num_active; i++) {
+        SwTileBin *bin = &r->bins[tiles[i]];
+        bin->count = 0;
+        if (r->draw.count_samples) {
+            r->zpass_pixel_count_result += r->tile_sample_counts[tiles[i]];
+        }
+        r->tile_sample_counts[tiles[i]] = 0;
+    }
+    r->num_triangles = 0;
+}
+
+void pgraph_sw_init_raster(PGRAPHState *pg)
+{
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    r->triangles = NULL;
+    r->num_triangles = 0;
+    r->triangles_capacity = 0;
+    r->bins = NULL;
+    r->bins_capacity = 0;
+    r->tile_sample_counts = NULL;
+    r->tiles_x = 0;
+    r->tiles_y = 0;
+}
+
+void pgraph_sw_finalize_raster(PGRAPHState *pg)
+{
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    for (size_t i = 0; i < r->bins_capacity; i++) {
+        g_free(r->bins[i].triangles);
+    }
+    g_free(r->bins);
+    g_free(r->tile_sample_counts);
+    g_free(r->triangles);
+    g_free(r->vertices);
+    g_free(r->indices);
+}
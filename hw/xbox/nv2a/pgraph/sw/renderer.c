@@ -0,0 +1,169 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "renderer.h"
+
+void pgraph_sw_parallel_for(PGRAPHSWState *r, int num_jobs,
+                            PGRAPHJobFunc func, void *opaque)
+{
+    pgraph_worker_pool_run(&r->pool, num_jobs, func, opaque);
+}
+
+static void pgraph_sw_sync(NV2AState *d)
+{
+    qatomic_set(&d->pgraph.sync_pending, false);
+    qemu_event_set(&d->pgraph.sync_complete);
+}
+
+static void pgraph_sw_flush(NV2AState *d)
+{
+    /* Surfaces live in guest RAM, so there is no cached state to discard */
+    qatomic_set(&d->pgraph.flush_pending, false);
+    qemu_event_set(&d->pgraph.flush_complete);
+}
+
+static void pgraph_sw_process_pending(NV2AState *d)
+{
+    if (
+        qatomic_read(&d->pgraph.sync_pending) ||
+        qatomic_read(&d->pgraph.flush_pending)
+        ) {
+        qemu_mutex_unlock(&d->pfifo.lock);
+        qemu_mutex_lock(&d->pgraph.lock);
+        if (qatomic_read(&d->pgraph.sync_pending)) {
+            pgraph_sw_sync(d);
+        }
+        if (qatomic_read(&d->pgraph.flush_pending)) {
+            pgraph_sw_flush(d);
+        }
+        qemu_mutex_unlock(&d->pgraph.lock);
+        qemu_mutex_lock(&d->pfifo.lock);
+    }
+}
+
+static void pgraph_sw_clear_report_value(NV2AState *d)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+    r->zpass_pixel_count_result = 0;
+}
+
+static void pgraph_sw_get_report(NV2AState *d, uint32_t parameter)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+    pgraph_write_zpass_pixel_cnt_report(d, parameter,
+                                        r->zpass_pixel_count_result);
+}
+
+static void pgraph_sw_flip_stall(NV2AState *d)
+{
+}
+
+static void pgraph_sw_pre_savevm_trigger(NV2AState *d)
+{
+}
+
+static void pgraph_sw_pre_savevm_wait(NV2AState *d)
+{
+}
+
+static void pgraph_sw_pre_shutdown_trigger(NV2AState *d)
+{
+}
+
+static void pgraph_sw_pre_shutdown_wait(NV2AState *d)
+{
+}
+
+static void pgraph_sw_process_pending_reports(NV2AState *d)
+{
+}
+
+static void pgraph_sw_surface_update(NV2AState *d, bool upload,
+                                     bool color_write, bool zeta_write)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    /* Draws land directly in VRAM, only the depth format needs tracking */
+    pg->surface_shape.z_format =
+        GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER),
+                 NV_PGRAPH_SETUPRASTER_Z_FORMAT);
+}
+
+static void pgraph_sw_init(NV2AState *d, Error **errp)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    pg->sw_renderer_state = g_malloc0(sizeof(PGRAPHSWState));
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    /* Surfaces are rendered at native resolution */
+    pg->surface_scale_factor = 1;
+
+    /* The submitting thread also runs jobs, leave one core for the vCPU */
+    pgraph_worker_pool_init(&r->pool, "nv2a.sw_raster",
+                            MAX(0, (int)g_get_num_processors() - 2));
+    pgraph_sw_init_surfaces(pg);
+    pgraph_sw_init_textures(pg);
+    pgraph_sw_init_raster(pg);
+}
+
+static void pgraph_sw_finalize(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    pgraph_sw_finalize_raster(pg);
+    pgraph_sw_finalize_textures(pg);
+    pgraph_sw_finalize_surfaces(pg);
+    pgraph_worker_pool_finalize(&r->pool);
+
+    g_free(pg->sw_renderer_state);
+    pg->sw_renderer_state = NULL;
+}
+
+static PGRAPHRenderer pgraph_sw_renderer = {
+    .type = CONFIG_DISPLAY_RENDERER_SOFTWARE,
+    .name = "Software",
+    .ops = {
+        .init = pgraph_sw_init,
+        .finalize = pgraph_sw_finalize,
+        .clear_report_value = pgraph_sw_clear_report_value,
+        .clear_surface = pgraph_sw_clear_surface,
+        .draw_begin = pgraph_sw_draw_begin,
+        .draw_end = pgraph_sw_draw_end,
+        .flip_stall = pgraph_sw_flip_stall,
+        .flush_draw = pgraph_sw_flush_draw,
+        .get_report = pgraph_sw_get_report,
+        .image_blit = pgraph_sw_image_blit,
+        .pre_savevm_trigger = pgraph_sw_pre_savevm_trigger,
+        .pre_savevm_wait = pgraph_sw_pre_savevm_wait,
+        .pre_shutdown_trigger = pgraph_sw_pre_shutdown_trigger,
+        .pre_shutdown_wait = pgraph_sw_pre_shutdown_wait,
+        .process_pending = pgraph_sw_process_pending,
+        .process_pending_reports = pgraph_sw_process_pending_reports,
+        .surface_update = pgraph_sw_surface_update,
+    }
+};
+
+static void __attribute__((constructor)) register_renderer(void)
+{
+    pgraph_renderer_register(&pgraph_sw_renderer);
+}
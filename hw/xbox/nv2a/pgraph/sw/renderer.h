@@ -0,0 +1,136 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_SW_RENDERER_H
+#define HW_XBOX_NV2A_PGRAPH_SW_RENDERER_H
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/lru.h"
+#include "hw/hw.h"
+#include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/nv2a_regs.h"
+#include "hw/xbox/nv2a/pgraph/surface.h"
+#include "hw/xbox/nv2a/pgraph/texture.h"
+#include "hw/xbox/nv2a/pgraph/worker_pool.h"
+#include "pixel.h"
+
+// Side length of the square screen regions rasterized by a single worker
+#define SW_TILE_SIZE 32
+
+// Triangles are binned and rasterized in batches of at most this many
+#define SW_MAX_BATCH_TRIANGLES (64 * 1024)
+
+#define SW_TEXTURE_CACHE_SIZE 256
+#define SW_TEXTURE_CACHE_MAX_SIZE (256 * MiB)
+
+typedef struct SwVertex {
+    /* Window space x, y (in unscaled surface pixels), z and w */
+    float pos[4];
+    float point_size;
+    float var[SW_NUM_VARYINGS];
+} SwVertex;
+
+typedef struct SwTextureKey {
+    TextureShape shape;
+    hwaddr texture_vram_offset;
+    hwaddr texture_length;
+    hwaddr palette_vram_offset;
+    hwaddr palette_length;
+} SwTextureKey;
+
+typedef struct SwTextureLruNode {
+    LruNode node;
+    SwTextureKey key;
+    SwTexture *texture;
+    bool possibly_dirty;
+} SwTextureLruNode;
+
+typedef struct SwTileBin {
+    uint32_t *triangles;
+    size_t count, capacity;
+} SwTileBin;
+
+typedef struct PGRAPHSWState {
+    PGRAPHWorkerPool pool;
+
+    SwSurface color_binding, zeta_binding;
+    SwDrawState draw;
+
+    Lru texture_cache;
+    SwTextureLruNode *texture_cache_entries;
+    SwTextureLruNode *texture_bindings[NV2A_MAX_TEXTURES];
+
+    SwVertex *vertices;
+    size_t vertices_capacity;
+    uint32_t *indices;
+    size_t indices_capacity;
+
+    SwTriangle *triangles;
+    size_t num_triangles;
+    size_t triangles_capacity;
+
+    int tiles_x, tiles_y;
+    SwTileBin *bins;
+    size_t bins_capacity;
+    uint64_t *tile_sample_counts;
+
+    uint64_t zpass_pixel_count_result;
+} PGRAPHSWState;
+
+/* renderer.c */
+void pgraph_sw_parallel_for(PGRAPHSWState *r, int num_jobs,
+                            PGRAPHJobFunc func, void *opaque);
+
+/* surface.c */
+bool pgraph_sw_surface_bind(NV2AState *d, bool color, bool zeta);
+void pgraph_sw_surface_unbind(NV2AState *d);
+void pgraph_sw_clear_surface(NV2AState *d, uint32_t parameter);
+void pgraph_sw_init_surfaces(PGRAPHState *pg);
+void pgraph_sw_finalize_surfaces(PGRAPHState *pg);
+
+/* draw.c */
+void pgraph_sw_draw_begin(NV2AState *d);
+void pgraph_sw_draw_end(NV2AState *d);
+void pgraph_sw_flush_draw(NV2AState *d);
+
+/* vertex.c */
+size_t pgraph_sw_process_vertices(NV2AState *d, unsigned int first,
+                                  unsigned int count,
+                                  unsigned int provoking_element,
+                                  SwVertex *out);
+size_t pgraph_sw_process_inline_vertices(NV2AState *d, SwVertex *out);
+
+/* raster.c */
+void pgraph_sw_setup_draw_state(NV2AState *d);
+void pgraph_sw_draw_primitives(NV2AState *d, const SwVertex *vertices,
+                               const uint32_t *indices, size_t num_indices);
+void pgraph_sw_flush_triangles(NV2AState *d);
+void pgraph_sw_init_raster(PGRAPHState *pg);
+void pgraph_sw_finalize_raster(PGRAPHState *pg);
+
+/* texture.c */
+void pgraph_sw_bind_textures(NV2AState *d, SwCombinerState *cs);
+void pgraph_sw_init_textures(PGRAPHState *pg);
+void pgraph_sw_finalize_textures(PGRAPHState *pg);
+
+/* blit.c */
+void pgraph_sw_image_blit(NV2AState *d);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Texture sampling, from textures decoded to RGBA8 by texture.c.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "pixel.h"
+
+static inline void unpack_texel(uint32_t v, float out[4])
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = ((v >> (i * 8)) & 0xFF) / 255.0f;
+    }
+}
+
+/* Returns the addressed texel index, or -1 to sample the border color */
+static inline int address_coord(unsigned int mode, int i, int size)
+{
+    switch (mode) {
+    case NV_PGRAPH_TEXADDRESS0_ADDRU_WRAP:
+        i %= size;
+        return i < 0 ? i + size : i;
+    case NV_PGRAPH_TEXADDRESS0_ADDRU_MIRROR: {
+        int period = size * 2;
+        i %= period;
+        i = i < 0 ? i + period : i;
+        return i < size ? i : period - 1 - i;
+    }
+    case NV_PGRAPH_TEXADDRESS0_ADDRU_BORDER:
+        return (i < 0 || i >= size) ? -1 : i;
+    default:
+        return MIN(MAX(i, 0), size - 1);
+    }
+}
+
+static void fetch(const SwSampler *s, const SwTextureLevel *level,
+                  unsigned int addr_u, unsigned int addr_v, int x, int y,
+                  float out[4])
+{
+    x = address_coord(addr_u, x, level->width);
+    y = address_coord(addr_v, y, level->height);
+    if (x < 0 || y < 0) {
+        memcpy(out, s->border_color, 4 * sizeof(float));
+        return;
+    }
+    unpack_texel(level->texels[y * level->width + x], out);
+}
+
+static void sample_level(const SwSampler *s, const SwTextureLevel *level,
+                         unsigned int addr_u, unsigned int addr_v, float u,
+                         float v, bool linear, float out[4])
+{
+    u *= level->width;
+    v *= level->height;
+
+    if (!linear) {
+        fetch(s, level, addr_u, addr_v, floorf(u), floorf(v), out);
+        return;
+    }
+
+    u -= 0.5f;
+    v -= 0.5f;
+    float fu = floorf(u), fv = floorf(v);
+    float au = u - fu, av = v - fv;
+    int x = fu, y = fv;
+
+    float t00[4], t10[4], t01[4], t11[4];
+    fetch(s, level, addr_u, addr_v, x, y, t00);
+    fetch(s, level, addr_u, addr_v, x + 1, y, t10);
+    fetch(s, level, addr_u, addr_v, x, y + 1, t01);
+    fetch(s, level, addr_u, addr_v, x + 1, y + 1, t11);
+    for (int i = 0; i < 4; i++) {
+        float top = t00[i] + (t10[i] - t00[i]) * au;
+        float bottom = t01[i] + (t11[i] - t01[i]) * au;
+        out[i] = top + (bottom - top) * av;
+    }
+}
+
+/* Select the cube face and face coordinates as in the GL specification */
+static int get_cube_face(const float *dir, float *u, float *v)
+{
+    float ax = fabsf(dir[0]), ay = fabsf(dir[1]), az = fabsf(dir[2]);
+    float sc, tc, ma;
+    int face;
+
+    if (ax >= ay && ax >= az) {
+        face = dir[0] >= 0.0f ? 0 : 1;
+        sc = dir[0] >= 0.0f ? -dir[2] : dir[2];
+        tc = -dir[1];
+        ma = ax;
+    } else if (ay >= az) {
+        face = dir[1] >= 0.0f ? 2 : 3;
+        sc = dir[0];
+        tc = dir[1] >= 0.0f ? dir[2] : -dir[2];
+        ma = ay;
+    } else {
+        face = dir[2] >= 0.0f ? 4 : 5;
+        sc = dir[2] >= 0.0f ? dir[0] : -dir[0];
+        tc = -dir[1];
+        ma = az;
+    }
+
+    if (ma == 0.0f) {
+        *u = *v = 0.5f;
+    } else {
+        *u = (sc / ma + 1.0f) * 0.5f;
+        *v = (tc / ma + 1.0f) * 0.5f;
+    }
+    return face;
+}
+
+/*
+ * Samples a bound texture. Derivatives are in the same units as the
+ * coordinates, and select the level of detail. Without derivatives the base
+ * level (adjusted by the LOD bias and clamps) is sampled.
+ */
+void pgraph_sw_sample_texture(const SwSampler *s, const float coord[3],
+                              const float *ddx, const float *ddy,
+                              float out[4])
+{
+    const SwTexture *t = s->texture;
+
+    if (t == NULL) {
+        out[0] = out[1] = out[2] = out[3] = 1.0f;
+        return;
+    }
+
+    int face = 0;
+    float u = coord[0], v = coord[1];
+    unsigned int addr_u = s->addr_u, addr_v = s->addr_v;
+    if (s->cubemap) {
+        face = get_cube_face(coord, &u, &v);
+        addr_u = addr_v = NV_PGRAPH_TEXADDRESS0_ADDRU_CLAMP_TO_EDGE;
+    }
+
+    const SwTextureLevel *base = &t->levels[face][0];
+    float rho = 0.0f;
+    if (ddx && ddy && !s->cubemap) {
+        float scale_u = s->rect ? 1.0f : base->width;
+        float scale_v = s->rect ? 1.0f : base->height;
+        float dx = hypotf(ddx[0] * scale_u, ddx[1] * scale_v);
+        float dy = hypotf(ddy[0] * scale_u, ddy[1] * scale_v);
+        rho = MAX(dx, dy);
+    }
+    if (s->rect) {
+        u /= base->width;
+        v /= base->height;
+    }
+
+    float lod = (rho > 0.0f ? log2f(rho) : -INFINITY) + s->lod_bias;
+    bool magnify = lod <= 0.0f;
+    lod = MIN(MAX(lod, s->min_lod), s->max_lod);
+
+    unsigned int filter = magnify ? s->mag_filter : s->min_filter;
+    bool linear;
+    bool mip_linear = false;
+    if (magnify) {
+        /* Magnification filters share the minification encoding */
+        linear = filter != NV_PGRAPH_TEXFILTER0_MIN_BOX_LOD0;
+    } else {
+        linear = filter == NV_PGRAPH_TEXFILTER0_MIN_TENT_LOD0 ||
+                 filter == NV_PGRAPH_TEXFILTER0_MIN_TENT_NEARESTLOD ||
+                 filter == NV_PGRAPH_TEXFILTER0_MIN_TENT_TENT_LOD ||
+                 filter == NV_PGRAPH_TEXFILTER0_MIN_CONVOLUTION_2D_LOD0;
+        mip_linear = filter == NV_PGRAPH_TEXFILTER0_MIN_BOX_TENT_LOD ||
+                     filter == NV_PGRAPH_TEXFILTER0_MIN_TENT_TENT_LOD;
+    }
+
+    if (!mip_linear || s->min_lod == s->max_lod) {
+        int level = MIN((int)(lod + 0.5f), (int)t->num_levels - 1);
+        sample_level(s, &t->levels[face][level], addr_u, addr_v, u, v, linear,
+                     out);
+        return;
+    }
+
+    int level0 = MIN((int)lod, (int)t->num_levels - 1);
+    int level1 = MIN(level0 + 1, (int)t->num_levels - 1);
+    float frac = lod - level0;
+    float a[4], b[4];
+    sample_level(s, &t->levels[face][level0], addr_u, addr_v, u, v, linear, a);
+    sample_level(s, &t->levels[face][level1], addr_u, addr_v, u, v, linear, b);
+    for (int i = 0; i < 4; i++) {
+        out[i] = a[i] + (b[i] - a[i]) * frac;
+    }
+}
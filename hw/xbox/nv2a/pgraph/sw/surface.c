@@ -0,0 +1,343 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/xbox/nv2a/pgraph/swizzle.h"
+#include "renderer.h"
+
+static unsigned int get_color_bytes_per_pixel(unsigned int format)
+{
+    switch (format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        return 1;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        return 2;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static void get_surface_dimensions(PGRAPHState *pg, unsigned int *width,
+                                   unsigned int *height)
+{
+    bool swizzle = (pg->surface_type == NV097_SET_SURFACE_FORMAT_TYPE_SWIZZLE);
+    if (swizzle) {
+        *width = 1 << pg->surface_shape.log_width;
+        *height = 1 << pg->surface_shape.log_height;
+    } else {
+        *width = pg->surface_shape.clip_width;
+        *height = pg->surface_shape.clip_height;
+    }
+    pgraph_apply_anti_aliasing_factor(pg, width, height);
+
+    /* Since we determine surface dimensions based on the clipping
+     * rectangle, make sure to include the surface offset as well.
+     */
+    if (!swizzle) {
+        *width += pg->surface_shape.clip_x;
+        *height += pg->surface_shape.clip_y;
+    }
+}
+
+static bool bind_surface(NV2AState *d, bool color, unsigned int width,
+                         unsigned int height, SwSurface *s)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    Surface *surface;
+    hwaddr dma_address;
+    unsigned int bytes_per_pixel;
+
+    if (color) {
+        surface = &pg->surface_color;
+        dma_address = pg->dma_color;
+        bytes_per_pixel =
+            get_color_bytes_per_pixel(pg->surface_shape.color_format);
+        if (bytes_per_pixel == 0) {
+            NV2A_UNIMPLEMENTED("Color surface format 0x%x",
+                               pg->surface_shape.color_format);
+            return false;
+        }
+    } else {
+        surface = &pg->surface_zeta;
+        dma_address = pg->dma_zeta;
+        if (pg->surface_shape.zeta_format == 0) {
+            return false;
+        }
+        bytes_per_pixel = pg->surface_shape.zeta_format ==
+                                  NV097_SET_SURFACE_FORMAT_ZETA_Z16 ? 2 : 4;
+    }
+
+    DMAObject dma = nv_dma_load(d, dma_address);
+    if (dma.dma_class != NV_DMA_IN_MEMORY_CLASS || width == 0 ||
+        height == 0 || surface->pitch == 0) {
+        return false;
+    }
+
+    s->swizzle = (pg->surface_type == NV097_SET_SURFACE_FORMAT_TYPE_SWIZZLE);
+    s->vram_addr = dma.address + surface->offset;
+    s->width = width;
+    s->height = height;
+    s->pitch = surface->pitch;
+    s->bytes_per_pixel = bytes_per_pixel;
+    s->format = color ? pg->surface_shape.color_format :
+                        pg->surface_shape.zeta_format;
+    s->size = height * MAX(surface->pitch, width * bytes_per_pixel);
+    s->dirty = false;
+
+    if (s->vram_addr + s->size > memory_region_size(d->vram)) {
+        NV2A_DPRINTF("surface at 0x%" HWADDR_PRIx " exceeds VRAM\n",
+                     s->vram_addr);
+        return false;
+    }
+
+    uint8_t *vram = d->vram_ptr + s->vram_addr;
+    if (s->swizzle) {
+        size_t staging_size = (size_t)width * height * bytes_per_pixel;
+        if (staging_size > s->staging_size) {
+            s->staging = g_realloc(s->staging, staging_size);
+            s->staging_size = staging_size;
+        }
+        unswizzle_rect(vram, width, height, s->staging,
+                       width * bytes_per_pixel, bytes_per_pixel);
+        s->data = s->staging;
+        s->pitch = width * bytes_per_pixel;
+    } else {
+        s->data = vram;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_UPLOAD);
+    s->bound = true;
+
+    return true;
+}
+
+static void unbind_surface(NV2AState *d, SwSurface *s)
+{
+    if (!s->bound) {
+        return;
+    }
+
+    if (s->dirty) {
+        if (s->swizzle) {
+            swizzle_rect(s->staging, s->width, s->height,
+                         d->vram_ptr + s->vram_addr,
+                         s->width * s->bytes_per_pixel, s->bytes_per_pixel);
+        }
+        memory_region_set_client_dirty(d->vram, s->vram_addr, s->size,
+                                       DIRTY_MEMORY_VGA);
+        memory_region_set_client_dirty(d->vram, s->vram_addr, s->size,
+                                       DIRTY_MEMORY_NV2A_TEX);
+    }
+
+    s->bound = false;
+    s->data = NULL;
+}
+
+/*
+ * Map the current color and/or zeta targets for CPU access. Swizzled targets
+ * are unswizzled into a staging buffer and written back by
+ * pgraph_sw_surface_unbind.
+ */
+bool pgraph_sw_surface_bind(NV2AState *d, bool color, bool zeta)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    unsigned int width, height;
+    get_surface_dimensions(pg, &width, &height);
+    pg->surface_binding_dim.width = width;
+    pg->surface_binding_dim.height = height;
+
+    r->color_binding.bound = false;
+    r->zeta_binding.bound = false;
+
+    if (color && pg->surface_shape.color_format != 0) {
+        if (bind_surface(d, true, width, height, &r->color_binding)) {
+            r->color_binding.dirty = true;
+        }
+    }
+
+    if (zeta) {
+        if (bind_surface(d, false, width, height, &r->zeta_binding)) {
+            r->zeta_binding.dirty = pgraph_zeta_write_enabled(pg);
+        }
+    }
+
+    if (r->color_binding.bound && r->zeta_binding.bound &&
+        r->color_binding.vram_addr == r->zeta_binding.vram_addr) {
+        NV2A_UNIMPLEMENTED("Same color & zeta surface offset");
+        unbind_surface(d, &r->zeta_binding);
+    }
+
+    return r->color_binding.bound || r->zeta_binding.bound;
+}
+
+void pgraph_sw_surface_unbind(NV2AState *d)
+{
+    PGRAPHSWState *r = d->pgraph.sw_renderer_state;
+
+    unbind_surface(d, &r->color_binding);
+    unbind_surface(d, &r->zeta_binding);
+}
+
+/* Bits of a packed color pixel covered by the CLEAR_SURFACE channel mask */
+static uint32_t get_color_clear_mask(unsigned int format, uint32_t parameter)
+{
+    bool r = parameter & NV097_CLEAR_SURFACE_R;
+    bool g = parameter & NV097_CLEAR_SURFACE_G;
+    bool b = parameter & NV097_CLEAR_SURFACE_B;
+    bool a = parameter & NV097_CLEAR_SURFACE_A;
+
+    switch (format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        return (r ? 0x7C00 : 0) | (g ? 0x03E0 : 0) | (b ? 0x001F : 0) |
+               (a ? 0x8000 : 0);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        return (r ? 0xF800 : 0) | (g ? 0x07E0 : 0) | (b ? 0x001F : 0);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        return b ? 0xFF : 0;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        return (g ? 0xFF00 : 0) | (b ? 0x00FF : 0);
+    default:
+        return (r ? 0x00FF0000 : 0) | (g ? 0x0000FF00 : 0) |
+               (b ? 0x000000FF : 0) | (a ? 0xFF000000 : 0);
+    }
+}
+
+static void clear_rect(SwSurface *s, unsigned int x0, unsigned int y0,
+                       unsigned int x1, unsigned int y1, uint32_t value,
+                       uint32_t mask)
+{
+    x1 = MIN(x1, s->width);
+    y1 = MIN(y1, s->height);
+    if (x0 >= x1 || y0 >= y1 || mask == 0) {
+        return;
+    }
+
+    for (unsigned int y = y0; y < y1; y++) {
+        uint8_t *row = s->data + y * s->pitch;
+        for (unsigned int x = x0; x < x1; x++) {
+            uint8_t *p = row + x * s->bytes_per_pixel;
+            switch (s->bytes_per_pixel) {
+            case 1:
+                *p = (*p & ~mask) | (value & mask);
+                break;
+            case 2:
+                stw_le_p(p, (lduw_le_p(p) & ~mask) | (value & mask));
+                break;
+            case 4:
+                stl_le_p(p, (ldl_le_p(p) & ~mask) | (value & mask));
+                break;
+            default:
+                assert(false);
+                break;
+            }
+        }
+    }
+}
+
+void pgraph_sw_clear_surface(NV2AState *d, uint32_t parameter)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    nv2a_profile_inc_counter(NV2A_PROF_CLEAR);
+
+    bool write_color = (parameter & NV097_CLEAR_SURFACE_COLOR);
+    bool write_zeta =
+        (parameter & (NV097_CLEAR_SURFACE_Z | NV097_CLEAR_SURFACE_STENCIL));
+
+    pg->clearing = true;
+    if (!pgraph_sw_surface_bind(d, write_color, write_zeta)) {
+        pg->clearing = false;
+        return;
+    }
+
+    unsigned int xmin =
+        GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTX), NV_PGRAPH_CLEARRECTX_XMIN);
+    unsigned int xmax =
+        GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTX), NV_PGRAPH_CLEARRECTX_XMAX);
+    unsigned int ymin =
+        GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTY), NV_PGRAPH_CLEARRECTY_YMIN);
+    unsigned int ymax =
+        GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTY), NV_PGRAPH_CLEARRECTY_YMAX);
+
+    unsigned int x1 = xmax + 1, y1 = ymax + 1;
+    pgraph_apply_anti_aliasing_factor(pg, &xmin, &ymin);
+    pgraph_apply_anti_aliasing_factor(pg, &x1, &y1);
+
+    NV2A_DPRINTF("CLEAR_SURFACE 0x%x rect %d,%d - %d,%d\n", parameter, xmin,
+                 ymin, x1 - 1, y1 - 1);
+
+    /* Clear values are stored in the native packing of the target */
+    if (r->color_binding.bound) {
+        SwSurface *s = &r->color_binding;
+        uint32_t value = pgraph_reg_r(pg, NV_PGRAPH_COLORCLEARVALUE);
+        clear_rect(s, xmin, ymin, x1, y1, value,
+                   get_color_clear_mask(s->format, parameter));
+        s->dirty = true;
+    }
+
+    if (r->zeta_binding.bound) {
+        SwSurface *s = &r->zeta_binding;
+        uint32_t value = pgraph_reg_r(pg, NV_PGRAPH_ZSTENCILCLEARVALUE);
+        uint32_t mask = 0;
+        if (s->format == NV097_SET_SURFACE_FORMAT_ZETA_Z16) {
+            /* FIXME: Remove bit for stencil clear? */
+            mask = (parameter & NV097_CLEAR_SURFACE_Z) ? 0xFFFF : 0;
+        } else {
+            mask = ((parameter & NV097_CLEAR_SURFACE_Z) ? 0xFFFFFF00 : 0) |
+                   ((parameter & NV097_CLEAR_SURFACE_STENCIL) ? 0xFF : 0);
+        }
+        clear_rect(s, xmin, ymin, x1, y1, value, mask);
+        s->dirty = true;
+    }
+
+    pgraph_sw_surface_unbind(d);
+    pg->clearing = false;
+}
+
+void pgraph_sw_init_surfaces(PGRAPHState *pg)
+{
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    memset(&r->color_binding, 0, sizeof(r->color_binding));
+    memset(&r->zeta_binding, 0, sizeof(r->zeta_binding));
+}
+
+void pgraph_sw_finalize_surfaces(PGRAPHState *pg)
+{
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    g_free(r->color_binding.staging);
+    g_free(r->zeta_binding.staging);
+    memset(&r->color_binding, 0, sizeof(r->color_binding));
+    memset(&r->zeta_binding, 0, sizeof(r->zeta_binding));
+}
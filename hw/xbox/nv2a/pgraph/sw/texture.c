@@ -0,0 +1,582 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
+#include "hw/xbox/nv2a/pgraph/s3tc.h"
+#include "hw/xbox/nv2a/pgraph/swizzle.h"
+#include "renderer.h"
+
+/* One mipmap level of one face, decoded by a single worker */
+typedef struct DecodeJob {
+    TextureShape shape;
+    const uint8_t *src;
+    const uint8_t *palette;
+    unsigned int width, height, depth;
+    unsigned int pitch;
+    uint32_t *dst;
+} DecodeJob;
+
+static inline uint32_t pack_rgba(uint32_t r, uint32_t g, uint32_t b,
+                                 uint32_t a)
+{
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+static inline uint32_t expand5(uint32_t v)
+{
+    return (v << 3) | (v >> 2);
+}
+
+static inline uint32_t expand6(uint32_t v)
+{
+    return (v << 2) | (v >> 4);
+}
+
+static enum S3TC_DECOMPRESS_FORMAT kelvin_format_to_s3tc_format(int color_format)
+{
+    switch (color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5:
+        return S3TC_DECOMPRESS_FORMAT_DXT1;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT23_A8R8G8B8:
+        return S3TC_DECOMPRESS_FORMAT_DXT3;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT45_A8R8G8B8:
+        return S3TC_DECOMPRESS_FORMAT_DXT5;
+    default:
+        assert(!"Invalid texture color format");
+    }
+}
+
+/*
+ * Expand a texel of an unswizzled (and, where needed, converted by
+ * pgraph_convert_texture_data) image to RGBA8. Component mappings follow
+ * kelvin_color_format_vk_map.
+ */
+static uint32_t decode_texel(unsigned int color_format, const uint8_t *p)
+{
+    uint32_t v;
+
+    switch (color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_Y8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_Y8:
+        return pack_rgba(p[0], p[0], p[0], 0xFF);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_AY8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_AY8:
+        return pack_rgba(p[0], p[0], p[0], p[0]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X1R5G5B5: {
+        v = lduw_le_p(p);
+        bool x = color_format == NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X1R5G5B5 ||
+                 color_format ==
+                     NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X1R5G5B5;
+        return pack_rgba(expand5((v >> 10) & 0x1F), expand5((v >> 5) & 0x1F),
+                         expand5(v & 0x1F), (x || (v & 0x8000)) ? 0xFF : 0);
+    }
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A4R4G4B4:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A4R4G4B4:
+        v = lduw_le_p(p);
+        return pack_rgba(((v >> 8) & 0xF) * 0x11, ((v >> 4) & 0xF) * 0x11,
+                         (v & 0xF) * 0x11, ((v >> 12) & 0xF) * 0x11);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R5G6B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_R5G6B5:
+        v = lduw_le_p(p);
+        return pack_rgba(expand5((v >> 11) & 0x1F), expand6((v >> 5) & 0x3F),
+                         expand5(v & 0x1F), 0xFF);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8: /* Converted */
+        return pack_rgba(p[2], p[1], p[0], p[3]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X8R8G8B8:
+        return pack_rgba(p[2], p[1], p[0], 0xFF);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_G8B8:
+        return pack_rgba(p[0], p[1], p[0], p[1]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R8B8:
+        return pack_rgba(p[1], p[0], p[0], p[1]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8:
+        return pack_rgba(0xFF, 0xFF, 0xFF, p[0]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A8Y8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8Y8:
+        return pack_rgba(p[0], p[0], p[0], p[1]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R6G5B5: /* Converted */
+        /* FIXME: Signed components are clamped to zero */
+        return pack_rgba(MAX((int8_t)p[0], 0) * 2, MAX((int8_t)p[1], 0) * 2,
+                         MAX((int8_t)p[2], 0) * 2, 0xFF);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_CR8YB8CB8YA8: /* Converted */
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_YB8CR8YA8CB8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT23_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT45_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A8B8G8R8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8B8G8R8:
+        return pack_rgba(p[0], p[1], p[2], p[3]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_B8G8R8A8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_B8G8R8A8:
+        return pack_rgba(p[1], p[2], p[3], p[0]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R8G8B8A8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_R8G8B8A8:
+        return pack_rgba(p[3], p[2], p[1], p[0]);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_Y16:
+        return pack_rgba(p[1], p[1], p[1], 0xFF);
+    /* FIXME: Depth textures are sampled as plain color */
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_DEPTH_Y16_FIXED:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_DEPTH_Y16_FIXED:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_DEPTH_Y16_FLOAT:
+        return pack_rgba(p[1], 0, 0, 0);
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_DEPTH_X8_Y24_FIXED:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_DEPTH_X8_Y24_FLOAT:
+        return pack_rgba(p[3], 0xFF, 0, 0);
+    default:
+        assert(!"Invalid texture color format");
+        return 0;
+    }
+}
+
+static unsigned int get_decoded_bytes_per_pixel(unsigned int color_format,
+                                                unsigned int bytes_per_pixel)
+{
+    switch (color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_CR8YB8CB8YA8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_YB8CR8YA8CB8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT23_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT45_A8R8G8B8:
+        return 4;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R6G5B5:
+        return 3;
+    default:
+        return bytes_per_pixel;
+    }
+}
+
+static void decode_job(void *opaque, int index)
+{
+    DecodeJob *job = &((DecodeJob *)opaque)[index];
+    TextureShape s = job->shape;
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
+    unsigned int width = job->width, height = job->height;
+    uint8_t *image = NULL;
+    const uint8_t *pixels;
+    unsigned int pitch;
+
+    if (pgraph_is_texture_format_compressed(NULL, s.color_format)) {
+        image = s3tc_decompress_2d(kelvin_format_to_s3tc_format(s.color_format),
+                                   job->src, width, height);
+        pixels = image;
+        pitch = width * 4;
+    } else {
+        uint8_t *unswizzled = NULL;
+        const uint8_t *src = job->src;
+        pitch = job->pitch;
+        if (!f.linear) {
+            /* FIXME: 3D textures, only the first slice is kept */
+            unsigned int row_pitch = width * f.bytes_per_pixel;
+            unsigned int slice_pitch = row_pitch * height;
+            unswizzled = g_malloc((size_t)slice_pitch * job->depth);
+            unswizzle_box(src, width, height, job->depth, unswizzled,
+                          row_pitch, slice_pitch, f.bytes_per_pixel);
+            src = unswizzled;
+            pitch = row_pitch;
+        }
+
+        image = pgraph_convert_texture_data(s, src, job->palette, width,
+                                            height, 1, pitch, 0, NULL);
+        if (image) {
+            g_free(unswizzled);
+            pitch = width * get_decoded_bytes_per_pixel(s.color_format,
+                                                        f.bytes_per_pixel);
+        } else {
+            image = unswizzled;
+        }
+        pixels = image ? image : src;
+    }
+
+    unsigned int bpp =
+        get_decoded_bytes_per_pixel(s.color_format, f.bytes_per_pixel);
+    uint32_t *dst = job->dst;
+    for (unsigned int y = 0; y < height; y++) {
+        const uint8_t *row = pixels + y * pitch;
+        for (unsigned int x = 0; x < width; x++) {
+            *dst++ = decode_texel(s.color_format, row + x * bpp);
+        }
+    }
+
+    g_free(image);
+}
+
+static size_t get_cubemap_layer_size(PGRAPHState *pg, TextureShape s,
+                                     unsigned int width, unsigned int height)
+{
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
+    bool is_compressed =
+        pgraph_is_texture_format_compressed(pg, s.color_format);
+    unsigned int block_size =
+        s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5 ? 8 :
+                                                                          16;
+    size_t length = 0;
+
+    for (int level = 0; level < s.levels; level++) {
+        if (is_compressed) {
+            length += width / 4 * height / 4 * block_size;
+        } else {
+            length += width * height * f.bytes_per_pixel;
+        }
+        width /= 2;
+        height /= 2;
+    }
+
+    return ROUND_UP(length, NV2A_CUBEMAP_FACE_ALIGNMENT);
+}
+
+/* Decode all faces and levels of a texture, one worker job per level */
+static void decode_texture(NV2AState *d, const SwTextureKey *key,
+                           SwTexture *t)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+    TextureShape s = key->shape;
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
+    bool is_compressed = pgraph_is_texture_format_compressed(pg, s.color_format);
+    unsigned int block_size =
+        s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5 ? 8 :
+                                                                          16;
+
+    unsigned int width = s.width, height = s.height, depth = s.depth;
+    if (!f.linear && s.border) {
+        /* FIXME: Border texels are sampled as part of the image */
+        width = MAX(16, width * 2);
+        height = MAX(16, height * 2);
+        depth = MAX(16, depth * 2);
+    }
+
+    t->num_faces = s.cubemap ? 6 : 1;
+    t->num_levels = f.linear ? 1 : MIN(s.levels, SW_MAX_TEXTURE_LEVELS);
+    size_t layer_size =
+        s.cubemap ? get_cubemap_layer_size(pg, s, width, height) : 0;
+
+    DecodeJob jobs[6 * SW_MAX_TEXTURE_LEVELS];
+    int num_jobs = 0;
+    size_t num_texels = 0;
+
+    for (unsigned int face = 0; face < t->num_faces; face++) {
+        const uint8_t *src =
+            d->vram_ptr + key->texture_vram_offset + face * layer_size;
+        unsigned int w = width, h = height, z = depth;
+
+        for (unsigned int level = 0; level < t->num_levels; level++) {
+            w = MAX(w, 1);
+            h = MAX(h, 1);
+            z = MAX(z, 1);
+
+            jobs[num_jobs++] = (DecodeJob){
+                .shape = s,
+                .src = src,
+                .palette = d->vram_ptr + key->palette_vram_offset,
+                .width = w,
+                .height = h,
+                .depth = s.dimensionality == 3 ? z : 1,
+                .pitch = f.linear ? s.pitch : w * f.bytes_per_pixel,
+            };
+            t->levels[face][level].width = w;
+            t->levels[face][level].height = h;
+            num_texels += (size_t)w * h;
+
+            if (is_compressed) {
+                unsigned int physical_w = (w + 3) & ~3;
+                unsigned int physical_h = (h + 3) & ~3;
+                src += physical_w / 4 * physical_h / 4 * block_size *
+                       (s.dimensionality == 3 ? z : 1);
+            } else {
+                src += (size_t)w * h * (s.dimensionality == 3 ? z : 1) *
+                       f.bytes_per_pixel;
+            }
+
+            w /= 2;
+            h /= 2;
+            z /= 2;
+        }
+    }
+
+    g_free(t->data);
+    t->data = g_malloc_n(num_texels, sizeof(uint32_t));
+    t->data_size = num_texels * sizeof(uint32_t);
+
+    uint32_t *dst = t->data;
+    for (int i = 0; i < num_jobs; i++) {
+        SwTextureLevel *level =
+            &t->levels[i / t->num_levels][i % t->num_levels];
+        jobs[i].dst = dst;
+        level->texels = dst;
+        dst += level->width * level->height;
+    }
+
+    pgraph_sw_parallel_for(r, num_jobs, decode_job, jobs);
+}
+
+struct texture_possibly_dirty_struct {
+    hwaddr addr, end;
+};
+
+static void mark_textures_possibly_dirty_visitor(Lru *lru, LruNode *node,
+                                                 void *opaque)
+{
+    struct texture_possibly_dirty_struct *test = opaque;
+
+    SwTextureLruNode *tnode = container_of(node, SwTextureLruNode, node);
+    if (tnode->possibly_dirty) {
+        return;
+    }
+
+    uintptr_t k_tex_addr = tnode->key.texture_vram_offset;
+    uintptr_t k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
+    bool overlapping = !(test->addr > k_tex_end || k_tex_addr > test->end);
+
+    if (tnode->key.palette_length > 0) {
+        uintptr_t k_pal_addr = tnode->key.palette_vram_offset;
+        uintptr_t k_pal_end = k_pal_addr + tnode->key.palette_length - 1;
+        overlapping |= !(test->addr > k_pal_end || k_pal_addr > test->end);
+    }
+
+    tnode->possibly_dirty |= overlapping;
+}
+
+static void mark_textures_possibly_dirty(NV2AState *d, hwaddr addr,
+                                         hwaddr size)
+{
+    hwaddr end = TARGET_PAGE_ALIGN(addr + size) - 1;
+    addr &= TARGET_PAGE_MASK;
+    assert(end <= memory_region_size(d->vram));
+
+    struct texture_possibly_dirty_struct test = {
+        .addr = addr,
+        .end = end,
+    };
+
+    lru_visit_active(&d->pgraph.sw_renderer_state->texture_cache,
+                     mark_textures_possibly_dirty_visitor, &test);
+}
+
+static bool check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
+{
+    hwaddr end = TARGET_PAGE_ALIGN(addr + size);
+    addr &= TARGET_PAGE_MASK;
+    assert(end <= memory_region_size(d->vram));
+    return memory_region_test_and_clear_dirty(d->vram, addr, end - addr,
+                                              DIRTY_MEMORY_NV2A_TEX);
+}
+
+static bool check_texture_possibly_dirty(NV2AState *d, const SwTextureKey *key)
+{
+    bool possibly_dirty = false;
+    if (check_texture_dirty(d, key->texture_vram_offset,
+                            key->texture_length)) {
+        possibly_dirty = true;
+        mark_textures_possibly_dirty(d, key->texture_vram_offset,
+                                     key->texture_length);
+    }
+    if (key->palette_length &&
+        check_texture_dirty(d, key->palette_vram_offset,
+                            key->palette_length)) {
+        possibly_dirty = true;
+        mark_textures_possibly_dirty(d, key->palette_vram_offset,
+                                     key->palette_length);
+    }
+    return possibly_dirty;
+}
+
+static SwTexture *get_texture(NV2AState *d, int texture_idx)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    SwTextureKey key;
+    memset(&key, 0, sizeof(key));
+    key.shape = pgraph_get_texture_shape(pg, texture_idx);
+    key.texture_vram_offset = pgraph_get_texture_phys_addr(pg, texture_idx);
+    key.texture_length = pgraph_get_texture_length(pg, &key.shape);
+    if (key.shape.color_format ==
+        NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8) {
+        size_t palette_length;
+        key.palette_vram_offset = pgraph_get_texture_palette_phys_addr_length(
+            pg, texture_idx, &palette_length);
+        key.palette_length = palette_length;
+    }
+
+    uint64_t key_hash = fast_hash((void *)&key, sizeof(key));
+    LruNode *node = lru_lookup(&r->texture_cache, key_hash, &key);
+    SwTextureLruNode *tnode = container_of(node, SwTextureLruNode, node);
+    r->texture_bindings[texture_idx] = tnode;
+
+    bool found = tnode->texture != NULL;
+    bool possibly_dirty = !found || tnode->possibly_dirty;
+    possibly_dirty |= check_texture_possibly_dirty(d, &key);
+
+    if (!found) {
+        memcpy(&tnode->key, &key, sizeof(key));
+        tnode->texture = g_malloc0(sizeof(SwTexture));
+    }
+    tnode->possibly_dirty = false;
+
+    if (possibly_dirty) {
+        uint64_t content_hash = fast_hash(d->vram_ptr + key.texture_vram_offset,
+                                          key.texture_length);
+        if (key.palette_length) {
+            content_hash ^= fast_hash(d->vram_ptr + key.palette_vram_offset,
+                                      key.palette_length);
+        }
+        if (!found || content_hash != tnode->texture->data_hash) {
+            nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
+            decode_texture(d, &key, tnode->texture);
+            tnode->texture->data_hash = content_hash;
+            lru_set_node_size(&r->texture_cache, &tnode->node,
+                              tnode->texture->data_size);
+        }
+    }
+
+    return tnode->texture;
+}
+
+void pgraph_sw_bind_textures(NV2AState *d, SwCombinerState *cs)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        r->texture_bindings[i] = NULL;
+    }
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        SwSampler *s = &cs->samplers[i];
+        memset(s, 0, sizeof(*s));
+
+        uint32_t ctl_0 = pgraph_reg_r(pg, NV_PGRAPH_TEXCTL0_0 + i * 4);
+        if (!pgraph_is_texture_stage_active(pg, i) ||
+            !(ctl_0 & NV_PGRAPH_TEXCTL0_0_ENABLE)) {
+            continue;
+        }
+
+        TextureShape shape = pgraph_get_texture_shape(pg, i);
+        BasicColorFormatInfo f = kelvin_color_format_info_map[shape.color_format];
+        uint32_t filter = pgraph_reg_r(pg, NV_PGRAPH_TEXFILTER0 + i * 4);
+        uint32_t address = pgraph_reg_r(pg, NV_PGRAPH_TEXADDRESS0 + i * 4);
+
+        if (shape.dimensionality != 2) {
+            NV2A_UNIMPLEMENTED("%dD texture", shape.dimensionality);
+        }
+
+        s->texture = get_texture(d, i);
+        s->cubemap = shape.cubemap;
+        s->rect = f.linear;
+        s->alpha_kill = ctl_0 & NV_PGRAPH_TEXCTL0_0_ALPHAKILLEN;
+        s->min_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIN);
+        s->mag_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MAG);
+        s->addr_u = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRU);
+        s->addr_v = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRV);
+        s->lod_bias = pgraph_convert_lod_bias_to_float(
+            GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIPMAP_LOD_BIAS));
+
+        bool mipmap_en =
+            !f.linear &&
+            !(s->min_filter == NV_PGRAPH_TEXFILTER0_MIN_BOX_LOD0 ||
+              s->min_filter == NV_PGRAPH_TEXFILTER0_MIN_TENT_LOD0 ||
+              s->min_filter == NV_PGRAPH_TEXFILTER0_MIN_CONVOLUTION_2D_LOD0);
+        unsigned int last_level = s->texture->num_levels - 1;
+        s->min_lod = mipmap_en ? MIN(shape.min_mipmap_level, last_level) : 0;
+        s->max_lod = mipmap_en ? MIN(shape.max_mipmap_level, last_level) : 0;
+
+        pgraph_argb_pack32_to_rgba_float(
+            pgraph_reg_r(pg, NV_PGRAPH_BORDERCOLOR0 + i * 4), s->border_color);
+
+        pg->texture_dirty[i] = false;
+    }
+}
+
+static void texture_cache_entry_init(Lru *lru, LruNode *node, const void *key)
+{
+    SwTextureLruNode *tnode = container_of(node, SwTextureLruNode, node);
+    memcpy(&tnode->key, key, sizeof(SwTextureKey));
+    tnode->texture = NULL;
+    tnode->possibly_dirty = false;
+}
+
+static bool texture_cache_entry_pre_evict(Lru *lru, LruNode *node)
+{
+    PGRAPHSWState *r = container_of(lru, PGRAPHSWState, texture_cache);
+    SwTextureLruNode *tnode = container_of(node, SwTextureLruNode, node);
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        if (r->texture_bindings[i] == tnode) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void texture_cache_entry_post_evict(Lru *lru, LruNode *node)
+{
+    SwTextureLruNode *tnode = container_of(node, SwTextureLruNode, node);
+    if (tnode->texture) {
+        g_free(tnode->texture->data);
+        g_free(tnode->texture);
+        tnode->texture = NULL;
+    }
+}
+
+static bool texture_cache_entry_compare(Lru *lru, LruNode *node,
+                                        const void *key)
+{
+    SwTextureLruNode *tnode = container_of(node, SwTextureLruNode, node);
+    return memcmp(&tnode->key, key, sizeof(SwTextureKey));
+}
+
+void pgraph_sw_init_textures(PGRAPHState *pg)
+{
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    lru_init(&r->texture_cache);
+    r->texture_cache.max_size = SW_TEXTURE_CACHE_MAX_SIZE;
+    r->texture_cache_entries =
+        g_malloc_n(SW_TEXTURE_CACHE_SIZE, sizeof(SwTextureLruNode));
+    for (int i = 0; i < SW_TEXTURE_CACHE_SIZE; i++) {
+        lru_add_free(&r->texture_cache, &r->texture_cache_entries[i].node);
+    }
+    r->texture_cache.init_node = texture_cache_entry_init;
+    r->texture_cache.compare_nodes = texture_cache_entry_compare;
+    r->texture_cache.pre_node_evict = texture_cache_entry_pre_evict;
+    r->texture_cache.post_node_evict = texture_cache_entry_post_evict;
+}
+
+void pgraph_sw_finalize_textures(PGRAPHState *pg)
+{
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        r->texture_bindings[i] = NULL;
+    }
+
+    lru_flush(&r->texture_cache);
+    lru_destroy(&r->texture_cache);
+    g_free(r->texture_cache_entries);
+    r->texture_cache_entries = NULL;
+}
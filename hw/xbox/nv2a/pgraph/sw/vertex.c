@@ -0,0 +1,941 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/xbox/nv2a/pgraph/vsh_regs.h"
+#include "nv2a_vsh_emulator.h"
+#include "renderer.h"
+
+#include <math.h>
+
+// Vertices are transformed in parallel in chunks of this size
+#define VERTEX_CHUNK_SIZE 256
+
+enum {
+    OUT_POS = 0,
+    OUT_D0 = 3,
+    OUT_D1 = 4,
+    OUT_FOG = 5,
+    OUT_PTS = 6,
+    OUT_T0 = 9,
+};
+
+typedef struct AttributeSource {
+    const uint8_t *data; /* NULL when the attribute is constant */
+    unsigned int stride;
+    unsigned int format;
+    bool inline_buffer;
+    float value[4];
+} AttributeSource;
+
+typedef struct TransformState {
+    const float (*c)[4];
+    bool vertex_program;
+    Nv2aVshProgram program;
+
+    bool fog_enable;
+    enum VshFogMode fog_mode;
+    float fog_param[2];
+
+    bool specular_enable;
+    bool separate_specular;
+    bool ignore_specular_alpha;
+
+    bool point_params_enable;
+    float point_size;
+    float point_params[8];
+
+    /* Fixed function only */
+    enum VshSkinning skinning;
+    bool normalization;
+    bool local_eye;
+    bool lighting;
+    enum VshLight light[NV2A_MAX_LIGHTS];
+    enum MaterialColorSource emission_src, ambient_src, diffuse_src,
+        specular_src;
+    enum VshTexgen texgen[NV2A_MAX_TEXTURES][4];
+    bool texture_matrix_enable[NV2A_MAX_TEXTURES];
+    enum VshFoggen foggen;
+
+    const float (*ltctxa)[4];
+    const float (*ltctxb)[4];
+    const float (*ltc1)[4];
+    const float (*light_infinite_half_vector)[3];
+    const float (*light_infinite_direction)[3];
+    const float (*light_local_position)[3];
+    const float (*light_local_attenuation)[3];
+    float material_alpha;
+    float specular_power;
+} TransformState;
+
+typedef struct VertexJob {
+    PGRAPHState *pg;
+    const TransformState *ts;
+    AttributeSource attrs[NV2A_VERTEXSHADER_ATTRIBUTES];
+    unsigned int first;
+    unsigned int count;
+    SwVertex *out;
+} VertexJob;
+
+static inline float dot3(const float *a, const float *b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline float dot4(const float *a, const float *b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+}
+
+static inline void normalize3(float *v)
+{
+    float len = sqrtf(dot3(v, v));
+    v[0] /= len;
+    v[1] /= len;
+    v[2] /= len;
+}
+
+/* v * mat4(c[idx], c[idx+1], c[idx+2], c[idx+3]) */
+static inline void mul_mat4(const TransformState *ts, const float *v,
+                            unsigned int idx, float *out)
+{
+    float r[4];
+    for (int j = 0; j < 4; j++) {
+        r[j] = dot4(v, ts->c[idx + j]);
+    }
+    memcpy(out, r, sizeof(r));
+}
+
+static float clamp_away_zero_inf(float t)
+{
+    uint32_t bits;
+    memcpy(&bits, &t, sizeof(bits));
+    if (t > 0.0f || bits == 0) {
+        return MIN(MAX(t, 0x1p-64f), 0x1p64f);
+    }
+    return MIN(MAX(t, -0x1p64f), -0x1p-64f);
+}
+
+static inline float round_screen_coord(float v)
+{
+    return truncf(v * 16.0f) / 16.0f;
+}
+
+static void decode_attribute(unsigned int format, const uint8_t *data,
+                             float out[4])
+{
+    switch (format) {
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D:
+        out[0] = data[2] / 255.0f;
+        out[1] = data[1] / 255.0f;
+        out[2] = data[0] / 255.0f;
+        out[3] = data[3] / 255.0f;
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_OGL:
+        for (int i = 0; i < 4; i++) {
+            out[i] = data[i] / 255.0f;
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S1:
+        for (int i = 0; i < 4; i++) {
+            int16_t v;
+            memcpy(&v, data + i * 2, sizeof(v));
+            out[i] = MAX(-1.0f, v / 32767.0f);
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_F:
+        memcpy(out, data, 4 * sizeof(float));
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S32K:
+        for (int i = 0; i < 4; i++) {
+            int16_t v;
+            memcpy(&v, data + i * 2, sizeof(v));
+            out[i] = v;
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_CMP: {
+        /* 3 signed, normalized components packed in 32-bits. (11,11,10) */
+        int32_t v;
+        memcpy(&v, data, sizeof(v));
+        out[0] = sextract32(v, 0, 11) / 1023.0f;
+        out[1] = sextract32(v, 11, 11) / 1023.0f;
+        out[2] = sextract32(v, 22, 10) / 511.0f;
+        out[3] = 1.0f;
+        break;
+    }
+    default:
+        NV2A_UNIMPLEMENTED("Vertex type 0x%x", format);
+        out[0] = out[1] = out[2] = 0.0f;
+        out[3] = 1.0f;
+        break;
+    }
+}
+
+static void fetch_attribute(const VertexAttribute *attr,
+                            const AttributeSource *src, unsigned int index,
+                            float out[4])
+{
+    if (src->inline_buffer) {
+        memcpy(out, (const float *)src->data + index * 4, 4 * sizeof(float));
+        return;
+    }
+
+    if (!src->data) {
+        memcpy(out, src->value, 4 * sizeof(float));
+        return;
+    }
+
+    /* Unused components of the source format default to (0, 0, 0, 1) */
+    uint8_t element[16] = { 0 };
+    const uint8_t *p = src->data + (size_t)index * src->stride;
+    size_t element_size = attr->size * attr->count;
+
+    if (attr->format == NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D ||
+        attr->format == NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_CMP) {
+        decode_attribute(attr->format, p, out);
+        return;
+    }
+
+    memcpy(element, p, MIN(element_size, sizeof(element)));
+    decode_attribute(attr->format, element, out);
+    for (int i = attr->count; i < 4; i++) {
+        out[i] = (i == 3) ? 1.0f : 0.0f;
+    }
+}
+
+static void apply_skinning(const TransformState *ts, const float v[16][4],
+                           const float *input, unsigned int matrix,
+                           int components, float *output)
+{
+    unsigned int count;
+    bool mix;
+    switch (ts->skinning) {
+    case SKINNING_OFF:
+        mix = false; count = 0; break;
+    case SKINNING_1WEIGHTS:
+        mix = true; count = 2; break;
+    case SKINNING_2WEIGHTS2MATRICES:
+        mix = false; count = 2; break;
+    case SKINNING_2WEIGHTS:
+        mix = true; count = 3; break;
+    case SKINNING_3WEIGHTS3MATRICES:
+        mix = false; count = 3; break;
+    case SKINNING_3WEIGHTS:
+        mix = true; count = 4; break;
+    case SKINNING_4WEIGHTS4MATRICES:
+        mix = false; count = 4; break;
+    default:
+        assert(!"Invalid skinning weight");
+        return;
+    }
+
+    float t[4];
+    if (count == 0) {
+        mul_mat4(ts, input, matrix, t);
+        memcpy(output, t, components * sizeof(float));
+        return;
+    }
+
+    const float *weight = v[1];
+    float weight_n = 1.0f;
+    memset(output, 0, components * sizeof(float));
+    for (int i = 0; i < count; i++) {
+        float weight_i;
+        if (!mix) {
+            weight_i = weight[i];
+        } else if (i < count - 1) {
+            weight_i = weight[i];
+            weight_n -= weight_i;
+        } else {
+            weight_i = weight_n;
+        }
+        /* Model view matrices are interleaved with their inverses */
+        mul_mat4(ts, input, matrix + i * 8, t);
+        for (int j = 0; j < components; j++) {
+            output[j] += t[j] * weight_i;
+        }
+    }
+}
+
+static void reflect3(const float *i, const float *n, float *out)
+{
+    float d = 2.0f * dot3(n, i);
+    for (int j = 0; j < 3; j++) {
+        out[j] = i[j] - d * n[j];
+    }
+}
+
+static void apply_material_source(enum MaterialColorSource src,
+                                  const float v[16][4], const float *light,
+                                  float *out)
+{
+    for (int j = 0; j < 3; j++) {
+        switch (src) {
+        case MATERIAL_COLOR_SRC_MATERIAL:
+            out[j] += light[j];
+            break;
+        case MATERIAL_COLOR_SRC_DIFFUSE:
+            out[j] += v[3][j] * light[j];
+            break;
+        case MATERIAL_COLOR_SRC_SPECULAR:
+            out[j] += v[4][j] * light[j];
+            break;
+        }
+    }
+}
+
+static void compute_lighting(const TransformState *ts, const float v[16][4],
+                             const float *t_position, const float *t_normal,
+                             float *d0, float *d1)
+{
+    const float *diffuse = v[3];
+    const float *specular = v[4];
+    const float *scene_ambient = ts->ltctxa[NV_IGRAPH_XF_LTCTXA_FR_AMB];
+    const float *material_emission = ts->ltctxa[NV_IGRAPH_XF_LTCTXA_CM_COL];
+
+    float alpha = diffuse[3];
+    if (ts->diffuse_src == MATERIAL_COLOR_SRC_MATERIAL) {
+        alpha = ts->material_alpha;
+    } else if (ts->diffuse_src == MATERIAL_COLOR_SRC_SPECULAR) {
+        alpha = specular[3];
+    }
+
+    const float *ambient = scene_ambient;
+    if (ts->ambient_src == MATERIAL_COLOR_SRC_DIFFUSE) {
+        ambient = diffuse;
+    } else if (ts->ambient_src == MATERIAL_COLOR_SRC_SPECULAR) {
+        ambient = specular;
+    }
+    const float *emission = scene_ambient;
+    if (ts->emission_src == MATERIAL_COLOR_SRC_DIFFUSE) {
+        emission = diffuse;
+    } else if (ts->emission_src == MATERIAL_COLOR_SRC_SPECULAR) {
+        emission = specular;
+    }
+    for (int j = 0; j < 3; j++) {
+        d0[j] = ambient[j] * material_emission[j] + emission[j];
+    }
+    d0[3] = alpha;
+
+    d1[0] = d1[1] = d1[2] = 0.0f;
+    d1[3] = specular[3];
+
+    float vp_eye[3] = { 0.0f, 0.0f, 0.0f };
+    if (ts->local_eye) {
+        const float *eye = ts->c[NV_IGRAPH_XF_XFCTX_EYEP];
+        for (int j = 0; j < 3; j++) {
+            vp_eye[j] = eye[j] / eye[3] - t_position[j] / t_position[3];
+        }
+        normalize3(vp_eye);
+    }
+
+    for (int i = 0; i < NV2A_MAX_LIGHTS; i++) {
+        if (ts->light[i] == LIGHT_OFF) {
+            continue;
+        }
+
+        float attenuation = 1.0f;
+        float n_dot_vp, n_dot_hv;
+
+        if (ts->light[i] == LIGHT_INFINITE) {
+            float dir[3];
+            memcpy(dir, ts->light_infinite_direction[i], sizeof(dir));
+            normalize3(dir);
+            n_dot_vp = MAX(0.0f, dot3(t_normal, dir));
+            if (ts->local_eye) {
+                float h[3] = { dir[0] + vp_eye[0], dir[1] + vp_eye[1],
+                               dir[2] + vp_eye[2] };
+                normalize3(h);
+                n_dot_hv = MAX(0.0f, dot3(t_normal, h));
+            } else {
+                n_dot_hv = MAX(0.0f, dot3(t_normal,
+                                          ts->light_infinite_half_vector[i]));
+            }
+        } else {
+            float vp[3];
+            for (int j = 0; j < 3; j++) {
+                vp[j] = ts->light_local_position[i][j] -
+                        t_position[j] / t_position[3];
+            }
+            float d = sqrtf(dot3(vp, vp));
+            /* FIXME: Double check that range is inclusive */
+            if (!(d <= ts->ltc1[NV_IGRAPH_XF_LTC1_r0 + i][0])) {
+                continue;
+            }
+            normalize3(vp);
+            const float *att = ts->light_local_attenuation[i];
+            attenuation = 1.0f / (att[0] + att[1] * d + att[2] * d * d);
+            float h[3] = { vp[0] + vp_eye[0], vp[1] + vp_eye[1],
+                           vp[2] + vp_eye[2] };
+            normalize3(h);
+            n_dot_vp = MAX(0.0f, dot3(t_normal, vp));
+            n_dot_hv = MAX(0.0f, dot3(t_normal, h));
+
+            if (ts->light[i] == LIGHT_SPOT) {
+                const float *spot_dir =
+                    ts->ltctxa[NV_IGRAPH_XF_LTCTXA_L0_SPT + i * 2];
+                float inv_scale = 1.0f / sqrtf(dot3(spot_dir, spot_dir));
+                float cos_half_phi = -inv_scale * spot_dir[3];
+                float cos_half_theta = inv_scale + cos_half_phi;
+                float spot_dir_dot_vp = dot3(spot_dir, vp);
+                float rho = inv_scale * spot_dir_dot_vp;
+                if (rho > cos_half_theta) {
+                } else if (rho <= cos_half_phi) {
+                    attenuation = 0.0f;
+                } else {
+                    /* FIXME: lightSpotFalloff */
+                    attenuation *= spot_dir_dot_vp + spot_dir[3];
+                }
+            }
+        }
+
+        float pf = 0.0f;
+        if (n_dot_vp != 0.0f && n_dot_hv != 0.0f) {
+            pf = powf(n_dot_hv, ts->specular_power);
+        }
+
+        const float *amb = ts->ltctxb[NV_IGRAPH_XF_LTCTXB_L0_AMB + i * 6];
+        const float *dif = ts->ltctxb[NV_IGRAPH_XF_LTCTXB_L0_DIF + i * 6];
+        const float *spc = ts->ltctxb[NV_IGRAPH_XF_LTCTXB_L0_SPC + i * 6];
+        float light_diffuse[3], light_specular[3];
+        for (int j = 0; j < 3; j++) {
+            d0[j] += amb[j] * attenuation;
+            light_diffuse[j] = dif[j] * attenuation * n_dot_vp;
+            light_specular[j] = spc[j] * attenuation * pf;
+        }
+        apply_material_source(ts->diffuse_src, v, light_diffuse, d0);
+        apply_material_source(ts->specular_src, v, light_specular, d1);
+    }
+}
+
+static void transform_fixed_function(const TransformState *ts,
+                                     const float v[16][4], float out[16][4],
+                                     float *fog_distance)
+{
+    const float *position = v[0];
+    float t_position[4];
+    float normal[4] = { v[2][0], v[2][1], v[2][2], 0.0f };
+    float t_normal[3];
+
+    apply_skinning(ts, v, position, NV_IGRAPH_XF_XFCTX_MMAT0, 4, t_position);
+    apply_skinning(ts, v, normal, NV_IGRAPH_XF_XFCTX_IMMAT0, 3, t_normal);
+    if (ts->normalization) {
+        normalize3(t_normal);
+    }
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        float *t = out[OUT_T0 + i];
+        const float *texture = v[9 + i];
+        unsigned int plane = NV_IGRAPH_XF_XFCTX_TG0MAT + i * 8;
+        for (int j = 0; j < 4; j++) {
+            switch (ts->texgen[i][j]) {
+            case TEXGEN_DISABLE:
+                t[j] = texture[j];
+                break;
+            case TEXGEN_EYE_LINEAR:
+                t[j] = dot4(ts->c[plane + j], t_position);
+                break;
+            case TEXGEN_OBJECT_LINEAR:
+                t[j] = dot4(ts->c[plane + j], position);
+                break;
+            case TEXGEN_SPHERE_MAP:
+            case TEXGEN_REFLECTION_MAP: {
+                float u[3], r[3];
+                memcpy(u, t_position, sizeof(u));
+                normalize3(u);
+                reflect3(u, t_normal, r);
+                if (ts->texgen[i][j] == TEXGEN_REFLECTION_MAP) {
+                    t[j] = r[j % 3];
+                } else {
+                    float ro[3] = { r[0], r[1], r[2] + 1.0f };
+                    float inv_m = 1.0f / (2.0f * sqrtf(dot3(ro, ro)));
+                    t[j] = r[j % 3] * inv_m + 0.5f;
+                }
+                break;
+            }
+            case TEXGEN_NORMAL_MAP:
+                t[j] = t_normal[j % 3];
+                break;
+            default:
+                assert(!"Unrecognized Texgen map mode");
+                break;
+            }
+        }
+        if (ts->texture_matrix_enable[i]) {
+            mul_mat4(ts, t, NV_IGRAPH_XF_XFCTX_T0MAT + i * 8, t);
+        }
+    }
+
+    if (ts->lighting) {
+        compute_lighting(ts, v, t_position, t_normal, out[OUT_D0],
+                         out[OUT_D1]);
+    } else {
+        memcpy(out[OUT_D0], v[3], sizeof(out[OUT_D0]));
+        memcpy(out[OUT_D1], v[4], sizeof(out[OUT_D1]));
+    }
+
+    if (!ts->specular_enable) {
+        static const float black[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        memcpy(out[OUT_D1], black, sizeof(black));
+    } else {
+        if (!ts->separate_specular) {
+            if (ts->lighting) {
+                for (int j = 0; j < 3; j++) {
+                    out[OUT_D0][j] += out[OUT_D1][j];
+                }
+            }
+            memcpy(out[OUT_D1], v[4], sizeof(out[OUT_D1]));
+        }
+        if (ts->ignore_specular_alpha) {
+            out[OUT_D1][3] = 1.0f;
+        }
+    }
+
+    if (ts->fog_enable) {
+        const float *fog_plane = ts->c[NV_IGRAPH_XF_XFCTX_FOG];
+        switch (ts->foggen) {
+        case FOGGEN_SPEC_ALPHA:
+            *fog_distance = MIN(MAX(v[4][3], 0.0f), 1.0f);
+            break;
+        case FOGGEN_RADIAL:
+            *fog_distance = sqrtf(dot3(t_position, t_position));
+            break;
+        case FOGGEN_PLANAR:
+        case FOGGEN_ABS_PLANAR:
+            *fog_distance = dot3(fog_plane, t_position) + fog_plane[3];
+            if (ts->foggen == FOGGEN_ABS_PLANAR) {
+                *fog_distance = fabsf(*fog_distance);
+            }
+            break;
+        case FOGGEN_FOG_X:
+            *fog_distance = v[5][0];
+            break;
+        default:
+            assert(!"Invalid foggen mode");
+            break;
+        }
+    }
+
+    /* If skinning is off the composite matrix already includes the MV matrix */
+    if (ts->skinning == SKINNING_OFF) {
+        memcpy(t_position, position, sizeof(t_position));
+    }
+
+    float *pos = out[OUT_POS];
+    mul_mat4(ts, t_position, NV_IGRAPH_XF_XFCTX_CMAT0, pos);
+
+    if (ts->point_params_enable) {
+        const float *pp = ts->point_params;
+        float eye[4];
+        mul_mat4(ts, position, NV_IGRAPH_XF_XFCTX_MMAT0, eye);
+        float d_e = sqrtf(dot4(eye, eye));
+        float min_size = MIN(pp[7], 63.875f);
+        float max_size = MIN(pp[3] + min_size, 63.875f);
+        float size = 1.0f / sqrtf(pp[0] + pp[1] * d_e + pp[2] * d_e * d_e) +
+                     pp[6];
+        out[OUT_PTS][0] = MIN(MAX(size * pp[3] + pp[7], min_size), max_size);
+    } else {
+        out[OUT_PTS][0] = MAX(1.0f, ts->point_size);
+    }
+}
+
+static float compute_fog_factor(const TransformState *ts, float fog_distance)
+{
+    float infinite_result = 0.0f, nan_result = 0.0f;
+    float factor;
+    const float *p = ts->fog_param;
+
+    switch (ts->fog_mode) {
+    case FOG_MODE_LINEAR:
+    case FOG_MODE_LINEAR_ABS:
+        infinite_result = 1.0f;
+        nan_result = 1.0f;
+        factor = p[0] + fog_distance * p[1] - 1.0f;
+        break;
+    case FOG_MODE_EXP:
+        infinite_result = 1.0f;
+        nan_result = 1.0f;
+        /* fallthrough */
+    case FOG_MODE_EXP_ABS:
+        factor = p[0] + exp2f(fog_distance * p[1] * 16.0f) - 1.5f;
+        break;
+    case FOG_MODE_EXP2:
+    case FOG_MODE_EXP2_ABS:
+        factor = p[0] +
+                 exp2f(-fog_distance * fog_distance * p[1] * p[1] * 32.0f) -
+                 1.5f;
+        break;
+    default:
+        assert(!"Invalid fog mode");
+        return 1.0f;
+    }
+
+    switch (ts->fog_mode) {
+    case FOG_MODE_LINEAR_ABS:
+    case FOG_MODE_EXP_ABS:
+    case FOG_MODE_EXP2_ABS:
+        factor = fabsf(factor);
+        break;
+    default:
+        break;
+    }
+
+    /* Clamped to normal float range to match HW interpolation */
+    if (isinf(fog_distance)) {
+        return infinite_result;
+    }
+    if (isnan(factor)) {
+        return nan_result;
+    }
+    return MIN(MAX(factor, -FLT_MAX), FLT_MAX);
+}
+
+static inline float nan_to_one_clamped(float v)
+{
+    return isnan(v) ? 1.0f : MIN(MAX(v, 0.0f), 1.0f);
+}
+
+static void transform_vertex(const TransformState *ts,
+                             Nv2aVshCPUXVSSExecutionState *state,
+                             const float v[16][4], SwVertex *vtx)
+{
+    float out[16][4];
+    float fog_distance = 0.0f;
+    float *pos = out[OUT_POS];
+
+    if (ts->vertex_program) {
+        Nv2aVshExecutionState s = nv2a_vsh_emu_initialize_xss_execution_state(
+            state, (float *)ts->c);
+        memcpy(state->input_regs, v, sizeof(state->input_regs));
+        nv2a_vsh_emu_execute(&s, &ts->program);
+        memcpy(out, state->output_regs, sizeof(out));
+
+        pos[0] = round_screen_coord(pos[0]);
+        pos[1] = round_screen_coord(pos[1]);
+        pos[3] = clamp_away_zero_inf(pos[3]);
+        fog_distance = out[OUT_FOG][0];
+
+        if (!ts->point_params_enable) {
+            out[OUT_PTS][0] = ts->point_size <= 0.0f ? 1.0f : ts->point_size;
+        }
+        memcpy(vtx->pos, pos, sizeof(vtx->pos));
+    } else {
+        transform_fixed_function(ts, v, out, &fog_distance);
+
+        pos[3] = clamp_away_zero_inf(pos[3]);
+        const float *vp_offset = ts->c[NV_IGRAPH_XF_XFCTX_VPOFF];
+        vtx->pos[0] = round_screen_coord(pos[0] / pos[3] + vp_offset[0]);
+        vtx->pos[1] = round_screen_coord(pos[1] / pos[3] + vp_offset[1]);
+        vtx->pos[2] = pos[2] / pos[3];
+        vtx->pos[3] = pos[3];
+    }
+
+    vtx->point_size = out[OUT_PTS][0];
+    vtx->var[SW_VAR_FOG] =
+        ts->fog_enable ? compute_fog_factor(ts, fog_distance) : 1.0f;
+
+    for (int j = 0; j < 4; j++) {
+        vtx->var[SW_VAR_D0 + j] = nan_to_one_clamped(out[OUT_D0][j]);
+    }
+    if (ts->specular_enable) {
+        for (int j = 0; j < 4; j++) {
+            vtx->var[SW_VAR_D1 + j] = nan_to_one_clamped(out[OUT_D1][j]);
+        }
+        if (ts->ignore_specular_alpha) {
+            vtx->var[SW_VAR_D1 + 3] = 1.0f;
+        }
+    } else {
+        vtx->var[SW_VAR_D1 + 0] = 0.0f;
+        vtx->var[SW_VAR_D1 + 1] = 0.0f;
+        vtx->var[SW_VAR_D1 + 2] = 0.0f;
+        vtx->var[SW_VAR_D1 + 3] = 1.0f;
+    }
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        memcpy(&vtx->var[SW_VAR_T0 + i * 4], out[OUT_T0 + i],
+               4 * sizeof(float));
+    }
+}
+
+static void vertex_job(void *opaque, int index)
+{
+    const VertexJob *job = opaque;
+    PGRAPHState *pg = job->pg;
+    Nv2aVshCPUXVSSExecutionState state;
+
+    unsigned int start = index * VERTEX_CHUNK_SIZE;
+    unsigned int end = MIN(start + VERTEX_CHUNK_SIZE, job->count);
+
+    for (unsigned int i = start; i < end; i++) {
+        float v[16][4];
+        for (int a = 0; a < NV2A_VERTEXSHADER_ATTRIBUTES; a++) {
+            fetch_attribute(&pg->vertex_attributes[a], &job->attrs[a],
+                            job->first + i, v[a]);
+        }
+        transform_vertex(job->ts, &state, v, &job->out[i]);
+    }
+}
+
+static void init_transform_state(PGRAPHState *pg, TransformState *ts)
+{
+    uint32_t csv0_c = pgraph_reg_r(pg, NV_PGRAPH_CSV0_C);
+    uint32_t csv0_d = pgraph_reg_r(pg, NV_PGRAPH_CSV0_D);
+    uint32_t control_3 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_3);
+
+    memset(ts, 0, sizeof(*ts));
+    ts->c = (const float (*)[4])pg->vsh_constants;
+
+    unsigned int mode = GET_MASK(csv0_d, NV_PGRAPH_CSV0_D_MODE);
+    assert(mode == 0 || mode == 2);
+    ts->vertex_program = mode == 2;
+
+    ts->specular_enable = GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_SPECULAR_ENABLE);
+    ts->separate_specular =
+        GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_SEPARATE_SPECULAR);
+    ts->ignore_specular_alpha =
+        !GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_ALPHA_FROM_MATERIAL_SPECULAR);
+
+    ts->point_params_enable =
+        GET_MASK(csv0_d, NV_PGRAPH_CSV0_D_POINTPARAMSENABLE);
+    ts->point_size = pgraph_reg_r(pg, NV_PGRAPH_POINTSIZE) / 8.0f;
+    memcpy(ts->point_params, pg->point_params, sizeof(ts->point_params));
+
+    ts->fog_enable = control_3 & NV_PGRAPH_CONTROL_3_FOGENABLE;
+    if (ts->fog_enable) {
+        ts->fog_mode = GET_MASK(control_3, NV_PGRAPH_CONTROL_3_FOG_MODE);
+        uint32_t param_0 = pgraph_reg_r(pg, NV_PGRAPH_FOGPARAM0);
+        uint32_t param_1 = pgraph_reg_r(pg, NV_PGRAPH_FOGPARAM1);
+        memcpy(&ts->fog_param[0], &param_0, sizeof(float));
+        memcpy(&ts->fog_param[1], &param_1, sizeof(float));
+    }
+
+    if (ts->vertex_program) {
+        unsigned int program_start =
+            GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START);
+        Nv2aVshParseResult result = nv2a_vsh_parse_program(
+            &ts->program, pg->program_data[program_start],
+            NV2A_MAX_TRANSFORM_PROGRAM_LENGTH - program_start);
+        assert(result == NV2AVPR_SUCCESS);
+        return;
+    }
+
+    ts->skinning = GET_MASK(csv0_d, NV_PGRAPH_CSV0_D_SKIN);
+    ts->normalization = csv0_c & NV_PGRAPH_CSV0_C_NORMALIZATION_ENABLE;
+    ts->local_eye = GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_LOCALEYE);
+    ts->emission_src = GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_EMISSION);
+    ts->ambient_src = GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_AMBIENT);
+    ts->diffuse_src = GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_DIFFUSE);
+    ts->specular_src = GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_SPECULAR);
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        ts->texture_matrix_enable[i] = pg->texture_matrix_enable[i];
+
+        unsigned int reg = (i < 2) ? NV_PGRAPH_CSV1_A : NV_PGRAPH_CSV1_B;
+        unsigned int masks[] = {
+            (i % 2) ? NV_PGRAPH_CSV1_A_T1_S : NV_PGRAPH_CSV1_A_T0_S,
+            (i % 2) ? NV_PGRAPH_CSV1_A_T1_T : NV_PGRAPH_CSV1_A_T0_T,
+            (i % 2) ? NV_PGRAPH_CSV1_A_T1_R : NV_PGRAPH_CSV1_A_T0_R,
+            (i % 2) ? NV_PGRAPH_CSV1_A_T1_Q : NV_PGRAPH_CSV1_A_T0_Q
+        };
+        for (int j = 0; j < 4; j++) {
+            ts->texgen[i][j] = GET_MASK(pgraph_reg_r(pg, reg), masks[j]);
+        }
+    }
+
+    ts->lighting = GET_MASK(csv0_c, NV_PGRAPH_CSV0_C_LIGHTING);
+    if (ts->lighting) {
+        for (int i = 0; i < NV2A_MAX_LIGHTS; i++) {
+            ts->light[i] = GET_MASK(csv0_d, NV_PGRAPH_CSV0_D_LIGHT0 << (i * 2));
+        }
+    }
+
+    if (ts->fog_enable) {
+        ts->foggen = GET_MASK(csv0_d, NV_PGRAPH_CSV0_D_FOGGENMODE);
+    }
+
+    ts->ltctxa = (const float (*)[4])pg->ltctxa;
+    ts->ltctxb = (const float (*)[4])pg->ltctxb;
+    ts->ltc1 = (const float (*)[4])pg->ltc1;
+    ts->light_infinite_half_vector =
+        (const float (*)[3])pg->light_infinite_half_vector;
+    ts->light_infinite_direction =
+        (const float (*)[3])pg->light_infinite_direction;
+    ts->light_local_position = (const float (*)[3])pg->light_local_position;
+    ts->light_local_attenuation =
+        (const float (*)[3])pg->light_local_attenuation;
+    ts->material_alpha = pg->material_alpha;
+    ts->specular_power = pg->specular_power;
+}
+
+static void finalize_transform_state(TransformState *ts)
+{
+    if (ts->vertex_program) {
+        nv2a_vsh_program_destroy(&ts->program);
+    }
+}
+
+static void run_vertex_jobs(NV2AState *d, VertexJob *job)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSWState *r = pg->sw_renderer_state;
+
+    TransformState ts;
+    init_transform_state(pg, &ts);
+    job->pg = pg;
+    job->ts = &ts;
+
+    int num_chunks = DIV_ROUND_UP(job->count, VERTEX_CHUNK_SIZE);
+    pgraph_sw_parallel_for(r, num_chunks, vertex_job, job);
+
+    finalize_transform_state(&ts);
+}
+
+/*
+ * Transform `count` vertices starting at array element `first`, sourcing
+ * attributes from the vertex DMA arrays. Element `provoking_element` is the
+ * last one referenced by the draw and becomes the new inline value.
+ */
+size_t pgraph_sw_process_vertices(NV2AState *d, unsigned int first,
+                                  unsigned int count,
+                                  unsigned int provoking_element,
+                                  SwVertex *out)
+{
+    PGRAPHState *pg = &d->pgraph;
+    VertexJob job = { .first = first, .count = count, .out = out };
+
+    pg->compressed_attrs = 0;
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+        AttributeSource *src = &job.attrs[i];
+
+        if (!attr->count) {
+            memcpy(src->value, attr->inline_value, sizeof(src->value));
+            continue;
+        }
+
+        nv2a_profile_inc_counter(NV2A_PROF_ATTR_BIND);
+
+        hwaddr dma_len;
+        uint8_t *attr_data = (uint8_t *)nv_dma_map(
+            d, attr->dma_select ? pg->dma_vertex_b : pg->dma_vertex_a,
+            &dma_len);
+        assert(attr->offset < dma_len);
+        attr_data += attr->offset;
+
+        if (!attr->stride) {
+            // Stride of 0 indicates that only the first element should be
+            // used.
+            pgraph_update_inline_value(attr, attr_data);
+            memcpy(src->value, attr->inline_value, sizeof(src->value));
+            continue;
+        }
+
+        src->data = attr_data;
+        src->stride = attr->stride;
+        src->format = attr->format;
+        pgraph_update_inline_value(attr, attr_data + (size_t)provoking_element *
+                                                         attr->stride);
+    }
+
+    run_vertex_jobs(d, &job);
+
+    return count;
+}
+
+static unsigned int bind_inline_array(NV2AState *d, VertexJob *job)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    unsigned int offset = 0;
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+        if (attr->count == 0) {
+            continue;
+        }
+
+        /* FIXME: Double check */
+        offset = ROUND_UP(offset, attr->size);
+        attr->inline_array_offset = offset;
+        offset += attr->size * attr->count;
+        offset = ROUND_UP(offset, attr->size);
+    }
+
+    unsigned int vertex_size = offset;
+    unsigned int index_count = pg->inline_array_length * 4 / vertex_size;
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+        AttributeSource *src = &job->attrs[i];
+
+        if (!attr->count) {
+            memcpy(src->value, attr->inline_value, sizeof(src->value));
+            continue;
+        }
+
+        src->data = (uint8_t *)pg->inline_array + attr->inline_array_offset;
+        src->stride = vertex_size;
+        src->format = attr->format;
+        pgraph_update_inline_value(attr, src->data + (size_t)(index_count - 1) *
+                                                         vertex_size);
+    }
+
+    return index_count;
+}
+
+/* Transform vertices supplied by inline arrays or inline buffers */
+size_t pgraph_sw_process_inline_vertices(NV2AState *d, SwVertex *out)
+{
+    PGRAPHState *pg = &d->pgraph;
+    VertexJob job = { .first = 0, .out = out };
+
+    pg->compressed_attrs = 0;
+
+    if (pg->inline_buffer_length) {
+        job.count = pg->inline_buffer_length;
+        for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+            VertexAttribute *attr = &pg->vertex_attributes[i];
+            AttributeSource *src = &job.attrs[i];
+            if (attr->inline_buffer_populated) {
+                src->data = (const uint8_t *)attr->inline_buffer;
+                src->inline_buffer = true;
+            } else {
+                memcpy(src->value, attr->inline_value, sizeof(src->value));
+            }
+        }
+    } else {
+        assert(pg->inline_array_length);
+        job.count = bind_inline_array(d, &job);
+    }
+
+    run_vertex_jobs(d, &job);
+
+    if (pg->inline_buffer_length) {
+        for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+            VertexAttribute *attr = &pg->vertex_attributes[i];
+            if (attr->inline_buffer_populated) {
+                attr->inline_buffer_populated = false;
+                memcpy(attr->inline_value,
+                       attr->inline_buffer + (pg->inline_buffer_length - 1) * 4,
+                       sizeof(attr->inline_value));
+            }
+        }
+    }
+
+    return job.count;
+}
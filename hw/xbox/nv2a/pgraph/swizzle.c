@@ -27,6 +27,15 @@
 
 #include "swizzle.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include "host/cpuinfo.h"
+#define SWIZZLE_ACCEL_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SWIZZLE_ACCEL_NEON 1
+#endif
+
 /*
  * Helpers for converting to and from swizzled (Z-ordered) texture formats.
  * Swizzled textures store pixels in a more cache-friendly layout for rendering
@@ -155,9 +164,11 @@ static inline void unswizzle_box_internal(
     m##_internal(src_buf, width, height, depth, dst_buf, row_pitch, \
                  slice_pitch, bpp)
 #define MULTIVERSION(m)                                                     \
-    void m(const uint8_t *src_buf, unsigned int width, unsigned int height, \
-           unsigned int depth, uint8_t *dst_buf, unsigned int row_pitch,    \
-           unsigned int slice_pitch, unsigned int bytes_per_pixel)          \
+    static void m##_scalar(const uint8_t *src_buf, unsigned int width,     \
+                           unsigned int height, unsigned int depth,        \
+                           uint8_t *dst_buf, unsigned int row_pitch,       \
+                           unsigned int slice_pitch,                       \
+                           unsigned int bytes_per_pixel)                   \
     {                                                                       \
         switch (bytes_per_pixel) {                                          \
         case 1:                                                             \
@@ -182,3 +193,511 @@ MULTIVERSION(unswizzle_box)
 
 #undef C
 #undef MULTIVERSION
+
+/*
+ * Vectorized 2D kernels.
+ *
+ * When width and height are both at least 4, the low four bits of the
+ * swizzled offset are x0 y0 x1 y1, so every aligned 4x4 block of pixels is
+ * stored as 16 consecutive pixels: four 2x2 quads, each made of two row
+ * pairs. A block is converted with a handful of unpacks between the four
+ * linear rows and the swizzled run. Blocks are walked in linear order with
+ * the same mask-ripple increment as the scalar path, with the low x and y
+ * bits removed from the masks.
+ *
+ * If the next swizzle bit is also an x bit (width >= 8), two horizontally
+ * adjacent blocks form 32 consecutive pixels, which the AVX2 kernel handles
+ * at once.
+ */
+
+typedef void (*SwizzleTileFunc)(uint8_t *swizzled, uint8_t *linear,
+                                unsigned int row_pitch);
+
+typedef void (*SwizzleRectFunc)(const uint8_t *src_buf, unsigned int width,
+                                unsigned int height, uint8_t *dst_buf,
+                                unsigned int row_pitch,
+                                unsigned int bytes_per_pixel);
+
+static inline uint32_t clear_low_mask_bits(uint32_t mask, int n)
+{
+    while (n-- > 0) {
+        mask &= mask - 1;
+    }
+    return mask;
+}
+
+static inline __attribute__((always_inline)) void
+swizzle_rect_tiled(uint8_t *swizzled_buf, uint8_t *linear_buf,
+                   unsigned int width, unsigned int height,
+                   unsigned int row_pitch, unsigned int bytes_per_pixel,
+                   unsigned int tile_width, int tile_width_bits,
+                   SwizzleTileFunc tile)
+{
+    uint32_t mask_x, mask_y, mask_z;
+    generate_swizzle_masks(width, height, 1, &mask_x, &mask_y, &mask_z);
+
+    uint32_t tile_mask_x = clear_low_mask_bits(mask_x, tile_width_bits);
+    uint32_t tile_mask_y = clear_low_mask_bits(mask_y, 2);
+
+    uint32_t off_y = 0;
+    for (unsigned int y = 0; y < height; y += 4) {
+        uint32_t off_x = 0;
+        uint8_t *linear = linear_buf + y * row_pitch;
+        for (unsigned int x = 0; x < width; x += tile_width) {
+            tile(swizzled_buf + (off_x + off_y) * bytes_per_pixel,
+                 linear + x * bytes_per_pixel, row_pitch);
+            off_x = (off_x - tile_mask_x) & tile_mask_x;
+        }
+        off_y = (off_y - tile_mask_y) & tile_mask_y;
+    }
+}
+
+static inline uint32_t ld32(const void *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void st32(void *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+#define SWIZZLE_RECT_TILED(fn, bpp, tile_width, tile_width_bits)             \
+    swizzle_rect_tiled(swizzled, linear, width, height, row_pitch, bpp,      \
+                       tile_width, tile_width_bits, fn)
+
+#ifdef SWIZZLE_ACCEL_X86
+
+static inline __attribute__((target("sse2"))) void
+swizzle_tile_1_sse2(uint8_t *swizzled, uint8_t *linear, unsigned int pitch)
+{
+    __m128i r0 = _mm_cvtsi32_si128(ld32(linear));
+    __m128i r1 = _mm_cvtsi32_si128(ld32(linear + pitch));
+    __m128i r2 = _mm_cvtsi32_si128(ld32(linear + 2 * pitch));
+    __m128i r3 = _mm_cvtsi32_si128(ld32(linear + 3 * pitch));
+
+    __m128i q01 = _mm_unpacklo_epi16(r0, r1);
+    __m128i q23 = _mm_unpacklo_epi16(r2, r3);
+    _mm_storeu_si128((__m128i *)swizzled, _mm_unpacklo_epi64(q01, q23));
+}
+
+static inline __attribute__((target("sse2"))) void
+unswizzle_tile_1_sse2(uint8_t *swizzled, uint8_t *linear, unsigned int pitch)
+{
+    __m128i s = _mm_loadu_si128((const __m128i *)swizzled);
+
+    /* Gather each row's two pixel pairs into one 32-bit lane */
+    s = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 1, 2, 0));
+    s = _mm_shufflehi_epi16(s, _MM_SHUFFLE(3, 1, 2, 0));
+
+    st32(linear, _mm_cvtsi128_si32(s));
+    st32(linear + pitch, _mm_cvtsi128_si32(_mm_srli_si128(s, 4)));
+    st32(linear + 2 * pitch, _mm_cvtsi128_si32(_mm_srli_si128(s, 8)));
+    st32(linear + 3 * pitch, _mm_cvtsi128_si32(_mm_srli_si128(s, 12)));
+}
+
+static inline __attribute__((target("sse2"))) void
+swizzle_tile_2_sse2(uint8_t *swizzled, uint8_t *linear, unsigned int pitch)
+{
+    __m128i r0 = _mm_loadl_epi64((const __m128i *)linear);
+    __m128i r1 = _mm_loadl_epi64((const __m128i *)(linear + pitch));
+    __m128i r2 = _mm_loadl_epi64((const __m128i *)(linear + 2 * pitch));
+    __m128i r3 = _mm_loadl_epi64((const __m128i *)(linear + 3 * pitch));
+
+    _mm_storeu_si128((__m128i *)swizzled, _mm_unpacklo_epi32(r0, r1));
+    _mm_storeu_si128((__m128i *)(swizzled + 16), _mm_unpacklo_epi32(r2, r3));
+}
+
+static inline __attribute__((target("sse2"))) void
+unswizzle_tile_2_sse2(uint8_t *swizzled, uint8_t *linear, unsigned int pitch)
+{
+    __m128i s0 = _mm_loadu_si128((const __m128i *)swizzled);
+    __m128i s1 = _mm_loadu_si128((const __m128i *)(swizzled + 16));
+
+    s0 = _mm_shuffle_epi32(s0, _MM_SHUFFLE(3, 1, 2, 0));
+    s1 = _mm_shuffle_epi32(s1, _MM_SHUFFLE(3, 1, 2, 0));
+
+    _mm_storel_epi64((__m128i *)linear, s0);
+    _mm_storel_epi64((__m128i *)(linear + pitch), _mm_unpackhi_epi64(s0, s0));
+    _mm_storel_epi64((__m128i *)(linear + 2 * pitch), s1);
+    _mm_storel_epi64((__m128i *)(linear + 3 * pitch),
+                     _mm_unpackhi_epi64(s1, s1));
+}
+
+static inline __attribute__((target("sse2"))) void
+swizzle_tile_4_sse2(uint8_t *swizzled, uint8_t *linear, unsigned int pitch)
+{
+    __m128i r0 = _mm_loadu_si128((const __m128i *)linear);
+    __m128i r1 = _mm_loadu_si128((const __m128i *)(linear + pitch));
+    __m128i r2 = _mm_loadu_si128((const __m128i *)(linear + 2 * pitch));
+    __m128i r3 = _mm_loadu_si128((const __m128i *)(linear + 3 * pitch));
+
+    _mm_storeu_si128((__m128i *)swizzled, _mm_unpacklo_epi64(r0, r1));
+    _mm_storeu_si128((__m128i *)(swizzled + 16), _mm_unpackhi_epi64(r0, r1));
+    _mm_storeu_si128((__m128i *)(swizzled + 32), _mm_unpacklo_epi64(r2, r3));
+    _mm_storeu_si128((__m128i *)(swizzled + 48), _mm_unpackhi_epi64(r2, r3));
+}
+
+static inline __attribute__((target("sse2"))) void
+unswizzle_tile_4_sse2(uint8_t *swizzled, uint8_t *linear, unsigned int pitch)
+{
+    __m128i s0 = _mm_loadu_si128((const __m128i *)swizzled);
+    __m128i s1 = _mm_loadu_si128((const __m128i *)(swizzled + 16));
+    __m128i s2 = _mm_loadu_si128((const __m128i *)(swizzled + 32));
+    __m128i s3 = _mm_loadu_si128((const __m128i *)(swizzled + 48));
+
+    _mm_storeu_si128((__m128i *)linear, _mm_unpacklo_epi64(s0, s1));
+    _mm_storeu_si128((__m128i *)(linear + pitch), _mm_unpackhi_epi64(s0, s1));
+    _mm_storeu_si128((__m128i *)(linear + 2 * pitch),
+                     _mm_unpacklo_epi64(s2, s3));
+    _mm_storeu_si128((__m128i *)(linear + 3 * pitch),
+                     _mm_unpackhi_epi64(s2, s3));
+}
+
+static void __attribute__((target("sse2")))
+swizzle_rect_sse2(const uint8_t *src_buf, unsigned int width,
+                  unsigned int height, uint8_t *dst_buf,
+                  unsigned int row_pitch, unsigned int bytes_per_pixel)
+{
+    uint8_t *linear = (uint8_t *)src_buf, *swizzled = dst_buf;
+
+    switch (bytes_per_pixel) {
+    case 1:
+        SWIZZLE_RECT_TILED(swizzle_tile_1_sse2, 1, 4, 2);
+        break;
+    case 2:
+        SWIZZLE_RECT_TILED(swizzle_tile_2_sse2, 2, 4, 2);
+        break;
+    case 4:
+        SWIZZLE_RECT_TILED(swizzle_tile_4_sse2, 4, 4, 2);
+        break;
+    default:
+        assert(!"Unsupported bytes_per_pixel");
+    }
+}
+
+static void __attribute__((target("sse2")))
+unswizzle_rect_sse2(const uint8_t *src_buf, unsigned int width,
+                    unsigned int height, uint8_t *dst_buf,
+                    unsigned int row_pitch, unsigned int bytes_per_pixel)
+{
+    uint8_t *swizzled = (uint8_t *)src_buf, *linear = dst_buf;
+
+    switch (bytes_per_pixel) {
+    case 1:
+        SWIZZLE_RECT_TILED(unswizzle_tile_1_sse2, 1, 4, 2);
+        break;
+    case 2:
+        SWIZZLE_RECT_TILED(unswizzle_tile_2_sse2, 2, 4, 2);
+        break;
+    case 4:
+        SWIZZLE_RECT_TILED(unswizzle_tile_4_sse2, 4, 4, 2);
+        break;
+    default:
+        assert(!"Unsupported bytes_per_pixel");
+    }
+}
+
+/* Two horizontally adjacent 4x4 blocks of 32-bit pixels */
+static inline __attribute__((target("avx2"))) void
+swizzle_tile_4_avx2(uint8_t *swizzled, uint8_t *linear, unsigned int pitch)
+{
+    __m256i r0 = _mm256_loadu_si256((const __m256i *)linear);
+    __m256i r1 = _mm256_loadu_si256((const __m256i *)(linear + pitch));
+    __m256i r2 = _mm256_loadu_si256((const __m256i *)(linear + 2 * pitch));
+    __m256i r3 = _mm256_loadu_si256((const __m256i *)(linear + 3 * pitch));
+
+    __m256i lo01 = _mm256_unpacklo_epi64(r0, r1);
+    __m256i hi01 = _mm256_unpackhi_epi64(r0, r1);
+    __m256i lo23 = _mm256_unpacklo_epi64(r2, r3);
+    __m256i hi23 = _mm256_unpackhi_epi64(r2, r3);
+
+    _mm256_storeu_si256((__m256i *)swizzled,
+                        _mm256_permute2x128_si256(lo01, hi01, 0x20));
+    _mm256_storeu_si256((__m256i *)(swizzled + 32),
+                        _mm256_permute2x128_si256(lo23, hi23, 0x20));
+    _mm256_storeu_si256((__m256i *)(swizzled + 64),
+                        _mm256_permute2x128_si256(lo01, hi01, 0x31));
+    _mm256_storeu_si256((__m256i *)(swizzled + 96),
+                        _mm256_permute2x128_si256(lo23, hi23, 0x31));
+}
+
+static inline __attribute__((target("avx2"))) void
+unswizzle_tile_4_avx2(uint8_t *swizzled, uint8_t *linear, unsigned int pitch)
+{
+    __m256i s0 = _mm256_loadu_si256((const __m256i *)swizzled);
+    __m256i s1 = _mm256_loadu_si256((const __m256i *)(swizzled + 32));
+    __m256i s2 = _mm256_loadu_si256((const __m256i *)(swizzled + 64));
+    __m256i s3 = _mm256_loadu_si256((const __m256i *)(swizzled + 96));
+
+    __m256i lo01 = _mm256_permute2x128_si256(s0, s2, 0x20);
+    __m256i hi01 = _mm256_permute2x128_si256(s0, s2, 0x31);
+    __m256i lo23 = _mm256_permute2x128_si256(s1, s3, 0x20);
+    __m256i hi23 = _mm256_permute2x128_si256(s1, s3, 0x31);
+
+    _mm256_storeu_si256((__m256i *)linear, _mm256_unpacklo_epi64(lo01, hi01));
+    _mm256_storeu_si256((__m256i *)(linear + pitch),
+                        _mm256_unpackhi_epi64(lo01, hi01));
+    _mm256_storeu_si256((__m256i *)(linear + 2 * pitch),
+                        _mm256_unpacklo_epi64(lo23, hi23));
+    _mm256_storeu_si256((__m256i *)(linear + 3 * pitch),
+                        _mm256_unpackhi_epi64(lo23, hi23));
+}
+
+static void __attribute__((target("avx2")))
+swizzle_rect_avx2(const uint8_t *src_buf, unsigned int width,
+                  unsigned int height, uint8_t *dst_buf,
+                  unsigned int row_pitch, unsigned int bytes_per_pixel)
+{
+    uint8_t *linear = (uint8_t *)src_buf, *swizzled = dst_buf;
+
+    if (bytes_per_pixel == 4 && width >= 8) {
+        SWIZZLE_RECT_TILED(swizzle_tile_4_avx2, 4, 8, 3);
+    } else {
+        swizzle_rect_sse2(src_buf, width, height, dst_buf, row_pitch,
+                          bytes_per_pixel);
+    }
+}
+
+static void __attribute__((target("avx2")))
+unswizzle_rect_avx2(const uint8_t *src_buf, unsigned int width,
+                    unsigned int height, uint8_t *dst_buf,
+                    unsigned int row_pitch, unsigned int bytes_per_pixel)
+{
+    uint8_t *swizzled = (uint8_t *)src_buf, *linear = dst_buf;
+
+    if (bytes_per_pixel == 4 && width >= 8) {
+        SWIZZLE_RECT_TILED(unswizzle_tile_4_avx2, 4, 8, 3);
+    } else {
+        unswizzle_rect_sse2(src_buf, width, height, dst_buf, row_pitch,
+                            bytes_per_pixel);
+    }
+}
+
+#endif /* SWIZZLE_ACCEL_X86 */
+
+#ifdef SWIZZLE_ACCEL_NEON
+
+static inline void swizzle_tile_1_neon(uint8_t *swizzled, uint8_t *linear,
+                                       unsigned int pitch)
+{
+    uint16x4_t r0 = vreinterpret_u16_u32(vdup_n_u32(ld32(linear)));
+    uint16x4_t r1 = vreinterpret_u16_u32(vdup_n_u32(ld32(linear + pitch)));
+    uint16x4_t r2 = vreinterpret_u16_u32(vdup_n_u32(ld32(linear + 2 * pitch)));
+    uint16x4_t r3 = vreinterpret_u16_u32(vdup_n_u32(ld32(linear + 3 * pitch)));
+
+    vst1q_u16((uint16_t *)swizzled,
+              vcombine_u16(vzip_u16(r0, r1).val[0], vzip_u16(r2, r3).val[0]));
+}
+
+static inline void unswizzle_tile_1_neon(uint8_t *swizzled, uint8_t *linear,
+                                         unsigned int pitch)
+{
+    uint16x8_t s = vld1q_u16((const uint16_t *)swizzled);
+    uint16x4x2_t q01 = vuzp_u16(vget_low_u16(s), vget_low_u16(s));
+    uint16x4x2_t q23 = vuzp_u16(vget_high_u16(s), vget_high_u16(s));
+
+    st32(linear, vget_lane_u32(vreinterpret_u32_u16(q01.val[0]), 0));
+    st32(linear + pitch, vget_lane_u32(vreinterpret_u32_u16(q01.val[1]), 0));
+    st32(linear + 2 * pitch,
+         vget_lane_u32(vreinterpret_u32_u16(q23.val[0]), 0));
+    st32(linear + 3 * pitch,
+         vget_lane_u32(vreinterpret_u32_u16(q23.val[1]), 0));
+}
+
+static inline void swizzle_tile_2_neon(uint8_t *swizzled, uint8_t *linear,
+                                       unsigned int pitch)
+{
+    uint32x2x2_t q01 = vzip_u32(vreinterpret_u32_u8(vld1_u8(linear)),
+                                vreinterpret_u32_u8(vld1_u8(linear + pitch)));
+    uint32x2x2_t q23 =
+        vzip_u32(vreinterpret_u32_u8(vld1_u8(linear + 2 * pitch)),
+                 vreinterpret_u32_u8(vld1_u8(linear + 3 * pitch)));
+
+    vst1q_u32((uint32_t *)swizzled, vcombine_u32(q01.val[0], q01.val[1]));
+    vst1q_u32((uint32_t *)(swizzled + 16),
+              vcombine_u32(q23.val[0], q23.val[1]));
+}
+
+static inline void unswizzle_tile_2_neon(uint8_t *swizzled, uint8_t *linear,
+                                         unsigned int pitch)
+{
+    uint32x4_t s0 = vld1q_u32((const uint32_t *)swizzled);
+    uint32x4_t s1 = vld1q_u32((const uint32_t *)(swizzled + 16));
+    uint32x2x2_t r01 = vuzp_u32(vget_low_u32(s0), vget_high_u32(s0));
+    uint32x2x2_t r23 = vuzp_u32(vget_low_u32(s1), vget_high_u32(s1));
+
+    vst1_u8(linear, vreinterpret_u8_u32(r01.val[0]));
+    vst1_u8(linear + pitch, vreinterpret_u8_u32(r01.val[1]));
+    vst1_u8(linear + 2 * pitch, vreinterpret_u8_u32(r23.val[0]));
+    vst1_u8(linear + 3 * pitch, vreinterpret_u8_u32(r23.val[1]));
+}
+
+static inline void swizzle_tile_4_neon(uint8_t *swizzled, uint8_t *linear,
+                                       unsigned int pitch)
+{
+    uint8x16_t r0 = vld1q_u8(linear);
+    uint8x16_t r1 = vld1q_u8(linear + pitch);
+    uint8x16_t r2 = vld1q_u8(linear + 2 * pitch);
+    uint8x16_t r3 = vld1q_u8(linear + 3 * pitch);
+
+    vst1q_u8(swizzled, vcombine_u8(vget_low_u8(r0), vget_low_u8(r1)));
+    vst1q_u8(swizzled + 16, vcombine_u8(vget_high_u8(r0), vget_high_u8(r1)));
+    vst1q_u8(swizzled + 32, vcombine_u8(vget_low_u8(r2), vget_low_u8(r3)));
+    vst1q_u8(swizzled + 48, vcombine_u8(vget_high_u8(r2), vget_high_u8(r3)));
+}
+
+static inline void unswizzle_tile_4_neon(uint8_t *swizzled, uint8_t *linear,
+                                         unsigned int pitch)
+{
+    uint8x16_t s0 = vld1q_u8(swizzled);
+    uint8x16_t s1 = vld1q_u8(swizzled + 16);
+    uint8x16_t s2 = vld1q_u8(swizzled + 32);
+    uint8x16_t s3 = vld1q_u8(swizzled + 48);
+
+    vst1q_u8(linear, vcombine_u8(vget_low_u8(s0), vget_low_u8(s1)));
+    vst1q_u8(linear + pitch, vcombine_u8(vget_high_u8(s0), vget_high_u8(s1)));
+    vst1q_u8(linear + 2 * pitch,
+             vcombine_u8(vget_low_u8(s2), vget_low_u8(s3)));
+    vst1q_u8(linear + 3 * pitch,
+             vcombine_u8(vget_high_u8(s2), vget_high_u8(s3)));
+}
+
+static void swizzle_rect_neon(const uint8_t *src_buf, unsigned int width,
+                              unsigned int height, uint8_t *dst_buf,
+                              unsigned int row_pitch,
+                              unsigned int bytes_per_pixel)
+{
+    uint8_t *linear = (uint8_t *)src_buf, *swizzled = dst_buf;
+
+    switch (bytes_per_pixel) {
+    case 1:
+        SWIZZLE_RECT_TILED(swizzle_tile_1_neon, 1, 4, 2);
+        break;
+    case 2:
+        SWIZZLE_RECT_TILED(swizzle_tile_2_neon, 2, 4, 2);
+        break;
+    case 4:
+        SWIZZLE_RECT_TILED(swizzle_tile_4_neon, 4, 4, 2);
+        break;
+    default:
+        assert(!"Unsupported bytes_per_pixel");
+    }
+}
+
+static void unswizzle_rect_neon(const uint8_t *src_buf, unsigned int width,
+                                unsigned int height, uint8_t *dst_buf,
+                                unsigned int row_pitch,
+                                unsigned int bytes_per_pixel)
+{
+    uint8_t *swizzled = (uint8_t *)src_buf, *linear = dst_buf;
+
+    switch (bytes_per_pixel) {
+    case 1:
+        SWIZZLE_RECT_TILED(unswizzle_tile_1_neon, 1, 4, 2);
+        break;
+    case 2:
+        SWIZZLE_RECT_TILED(unswizzle_tile_2_neon, 2, 4, 2);
+        break;
+    case 4:
+        SWIZZLE_RECT_TILED(unswizzle_tile_4_neon, 4, 4, 2);
+        break;
+    default:
+        assert(!"Unsupported bytes_per_pixel");
+    }
+}
+
+#endif /* SWIZZLE_ACCEL_NEON */
+
+#undef SWIZZLE_RECT_TILED
+
+typedef struct SwizzleAccel {
+    SwizzleRectFunc swizzle, unswizzle;
+} SwizzleAccel;
+
+/* Ordered from least to most preferred, the first entry is scalar only */
+static const SwizzleAccel accel_table[] = {
+    { NULL, NULL },
+#ifdef SWIZZLE_ACCEL_X86
+    { swizzle_rect_sse2, unswizzle_rect_sse2 },
+    { swizzle_rect_avx2, unswizzle_rect_avx2 },
+#endif
+#ifdef SWIZZLE_ACCEL_NEON
+    { swizzle_rect_neon, unswizzle_rect_neon },
+#endif
+};
+
+static const SwizzleAccel *swizzle_accel;
+static unsigned int accel_index;
+
+static unsigned int best_accel(void)
+{
+#ifdef SWIZZLE_ACCEL_X86
+    unsigned info = cpuinfo_init();
+
+    if (info & CPUINFO_AVX2) {
+        return 2;
+    }
+    return info & CPUINFO_SSE2 ? 1 : 0;
+#elif defined(SWIZZLE_ACCEL_NEON)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    accel_index = best_accel();
+    swizzle_accel = &accel_table[accel_index];
+}
+
+bool test_swizzle_next_accel(void)
+{
+    if (accel_index != 0) {
+        swizzle_accel = &accel_table[--accel_index];
+        return true;
+    }
+    return false;
+}
+
+static inline bool can_use_accel(SwizzleRectFunc func, unsigned int width,
+                                 unsigned int height, unsigned int depth,
+                                 unsigned int bytes_per_pixel)
+{
+    return func && depth == 1 && width >= 4 && height >= 4 &&
+           (bytes_per_pixel == 1 || bytes_per_pixel == 2 ||
+            bytes_per_pixel == 4);
+}
+
+void swizzle_box(const uint8_t *src_buf, unsigned int width,
+                 unsigned int height, unsigned int depth, uint8_t *dst_buf,
+                 unsigned int row_pitch, unsigned int slice_pitch,
+                 unsigned int bytes_per_pixel)
+{
+    SwizzleRectFunc func = swizzle_accel->swizzle;
+
+    if (can_use_accel(func, width, height, depth, bytes_per_pixel)) {
+        func(src_buf, width, height, dst_buf, row_pitch, bytes_per_pixel);
+    } else {
+        swizzle_box_scalar(src_buf, width, height, depth, dst_buf, row_pitch,
+                           slice_pitch, bytes_per_pixel);
+    }
+}
+
+void unswizzle_box(const uint8_t *src_buf, unsigned int width,
+                   unsigned int height, unsigned int depth, uint8_t *dst_buf,
+                   unsigned int row_pitch, unsigned int slice_pitch,
+                   unsigned int bytes_per_pixel)
+{
+    SwizzleRectFunc func = swizzle_accel->unswizzle;
+
+    if (can_use_accel(func, width, height, depth, bytes_per_pixel)) {
+        func(src_buf, width, height, dst_buf, row_pitch, bytes_per_pixel);
+    } else {
+        unswizzle_box_scalar(src_buf, width, height, depth, dst_buf,
+                             row_pitch, slice_pitch, bytes_per_pixel);
+    }
+}
@@ -21,6 +21,7 @@
 #ifndef HW_XBOX_NV2A_PGRAPH_SWIZZLE_H
 #define HW_XBOX_NV2A_PGRAPH_SWIZZLE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 void swizzle_box(
@@ -43,6 +44,13 @@ void unswizzle_box(
     unsigned int slice_pitch,
     unsigned int bytes_per_pixel);
 
+/*
+ * Switch swizzle_box and unswizzle_box to the next less preferred
+ * accelerated implementation. Returns false once the scalar
+ * implementation is in use. For testing only.
+ */
+bool test_swizzle_next_accel(void);
+
 static inline void unswizzle_rect(
     const uint8_t *src_buf,
     unsigned int width,
@@ -20,6 +20,11 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "qemu/bitmap.h"
+#include "qemu/fast-hash.h"
+#include "psh_regs.h"
+#include "s3tc.h"
+#include "swizzle.h"
 #include "texture.h"
 #include "util.h"
 
@@ -140,6 +145,113 @@ hwaddr pgraph_get_texture_palette_phys_addr_length(PGRAPHState *pg, int texture_
     return palette_data - d->vram_ptr;
 }
 
+void pgraph_texture_page_hashes_init(TexturePageHashes *h, hwaddr vram_size)
+{
+    h->num_pages = vram_size >> TARGET_PAGE_BITS;
+    h->hashes = g_new(uint64_t, h->num_pages);
+    h->valid = bitmap_new(h->num_pages);
+}
+
+void pgraph_texture_page_hashes_finalize(TexturePageHashes *h)
+{
+    g_free(h->hashes);
+    h->hashes = NULL;
+    g_free(h->valid);
+    h->valid = NULL;
+    h->num_pages = 0;
+}
+
+void pgraph_texture_page_hashes_invalidate(TexturePageHashes *h,
+                                           TexturePageRange pages)
+{
+    assert(pages.first + pages.count <= h->num_pages);
+    bitmap_clear(h->valid, pages.first, pages.count);
+}
+
+/*
+ * Consume the NV2A_TEX dirty bits of the given pages, dropping the cached
+ * hashes of pages that were written. The snapshot clears whole bitmap words,
+ * so every page in those words is processed and dirty_fn is told about each
+ * dirty run. Returns true if any page in the requested range was dirty.
+ */
+bool pgraph_texture_page_hashes_sync(TexturePageHashes *h, MemoryRegion *vram,
+                                     TexturePageRange pages,
+                                     TexturePageDirtyFunc dirty_fn,
+                                     void *opaque)
+{
+    if (pages.count == 0) {
+        return false;
+    }
+
+    hwaddr pages_end = pages.first + pages.count;
+    assert(pages_end <= h->num_pages);
+
+    hwaddr first = QEMU_ALIGN_DOWN(pages.first, BITS_PER_LONG);
+    hwaddr end = MIN(QEMU_ALIGN_UP(pages_end, BITS_PER_LONG), h->num_pages);
+
+    DirtyBitmapSnapshot *snap = memory_region_snapshot_and_clear_dirty(
+        vram, first << TARGET_PAGE_BITS, (end - first) << TARGET_PAGE_BITS,
+        DIRTY_MEMORY_NV2A_TEX);
+
+    bool dirty = false;
+    hwaddr run_start = end;
+    for (hwaddr page = first; page <= end; page++) {
+        bool page_dirty =
+            page < end &&
+            memory_region_snapshot_get_dirty(vram, snap,
+                                             page << TARGET_PAGE_BITS,
+                                             TARGET_PAGE_SIZE);
+        if (page_dirty) {
+            clear_bit(page, h->valid);
+            dirty |= page >= pages.first && page < pages_end;
+            if (run_start == end) {
+                run_start = page;
+            }
+        } else if (run_start != end) {
+            dirty_fn(opaque, (TexturePageRange){ run_start, page - run_start });
+            run_start = end;
+        }
+    }
+
+    g_free(snap);
+    return dirty;
+}
+
+/*
+ * Hash [addr, addr + size) from the per-page hashes. Whole pages are hashed
+ * at most once until they are dirtied again; partial pages at either end are
+ * hashed directly so bytes outside the range do not affect the result.
+ */
+uint64_t pgraph_texture_page_hashes_hash(TexturePageHashes *h,
+                                         const uint8_t *vram_ptr, hwaddr addr,
+                                         hwaddr size)
+{
+    hwaddr end = addr + size;
+    assert(end <= h->num_pages << TARGET_PAGE_BITS);
+
+    uint64_t hash = size;
+    while (addr < end) {
+        hwaddr page = addr >> TARGET_PAGE_BITS;
+        hwaddr seg_end = MIN(end, (page + 1) << TARGET_PAGE_BITS);
+        uint64_t seg_hash;
+
+        if (seg_end - addr == TARGET_PAGE_SIZE) {
+            if (!test_bit(page, h->valid)) {
+                h->hashes[page] = fast_hash(vram_ptr + addr, TARGET_PAGE_SIZE);
+                set_bit(page, h->valid);
+            }
+            seg_hash = h->hashes[page];
+        } else {
+            seg_hash = fast_hash(vram_ptr + addr, seg_end - addr);
+        }
+
+        hash = (hash ^ seg_hash) * 0x100000001b3ULL;
+        addr = seg_end;
+    }
+
+    return hash;
+}
+
 size_t pgraph_get_texture_length(PGRAPHState *pg, TextureShape *shape)
 {
     BasicColorFormatInfo f = kelvin_color_format_info_map[shape->color_format];
@@ -325,6 +437,151 @@ TextureShape pgraph_get_texture_shape(PGRAPHState *pg, int texture_idx)
     return shape;
 }
 
+/*
+ * Point sampled I8 textures are uploaded as their raw 8-bit indices and
+ * resolved against the palette in the fragment shader, so a palette change
+ * only re-uploads the palette. Filtering or sampling the border color would
+ * operate on indices instead of colors, so those textures are still expanded
+ * on the CPU.
+ */
+bool pgraph_is_texture_palette_lookup_enabled(PGRAPHState *pg, int texture_idx)
+{
+    if (!pgraph_is_texture_enabled(pg, texture_idx)) {
+        return false;
+    }
+
+    uint32_t fmt = pgraph_reg_r(pg, NV_PGRAPH_TEXFMT0 + texture_idx * 4);
+    if (GET_MASK(fmt, NV_PGRAPH_TEXFMT0_COLOR) !=
+        NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8) {
+        return false;
+    }
+
+    uint32_t filter = pgraph_reg_r(pg, NV_PGRAPH_TEXFILTER0 + texture_idx * 4);
+    unsigned int min_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIN);
+    unsigned int mag_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MAG);
+    if (mag_filter != NV_PGRAPH_TEXFILTER0_MAG_BOX_LOD0 ||
+        (min_filter != NV_PGRAPH_TEXFILTER0_MIN_BOX_LOD0 &&
+         min_filter != NV_PGRAPH_TEXFILTER0_MIN_BOX_NEARESTLOD)) {
+        return false;
+    }
+
+    uint32_t ctl_0 = pgraph_reg_r(pg, NV_PGRAPH_TEXCTL0_0 + texture_idx * 4);
+    if (GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MAX_ANISOTROPY)) {
+        return false;
+    }
+
+    uint32_t address =
+        pgraph_reg_r(pg, NV_PGRAPH_TEXADDRESS0 + texture_idx * 4);
+    unsigned int modes[] = {
+        GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRU),
+        GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRV),
+        GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRP),
+    };
+    for (int i = 0; i < ARRAY_SIZE(modes); i++) {
+        if (modes[i] == NV_PGRAPH_TEXADDRESS0_ADDRU_BORDER ||
+            modes[i] == NV_PGRAPH_TEXADDRESS0_ADDRU_CLAMP_OGL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Shape of the index texture used for palette lookup. The indices are stored
+ * like a swizzled 8-bit luminance texture.
+ */
+TextureShape pgraph_get_texture_index_shape(TextureShape s)
+{
+    assert(s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8);
+    s.color_format = NV097_SET_TEXTURE_FORMAT_COLOR_SZ_Y8;
+    return s;
+}
+
+/*
+ * Packed YUV textures sampled by a plain 2D projection are uploaded as is and
+ * converted to RGB in the fragment shader.
+ */
+static bool is_clamp_address_mode(unsigned int mode)
+{
+    return mode == NV_PGRAPH_TEXADDRESS0_ADDRU_CLAMP_TO_EDGE ||
+           mode == NV_PGRAPH_TEXADDRESS0_ADDRU_CLAMP_OGL;
+}
+
+bool pgraph_is_texture_yuv_conversion_enabled(PGRAPHState *pg, int texture_idx)
+{
+    if (!pgraph_is_texture_enabled(pg, texture_idx)) {
+        return false;
+    }
+
+    uint32_t fmt = pgraph_reg_r(pg, NV_PGRAPH_TEXFMT0 + texture_idx * 4);
+    unsigned int color_format = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_COLOR);
+    if (color_format != NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_CR8YB8CB8YA8 &&
+        color_format != NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_YB8CR8YA8CB8) {
+        return false;
+    }
+    if (GET_MASK(fmt, NV_PGRAPH_TEXFMT0_DIMENSIONALITY) != 2 ||
+        GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CUBEMAPENABLE)) {
+        return false;
+    }
+
+    int tex_mode =
+        (pgraph_reg_r(pg, NV_PGRAPH_SHADERPROG) >> (texture_idx * 5)) & 0x1F;
+    if (tex_mode != PS_TEXTUREMODES_PROJECT2D) {
+        return false;
+    }
+
+    uint32_t filter = pgraph_reg_r(pg, NV_PGRAPH_TEXFILTER0 + texture_idx * 4);
+    if (GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIN) ==
+        NV_PGRAPH_TEXFILTER0_MIN_CONVOLUTION_2D_LOD0) {
+        return false;
+    }
+
+    /* The shader clamps coordinates, other modes need the sampler */
+    uint32_t address =
+        pgraph_reg_r(pg, NV_PGRAPH_TEXADDRESS0 + texture_idx * 4);
+    unsigned int addru = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRU);
+    unsigned int addrv = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRV);
+    if (!is_clamp_address_mode(addru) || !is_clamp_address_mode(addrv)) {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Shape of a packed YUV texture viewed as linear A8R8G8B8, one texel per pair
+ * of pixels.
+ */
+TextureShape pgraph_get_texture_yuv_shape(TextureShape s)
+{
+    assert(s.color_format ==
+               NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_CR8YB8CB8YA8 ||
+           s.color_format ==
+               NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_YB8CR8YA8CB8);
+    s.color_format = NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8R8G8B8;
+    s.width = (s.width + 1) / 2;
+    return s;
+}
+
+/* Shape of a palette viewed as a one row linear A8R8G8B8 texture */
+TextureShape pgraph_get_texture_palette_shape(size_t palette_length)
+{
+    TextureShape shape;
+
+    // We will hash it, so make sure any padding is zero
+    memset(&shape, 0, sizeof(shape));
+
+    shape.dimensionality = 2;
+    shape.color_format = NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8R8G8B8;
+    shape.levels = 1;
+    shape.width = palette_length / 4;
+    shape.height = 1;
+    shape.depth = 1;
+    shape.pitch = palette_length;
+    return shape;
+}
+
 uint8_t *pgraph_convert_texture_data(const TextureShape s, const uint8_t *data,
                                      const uint8_t *palette_data,
                                      unsigned int width, unsigned int height,
@@ -403,3 +660,243 @@ uint8_t *pgraph_convert_texture_data(const TextureShape s, const uint8_t *data,
     }
     return converted_data;
 }
+
+static enum S3TC_DECOMPRESS_FORMAT kelvin_format_to_s3tc_format(int color_format)
+{
+    switch (color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5:
+        return S3TC_DECOMPRESS_FORMAT_DXT1;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT23_A8R8G8B8:
+        return S3TC_DECOMPRESS_FORMAT_DXT3;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT45_A8R8G8B8:
+        return S3TC_DECOMPRESS_FORMAT_DXT5;
+    default:
+        assert(!"Invalid texture color format");
+    }
+}
+
+size_t pgraph_get_texture_cubemap_face_size(PGRAPHState *pg, TextureShape s)
+{
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
+    bool is_compressed =
+        pgraph_is_texture_format_compressed(pg, s.color_format);
+    unsigned int block_size =
+        s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5 ? 8 :
+                                                                          16;
+
+    unsigned int w = s.width, h = s.height;
+    size_t length = 0;
+
+    if (!f.linear && s.border) {
+        w = MAX(16, w * 2);
+        h = MAX(16, h * 2);
+    }
+
+    for (int level = 0; level < s.levels; level++) {
+        if (is_compressed) {
+            length += w / 4 * h / 4 * block_size;
+        } else {
+            length += w * h * f.bytes_per_pixel;
+        }
+
+        w /= 2;
+        h /= 2;
+    }
+
+    return ROUND_UP(length, NV2A_CUBEMAP_FACE_ALIGNMENT);
+}
+
+/* Compressed levels are split into jobs of at most this many block rows */
+#define TEXTURE_DECODE_BLOCK_ROWS_PER_JOB 16
+
+typedef struct TextureDecodeJob {
+    TextureDecodeLevel *level;
+    unsigned int first_row, num_rows;
+} TextureDecodeJob;
+
+typedef struct TextureDecodeJobs {
+    TextureDecode *td;
+    GArray *jobs;
+} TextureDecodeJobs;
+
+static void decode_texture_job(void *opaque, int index)
+{
+    TextureDecodeJobs *jobs = opaque;
+    TextureDecodeJob *job = &g_array_index(jobs->jobs, TextureDecodeJob, index);
+    TextureDecode *td = jobs->td;
+    TextureDecodeLevel *l = job->level;
+    TextureShape s = td->shape;
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
+
+    if (td->compressed) {
+        /* The level's buffer was allocated up front, jobs fill in rows */
+        s3tc_decompress_block_rows(kelvin_format_to_s3tc_format(s.color_format),
+                                   l->src, l->data, l->width, l->height,
+                                   l->depth, job->first_row, job->num_rows);
+        return;
+    }
+
+    const uint8_t *pixels = l->src;
+    uint8_t *unswizzled = NULL;
+    unsigned int row_pitch = s.pitch;
+    unsigned int slice_pitch = 0;
+
+    if (!f.linear) {
+        row_pitch = l->width * f.bytes_per_pixel;
+        slice_pitch = row_pitch * l->height;
+        unswizzled = g_malloc(slice_pitch * l->depth);
+        if (s.dimensionality == 3) {
+            unswizzle_box(l->src, l->width, l->height, l->depth, unswizzled,
+                          row_pitch, slice_pitch, f.bytes_per_pixel);
+        } else {
+            unswizzle_rect(l->src, l->width, l->height, unswizzled,
+                           row_pitch, f.bytes_per_pixel);
+        }
+        pixels = unswizzled;
+    }
+
+    l->data = pgraph_convert_texture_data(s, pixels, td->palette, l->width,
+                                          l->height, l->depth, row_pitch,
+                                          slice_pitch, &l->size);
+    if (l->data) {
+        g_free(unswizzled);
+    } else if (unswizzled) {
+        l->data = unswizzled;
+        l->size = slice_pitch * l->depth;
+    } else {
+        /* Linear texture, drop the row padding */
+        size_t dst_pitch = l->width * f.bytes_per_pixel;
+        l->size = dst_pitch * l->height;
+        l->data = g_malloc(l->size);
+        for (unsigned int y = 0; y < l->height; y++) {
+            memcpy(l->data + y * dst_pitch, l->src + y * row_pitch,
+                   dst_pitch);
+        }
+    }
+}
+
+/*
+ * Decode every face and mipmap level of a texture into host memory. The levels
+ * are independent, so they are unswizzled, converted and decompressed in
+ * parallel on the texture decode workers. Large compressed levels are further
+ * split into ranges of block rows. Returns once all of them are done.
+ *
+ * With keep_compressed, S3TC levels are copied as is for hosts that can
+ * sample them directly.
+ */
+TextureDecode *pgraph_decode_texture(PGRAPHState *pg, TextureShape s,
+                                     const uint8_t *texture_data,
+                                     const uint8_t *palette_data,
+                                     bool keep_compressed)
+{
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
+    bool is_3d = s.dimensionality == 3;
+
+    TextureDecode *td = g_new0(TextureDecode, 1);
+    td->shape = s;
+    td->palette = palette_data;
+    td->compressed = pgraph_is_texture_format_compressed(pg, s.color_format);
+    td->keep_compressed = td->compressed && keep_compressed;
+    td->num_faces = s.cubemap ? 6 : 1;
+    td->num_levels = f.linear ? 1 : s.levels;
+    assert(td->num_levels <= NV2A_MAX_TEXTURE_LEVELS);
+
+    unsigned int block_size =
+        s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5 ? 8 :
+                                                                          16;
+    unsigned int base_width = s.width, base_height = s.height,
+                 base_depth = is_3d ? s.depth : 1;
+    if (!f.linear && s.border) {
+        base_width = MAX(16, base_width * 2);
+        base_height = MAX(16, base_height * 2);
+        base_depth = is_3d ? MAX(16, s.depth * 2) : 1;
+    }
+    size_t face_size =
+        s.cubemap ? pgraph_get_texture_cubemap_face_size(pg, s) : 0;
+
+    TextureDecodeJobs jobs = {
+        .td = td,
+        .jobs = g_array_new(false, false, sizeof(TextureDecodeJob)),
+    };
+
+    for (unsigned int face = 0; face < td->num_faces; face++) {
+        const uint8_t *src = texture_data + face * face_size;
+        unsigned int width = base_width, height = base_height,
+                     depth = base_depth;
+
+        for (unsigned int level = 0; level < td->num_levels; level++) {
+            width = MAX(width, 1);
+            height = MAX(height, 1);
+            depth = MAX(depth, 1);
+
+            TextureDecodeLevel *l = &td->levels[face][level];
+            *l = (TextureDecodeLevel){
+                .src = src,
+                .width = width,
+                .height = height,
+                .depth = depth,
+            };
+
+            if (td->compressed) {
+                // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
+                unsigned int physical_width = (width + 3) & ~3,
+                             physical_height = (height + 3) & ~3;
+                size_t compressed_size = physical_width / 4 *
+                                         physical_height / 4 * depth *
+                                         block_size;
+                src += compressed_size;
+
+                if (td->keep_compressed) {
+                    l->size = compressed_size;
+                    if (depth > 1) {
+                        l->data = g_malloc(l->size);
+                        s3tc_linearize_volume_blocks(l->src, l->data,
+                                                     block_size, width, height,
+                                                     depth);
+                    } else {
+                        l->data = g_memdup2(l->src, compressed_size);
+                    }
+                } else {
+                    l->size = width * height * depth * 4;
+                    l->data = g_malloc(l->size);
+                    unsigned int num_rows = s3tc_get_block_rows(height, depth);
+                    for (unsigned int row = 0; row < num_rows;
+                         row += TEXTURE_DECODE_BLOCK_ROWS_PER_JOB) {
+                        TextureDecodeJob job = {
+                            .level = l,
+                            .first_row = row,
+                            .num_rows =
+                                MIN(num_rows - row,
+                                    TEXTURE_DECODE_BLOCK_ROWS_PER_JOB),
+                        };
+                        g_array_append_val(jobs.jobs, job);
+                    }
+                }
+            } else {
+                src += width * height * depth * f.bytes_per_pixel;
+                TextureDecodeJob job = { .level = l };
+                g_array_append_val(jobs.jobs, job);
+            }
+
+            width /= 2;
+            height /= 2;
+            depth /= 2;
+        }
+    }
+
+    pgraph_worker_pool_run(&pg->texture_decode_pool, jobs.jobs->len,
+                           decode_texture_job, &jobs);
+    g_array_free(jobs.jobs, true);
+
+    return td;
+}
+
+void pgraph_free_texture_decode(TextureDecode *td)
+{
+    for (unsigned int face = 0; face < td->num_faces; face++) {
+        for (unsigned int level = 0; level < td->num_levels; level++) {
+            g_free(td->levels[face][level].data);
+        }
+    }
+    g_free(td);
+}
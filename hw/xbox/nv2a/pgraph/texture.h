@@ -63,6 +63,87 @@ hwaddr pgraph_get_texture_phys_addr(PGRAPHState *pg, int texture_idx);
 hwaddr pgraph_get_texture_palette_phys_addr_length(PGRAPHState *pg, int texture_idx, size_t *length);
 TextureShape pgraph_get_texture_shape(PGRAPHState *pg, int texture_idx);
 size_t pgraph_get_texture_length(PGRAPHState *pg, TextureShape *shape);
+bool pgraph_is_texture_palette_lookup_enabled(PGRAPHState *pg, int texture_idx);
+TextureShape pgraph_get_texture_index_shape(TextureShape s);
+TextureShape pgraph_get_texture_palette_shape(size_t palette_length);
+bool pgraph_is_texture_yuv_conversion_enabled(PGRAPHState *pg, int texture_idx);
+TextureShape pgraph_get_texture_yuv_shape(TextureShape s);
+
+#define NV2A_MAX_TEXTURE_LEVELS 16
+
+/* One mipmap level of one cubemap face, decoded to a tightly packed image */
+typedef struct TextureDecodeLevel {
+    const uint8_t *src;
+    unsigned int width, height, depth;
+    uint8_t *data;
+    size_t size;
+} TextureDecodeLevel;
+
+typedef struct TextureDecode {
+    TextureShape shape;
+    const uint8_t *palette;
+    bool compressed;
+    bool keep_compressed;
+    unsigned int num_faces;
+    unsigned int num_levels;
+    TextureDecodeLevel levels[6][NV2A_MAX_TEXTURE_LEVELS];
+} TextureDecode;
+
+size_t pgraph_get_texture_cubemap_face_size(PGRAPHState *pg, TextureShape s);
+TextureDecode *pgraph_decode_texture(PGRAPHState *pg, TextureShape s,
+                                     const uint8_t *texture_data,
+                                     const uint8_t *palette_data,
+                                     bool keep_compressed);
+void pgraph_free_texture_decode(TextureDecode *td);
+
+/* A run of VRAM pages, in units of TARGET_PAGE_SIZE */
+typedef struct TexturePageRange {
+    hwaddr first;
+    hwaddr count;
+} TexturePageRange;
+
+/*
+ * Content hash of each VRAM page, kept valid until the page shows up in the
+ * DIRTY_MEMORY_NV2A_TEX bitmap. Revalidating a texture then only rehashes the
+ * pages that were written since the last check.
+ */
+typedef struct TexturePageHashes {
+    hwaddr num_pages;
+    uint64_t *hashes;
+    unsigned long *valid;
+} TexturePageHashes;
+
+typedef void (*TexturePageDirtyFunc)(void *opaque, TexturePageRange pages);
+
+static inline TexturePageRange pgraph_texture_page_range(hwaddr addr,
+                                                         hwaddr size)
+{
+    if (size == 0) {
+        return (TexturePageRange){ 0, 0 };
+    }
+    hwaddr first = addr >> TARGET_PAGE_BITS;
+    hwaddr last = (addr + size - 1) >> TARGET_PAGE_BITS;
+    return (TexturePageRange){ first, last - first + 1 };
+}
+
+static inline bool pgraph_texture_page_ranges_overlap(TexturePageRange a,
+                                                      TexturePageRange b)
+{
+    return a.count && b.count && a.first < b.first + b.count &&
+           b.first < a.first + a.count;
+}
+
+void pgraph_texture_page_hashes_init(TexturePageHashes *h, hwaddr vram_size);
+void pgraph_texture_page_hashes_finalize(TexturePageHashes *h);
+void pgraph_texture_page_hashes_invalidate(TexturePageHashes *h,
+                                           TexturePageRange pages);
+bool pgraph_texture_page_hashes_sync(TexturePageHashes *h, MemoryRegion *vram,
+                                     TexturePageRange pages,
+                                     TexturePageDirtyFunc dirty_fn,
+                                     void *opaque);
+uint64_t pgraph_texture_page_hashes_hash(TexturePageHashes *h,
+                                         const uint8_t *vram_ptr, hwaddr addr,
+                                         hwaddr size);
 
 static inline float pgraph_convert_lod_bias_to_float(uint32_t lod_bias)
 {
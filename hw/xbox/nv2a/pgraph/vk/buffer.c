@@ -25,7 +25,7 @@ static void create_buffer(PGRAPHState *pg, StorageBuffer *buffer)
 
     VkBufferCreateInfo buffer_create_info = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = buffer->buffer_size,
+        .size = buffer->buffer_size * MAX(1, buffer->num_regions),
         .usage = buffer->usage,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
@@ -50,6 +50,12 @@ void pgraph_vk_init_buffers(NV2AState *d)
 
     // FIXME: Profile buffer sizes
 
+    /*
+     * Buffers which are written each frame are split into one region per
+     * frame in flight, so the CPU can fill the next region while the GPU
+     * consumes the previous one. buffer_size is the size of a region.
+     */
+
     VmaAllocationCreateInfo host_alloc_create_info = {
         .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
         .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
@@ -91,12 +97,14 @@ void pgraph_vk_init_buffers(NV2AState *d)
         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
                  VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
         .buffer_size = sizeof(pg->inline_elements) * 100,
+        .num_regions = NV2A_VK_FRAMES_IN_FLIGHT,
     };
 
     r->storage_buffers[BUFFER_INDEX_STAGING] = (StorageBuffer){
         .alloc_info = host_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
         .buffer_size = r->storage_buffers[BUFFER_INDEX].buffer_size,
+        .num_regions = NV2A_VK_FRAMES_IN_FLIGHT,
     };
 
     // FIXME: Don't assume that we can render with host mapped buffer
@@ -109,6 +117,8 @@ void pgraph_vk_init_buffers(NV2AState *d)
     r->bitmap_size = memory_region_size(d->vram) / 4096;
     r->uploaded_bitmap = bitmap_new(r->bitmap_size);
     bitmap_clear(r->uploaded_bitmap, 0, r->bitmap_size);
+    r->stale_bitmap = bitmap_new(r->bitmap_size);
+    r->page_submit_times = g_new0(uint32_t, r->bitmap_size);
 
     r->storage_buffers[BUFFER_VERTEX_INLINE] = (StorageBuffer){
         .alloc_info = device_alloc_create_info,
@@ -116,12 +126,14 @@ void pgraph_vk_init_buffers(NV2AState *d)
                  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
         .buffer_size = NV2A_VERTEXSHADER_ATTRIBUTES * NV2A_MAX_BATCH_LENGTH *
                        4 * sizeof(float) * 10,
+        .num_regions = NV2A_VK_FRAMES_IN_FLIGHT,
     };
 
     r->storage_buffers[BUFFER_VERTEX_INLINE_STAGING] = (StorageBuffer){
         .alloc_info = host_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
         .buffer_size = r->storage_buffers[BUFFER_VERTEX_INLINE].buffer_size,
+        .num_regions = NV2A_VK_FRAMES_IN_FLIGHT,
     };
 
     r->storage_buffers[BUFFER_UNIFORM] = (StorageBuffer){
@@ -129,12 +141,22 @@ void pgraph_vk_init_buffers(NV2AState *d)
         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
         .buffer_size = 8 * 1024 * 1024,
+        .num_regions = NV2A_VK_FRAMES_IN_FLIGHT,
     };
 
     r->storage_buffers[BUFFER_UNIFORM_STAGING] = (StorageBuffer){
         .alloc_info = host_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
         .buffer_size = r->storage_buffers[BUFFER_UNIFORM].buffer_size,
+        .num_regions = NV2A_VK_FRAMES_IN_FLIGHT,
+    };
+
+    // Decoded texture data, copied to images in the frame's command buffer
+    r->storage_buffers[BUFFER_TEXTURE_STAGING] = (StorageBuffer){
+        .alloc_info = host_alloc_create_info,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .buffer_size = 16 * 1024 * 1024,
+        .num_regions = NV2A_VK_FRAMES_IN_FLIGHT,
     };
 
     for (int i = 0; i < BUFFER_COUNT; i++) {
@@ -146,7 +168,8 @@ void pgraph_vk_init_buffers(NV2AState *d)
     int buffers_to_map[] = { BUFFER_VERTEX_RAM,
                              BUFFER_INDEX_STAGING,
                              BUFFER_VERTEX_INLINE_STAGING,
-                             BUFFER_UNIFORM_STAGING };
+                             BUFFER_UNIFORM_STAGING,
+                             BUFFER_TEXTURE_STAGING };
 
     for (int i = 0; i < ARRAY_SIZE(buffers_to_map); i++) {
         VK_CHECK(vmaMapMemory(
@@ -169,6 +192,10 @@ void pgraph_vk_finalize_buffers(NV2AState *d)
 
     g_free(r->uploaded_bitmap);
     r->uploaded_bitmap = NULL;
+    g_free(r->stale_bitmap);
+    r->stale_bitmap = NULL;
+    g_free(r->page_submit_times);
+    r->page_submit_times = NULL;
 }
 
 bool pgraph_vk_buffer_has_space_for(PGRAPHState *pg, int index,
@@ -199,9 +226,10 @@ VkDeviceSize pgraph_vk_append_to_buffer(PGRAPHState *pg, int index, void **data,
 
     for (int i = 0; i < count; i++) {
         b->buffer_offset = ROUND_UP(b->buffer_offset, alignment);
-        memcpy(b->mapped + b->buffer_offset, data[i], sizes[i]);
+        memcpy(b->mapped + b->region_offset + b->buffer_offset, data[i],
+               sizes[i]);
         b->buffer_offset += sizes[i];
     }
 
-    return starting_offset;
+    return b->region_offset + starting_offset;
 }
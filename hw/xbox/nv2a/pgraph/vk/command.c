@@ -42,34 +42,153 @@ static void destroy_command_pool(PGRAPHState *pg)
     vkDestroyCommandPool(r->device, r->command_pool, NULL);
 }
 
-static void create_command_buffers(PGRAPHState *pg)
+static void create_frames(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    VkCommandBuffer command_buffers[2 * NV2A_VK_FRAMES_IN_FLIGHT];
+
     VkCommandBufferAllocateInfo alloc_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .commandPool = r->command_pool,
         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = ARRAY_SIZE(r->command_buffers),
+        .commandBufferCount = ARRAY_SIZE(command_buffers),
     };
     VK_CHECK(
-        vkAllocateCommandBuffers(r->device, &alloc_info, r->command_buffers));
+        vkAllocateCommandBuffers(r->device, &alloc_info, command_buffers));
+
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+    };
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
 
-    r->command_buffer = r->command_buffers[0];
-    r->aux_command_buffer = r->command_buffers[1];
+    for (int i = 0; i < NV2A_VK_FRAMES_IN_FLIGHT; i++) {
+        FrameContext *frame = &r->frames[i];
+        frame->command_buffer = command_buffers[2 * i];
+        frame->aux_command_buffer = command_buffers[2 * i + 1];
+        VK_CHECK(vkCreateSemaphore(r->device, &semaphore_info, NULL,
+                                   &frame->semaphore));
+        VK_CHECK(vkCreateFence(r->device, &fence_info, NULL, &frame->fence));
+        frame->in_flight = false;
+        frame->num_framebuffers = 0;
+    }
+
+    r->frame_index = 0;
+    r->command_buffer = r->frames[0].command_buffer;
+    r->aux_command_buffer = r->frames[0].aux_command_buffer;
 }
 
-static void destroy_command_buffers(PGRAPHState *pg)
+static void destroy_frames(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    vkFreeCommandBuffers(r->device, r->command_pool,
-                         ARRAY_SIZE(r->command_buffers), r->command_buffers);
+    pgraph_vk_wait_for_frames_in_flight(r);
+
+    for (int i = 0; i < NV2A_VK_FRAMES_IN_FLIGHT; i++) {
+        FrameContext *frame = &r->frames[i];
+        VkCommandBuffer command_buffers[] = { frame->command_buffer,
+                                              frame->aux_command_buffer };
+        vkFreeCommandBuffers(r->device, r->command_pool,
+                             ARRAY_SIZE(command_buffers), command_buffers);
+        vkDestroyFence(r->device, frame->fence, NULL);
+        vkDestroySemaphore(r->device, frame->semaphore, NULL);
+        frame->command_buffer = VK_NULL_HANDLE;
+        frame->aux_command_buffer = VK_NULL_HANDLE;
+    }
 
     r->command_buffer = VK_NULL_HANDLE;
     r->aux_command_buffer = VK_NULL_HANDLE;
 }
 
+static void retire_frame(PGRAPHVkState *r, FrameContext *frame)
+{
+    if (!frame->in_flight) {
+        return;
+    }
+
+    if (vkGetFenceStatus(r->device, frame->fence) != VK_SUCCESS) {
+        nv2a_profile_inc_counter(NV2A_PROF_FRAME_WAIT);
+        VK_CHECK(vkWaitForFences(r->device, 1, &frame->fence, VK_TRUE,
+                                 UINT64_MAX));
+    }
+
+    for (int i = 0; i < frame->num_framebuffers; i++) {
+        vkDestroyFramebuffer(r->device, frame->framebuffers[i], NULL);
+        frame->framebuffers[i] = VK_NULL_HANDLE;
+    }
+    frame->num_framebuffers = 0;
+
+    frame->in_flight = false;
+    r->completed_submit_count =
+        MAX(r->completed_submit_count, frame->submit_index + 1);
+}
+
+bool pgraph_vk_frames_in_flight(PGRAPHVkState *r)
+{
+    for (int i = 0; i < NV2A_VK_FRAMES_IN_FLIGHT; i++) {
+        if (r->frames[i].in_flight) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void pgraph_vk_wait_for_frames_in_flight(PGRAPHVkState *r)
+{
+    /* Oldest first, so completed_submit_count advances in order */
+    for (int i = 1; i <= NV2A_VK_FRAMES_IN_FLIGHT; i++) {
+        int index = (r->frame_index + i) % NV2A_VK_FRAMES_IN_FLIGHT;
+        retire_frame(r, &r->frames[index]);
+    }
+}
+
+void pgraph_vk_wait_for_submit(PGRAPHVkState *r, uint32_t submit_index)
+{
+    /* Oldest first, stopping after the given submission */
+    for (int i = 1; i <= NV2A_VK_FRAMES_IN_FLIGHT; i++) {
+        int index = (r->frame_index + i) % NV2A_VK_FRAMES_IN_FLIGHT;
+        FrameContext *frame = &r->frames[index];
+        if (frame->in_flight && frame->submit_index <= submit_index) {
+            retire_frame(r, frame);
+        }
+    }
+}
+
+static void set_ring_buffer_regions(PGRAPHVkState *r)
+{
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        StorageBuffer *b = &r->storage_buffers[i];
+        if (b->num_regions > 1) {
+            b->region_offset =
+                (r->frame_index % b->num_regions) * b->buffer_size;
+        }
+    }
+}
+
+FrameContext *pgraph_vk_get_current_frame(PGRAPHVkState *r)
+{
+    return &r->frames[r->frame_index];
+}
+
+void pgraph_vk_advance_frame(PGRAPHVkState *r)
+{
+    FrameContext *frame = pgraph_vk_get_current_frame(r);
+    assert(!frame->in_flight);
+    frame->in_flight = true;
+
+    r->frame_index = (r->frame_index + 1) % NV2A_VK_FRAMES_IN_FLIGHT;
+
+    /* The next frame reuses the oldest slot, wait until the GPU is done */
+    frame = pgraph_vk_get_current_frame(r);
+    retire_frame(r, frame);
+
+    r->command_buffer = frame->command_buffer;
+    r->aux_command_buffer = frame->aux_command_buffer;
+    set_ring_buffer_regions(r);
+}
+
 VkCommandBuffer pgraph_vk_begin_single_time_commands(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -77,6 +196,9 @@ VkCommandBuffer pgraph_vk_begin_single_time_commands(PGRAPHState *pg)
     assert(!r->in_aux_command_buffer);
     r->in_aux_command_buffer = true;
 
+    // Resources touched here may still be in use by submitted frames
+    pgraph_vk_wait_for_frames_in_flight(r);
+
     VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
@@ -109,11 +231,11 @@ void pgraph_vk_end_single_time_commands(PGRAPHState *pg, VkCommandBuffer cmd)
 void pgraph_vk_init_command_buffers(PGRAPHState *pg)
 {
     create_command_pool(pg);
-    create_command_buffers(pg);
+    create_frames(pg);
 }
 
 void pgraph_vk_finalize_command_buffers(PGRAPHState *pg)
 {
-    destroy_command_buffers(pg);
+    destroy_frames(pg);
     destroy_command_pool(pg);
-}
\ No newline at end of file
+}
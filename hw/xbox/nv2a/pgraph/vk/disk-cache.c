@@ -0,0 +1,432 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "xemu-version.h"
+#include "ui/xemu-settings.h"
+#include "renderer.h"
+
+/*
+ * On-disk cache layout (relative to the settings base path):
+ *
+ *   vk_shader_cache_list      hashes of shader modules active at shutdown
+ *   vk_shaders/XXXX/YYYY...   compiled SPIR-V, one file per module key
+ *   vk_pipeline_cache         vkGetPipelineCacheData blob
+ *
+ * Every file starts with the xemu version string and the device pipeline
+ * cache UUID. Files that do not match the running build and device are
+ * deleted when encountered.
+ */
+
+typedef struct ShaderModuleDiskEntry {
+    uint64_t hash;
+    ShaderModuleCacheKey key;
+    GByteArray *spirv;
+} ShaderModuleDiskEntry;
+
+static char *get_module_list_path(void)
+{
+    return g_strdup_printf("%svk_shader_cache_list",
+                           xemu_settings_get_base_path());
+}
+
+static char *get_pipeline_cache_path(void)
+{
+    return g_strdup_printf("%svk_pipeline_cache",
+                           xemu_settings_get_base_path());
+}
+
+static char *get_module_bin_directory(uint64_t hash)
+{
+    return g_strdup_printf("%svk_shaders/%04x", xemu_settings_get_base_path(),
+                           (uint32_t)(hash >> 48));
+}
+
+static char *get_module_binary_path(const char *bin_dir, uint64_t hash)
+{
+    uint64_t bin_mask = (uint64_t)0xffff << 48;
+    return g_strdup_printf("%s/%012" PRIx64, bin_dir, hash & ~bin_mask);
+}
+
+static void create_cache_folder(void)
+{
+    char *path = g_strdup_printf("%svk_shaders", xemu_settings_get_base_path());
+    qemu_mkdir(path);
+    g_free(path);
+}
+
+static bool write_header(PGRAPHVkState *r, FILE *file)
+{
+    uint64_t xemu_version_len = strlen(xemu_version) + 1;
+
+    return fwrite(&xemu_version_len, sizeof(xemu_version_len), 1, file) == 1 &&
+           fwrite(xemu_version, xemu_version_len, 1, file) == 1 &&
+           fwrite(r->device_props.pipelineCacheUUID, VK_UUID_SIZE, 1, file) ==
+               1;
+}
+
+static bool check_header(PGRAPHVkState *r, FILE *file)
+{
+    uint64_t cached_xemu_version_len;
+    uint8_t cached_uuid[VK_UUID_SIZE];
+
+    if (fread(&cached_xemu_version_len, sizeof(cached_xemu_version_len), 1,
+              file) != 1 ||
+        cached_xemu_version_len != strlen(xemu_version) + 1) {
+        return false;
+    }
+
+    g_autofree char *cached_xemu_version = g_malloc(cached_xemu_version_len);
+    if (fread(cached_xemu_version, cached_xemu_version_len, 1, file) != 1 ||
+        memcmp(cached_xemu_version, xemu_version, cached_xemu_version_len)) {
+        return false;
+    }
+
+    if (fread(cached_uuid, sizeof(cached_uuid), 1, file) != 1 ||
+        memcmp(cached_uuid, r->device_props.pipelineCacheUUID,
+               VK_UUID_SIZE)) {
+        return false;
+    }
+
+    return true;
+}
+
+static void shader_module_disk_entry_free(gpointer data)
+{
+    ShaderModuleDiskEntry *entry = data;
+    g_byte_array_unref(entry->spirv);
+    g_free(entry);
+}
+
+static void load_module_from_disk(PGRAPHVkState *r, uint64_t hash)
+{
+    char *bin_dir = get_module_bin_directory(hash);
+    char *path = get_module_binary_path(bin_dir, hash);
+    g_free(bin_dir);
+
+    ShaderModuleDiskEntry *entry = NULL;
+    uint64_t spirv_size;
+    void *spirv = NULL;
+
+    qemu_mutex_lock(&r->shader_disk_lock);
+    bool present = g_hash_table_contains(r->shader_disk_modules, &hash);
+    qemu_mutex_unlock(&r->shader_disk_lock);
+    if (present) {
+        g_free(path);
+        return;
+    }
+
+    FILE *file = qemu_fopen(path, "rb");
+    if (!file) {
+        g_free(path);
+        return;
+    }
+
+    entry = g_malloc0(sizeof(*entry));
+    entry->hash = hash;
+
+    if (!check_header(r, file) ||
+        fread(&entry->key, sizeof(entry->key), 1, file) != 1 ||
+        fread(&spirv_size, sizeof(spirv_size), 1, file) != 1 ||
+        spirv_size == 0 || spirv_size % sizeof(uint32_t)) {
+        goto error;
+    }
+
+    spirv = g_malloc(spirv_size);
+    if (fread(spirv, spirv_size, 1, file) != 1) {
+        goto error;
+    }
+
+    fclose(file);
+    g_free(path);
+
+    entry->spirv = g_byte_array_new_take(spirv, spirv_size);
+
+    qemu_mutex_lock(&r->shader_disk_lock);
+    g_hash_table_insert(r->shader_disk_modules, &entry->hash, entry);
+    qemu_mutex_unlock(&r->shader_disk_lock);
+    return;
+
+error:
+    /* Delete the module so it won't be loaded again */
+    fclose(file);
+    qemu_unlink(path);
+    g_free(path);
+    g_free(spirv);
+    g_free(entry);
+}
+
+static void *reload_modules_from_disk(void *arg)
+{
+    PGRAPHVkState *r = arg;
+
+    char *list_path = get_module_list_path();
+    FILE *list = qemu_fopen(list_path, "rb");
+    g_free(list_path);
+    if (list) {
+        uint64_t hash;
+        while (fread(&hash, sizeof(hash), 1, list) == 1) {
+            load_module_from_disk(r, hash);
+        }
+        fclose(list);
+    }
+
+    pgraph_vk_set_shader_disk_cache_loaded(r);
+
+    return NULL;
+}
+
+/* Also called from the shader compile workers */
+bool pgraph_vk_disk_cache_contains_spirv(PGRAPHVkState *r, uint64_t hash)
+{
+    qemu_mutex_lock(&r->shader_disk_lock);
+    bool present = r->shader_disk_modules &&
+                   g_hash_table_contains(r->shader_disk_modules, &hash);
+    qemu_mutex_unlock(&r->shader_disk_lock);
+
+    return present;
+}
+
+GByteArray *pgraph_vk_disk_cache_take_spirv(PGRAPHVkState *r, uint64_t hash,
+                                            const ShaderModuleCacheKey *key)
+{
+    GByteArray *spirv = NULL;
+
+    qemu_mutex_lock(&r->shader_disk_lock);
+    ShaderModuleDiskEntry *entry =
+        r->shader_disk_modules ?
+            g_hash_table_lookup(r->shader_disk_modules, &hash) :
+            NULL;
+    if (entry && !memcmp(&entry->key, key, sizeof(*key))) {
+        spirv = g_byte_array_ref(entry->spirv);
+        g_hash_table_remove(r->shader_disk_modules, &hash);
+    }
+    qemu_mutex_unlock(&r->shader_disk_lock);
+
+    return spirv;
+}
+
+static void write_module_to_disk(PGRAPHVkState *r,
+                                 ShaderModuleCacheEntry *module)
+{
+    uint64_t hash = module->node.hash;
+    GByteArray *spirv = module->module_info->spirv;
+    uint64_t spirv_size = spirv->len;
+
+    char *bin_dir = get_module_bin_directory(hash);
+    char *path = get_module_binary_path(bin_dir, hash);
+    qemu_mkdir(bin_dir);
+    g_free(bin_dir);
+
+    FILE *file = qemu_fopen(path, "wb");
+    if (!file) {
+        goto error;
+    }
+
+    if (!write_header(r, file) ||
+        fwrite(&module->key, sizeof(module->key), 1, file) != 1 ||
+        fwrite(&spirv_size, sizeof(spirv_size), 1, file) != 1 ||
+        fwrite(spirv->data, spirv_size, 1, file) != 1) {
+        fclose(file);
+        goto error;
+    }
+
+    fclose(file);
+    g_free(path);
+    module->cached = true;
+    return;
+
+error:
+    fprintf(stderr, "nv2a: Failed to write shader module file to %s\n", path);
+    qemu_unlink(path);
+    g_free(path);
+}
+
+static void write_module_list_entry_to_disk(Lru *lru, LruNode *node,
+                                            void *opaque)
+{
+    PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_module_cache);
+    ShaderModuleCacheEntry *module =
+        container_of(node, ShaderModuleCacheEntry, node);
+    FILE *list = opaque;
+
+    if (!module->cached) {
+        write_module_to_disk(r, module);
+        if (!module->cached) {
+            return;
+        }
+    }
+
+    if (fwrite(&node->hash, sizeof(node->hash), 1, list) != 1) {
+        fprintf(stderr,
+                "nv2a: Failed to write shader module list entry %llx to disk\n",
+                (unsigned long long)node->hash);
+    }
+}
+
+static void write_pipeline_cache_to_disk(PGRAPHVkState *r)
+{
+    size_t data_size = 0;
+    VK_CHECK(vkGetPipelineCacheData(r->device, r->vk_pipeline_cache,
+                                    &data_size, NULL));
+    if (data_size == 0) {
+        return;
+    }
+
+    g_autofree void *data = g_malloc(data_size);
+    VkResult result = vkGetPipelineCacheData(r->device, r->vk_pipeline_cache,
+                                             &data_size, data);
+    if (result != VK_SUCCESS && result != VK_INCOMPLETE) {
+        return;
+    }
+
+    uint64_t size = data_size;
+    char *path = get_pipeline_cache_path();
+    FILE *file = qemu_fopen(path, "wb");
+    if (!file) {
+        goto error;
+    }
+
+    if (!write_header(r, file) ||
+        fwrite(&size, sizeof(size), 1, file) != 1 ||
+        fwrite(data, data_size, 1, file) != 1) {
+        fclose(file);
+        goto error;
+    }
+
+    fclose(file);
+    g_free(path);
+    return;
+
+error:
+    fprintf(stderr, "nv2a: Failed to write pipeline cache to %s\n", path);
+    qemu_unlink(path);
+    g_free(path);
+}
+
+void *pgraph_vk_disk_cache_load_pipeline_data(PGRAPHVkState *r, size_t *size)
+{
+    *size = 0;
+
+    if (!g_config.perf.cache_shaders) {
+        return NULL;
+    }
+
+    char *path = get_pipeline_cache_path();
+    FILE *file = qemu_fopen(path, "rb");
+    if (!file) {
+        g_free(path);
+        return NULL;
+    }
+
+    uint64_t data_size;
+    void *data = NULL;
+
+    if (!check_header(r, file) ||
+        fread(&data_size, sizeof(data_size), 1, file) != 1 ||
+        data_size == 0) {
+        goto error;
+    }
+
+    data = g_malloc(data_size);
+    if (fread(data, data_size, 1, file) != 1) {
+        goto error;
+    }
+
+    fclose(file);
+    g_free(path);
+    *size = data_size;
+    return data;
+
+error:
+    fclose(file);
+    qemu_unlink(path);
+    g_free(path);
+    g_free(data);
+    return NULL;
+}
+
+void pgraph_vk_disk_cache_write_back(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!g_config.perf.cache_shaders || !r->shader_disk_modules) {
+        goto done;
+    }
+
+    qemu_thread_join(&r->shader_disk_thread);
+
+    char *list_path = get_module_list_path();
+    FILE *list = qemu_fopen(list_path, "wb");
+    g_free(list_path);
+    if (!list) {
+        fprintf(stderr, "nv2a: Failed to open shader module list for writing\n");
+    } else {
+        lru_visit_active(&r->shader_module_cache,
+                         write_module_list_entry_to_disk, list);
+        fclose(list);
+    }
+
+    write_pipeline_cache_to_disk(r);
+
+    /* Nothing more will be picked up from disk this session */
+    qemu_mutex_lock(&r->shader_disk_lock);
+    g_hash_table_destroy(r->shader_disk_modules);
+    r->shader_disk_modules = NULL;
+    qemu_mutex_unlock(&r->shader_disk_lock);
+
+done:
+    qatomic_set(&r->shader_cache_writeback_pending, false);
+    qemu_event_set(&r->shader_cache_writeback_complete);
+}
+
+void pgraph_vk_init_disk_cache(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    qemu_mutex_init(&r->shader_disk_lock);
+    qemu_event_init(&r->shader_cache_writeback_complete, false);
+
+    if (!g_config.perf.cache_shaders) {
+        pgraph_vk_set_shader_disk_cache_loaded(r);
+        return;
+    }
+
+    create_cache_folder();
+
+    r->shader_disk_modules = g_hash_table_new_full(
+        g_int64_hash, g_int64_equal, NULL, shader_module_disk_entry_free);
+
+    qemu_thread_create(&r->shader_disk_thread, "nv2a.vk_shader_disk",
+                       reload_modules_from_disk, r, QEMU_THREAD_JOINABLE);
+}
+
+void pgraph_vk_finalize_disk_cache(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (r->shader_disk_modules) {
+        qemu_thread_join(&r->shader_disk_thread);
+        g_hash_table_destroy(r->shader_disk_modules);
+        r->shader_disk_modules = NULL;
+    }
+
+    qemu_mutex_destroy(&r->shader_disk_lock);
+    qemu_event_destroy(&r->shader_cache_writeback_complete);
+}
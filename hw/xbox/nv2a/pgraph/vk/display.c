@@ -17,28 +17,10 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "qemu/fast-hash.h"
 #include "renderer.h"
 #include <math.h>
 
-static uint8_t *convert_texture_data__CR8YB8CB8YA8(uint8_t *data_out,
-                                                   const uint8_t *data_in,
-                                                   unsigned int width,
-                                                   unsigned int height,
-                                                   unsigned int pitch)
-{
-    int x, y;
-    for (y = 0; y < height; y++) {
-        const uint8_t *line = &data_in[y * pitch];
-        const uint32_t row_offset = y * width;
-        for (x = 0; x < width; x++) {
-            uint8_t *pixel = &data_out[(row_offset + x) * 4];
-            convert_yuy2_to_rgb(line, x, &pixel[0], &pixel[1], &pixel[2]);
-            pixel[3] = 255;
-        }
-    }
-    return data_out;
-}
-
 static float pvideo_calculate_scale(unsigned int din_dout,
                                     unsigned int output_size)
 {
@@ -74,11 +56,15 @@ static void create_pvideo_image(PGRAPHState *pg, int width, int height)
     PGRAPHVkState *r = pg->vk_renderer_state;
     PGRAPHVkDisplayState *d = &r->display;
 
-    if (d->pvideo.image == VK_NULL_HANDLE || d->pvideo.width != width ||
-        d->pvideo.height != height) {
-        destroy_pvideo_image(pg);
+    if (d->pvideo.image != VK_NULL_HANDLE && d->pvideo.width == width &&
+        d->pvideo.height == height) {
+        return;
     }
 
+    destroy_pvideo_image(pg);
+    d->pvideo.width = width;
+    d->pvideo.height = height;
+
     VkImageCreateInfo image_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = VK_IMAGE_TYPE_2D,
@@ -87,7 +73,7 @@ static void create_pvideo_image(PGRAPHState *pg, int width, int height)
         .extent.depth = 1,
         .mipLevels = 1,
         .arrayLayers = 1,
-        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .format = VK_FORMAT_B8G8R8A8_UNORM,
         .tiling = VK_IMAGE_TILING_OPTIMAL,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
         .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
@@ -106,7 +92,7 @@ static void create_pvideo_image(PGRAPHState *pg, int width, int height)
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = d->pvideo.image,
         .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .format = VK_FORMAT_B8G8R8A8_UNORM,
         .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
         .subresourceRange.baseMipLevel = 0,
         .subresourceRange.levelCount = image_create_info.mipLevels,
@@ -118,11 +104,11 @@ static void create_pvideo_image(PGRAPHState *pg, int width, int height)
 
     VkSamplerCreateInfo sampler_create_info = {
         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-        .magFilter = VK_FILTER_LINEAR,
+        .magFilter = VK_FILTER_NEAREST,
         .minFilter = VK_FILTER_NEAREST,
-        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
         .borderColor = VK_BORDER_COLOR_INT_OPAQUE_WHITE,
         .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
     };
@@ -136,9 +122,22 @@ static void upload_pvideo_image(PGRAPHState *pg, PvideoState state)
     PGRAPHVkState *r = pg->vk_renderer_state;
     PGRAPHVkDisplayState *disp = &r->display;
 
-    create_pvideo_image(pg, state.in_width, state.in_height);
+    /* Packed YUY2 is uploaded as is, two pixels per texel, and converted by
+     * the display shader */
+    unsigned int tex_width = (state.in_width + 1) / 2;
+    const uint8_t *src = d->vram_ptr + state.base + state.offset;
+    uint64_t hash = fast_hash(src, state.pitch * state.in_height);
+    bool same_size = disp->pvideo.image != VK_NULL_HANDLE &&
+                     disp->pvideo.width == tex_width &&
+                     disp->pvideo.height == state.in_height;
+    if (same_size && hash == disp->pvideo.hash &&
+        state.pitch == disp->pvideo.pitch) {
+        return;
+    }
 
-    // FIXME: Dirty tracking. We don't necessarily need to upload so much.
+    create_pvideo_image(pg, tex_width, state.in_height);
+    disp->pvideo.hash = hash;
+    disp->pvideo.pitch = state.pitch;
 
     // Copy texture data to mapped device buffer
     uint8_t *mapped_memory_ptr;
@@ -147,9 +146,11 @@ static void upload_pvideo_image(PGRAPHState *pg, PvideoState state)
                           r->storage_buffers[BUFFER_STAGING_SRC].allocation,
                           (void *)&mapped_memory_ptr));
 
-    convert_texture_data__CR8YB8CB8YA8(
-        mapped_memory_ptr, d->vram_ptr + state.base + state.offset,
-        state.in_width, state.in_height, state.pitch);
+    size_t row_size = tex_width * 4;
+    for (int y = 0; y < state.in_height; y++) {
+        memcpy(&mapped_memory_ptr[y * row_size], &src[y * state.pitch],
+               row_size);
+    }
 
     vmaFlushAllocation(r->allocator,
                        r->storage_buffers[BUFFER_STAGING_SRC].allocation, 0,
@@ -188,14 +189,14 @@ static void upload_pvideo_image(PGRAPHState *pg, PvideoState state)
         .imageSubresource.baseArrayLayer = 0,
         .imageSubresource.layerCount = 1,
         .imageOffset = (VkOffset3D){ 0, 0, 0 },
-        .imageExtent = (VkExtent3D){ state.in_width, state.in_height, 1 },
+        .imageExtent = (VkExtent3D){ tex_width, state.in_height, 1 },
     };
     vkCmdCopyBufferToImage(cmd, r->storage_buffers[BUFFER_STAGING_SRC].buffer,
                            disp->pvideo.image,
                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
     pgraph_vk_transition_image_layout(pg, cmd, disp->pvideo.image,
-                                      VK_FORMAT_R8G8B8A8_UNORM,
+                                      VK_FORMAT_B8G8R8A8_UNORM,
                                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
     pgraph_vk_end_single_time_commands(pg, cmd);
@@ -216,6 +217,7 @@ static const char *display_frag_glsl =
     "    vec3 pvideo_color_key;\n"
     "};\n"
     "layout(location = 0) out vec4 out_Color;\n"
+    GLSL_YUV_SAMPLER
     "void main()\n"
     "{\n"
     "    vec2 tex_coord = gl_FragCoord.xy/display_size;\n"
@@ -230,8 +232,8 @@ static const char *display_frag_glsl =
     "                           greaterThan(screen_coord, output_region.zw));\n"
     "        if (!any(clip) && (!pvideo_color_key_enable || out_Color.rgb == pvideo_color_key)) {\n"
     "            vec2 out_xy = screen_coord - pvideo_pos.xy;\n"
-    "            vec2 in_st = (pvideo_in_pos + out_xy * pvideo_scale.xy) / textureSize(pvideo_tex, 0);\n"
-    "            out_Color.rgba = texture(pvideo_tex, in_st);\n"
+    "            vec2 in_xy = pvideo_in_pos + out_xy * pvideo_scale.xy;\n"
+    "            out_Color.rgba = textureYuv(pvideo_tex, in_xy, false, true);\n"
     "        }\n"
     "    }\n"
     "}\n";
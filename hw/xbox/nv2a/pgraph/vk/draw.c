@@ -96,6 +96,7 @@ static void pipeline_cache_entry_init(Lru *lru, LruNode *node,
     snode->layout = VK_NULL_HANDLE;
     snode->pipeline = VK_NULL_HANDLE;
     snode->draw_time = 0;
+    snode->submit_time = 0;
 }
 
 static void pipeline_cache_entry_post_evict(Lru *lru, LruNode *node)
@@ -107,6 +108,12 @@ static void pipeline_cache_entry_post_evict(Lru *lru, LruNode *node)
             snode->draw_time < r->command_buffer_start_time) &&
            "Pipeline evicted while in use!");
 
+    // Only the submission that last drew with it can still be using it
+    if (snode->submit_time >= r->completed_submit_count &&
+        snode->submit_time < r->submit_count) {
+        pgraph_vk_wait_for_submit(r, snode->submit_time);
+    }
+
     vkDestroyPipeline(r->device, snode->pipeline, NULL);
     snode->pipeline = VK_NULL_HANDLE;
 
@@ -125,15 +132,27 @@ static void init_pipeline_cache(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    size_t initial_data_size;
+    g_autofree void *initial_data =
+        pgraph_vk_disk_cache_load_pipeline_data(r, &initial_data_size);
+
     VkPipelineCacheCreateInfo cache_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
         .flags = 0,
-        .initialDataSize = 0,
-        .pInitialData = NULL,
+        .initialDataSize = initial_data_size,
+        .pInitialData = initial_data,
         .pNext = NULL,
     };
-    VK_CHECK(vkCreatePipelineCache(r->device, &cache_info, NULL,
-                                   &r->vk_pipeline_cache));
+    VkResult result = vkCreatePipelineCache(r->device, &cache_info, NULL,
+                                            &r->vk_pipeline_cache);
+    if (result != VK_SUCCESS && initial_data) {
+        /* Driver rejected the cached blob, start over with an empty cache */
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = NULL;
+        result = vkCreatePipelineCache(r->device, &cache_info, NULL,
+                                       &r->vk_pipeline_cache);
+    }
+    VK_CHECK(result);
 
     const size_t pipeline_cache_size = 2048;
     lru_init(&r->pipeline_cache);
@@ -154,6 +173,7 @@ static void finalize_pipeline_cache(PGRAPHState *pg)
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     lru_flush(&r->pipeline_cache);
+    lru_destroy(&r->pipeline_cache);
     g_free(r->pipeline_cache_entries);
     r->pipeline_cache_entries = NULL;
 
@@ -216,18 +236,6 @@ void pgraph_vk_init_pipelines(PGRAPHState *pg)
     init_pipeline_cache(pg);
     init_clear_shaders(pg);
     init_render_passes(r);
-
-    VkSemaphoreCreateInfo semaphore_info = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
-    };
-    VK_CHECK(vkCreateSemaphore(r->device, &semaphore_info, NULL,
-                               &r->command_buffer_semaphore));
-
-    VkFenceCreateInfo fence_info = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-    };
-    VK_CHECK(
-        vkCreateFence(r->device, &fence_info, NULL, &r->command_buffer_fence));
 }
 
 void pgraph_vk_finalize_pipelines(PGRAPHState *pg)
@@ -237,9 +245,6 @@ void pgraph_vk_finalize_pipelines(PGRAPHState *pg)
     finalize_clear_shaders(pg);
     finalize_pipeline_cache(pg);
     finalize_render_passes(r);
-
-    vkDestroyFence(r->device, r->command_buffer_fence, NULL);
-    vkDestroySemaphore(r->device, r->command_buffer_semaphore, NULL);
 }
 
 static void init_render_pass_state(PGRAPHState *pg, RenderPassState *state)
@@ -379,8 +384,10 @@ static void create_frame_buffer(PGRAPHState *pg)
 
     assert(r->color_binding || r->zeta_binding);
 
-    if (r->framebuffer_index >= ARRAY_SIZE(r->framebuffers)) {
+    FrameContext *frame = pgraph_vk_get_current_frame(r);
+    if (frame->num_framebuffers >= ARRAY_SIZE(frame->framebuffers)) {
         pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
+        frame = pgraph_vk_get_current_frame(r);
     }
 
     VkImageView attachments[2];
@@ -405,20 +412,9 @@ static void create_frame_buffer(PGRAPHState *pg)
         .layers = 1,
     };
     pgraph_apply_scaling_factor(pg, &create_info.width, &create_info.height);
-    VK_CHECK(vkCreateFramebuffer(r->device, &create_info, NULL,
-                                 &r->framebuffers[r->framebuffer_index++]));
-}
-
-static void destroy_framebuffers(PGRAPHState *pg)
-{
-    NV2A_VK_DPRINTF("Destroying framebuffer");
-    PGRAPHVkState *r = pg->vk_renderer_state;
-
-    for (int i = 0; i < r->framebuffer_index; i++) {
-        vkDestroyFramebuffer(r->device, r->framebuffers[i], NULL);
-        r->framebuffers[i] = VK_NULL_HANDLE;
-    }
-    r->framebuffer_index = 0;
+    VK_CHECK(vkCreateFramebuffer(
+        r->device, &create_info, NULL,
+        &frame->framebuffers[frame->num_framebuffers++]));
 }
 
 static void create_clear_pipeline(PGRAPHState *pg)
@@ -689,7 +685,7 @@ static void init_pipeline_key(PGRAPHState *pg, PipelineKey *key)
     }
 }
 
-static void create_pipeline(PGRAPHState *pg)
+static bool create_pipeline(PGRAPHState *pg)
 {
     NV2A_VK_DGROUP_BEGIN("Creating pipeline");
 
@@ -697,7 +693,13 @@ static void create_pipeline(PGRAPHState *pg)
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     pgraph_vk_bind_textures(d);
-    pgraph_vk_bind_shaders(pg);
+    if (!pgraph_vk_bind_shaders(pg)) {
+        /* Shaders are still compiling, force a rebind once they are ready */
+        NV2A_VK_DPRINTF("Shaders not ready");
+        r->pipeline_binding = NULL;
+        NV2A_VK_DGROUP_END();
+        return false;
+    }
 
     // FIXME: If nothing was dirty, don't even try creating the key or hashing.
     //        Just use the same pipeline.
@@ -709,7 +711,7 @@ static void create_pipeline(PGRAPHState *pg)
     if (r->pipeline_binding && !pipeline_dirty) {
         NV2A_VK_DPRINTF("Cache hit");
         NV2A_VK_DGROUP_END();
-        return;
+        return true;
     }
 
     PipelineKey key;
@@ -723,7 +725,7 @@ static void create_pipeline(PGRAPHState *pg)
         r->pipeline_binding_changed = r->pipeline_binding != snode;
         r->pipeline_binding = snode;
         NV2A_VK_DGROUP_END();
-        return;
+        return true;
     }
 
     NV2A_VK_DPRINTF("Cache miss");
@@ -1017,6 +1019,7 @@ static void create_pipeline(PGRAPHState *pg)
     r->pipeline_binding_changed = true;
 
     NV2A_VK_DGROUP_END();
+    return true;
 }
 
 static void push_vertex_attr_values(PGRAPHState *pg)
@@ -1050,8 +1053,9 @@ static void bind_descriptor_sets(PGRAPHState *pg)
 
     vkCmdBindDescriptorSets(r->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                             r->pipeline_binding->layout, 0, 1,
-                            &r->descriptor_sets[r->descriptor_set_index - 1], 0,
-                            NULL);
+                            &r->descriptor_sets[r->frame_index]
+                                               [r->descriptor_set_index - 1],
+                            0, NULL);
 }
 
 static void begin_query(PGRAPHVkState *r)
@@ -1097,7 +1101,13 @@ static void sync_staging_buffer(PGRAPHState *pg, VkCommandBuffer cmd,
         return;
     }
 
-    VkBufferCopy copy_region = { .size = b_src->buffer_offset };
+    assert(b_src->region_offset == b_dst->region_offset);
+
+    VkBufferCopy copy_region = {
+        .srcOffset = b_src->region_offset,
+        .dstOffset = b_dst->region_offset,
+        .size = b_src->buffer_offset,
+    };
     vkCmdCopyBuffer(cmd, b_src->buffer, b_dst->buffer, 1, &copy_region);
 
     VkAccessFlags dst_access_mask;
@@ -1128,6 +1138,7 @@ static void sync_staging_buffer(PGRAPHState *pg, VkCommandBuffer cmd,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .buffer = b_dst->buffer,
+        .offset = b_dst->region_offset,
         .size = b_src->buffer_offset
     };
     vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage_mask, 0,
@@ -1173,12 +1184,13 @@ static void begin_render_pass(PGRAPHState *pg)
                  vp_height = pg->surface_binding_dim.height;
     pgraph_apply_scaling_factor(pg, &vp_width, &vp_height);
 
-    assert(r->framebuffer_index > 0);
+    FrameContext *frame = pgraph_vk_get_current_frame(r);
+    assert(frame->num_framebuffers > 0);
 
     VkRenderPassBeginInfo render_pass_begin_info = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .renderPass = r->render_pass,
-        .framebuffer = r->framebuffers[r->framebuffer_index - 1],
+        .framebuffer = frame->framebuffers[frame->num_framebuffers - 1],
         .renderArea.extent.width = vp_width,
         .renderArea.extent.height = vp_height,
         .clearValueCount = 0,
@@ -1210,6 +1222,31 @@ const enum NV2A_PROF_COUNTERS_ENUM finish_reason_to_counter_enum[] = {
     [VK_FINISH_REASON_STALLED] = NV2A_PROF_FINISH_STALLED,
 };
 
+static bool finish_reason_needs_wait(FinishReason finish_reason)
+{
+    switch (finish_reason) {
+    case VK_FINISH_REASON_VERTEX_BUFFER_DIRTY:
+    case VK_FINISH_REASON_NEED_BUFFER_SPACE:
+    case VK_FINISH_REASON_FRAMEBUFFER_DIRTY:
+    case VK_FINISH_REASON_FLIP_STALL:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static void begin_frame_aux_command_buffer(PGRAPHVkState *r)
+{
+    assert(!r->in_aux_command_buffer);
+    r->in_aux_command_buffer = true;
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VK_CHECK(vkBeginCommandBuffer(r->aux_command_buffer, &begin_info));
+}
+
 void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -1228,11 +1265,15 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
         }
         VK_CHECK(vkEndCommandBuffer(r->command_buffer));
 
-        VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg); // FIXME: Cleanup
+        FrameContext *frame = pgraph_vk_get_current_frame(r);
+
+        begin_frame_aux_command_buffer(r);
+        VkCommandBuffer cmd = r->aux_command_buffer;
         sync_staging_buffer(pg, cmd, BUFFER_INDEX_STAGING, BUFFER_INDEX);
         sync_staging_buffer(pg, cmd, BUFFER_VERTEX_INLINE_STAGING,
                                 BUFFER_VERTEX_INLINE);
         sync_staging_buffer(pg, cmd, BUFFER_UNIFORM_STAGING, BUFFER_UNIFORM);
+        r->storage_buffers[BUFFER_TEXTURE_STAGING].buffer_offset = 0;
         bitmap_clear(r->uploaded_bitmap, 0, r->bitmap_size);
         flush_memory_buffer(pg, cmd);
         VK_CHECK(vkEndCommandBuffer(r->aux_command_buffer));
@@ -1243,24 +1284,25 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
             {
                 .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
                 .commandBufferCount = 1,
-                .pCommandBuffers = &r->aux_command_buffer,
+                .pCommandBuffers = &frame->aux_command_buffer,
                 .signalSemaphoreCount = 1,
-                .pSignalSemaphores = &r->command_buffer_semaphore,
+                .pSignalSemaphores = &frame->semaphore,
             },
             {
 
                 .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
                 .commandBufferCount = 1,
-                .pCommandBuffers = &r->command_buffer,
+                .pCommandBuffers = &frame->command_buffer,
                 .waitSemaphoreCount = 1,
-                .pWaitSemaphores = &r->command_buffer_semaphore,
+                .pWaitSemaphores = &frame->semaphore,
                 .pWaitDstStageMask = &wait_stage,
             }
         };
         nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT);
-        vkResetFences(r->device, 1, &r->command_buffer_fence);
+        vkResetFences(r->device, 1, &frame->fence);
         VK_CHECK(vkQueueSubmit(r->queue, ARRAY_SIZE(submit_infos), submit_infos,
-                               r->command_buffer_fence));
+                               frame->fence));
+        frame->submit_index = r->submit_count;
         r->submit_count += 1;
 
         bool check_budget = false;
@@ -1277,12 +1319,19 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
             check_budget = true;
         }
 
-        VK_CHECK(vkWaitForFences(r->device, 1, &r->command_buffer_fence,
-                                 VK_TRUE, UINT64_MAX));
+        /*
+         * Move on to the next frame context. This only blocks if the GPU is
+         * still executing the frame that previously used it. Results are only
+         * waited for when the caller needs to observe them.
+         */
+        pgraph_vk_advance_frame(r);
+        if (finish_reason_needs_wait(finish_reason) ||
+            pgraph_vk_compute_needs_finish(r)) {
+            pgraph_vk_wait_for_frames_in_flight(r);
+        }
 
         r->descriptor_set_index = 0;
         r->in_command_buffer = false;
-        destroy_framebuffers(pg);
 
         if (check_budget) {
             pgraph_vk_check_memory_budget(pg);
@@ -1292,7 +1341,9 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
     NV2AState *d = container_of(pg, NV2AState, pgraph);
     pgraph_vk_process_pending_reports_internal(d);
 
-    pgraph_vk_compute_finish_complete(r);
+    if (!pgraph_vk_frames_in_flight(r)) {
+        pgraph_vk_compute_finish_complete(r);
+    }
 }
 
 void pgraph_vk_begin_command_buffer(PGRAPHState *pg)
@@ -1352,7 +1403,8 @@ void pgraph_vk_end_nondraw_commands(PGRAPHState *pg, VkCommandBuffer cmd)
 // buffer. For other reasons though (like descriptor set amount, surface
 // changes, etc) we do flush often.
 
-static void begin_pre_draw(PGRAPHState *pg)
+// Returns false if the draw must be skipped.
+static bool begin_pre_draw(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
@@ -1362,8 +1414,8 @@ static void begin_pre_draw(PGRAPHState *pg)
 
     if (pg->clearing) {
         create_clear_pipeline(pg);
-    } else {
-        create_pipeline(pg);
+    } else if (!create_pipeline(pg)) {
+        return false;
     }
 
     bool render_pass_dirty = r->pipeline_binding->render_pass != r->render_pass;
@@ -1381,11 +1433,13 @@ static void begin_pre_draw(PGRAPHState *pg)
     if (!pg->clearing) {
         pgraph_vk_update_descriptor_sets(pg);
     }
-    if (r->framebuffer_index == 0) {
+    if (pgraph_vk_get_current_frame(r)->num_framebuffers == 0) {
         create_frame_buffer(pg);
     }
 
     pgraph_vk_ensure_command_buffer(pg);
+
+    return true;
 }
 
 static float clamp_line_width_to_device_limits(PGRAPHState *pg, float width)
@@ -1440,6 +1494,7 @@ static void begin_draw(PGRAPHState *pg)
         vkCmdBindPipeline(r->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                           r->pipeline_binding->pipeline);
         r->pipeline_binding->draw_time = pg->draw_time;
+        r->pipeline_binding->submit_time = r->submit_count;
 
         unsigned int vp_width = pg->surface_binding_dim.width,
                      vp_height = pg->surface_binding_dim.height;
@@ -1626,12 +1681,16 @@ static void sync_vertex_ram_buffer(PGRAPHState *pg)
 
         NV2A_VK_DPRINTF("- %d: %08"HWADDR_PRIx" %zd bytes", i, addr, size);
 
+        // Stale pages were skipped earlier in the draw list and have no
+        // dirty bits left
         if (memory_region_test_and_clear_dirty(d->vram, addr, size,
-                                               DIRTY_MEMORY_NV2A)) {
+                                               DIRTY_MEMORY_NV2A) ||
+            pgraph_vk_is_vertex_ram_buffer_stale(r, addr, size)) {
             NV2A_VK_DPRINTF("Memory dirty. Synchronizing...");
             pgraph_vk_update_vertex_ram_buffer(pg, addr, d->vram_ptr + addr,
                                                size);
         }
+        pgraph_vk_mark_vertex_ram_buffer_used(r, addr, size);
     }
 
     r->num_vertex_ram_buffer_syncs = 0;
@@ -1913,6 +1972,10 @@ static VertexBufferRemap remap_unaligned_attributes(PGRAPHState *pg,
 
     VertexBufferRemap remap = {0};
 
+    if (num_vertices == 0) {
+        return remap;
+    }
+
     VkDeviceAddress output_offset = 0;
 
     for (int attr_id = 0; attr_id < NV2A_VERTEXSHADER_ATTRIBUTES; attr_id++) {
@@ -1933,7 +1996,13 @@ static VertexBufferRemap remap_unaligned_attributes(PGRAPHState *pg,
             (r->vertex_attribute_offsets[attr_id] % element_size == 0);
         bool stride_valid = (desc->stride % element_size == 0);
 
-        if (offset_valid && stride_valid) {
+        // Attributes reading stale RAM buffer pages are copied from VRAM too
+        bool stale = pgraph_vk_is_vertex_ram_buffer_stale(
+            r, r->vertex_attribute_offsets[attr_id],
+            (VkDeviceSize)desc->stride * (num_vertices - 1) +
+                element_size * element_count);
+
+        if (offset_valid && stride_valid && !stale) {
             continue;
         }
 
@@ -1999,8 +2068,9 @@ static void copy_remapped_attributes_to_inline_buffer(PGRAPHState *pg,
             continue;
         }
 
-        VkDeviceSize attr_buffer_offset =
-            buffer->buffer_offset + remap.map[attr_id].offset;
+        VkDeviceSize attr_buffer_offset = buffer->region_offset +
+                                          buffer->buffer_offset +
+                                          remap.map[attr_id].offset;
 
         uint8_t *out_ptr = buffer->mapped + attr_buffer_offset;
         uint8_t *in_ptr = d->vram_ptr + r->vertex_attribute_offsets[attr_id];
@@ -2050,7 +2120,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
         sync_vertex_ram_buffer(pg);
         VertexBufferRemap remap = remap_unaligned_attributes(pg, max_element);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         copy_remapped_attributes_to_inline_buffer(pg, remap, 0, max_element);
         pgraph_vk_begin_debug_marker(r, r->command_buffer, RGBA_BLUE,
                                      "Draw Arrays");
@@ -2090,7 +2163,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
         sync_vertex_ram_buffer(pg);
         VertexBufferRemap remap = remap_unaligned_attributes(pg, max_element + 1);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         copy_remapped_attributes_to_inline_buffer(pg, remap, 0, max_element + 1);
         VkDeviceSize buffer_offset = pgraph_vk_update_index_buffer(
             pg, pg->inline_elements, index_data_size);
@@ -2132,7 +2208,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
         }
         ensure_buffer_space(pg, BUFFER_VERTEX_INLINE_STAGING, offset);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         VkDeviceSize buffer_offset = pgraph_vk_update_vertex_inline_buffer(
             pg, data, sizes, r->num_active_vertex_attribute_descriptions);
         pgraph_vk_begin_debug_marker(r, r->command_buffer, RGBA_BLUE,
@@ -2175,7 +2254,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
         pgraph_vk_bind_vertex_attributes(d, 0, index_count - 1, true,
                                          vertex_size, index_count - 1);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         void *inline_array_data = pg->inline_array;
         VkDeviceSize buffer_offset = pgraph_vk_update_vertex_inline_buffer(
             pg, &inline_array_data, &inline_array_data_size, 1);
@@ -348,7 +348,8 @@ static void init_layout_from_spv(ShaderModuleInfo *info)
     }
 }
 
-static glslang_stage_t vk_shader_stage_to_glslang_stage(VkShaderStageFlagBits stage)
+glslang_stage_t
+pgraph_vk_shader_stage_to_glslang_stage(VkShaderStageFlagBits stage)
 {
     switch (stage) {
     case VK_SHADER_STAGE_GEOMETRY_BIT:
@@ -371,7 +372,19 @@ ShaderModuleInfo *pgraph_vk_create_shader_module_from_glsl(
     info->refcnt = 0;
     info->glsl = strdup(glsl);
     info->spirv = pgraph_vk_compile_glsl_to_spv(
-        vk_shader_stage_to_glslang_stage(stage), glsl);
+        pgraph_vk_shader_stage_to_glslang_stage(stage), glsl);
+    info->module = pgraph_vk_create_shader_module_from_spv(r, info->spirv);
+    init_layout_from_spv(info);
+    return info;
+}
+
+ShaderModuleInfo *pgraph_vk_create_shader_module_from_spirv(PGRAPHVkState *r,
+                                                            GByteArray *spv)
+{
+    ShaderModuleInfo *info = g_malloc0(sizeof(*info));
+    info->refcnt = 0;
+    info->glsl = NULL;
+    info->spirv = spv;
     info->module = pgraph_vk_create_shader_module_from_spv(r, info->spirv);
     init_layout_from_spv(info);
     return info;
@@ -405,6 +418,11 @@ void pgraph_vk_unref_shader_module(PGRAPHVkState *r, ShaderModuleInfo *info)
 void pgraph_vk_destroy_shader_module(PGRAPHVkState *r, ShaderModuleInfo *info)
 {
     assert(info->refcnt == 0);
+    for (int i = 0; i < ARRAY_SIZE(r->uniform_layouts); i++) {
+        if (r->uniform_layouts[i] == &info->uniforms) {
+            r->uniform_layouts[i] = NULL;
+        }
+    }
     if (info->glsl) {
         free(info->glsl);
     }
@@ -70,6 +70,8 @@ static void pgraph_vk_finalize(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
 
+    pgraph_vk_wait_for_frames_in_flight(pg->vk_renderer_state);
+
     pgraph_vk_finalize_display(pg);
     pgraph_vk_finalize_compute(pg);
     pgraph_vk_finalize_reports(pg);
@@ -97,6 +99,7 @@ static void pgraph_vk_flush(NV2AState *d)
     for (int i = 0; i < 4; i++) {
         pg->texture_dirty[i] = true;
     }
+    pgraph_vk_reset_uniform_tracking(pg);
 
     /* FIXME: Flush more? */
 
@@ -120,7 +123,8 @@ static void pgraph_vk_process_pending(NV2AState *d)
     if (qatomic_read(&r->downloads_pending) ||
         qatomic_read(&r->download_dirty_surfaces_pending) ||
         qatomic_read(&d->pgraph.sync_pending) ||
-        qatomic_read(&d->pgraph.flush_pending)
+        qatomic_read(&d->pgraph.flush_pending) ||
+        qatomic_read(&r->shader_cache_writeback_pending)
     ) {
         qemu_mutex_unlock(&d->pfifo.lock);
         qemu_mutex_lock(&d->pgraph.lock);
@@ -136,6 +140,9 @@ static void pgraph_vk_process_pending(NV2AState *d)
         if (qatomic_read(&d->pgraph.flush_pending)) {
             pgraph_vk_flush(d);
         }
+        if (qatomic_read(&r->shader_cache_writeback_pending)) {
+            pgraph_vk_disk_cache_write_back(&d->pgraph);
+        }
         qemu_mutex_unlock(&d->pgraph.lock);
         qemu_mutex_lock(&d->pfifo.lock);
     }
@@ -160,13 +167,13 @@ static void pgraph_vk_pre_savevm_wait(NV2AState *d)
 
 static void pgraph_vk_pre_shutdown_trigger(NV2AState *d)
 {
-    // qatomic_set(&d->pgraph.vk_renderer_state->shader_cache_writeback_pending, true);
-    // qemu_event_reset(&d->pgraph.vk_renderer_state->shader_cache_writeback_complete);
+    qatomic_set(&d->pgraph.vk_renderer_state->shader_cache_writeback_pending, true);
+    qemu_event_reset(&d->pgraph.vk_renderer_state->shader_cache_writeback_complete);
 }
 
 static void pgraph_vk_pre_shutdown_wait(NV2AState *d)
 {
-    // qemu_event_wait(&d->pgraph.vk_renderer_state->shader_cache_writeback_complete);   
+    qemu_event_wait(&d->pgraph.vk_renderer_state->shader_cache_writeback_complete);
 }
 
 static int pgraph_vk_get_framebuffer_surface(NV2AState *d)
@@ -24,6 +24,7 @@
 #include "qemu/thread.h"
 #include "qemu/queue.h"
 #include "qemu/lru.h"
+#include "qemu/interval-tree.h"
 #include "hw/hw.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
 #include "hw/xbox/nv2a/nv2a_regs.h"
@@ -43,6 +44,9 @@
 
 #define HAVE_EXTERNAL_MEMORY 1
 
+// Number of command buffers which may be executing on the GPU at once
+#define NV2A_VK_FRAMES_IN_FLIGHT 2
+
 typedef struct QueueFamilyIndices {
     int queue_family;
 } QueueFamilyIndices;
@@ -77,6 +81,7 @@ typedef struct PipelineBinding {
     VkPipeline pipeline;
     VkRenderPass render_pass;
     unsigned int draw_time;
+    uint32_t submit_time;
     bool has_dynamic_line_width;
 } PipelineBinding;
 
@@ -92,6 +97,7 @@ enum Buffer {
     BUFFER_VERTEX_INLINE_STAGING,
     BUFFER_UNIFORM,
     BUFFER_UNIFORM_STAGING,
+    BUFFER_TEXTURE_STAGING,
     BUFFER_COUNT
 };
 
@@ -102,12 +108,26 @@ typedef struct StorageBuffer {
     VmaAllocation allocation;
     VkMemoryPropertyFlags properties;
     size_t buffer_offset;
-    size_t buffer_size;
+    size_t buffer_size; // Per region
+    int num_regions; // > 1 for buffers partitioned per frame in flight
+    size_t region_offset; // Start of the current frame's region
     uint8_t *mapped;
 } StorageBuffer;
 
+typedef struct FrameContext {
+    VkCommandBuffer command_buffer;
+    VkCommandBuffer aux_command_buffer;
+    VkSemaphore semaphore;
+    VkFence fence;
+    bool in_flight;
+    uint32_t submit_index;
+    VkFramebuffer framebuffers[50];
+    int num_framebuffers;
+} FrameContext;
+
 typedef struct SurfaceBinding {
     QTAILQ_ENTRY(SurfaceBinding) entry;
+    IntervalTreeNode itree; /* Keyed by VRAM range */
     MemAccessCallback *access_cb;
 
     hwaddr vram_addr;
@@ -178,11 +198,23 @@ typedef struct ShaderModuleCacheEntry {
     LruNode node;
     ShaderModuleCacheKey key;
     ShaderModuleInfo *module_info;
+    bool cached; // SPIR-V already present in the disk cache
 } ShaderModuleCacheEntry;
 
+typedef struct ShaderCompileJob {
+    QSIMPLEQ_ENTRY(ShaderCompileJob) entry;
+    ShaderModuleCacheKey keys[3]; // geom, vsh, psh
+    bool need_compile[3];
+    bool prebuild; // Queued at init, may be found in the disk cache instead
+    GByteArray *spirv[3];
+    bool complete;
+    QemuEvent complete_event;
+} ShaderCompileJob;
+
 typedef struct ShaderBinding {
     LruNode node;
     ShaderState state;
+    ShaderCompileJob *compile_job; // Modules are not ready while set
     struct {
         ShaderModuleInfo *module_info;
         VshUniformLocs uniform_locs;
@@ -212,6 +244,8 @@ typedef struct TextureKey {
 typedef struct TextureBinding {
     LruNode node;
     TextureKey key;
+    TexturePageRange texture_pages;
+    TexturePageRange palette_pages;
     VkImage image;
     VkImageLayout current_layout;
     VkImageView image_view;
@@ -277,6 +311,8 @@ typedef struct PGRAPHVkDisplayState {
     struct {
         PvideoState state;
         int width, height;
+        int pitch;
+        uint64_t hash;
         VkImage image;
         VkImageView image_view;
         VmaAllocation allocation;
@@ -337,11 +373,11 @@ typedef struct PGRAPHVkState {
 
     VkQueue queue;
     VkCommandPool command_pool;
-    VkCommandBuffer command_buffers[2];
+    FrameContext frames[NV2A_VK_FRAMES_IN_FLIGHT];
+    int frame_index;
+    uint32_t completed_submit_count;
 
     VkCommandBuffer command_buffer;
-    VkSemaphore command_buffer_semaphore;
-    VkFence command_buffer_fence;
     unsigned int command_buffer_start_time;
     bool in_command_buffer;
     uint32_t submit_count;
@@ -349,8 +385,6 @@ typedef struct PGRAPHVkState {
     VkCommandBuffer aux_command_buffer;
     bool in_aux_command_buffer;
 
-    VkFramebuffer framebuffers[50];
-    int framebuffer_index;
     bool framebuffer_dirty;
 
     VkRenderPass render_pass;
@@ -366,14 +400,16 @@ typedef struct PGRAPHVkState {
 
     VkDescriptorPool descriptor_pool;
     VkDescriptorSetLayout descriptor_set_layout;
-    VkDescriptorSet descriptor_sets[1024];
+    VkDescriptorSet descriptor_sets[NV2A_VK_FRAMES_IN_FLIGHT][1024];
     int descriptor_set_index;
 
     StorageBuffer storage_buffers[BUFFER_COUNT];
 
     MemorySyncRequirement vertex_ram_buffer_syncs[NV2A_VERTEXSHADER_ATTRIBUTES];
     size_t num_vertex_ram_buffer_syncs;
-    unsigned long *uploaded_bitmap;
+    unsigned long *uploaded_bitmap; // Read by this draw list
+    unsigned long *stale_bitmap; // Changed after upload in this draw list
+    uint32_t *page_submit_times; // Last submission reading each page
     size_t bitmap_size;
 
     VkVertexInputAttributeDescription vertex_attribute_descriptions[NV2A_VERTEXSHADER_ATTRIBUTES];
@@ -385,6 +421,7 @@ typedef struct PGRAPHVkState {
     hwaddr vertex_attribute_offsets[NV2A_VERTEXSHADER_ATTRIBUTES];
 
     QTAILQ_HEAD(, SurfaceBinding) surfaces;
+    IntervalTreeRoot surface_tree;
     QTAILQ_HEAD(, SurfaceBinding) invalid_surfaces;
     SurfaceBinding *color_binding, *zeta_binding;
     bool downloads_pending;
@@ -394,25 +431,49 @@ typedef struct PGRAPHVkState {
 
     Lru texture_cache;
     TextureBinding *texture_cache_entries;
+    TexturePageHashes texture_page_hashes;
     TextureBinding *texture_bindings[NV2A_MAX_TEXTURES];
+    TextureBinding *palette_bindings[NV2A_MAX_TEXTURES];
     TextureBinding dummy_texture;
     bool texture_bindings_changed;
     VkFormatProperties *texture_format_properties;
+    bool texture_bc_supported[3][3]; // S3TC format, TextureBcImageKind
 
     Lru shader_cache;
     ShaderBinding *shader_cache_entries;
+    ShaderStateTracker shader_state;
     ShaderBinding *shader_binding;
+    ShaderBinding *pending_shader_binding; // Waiting on its compile job
+    ShaderBinding *ubershader_binding; // Drawing for pending_shader_binding
+    ShaderCompileJob *ubershader_jobs[PSH_UBERSHADER_NUM_VARIANTS];
+    ShaderModuleInfo *ubershader_modules[PSH_UBERSHADER_NUM_VARIANTS];
     ShaderModuleInfo *quad_vert_module, *solid_frag_module;
     bool shader_bindings_changed;
     bool use_push_constants_for_uniform_attrs;
 
     Lru shader_module_cache;
     ShaderModuleCacheEntry *shader_module_cache_entries;
+    GByteArray *shader_module_precompiled_spirv;
+
+    QemuThread *shader_compile_threads;
+    int num_shader_compile_threads;
+    QemuMutex shader_compile_lock;
+    QemuCond shader_compile_cond;
+    QSIMPLEQ_HEAD(, ShaderCompileJob) shader_compile_queue;
+    QSIMPLEQ_HEAD(, ShaderCompileJob) shader_prebuild_queue; // When idle
+    bool shader_compile_shutdown;
+    bool shader_disk_loaded; // Prebuild jobs can check the disk cache
+
+    QemuThread shader_disk_thread;
+    QemuMutex shader_disk_lock;
+    GHashTable *shader_disk_modules; // ShaderModuleDiskEntry, by hash
+    bool shader_cache_writeback_pending;
+    QemuEvent shader_cache_writeback_complete;
 
     // FIXME: Merge these into a structure
-    uint64_t uniform_buffer_hashes[2];
+    ShaderUniformLayout *uniform_layouts[2]; // Contents last written, by stage
     size_t uniform_buffer_offsets[2];
-    bool uniforms_changed;
+    bool uniforms_changed[2];
 
     VkQueryPool query_pool;
     int max_queries_in_flight; // FIXME: Move out to constant
@@ -458,12 +519,16 @@ uint32_t pgraph_vk_get_memory_type(PGRAPHState *pg, uint32_t type_bits,
 // glsl.c
 void pgraph_vk_init_glsl_compiler(void);
 void pgraph_vk_finalize_glsl_compiler(void);
+glslang_stage_t
+pgraph_vk_shader_stage_to_glslang_stage(VkShaderStageFlagBits stage);
 GByteArray *pgraph_vk_compile_glsl_to_spv(glslang_stage_t stage,
                                           const char *glsl_source);
 VkShaderModule pgraph_vk_create_shader_module_from_spv(PGRAPHVkState *r,
                                                        GByteArray *spv);
 ShaderModuleInfo *pgraph_vk_create_shader_module_from_glsl(
     PGRAPHVkState *r, VkShaderStageFlagBits stage, const char *glsl);
+ShaderModuleInfo *pgraph_vk_create_shader_module_from_spirv(PGRAPHVkState *r,
+                                                            GByteArray *spv);
 void pgraph_vk_ref_shader_module(ShaderModuleInfo *info);
 void pgraph_vk_unref_shader_module(PGRAPHVkState *r, ShaderModuleInfo *info);
 void pgraph_vk_destroy_shader_module(PGRAPHVkState *r, ShaderModuleInfo *info);
@@ -483,6 +548,11 @@ void pgraph_vk_init_command_buffers(PGRAPHState *pg);
 void pgraph_vk_finalize_command_buffers(PGRAPHState *pg);
 VkCommandBuffer pgraph_vk_begin_single_time_commands(PGRAPHState *pg);
 void pgraph_vk_end_single_time_commands(PGRAPHState *pg, VkCommandBuffer cmd);
+FrameContext *pgraph_vk_get_current_frame(PGRAPHVkState *r);
+void pgraph_vk_advance_frame(PGRAPHVkState *r);
+bool pgraph_vk_frames_in_flight(PGRAPHVkState *r);
+void pgraph_vk_wait_for_frames_in_flight(PGRAPHVkState *r);
+void pgraph_vk_wait_for_submit(PGRAPHVkState *r, uint32_t submit_index);
 
 // image.c
 void pgraph_vk_transition_image_layout(PGRAPHState *pg, VkCommandBuffer cmd,
@@ -499,6 +569,10 @@ void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
 void pgraph_vk_bind_vertex_attributes_inline(NV2AState *d);
 void pgraph_vk_update_vertex_ram_buffer(PGRAPHState *pg, hwaddr offset, void *data,
                                     VkDeviceSize size);
+bool pgraph_vk_is_vertex_ram_buffer_stale(PGRAPHVkState *r, hwaddr offset,
+                                          VkDeviceSize size);
+void pgraph_vk_mark_vertex_ram_buffer_used(PGRAPHVkState *r, hwaddr offset,
+                                          VkDeviceSize size);
 VkDeviceSize pgraph_vk_update_index_buffer(PGRAPHState *pg, void *data,
                                            VkDeviceSize size);
 VkDeviceSize pgraph_vk_update_vertex_inline_buffer(PGRAPHState *pg, void **data,
@@ -554,7 +628,18 @@ void pgraph_vk_trim_texture_cache(PGRAPHState *pg);
 void pgraph_vk_init_shaders(PGRAPHState *pg);
 void pgraph_vk_finalize_shaders(PGRAPHState *pg);
 void pgraph_vk_update_descriptor_sets(PGRAPHState *pg);
-void pgraph_vk_bind_shaders(PGRAPHState *pg);
+bool pgraph_vk_bind_shaders(PGRAPHState *pg);
+void pgraph_vk_reset_uniform_tracking(PGRAPHState *pg);
+void pgraph_vk_set_shader_disk_cache_loaded(PGRAPHVkState *r);
+
+// disk-cache.c
+void pgraph_vk_init_disk_cache(PGRAPHState *pg);
+void pgraph_vk_finalize_disk_cache(PGRAPHState *pg);
+bool pgraph_vk_disk_cache_contains_spirv(PGRAPHVkState *r, uint64_t hash);
+GByteArray *pgraph_vk_disk_cache_take_spirv(PGRAPHVkState *r, uint64_t hash,
+                                            const ShaderModuleCacheKey *key);
+void *pgraph_vk_disk_cache_load_pipeline_data(PGRAPHVkState *r, size_t *size);
+void pgraph_vk_disk_cache_write_back(PGRAPHState *pg);
 
 // reports.c
 void pgraph_vk_init_reports(PGRAPHState *pg);
@@ -20,11 +20,13 @@
 #include "qemu/osdep.h"
 #include "qemu/fast-hash.h"
 #include "qemu/mstring.h"
+#include "ui/xemu-settings.h"
 #include "renderer.h"
 
 #define VSH_UBO_BINDING 0
 #define PSH_UBO_BINDING 1
 #define PSH_TEX_BINDING 2
+#define PSH_PALETTE_BINDING (PSH_TEX_BINDING + NV2A_MAX_TEXTURES)
 
 const size_t MAX_UNIFORM_ATTR_VALUES_SIZE = NV2A_VERTEXSHADER_ATTRIBUTES * 4 * sizeof(float);
 
@@ -32,7 +34,8 @@ static void create_descriptor_pool(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    size_t num_sets = ARRAY_SIZE(r->descriptor_sets);
+    size_t num_sets =
+        NV2A_VK_FRAMES_IN_FLIGHT * ARRAY_SIZE(r->descriptor_sets[0]);
 
     VkDescriptorPoolSize pool_sizes[] = {
         {
@@ -41,7 +44,7 @@ static void create_descriptor_pool(PGRAPHState *pg)
         },
         {
             .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = NV2A_MAX_TEXTURES * num_sets,
+            .descriptorCount = 2 * NV2A_MAX_TEXTURES * num_sets,
         }
     };
 
@@ -49,7 +52,7 @@ static void create_descriptor_pool(PGRAPHState *pg)
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
         .poolSizeCount = ARRAY_SIZE(pool_sizes),
         .pPoolSizes = pool_sizes,
-        .maxSets = ARRAY_SIZE(r->descriptor_sets),
+        .maxSets = num_sets,
         .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
     };
     VK_CHECK(vkCreateDescriptorPool(r->device, &pool_info, NULL,
@@ -68,7 +71,7 @@ static void create_descriptor_set_layout(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    VkDescriptorSetLayoutBinding bindings[2 + NV2A_MAX_TEXTURES];
+    VkDescriptorSetLayoutBinding bindings[2 + 2 * NV2A_MAX_TEXTURES];
 
     bindings[0] = (VkDescriptorSetLayoutBinding){
         .binding = VSH_UBO_BINDING,
@@ -89,6 +92,12 @@ static void create_descriptor_set_layout(PGRAPHState *pg)
             .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
             .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
         };
+        bindings[2 + NV2A_MAX_TEXTURES + i] = (VkDescriptorSetLayoutBinding){
+            .binding = PSH_PALETTE_BINDING + i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        };
     }
     VkDescriptorSetLayoutCreateInfo layout_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
@@ -111,29 +120,35 @@ static void create_descriptor_sets(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    VkDescriptorSetLayout layouts[ARRAY_SIZE(r->descriptor_sets)];
+    VkDescriptorSetLayout layouts[ARRAY_SIZE(r->descriptor_sets[0])];
     for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
         layouts[i] = r->descriptor_set_layout;
     }
 
-    VkDescriptorSetAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = r->descriptor_pool,
-        .descriptorSetCount = ARRAY_SIZE(r->descriptor_sets),
-        .pSetLayouts = layouts,
-    };
-    VK_CHECK(
-        vkAllocateDescriptorSets(r->device, &alloc_info, r->descriptor_sets));
+    // Each frame in flight writes its own sets
+    for (int i = 0; i < NV2A_VK_FRAMES_IN_FLIGHT; i++) {
+        VkDescriptorSetAllocateInfo alloc_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = r->descriptor_pool,
+            .descriptorSetCount = ARRAY_SIZE(r->descriptor_sets[i]),
+            .pSetLayouts = layouts,
+        };
+        VK_CHECK(vkAllocateDescriptorSets(r->device, &alloc_info,
+                                          r->descriptor_sets[i]));
+    }
 }
 
 static void destroy_descriptor_sets(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    vkFreeDescriptorSets(r->device, r->descriptor_pool,
-                         ARRAY_SIZE(r->descriptor_sets), r->descriptor_sets);
-    for (int i = 0; i < ARRAY_SIZE(r->descriptor_sets); i++) {
-        r->descriptor_sets[i] = VK_NULL_HANDLE;
+    for (int i = 0; i < NV2A_VK_FRAMES_IN_FLIGHT; i++) {
+        vkFreeDescriptorSets(r->device, r->descriptor_pool,
+                             ARRAY_SIZE(r->descriptor_sets[i]),
+                             r->descriptor_sets[i]);
+        for (int j = 0; j < ARRAY_SIZE(r->descriptor_sets[i]); j++) {
+            r->descriptor_sets[i][j] = VK_NULL_HANDLE;
+        }
     }
 }
 
@@ -141,9 +156,11 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    bool need_uniform_write =
-        r->uniforms_changed ||
+    /* Stages whose uniforms did not change keep pointing at their last copy */
+    bool write_all_uniforms =
         !r->storage_buffers[BUFFER_UNIFORM_STAGING].buffer_offset;
+    bool need_uniform_write = r->uniforms_changed[0] ||
+                              r->uniforms_changed[1] || write_all_uniforms;
 
     if (!(r->shader_bindings_changed || r->texture_bindings_changed ||
           (r->descriptor_set_index == 0) || need_uniform_write)) {
@@ -155,36 +172,44 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
                                        &binding->psh.module_info->uniforms };
     VkDeviceSize ubo_buffer_total_size = 0;
     for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
-        ubo_buffer_total_size += layouts[i]->total_size;
+        if (write_all_uniforms || r->uniforms_changed[i]) {
+            ubo_buffer_total_size += layouts[i]->total_size;
+        }
     }
     bool need_ubo_staging_buffer_reset =
-        r->uniforms_changed &&
+        need_uniform_write &&
         !pgraph_vk_buffer_has_space_for(pg, BUFFER_UNIFORM_STAGING,
                                         ubo_buffer_total_size,
                                         r->device_props.limits.minUniformBufferOffsetAlignment);
 
     bool need_descriptor_write_reset =
-        (r->descriptor_set_index >= ARRAY_SIZE(r->descriptor_sets));
+        (r->descriptor_set_index >= ARRAY_SIZE(r->descriptor_sets[0]));
 
     if (need_descriptor_write_reset || need_ubo_staging_buffer_reset) {
         pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
         need_uniform_write = true;
+        write_all_uniforms = true;
     }
 
-    VkWriteDescriptorSet descriptor_writes[2 + NV2A_MAX_TEXTURES];
+    VkWriteDescriptorSet descriptor_writes[2 + 2 * NV2A_MAX_TEXTURES];
+
+    assert(r->descriptor_set_index < ARRAY_SIZE(r->descriptor_sets[0]));
 
-    assert(r->descriptor_set_index < ARRAY_SIZE(r->descriptor_sets));
+    VkDescriptorSet descriptor_set =
+        r->descriptor_sets[r->frame_index][r->descriptor_set_index];
 
     if (need_uniform_write) {
         for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
+            if (!write_all_uniforms && !r->uniforms_changed[i]) {
+                continue;
+            }
             void *data = layouts[i]->allocation;
             VkDeviceSize size = layouts[i]->total_size;
             r->uniform_buffer_offsets[i] = pgraph_vk_append_to_buffer(
                 pg, BUFFER_UNIFORM_STAGING, &data, &size, 1,
                 r->device_props.limits.minUniformBufferOffsetAlignment);
+            r->uniforms_changed[i] = false;
         }
-
-        r->uniforms_changed = false;
     }
 
     VkDescriptorBufferInfo ubo_buffer_infos[2];
@@ -196,7 +221,7 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
         };
         descriptor_writes[i] = (VkWriteDescriptorSet){
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = r->descriptor_sets[r->descriptor_set_index],
+            .dstSet = descriptor_set,
             .dstBinding = i == 0 ? VSH_UBO_BINDING : PSH_UBO_BINDING,
             .dstArrayElement = 0,
             .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
@@ -205,17 +230,23 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
         };
     }
 
-    VkDescriptorImageInfo image_infos[NV2A_MAX_TEXTURES];
-    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+    VkDescriptorImageInfo image_infos[2 * NV2A_MAX_TEXTURES];
+    for (int i = 0; i < 2 * NV2A_MAX_TEXTURES; i++) {
+        bool is_palette = i >= NV2A_MAX_TEXTURES;
+        TextureBinding *binding =
+            is_palette ? r->palette_bindings[i - NV2A_MAX_TEXTURES] :
+                         r->texture_bindings[i];
         image_infos[i] = (VkDescriptorImageInfo){
             .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            .imageView = r->texture_bindings[i]->image_view,
-            .sampler = r->texture_bindings[i]->sampler,
+            .imageView = binding->image_view,
+            .sampler = binding->sampler,
         };
         descriptor_writes[2 + i] = (VkWriteDescriptorSet){
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = r->descriptor_sets[r->descriptor_set_index],
-            .dstBinding = PSH_TEX_BINDING + i,
+            .dstSet = descriptor_set,
+            .dstBinding = is_palette ?
+                              PSH_PALETTE_BINDING + i - NV2A_MAX_TEXTURES :
+                              PSH_TEX_BINDING + i,
             .dstArrayElement = 0,
             .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
             .descriptorCount = 1,
@@ -223,7 +254,8 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
         };
     }
 
-    vkUpdateDescriptorSets(r->device, 6, descriptor_writes, 0, NULL);
+    vkUpdateDescriptorSets(r->device, ARRAY_SIZE(descriptor_writes),
+                           descriptor_writes, 0, NULL);
 
     r->descriptor_set_index++;
 }
@@ -241,18 +273,285 @@ static void update_shader_uniform_locs(ShaderBinding *binding)
     }
 }
 
+static MString *generate_module_glsl(const ShaderModuleCacheKey *key)
+{
+    switch (key->kind) {
+    case VK_SHADER_STAGE_VERTEX_BIT:
+        return pgraph_glsl_gen_vsh(&key->vsh.state, key->vsh.glsl_opts);
+    case VK_SHADER_STAGE_GEOMETRY_BIT:
+        return pgraph_glsl_gen_geom(&key->geom.state, key->geom.glsl_opts);
+    case VK_SHADER_STAGE_FRAGMENT_BIT:
+        return pgraph_glsl_gen_psh(&key->psh.state, key->psh.glsl_opts);
+    default:
+        assert(!"Invalid shader module kind");
+        return NULL;
+    }
+}
+
+static uint64_t get_shader_module_key_hash(const ShaderModuleCacheKey *key)
+{
+    return fast_hash((void *)key, sizeof(ShaderModuleCacheKey));
+}
+
 static ShaderModuleInfo *
 get_and_ref_shader_module_for_key(PGRAPHVkState *r,
-                                  const ShaderModuleCacheKey *key)
+                                  const ShaderModuleCacheKey *key,
+                                  GByteArray *spirv)
 {
-    uint64_t hash = fast_hash((void *)key, sizeof(ShaderModuleCacheKey));
+    uint64_t hash = get_shader_module_key_hash(key);
+
+    /* Handed to shader_module_cache_entry_init on a miss */
+    r->shader_module_precompiled_spirv = spirv;
     LruNode *node = lru_lookup(&r->shader_module_cache, hash, key);
+    if (r->shader_module_precompiled_spirv) {
+        g_byte_array_unref(r->shader_module_precompiled_spirv);
+        r->shader_module_precompiled_spirv = NULL;
+    }
+
     ShaderModuleCacheEntry *module =
         container_of(node, ShaderModuleCacheEntry, node);
     pgraph_vk_ref_shader_module(module->module_info);
     return module->module_info;
 }
 
+static void init_psh_module_key(const PshState *state, ShaderModuleCacheKey *key)
+{
+    key->kind = VK_SHADER_STAGE_FRAGMENT_BIT;
+    key->psh.state = *state;
+    key->psh.glsl_opts.vulkan = true;
+    key->psh.glsl_opts.ubo_binding = PSH_UBO_BINDING;
+    key->psh.glsl_opts.tex_binding = PSH_TEX_BINDING;
+    key->psh.glsl_opts.palette_binding = PSH_PALETTE_BINDING;
+}
+
+/* Module keys are ordered geometry, vertex, pixel. Unused stages have kind 0. */
+static void init_shader_module_keys(PGRAPHVkState *r, const ShaderState *state,
+                                    ShaderModuleCacheKey keys[3])
+{
+    memset(keys, 0, 3 * sizeof(keys[0]));
+
+    bool need_geometry_shader = pgraph_glsl_need_geom(&state->geom);
+    if (need_geometry_shader) {
+        keys[0].kind = VK_SHADER_STAGE_GEOMETRY_BIT;
+        keys[0].geom.state = state->geom;
+        keys[0].geom.glsl_opts.vulkan = true;
+    }
+
+    keys[1].kind = VK_SHADER_STAGE_VERTEX_BIT;
+    keys[1].vsh.state = state->vsh;
+    keys[1].vsh.glsl_opts.vulkan = true;
+    keys[1].vsh.glsl_opts.prefix_outputs = need_geometry_shader;
+    keys[1].vsh.glsl_opts.use_push_constants_for_uniform_attrs =
+        r->use_push_constants_for_uniform_attrs;
+    keys[1].vsh.glsl_opts.ubo_binding = VSH_UBO_BINDING;
+
+    /* Ubershader pixel modules are prebuilt, see queue_ubershader_job */
+    if (!state->psh.uber_combiners) {
+        init_psh_module_key(&state->psh, &keys[2]);
+    }
+}
+
+static void bind_shader_modules(PGRAPHVkState *r, ShaderBinding *binding,
+                                const ShaderModuleCacheKey keys[3],
+                                GByteArray *spirv[3])
+{
+    ShaderModuleInfo **modules[3] = {
+        &binding->geom.module_info,
+        &binding->vsh.module_info,
+        &binding->psh.module_info,
+    };
+
+    for (int i = 0; i < 3; i++) {
+        *modules[i] = keys[i].kind ?
+                          get_and_ref_shader_module_for_key(
+                              r, &keys[i], spirv ? spirv[i] : NULL) :
+                          NULL;
+    }
+
+    if (binding->state.psh.uber_combiners) {
+        unsigned int variant =
+            pgraph_glsl_get_psh_ubershader_variant(&binding->state.psh);
+        assert(r->ubershader_modules[variant]);
+        binding->psh.module_info = r->ubershader_modules[variant];
+        pgraph_vk_ref_shader_module(binding->psh.module_info);
+    }
+
+    update_shader_uniform_locs(binding);
+}
+
+/*
+ * Jobs for draws come first. Prebuild jobs wait for the disk cache to load, so
+ * that modules compiled in an earlier session are not compiled again.
+ */
+static ShaderCompileJob *take_shader_compile_job(PGRAPHVkState *r)
+{
+    ShaderCompileJob *job = QSIMPLEQ_FIRST(&r->shader_compile_queue);
+    if (job) {
+        QSIMPLEQ_REMOVE_HEAD(&r->shader_compile_queue, entry);
+        return job;
+    }
+
+    job = QSIMPLEQ_FIRST(&r->shader_prebuild_queue);
+    if (job && r->shader_disk_loaded) {
+        QSIMPLEQ_REMOVE_HEAD(&r->shader_prebuild_queue, entry);
+        return job;
+    }
+
+    return NULL;
+}
+
+static void *shader_compile_worker(void *arg)
+{
+    PGRAPHVkState *r = arg;
+
+    qemu_mutex_lock(&r->shader_compile_lock);
+    while (true) {
+        ShaderCompileJob *job;
+        while (!(job = take_shader_compile_job(r)) &&
+               !r->shader_compile_shutdown) {
+            qemu_cond_wait(&r->shader_compile_cond, &r->shader_compile_lock);
+        }
+        if (!job) {
+            break;
+        }
+        qemu_mutex_unlock(&r->shader_compile_lock);
+
+        for (int i = 0; i < 3; i++) {
+            if (!job->keys[i].kind || !job->need_compile[i]) {
+                continue;
+            }
+            if (job->prebuild &&
+                pgraph_vk_disk_cache_contains_spirv(
+                    r, get_shader_module_key_hash(&job->keys[i]))) {
+                continue;
+            }
+            MString *code = generate_module_glsl(&job->keys[i]);
+            job->spirv[i] = pgraph_vk_compile_glsl_to_spv(
+                pgraph_vk_shader_stage_to_glslang_stage(job->keys[i].kind),
+                mstring_get_str(code));
+            mstring_unref(code);
+        }
+
+        qatomic_store_release(&job->complete, true);
+        qemu_event_set(&job->complete_event);
+
+        qemu_mutex_lock(&r->shader_compile_lock);
+    }
+    qemu_mutex_unlock(&r->shader_compile_lock);
+
+    return NULL;
+}
+
+static bool is_shader_module_available(PGRAPHVkState *r,
+                                       const ShaderModuleCacheKey *key)
+{
+    uint64_t hash = get_shader_module_key_hash(key);
+    return lru_contains_hash(&r->shader_module_cache, hash) ||
+           pgraph_vk_disk_cache_contains_spirv(r, hash);
+}
+
+/*
+ * Queue compilation of the modules that are not already available. Returns
+ * NULL if every module can be obtained without invoking the compiler.
+ */
+static ShaderCompileJob *queue_shader_compile_job(PGRAPHVkState *r,
+                                                  const ShaderModuleCacheKey keys[3])
+{
+    bool need_compile[3];
+    bool any_compile = false;
+
+    for (int i = 0; i < 3; i++) {
+        need_compile[i] =
+            keys[i].kind && !is_shader_module_available(r, &keys[i]);
+        any_compile |= need_compile[i];
+    }
+
+    if (!any_compile) {
+        return NULL;
+    }
+
+    ShaderCompileJob *job = g_malloc0(sizeof(ShaderCompileJob));
+    memcpy(job->keys, keys, sizeof(job->keys));
+    memcpy(job->need_compile, need_compile, sizeof(job->need_compile));
+    qemu_event_init(&job->complete_event, false);
+
+    qemu_mutex_lock(&r->shader_compile_lock);
+    QSIMPLEQ_INSERT_TAIL(&r->shader_compile_queue, job, entry);
+    qemu_cond_signal(&r->shader_compile_cond);
+    qemu_mutex_unlock(&r->shader_compile_lock);
+
+    return job;
+}
+
+/*
+ * Queue the pixel module of an ubershader variant behind the jobs for draws.
+ * It is installed by get_ubershader_binding once complete.
+ */
+static void queue_ubershader_job(PGRAPHVkState *r, unsigned int variant)
+{
+    assert(!r->ubershader_jobs[variant] && !r->ubershader_modules[variant]);
+
+    ShaderCompileJob *job = g_malloc0(sizeof(ShaderCompileJob));
+    PshState state;
+    pgraph_glsl_init_psh_ubershader_state(&state, variant);
+    init_psh_module_key(&state, &job->keys[2]);
+    job->need_compile[2] = true;
+    job->prebuild = true;
+    qemu_event_init(&job->complete_event, false);
+    r->ubershader_jobs[variant] = job;
+
+    qemu_mutex_lock(&r->shader_compile_lock);
+    QSIMPLEQ_INSERT_TAIL(&r->shader_prebuild_queue, job, entry);
+    qemu_cond_signal(&r->shader_compile_cond);
+    qemu_mutex_unlock(&r->shader_compile_lock);
+}
+
+void pgraph_vk_set_shader_disk_cache_loaded(PGRAPHVkState *r)
+{
+    qemu_mutex_lock(&r->shader_compile_lock);
+    r->shader_disk_loaded = true;
+    qemu_cond_broadcast(&r->shader_compile_cond);
+    qemu_mutex_unlock(&r->shader_compile_lock);
+}
+
+static void free_shader_compile_job(ShaderCompileJob *job)
+{
+    for (int i = 0; i < 3; i++) {
+        if (job->spirv[i]) {
+            g_byte_array_unref(job->spirv[i]);
+        }
+    }
+    qemu_event_destroy(&job->complete_event);
+    g_free(job);
+}
+
+/*
+ * Attach the modules produced by a pending compile job to the binding.
+ * Returns false if the job has not completed and `wait` is not set.
+ */
+static bool complete_shader_compile_job(PGRAPHVkState *r,
+                                        ShaderBinding *binding, bool wait)
+{
+    ShaderCompileJob *job = binding->compile_job;
+    assert(job);
+
+    if (!qatomic_load_acquire(&job->complete)) {
+        if (!wait) {
+            return false;
+        }
+        qemu_event_wait(&job->complete_event);
+    }
+
+    bind_shader_modules(r, binding, job->keys, job->spirv);
+
+    /* Ownership of the SPIR-V was transferred to the module cache */
+    memset(job->spirv, 0, sizeof(job->spirv));
+    free_shader_compile_job(job);
+    binding->compile_job = NULL;
+
+    return true;
+}
+
 static void shader_cache_entry_init(Lru *lru, LruNode *node, const void *state)
 {
     PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_cache);
@@ -262,38 +561,18 @@ static void shader_cache_entry_init(Lru *lru, LruNode *node, const void *state)
     NV2A_VK_DPRINTF("cache miss");
     nv2a_profile_inc_counter(NV2A_PROF_SHADER_GEN);
 
-    ShaderModuleCacheKey key;
+    ShaderModuleCacheKey keys[3];
+    init_shader_module_keys(r, &binding->state, keys);
 
-    bool need_geometry_shader = pgraph_glsl_need_geom(&binding->state.geom);
-    if (need_geometry_shader) {
-        memset(&key, 0, sizeof(key));
-        key.kind = VK_SHADER_STAGE_GEOMETRY_BIT;
-        key.geom.state = binding->state.geom;
-        key.geom.glsl_opts.vulkan = true;
-        binding->geom.module_info = get_and_ref_shader_module_for_key(r, &key);
-    } else {
+    binding->compile_job = queue_shader_compile_job(r, keys);
+    if (binding->compile_job) {
         binding->geom.module_info = NULL;
+        binding->vsh.module_info = NULL;
+        binding->psh.module_info = NULL;
+        return;
     }
 
-    memset(&key, 0, sizeof(key));
-    key.kind = VK_SHADER_STAGE_VERTEX_BIT;
-    key.vsh.state = binding->state.vsh;
-    key.vsh.glsl_opts.vulkan = true;
-    key.vsh.glsl_opts.prefix_outputs = need_geometry_shader;
-    key.vsh.glsl_opts.use_push_constants_for_uniform_attrs =
-        r->use_push_constants_for_uniform_attrs;
-    key.vsh.glsl_opts.ubo_binding = VSH_UBO_BINDING;
-    binding->vsh.module_info = get_and_ref_shader_module_for_key(r, &key);
-
-    memset(&key, 0, sizeof(key));
-    key.kind = VK_SHADER_STAGE_FRAGMENT_BIT;
-    key.psh.state = binding->state.psh;
-    key.psh.glsl_opts.vulkan = true;
-    key.psh.glsl_opts.ubo_binding = PSH_UBO_BINDING;
-    key.psh.glsl_opts.tex_binding = PSH_TEX_BINDING;
-    binding->psh.module_info = get_and_ref_shader_module_for_key(r, &key);
-
-    update_shader_uniform_locs(binding);
+    bind_shader_modules(r, binding, keys, NULL);
 }
 
 static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
@@ -301,6 +580,13 @@ static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
     PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_cache);
     ShaderBinding *snode = container_of(node, ShaderBinding, node);
 
+    if (snode->compile_job) {
+        qemu_event_wait(&snode->compile_job->complete_event);
+        free_shader_compile_job(snode->compile_job);
+        snode->compile_job = NULL;
+        return;
+    }
+
     ShaderModuleInfo *modules[] = {
         snode->vsh.module_info,
         snode->geom.module_info,
@@ -313,6 +599,17 @@ static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
     }
 }
 
+static bool shader_cache_entry_pre_evict(Lru *lru, LruNode *node)
+{
+    PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_cache);
+    ShaderBinding *snode = container_of(node, ShaderBinding, node);
+
+    /* In use for drawing, or about to be */
+    return snode != r->shader_binding &&
+           snode != r->pending_shader_binding &&
+           snode != r->ubershader_binding;
+}
+
 static bool shader_cache_entry_compare(Lru *lru, LruNode *node, const void *key)
 {
     ShaderBinding *snode = container_of(node, ShaderBinding, node);
@@ -327,26 +624,26 @@ static void shader_module_cache_entry_init(Lru *lru, LruNode *node,
         container_of(node, ShaderModuleCacheEntry, node);
     memcpy(&module->key, key, sizeof(ShaderModuleCacheKey));
 
-    MString *code;
+    GByteArray *spirv = r->shader_module_precompiled_spirv;
+    r->shader_module_precompiled_spirv = NULL;
+    if (spirv) {
+        module->module_info = pgraph_vk_create_shader_module_from_spirv(r, spirv);
+        pgraph_vk_ref_shader_module(module->module_info);
+        module->cached = false;
+        return;
+    }
 
-    switch (module->key.kind) {
-    case VK_SHADER_STAGE_VERTEX_BIT:
-        code = pgraph_glsl_gen_vsh(&module->key.vsh.state,
-                                   module->key.vsh.glsl_opts);
-        break;
-    case VK_SHADER_STAGE_GEOMETRY_BIT:
-        code = pgraph_glsl_gen_geom(&module->key.geom.state,
-                                    module->key.geom.glsl_opts);
-        break;
-    case VK_SHADER_STAGE_FRAGMENT_BIT:
-        code = pgraph_glsl_gen_psh(&module->key.psh.state,
-                                   module->key.psh.glsl_opts);
-        break;
-    default:
-        assert(!"Invalid shader module kind");
-        code = NULL;
+    spirv = pgraph_vk_disk_cache_take_spirv(r, node->hash, key);
+    if (spirv) {
+        module->module_info = pgraph_vk_create_shader_module_from_spirv(r, spirv);
+        pgraph_vk_ref_shader_module(module->module_info);
+        module->cached = true;
+        return;
     }
 
+    module->cached = false;
+
+    MString *code = generate_module_glsl(&module->key);
     module->module_info = pgraph_vk_create_shader_module_from_glsl(
         r, module->key.kind, mstring_get_str(code));
     pgraph_vk_ref_shader_module(module->module_info);
@@ -370,6 +667,46 @@ static bool shader_module_cache_entry_compare(Lru *lru, LruNode *node,
     return memcmp(&module->key, key, sizeof(ShaderModuleCacheKey));
 }
 
+static void shader_compile_pool_init(PGRAPHVkState *r)
+{
+    qemu_mutex_init(&r->shader_compile_lock);
+    qemu_cond_init(&r->shader_compile_cond);
+    QSIMPLEQ_INIT(&r->shader_compile_queue);
+    QSIMPLEQ_INIT(&r->shader_prebuild_queue);
+    r->shader_compile_shutdown = false;
+    r->shader_disk_loaded = false;
+
+    r->num_shader_compile_threads =
+        MAX(1, MIN(4, (int)g_get_num_processors() / 2));
+    r->shader_compile_threads =
+        g_malloc_n(r->num_shader_compile_threads, sizeof(QemuThread));
+    for (int i = 0; i < r->num_shader_compile_threads; i++) {
+        char name[24];
+        snprintf(name, sizeof(name), "nv2a.vk_shader_compile%d", i);
+        qemu_thread_create(&r->shader_compile_threads[i], name,
+                           shader_compile_worker, r, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void shader_compile_pool_finalize(PGRAPHVkState *r)
+{
+    qemu_mutex_lock(&r->shader_compile_lock);
+    r->shader_compile_shutdown = true;
+    qemu_cond_broadcast(&r->shader_compile_cond);
+    qemu_mutex_unlock(&r->shader_compile_lock);
+
+    for (int i = 0; i < r->num_shader_compile_threads; i++) {
+        qemu_thread_join(&r->shader_compile_threads[i]);
+    }
+    g_free(r->shader_compile_threads);
+    r->shader_compile_threads = NULL;
+
+    assert(QSIMPLEQ_EMPTY(&r->shader_compile_queue));
+    assert(QSIMPLEQ_EMPTY(&r->shader_prebuild_queue));
+    qemu_cond_destroy(&r->shader_compile_cond);
+    qemu_mutex_destroy(&r->shader_compile_lock);
+}
+
 static void shader_cache_init(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -383,6 +720,7 @@ static void shader_cache_init(PGRAPHState *pg)
     }
     r->shader_cache.init_node = shader_cache_entry_init;
     r->shader_cache.compare_nodes = shader_cache_entry_compare;
+    r->shader_cache.pre_node_evict = shader_cache_entry_pre_evict;
     r->shader_cache.post_node_evict = shader_cache_entry_post_evict;
 
     /* FIXME: Make this configurable */
@@ -406,38 +744,76 @@ static void shader_cache_finalize(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    r->shader_binding = NULL;
+    r->pending_shader_binding = NULL;
+    r->ubershader_binding = NULL;
     lru_flush(&r->shader_cache);
+    lru_destroy(&r->shader_cache);
     g_free(r->shader_cache_entries);
     r->shader_cache_entries = NULL;
 
     lru_flush(&r->shader_module_cache);
+    lru_destroy(&r->shader_module_cache);
     g_free(r->shader_module_cache_entries);
     r->shader_module_cache_entries = NULL;
 }
 
 static ShaderBinding *get_shader_binding_for_state(PGRAPHVkState *r,
-                                                   const ShaderState *state)
+                                                   const ShaderState *state,
+                                                   uint64_t hash)
 {
-    uint64_t hash = fast_hash((void *)state, sizeof(*state));
     LruNode *node = lru_lookup(&r->shader_cache, hash, state);
     ShaderBinding *binding = container_of(node, ShaderBinding, node);
     NV2A_VK_DPRINTF("shader state hash: %016" PRIx64 " %p", hash, binding);
     return binding;
 }
 
-static void apply_uniform_updates(ShaderUniformLayout *layout,
+static bool apply_uniform_updates(ShaderUniformLayout *layout,
                                   const UniformInfo *info, int *locs,
                                   void *values, size_t count)
 {
+    bool changed = false;
+
     for (int i = 0; i < count; i++) {
         if (locs[i] != -1) {
-            uniform_copy(layout, locs[i], (char*)values + info[i].val_offs,
-                         4, (info[i].size * info[i].count) / 4);
+            changed |= uniform_copy(layout, locs[i],
+                                    (char *)values + info[i].val_offs, 4,
+                                    (info[i].size * info[i].count) / 4);
         }
     }
+
+    return changed;
+}
+
+/*
+ * Copy the rows of a vec4 constant array that were written since they were
+ * last copied, or all of them when the layout contents are not known.
+ */
+static bool update_uniform_rows(ShaderUniformLayout *layout, int loc,
+                                uint32_t (*rows)[4], bool *rows_dirty,
+                                size_t count, bool all)
+{
+    bool changed = false;
+
+    if (loc != -1) {
+        ShaderUniform *u = &layout->uniforms[loc - 1];
+        assert(u->dim_v == 4 && u->dim_a >= count && u->stride == 16);
+
+        char *p_out = uniform_ptr(layout, loc);
+        for (int i = 0; i < count; i++) {
+            if ((all || rows_dirty[i]) &&
+                memcmp(p_out + i * 16, rows[i], 16)) {
+                memcpy(p_out + i * 16, rows[i], 16);
+                changed = true;
+            }
+        }
+    }
+
+    memset(rows_dirty, 0, count * sizeof(bool));
+
+    return changed;
 }
 
-// FIXME: Dirty tracking
 static void update_shader_uniforms(PGRAPHState *pg)
 {
     NV2A_VK_DGROUP_BEGIN("%s", __func__);
@@ -450,16 +826,54 @@ static void update_shader_uniforms(PGRAPHState *pg)
     ShaderUniformLayout *layouts[] = { &binding->vsh.module_info->uniforms,
                                        &binding->psh.module_info->uniforms };
 
+    /* Layouts can be shared between bindings, switching one in rewrites it */
+    bool reset[2];
+    for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
+        reset[i] = r->uniform_layouts[i] != layouts[i];
+        r->uniforms_changed[i] |= reset[i];
+        r->uniform_layouts[i] = layouts[i];
+    }
+
+    /*
+     * The constant arrays make up most of the vertex uniforms, only copy rows
+     * the guest wrote. Everything else is small and compared per uniform.
+     */
+    VshUniformLocs vsh_locs;
+    memcpy(vsh_locs, binding->vsh.uniform_locs, sizeof(vsh_locs));
+
+    bool vsh_changed = false;
+    vsh_changed |= update_uniform_rows(
+        layouts[0], vsh_locs[VshUniform_c], pg->vsh_constants,
+        pg->vsh_constants_dirty, NV2A_VERTEXSHADER_CONSTANTS, reset[0]);
+    vsh_changed |= update_uniform_rows(layouts[0], vsh_locs[VshUniform_ltctxa],
+                                       pg->ltctxa, pg->ltctxa_dirty,
+                                       NV2A_LTCTXA_COUNT, reset[0]);
+    vsh_changed |= update_uniform_rows(layouts[0], vsh_locs[VshUniform_ltctxb],
+                                       pg->ltctxb, pg->ltctxb_dirty,
+                                       NV2A_LTCTXB_COUNT, reset[0]);
+    vsh_changed |= update_uniform_rows(layouts[0], vsh_locs[VshUniform_ltc1],
+                                       pg->ltc1, pg->ltc1_dirty,
+                                       NV2A_LTC1_COUNT, reset[0]);
+    vsh_locs[VshUniform_c] = -1;
+    vsh_locs[VshUniform_ltctxa] = -1;
+    vsh_locs[VshUniform_ltctxb] = -1;
+    vsh_locs[VshUniform_ltc1] = -1;
+
     VshUniformValues vsh_values;
-    pgraph_glsl_set_vsh_uniform_values(pg, &binding->state.vsh,
-                                  binding->vsh.uniform_locs, &vsh_values);
-    apply_uniform_updates(&binding->vsh.module_info->uniforms, VshUniformInfo,
-                          binding->vsh.uniform_locs, &vsh_values,
-                          VshUniform__COUNT);
+    pgraph_glsl_set_vsh_uniform_values(pg, &binding->state.vsh, vsh_locs,
+                                       &vsh_values);
+    vsh_changed |= apply_uniform_updates(layouts[0], VshUniformInfo, vsh_locs,
+                                         &vsh_values, VshUniform__COUNT);
+    r->uniforms_changed[0] |= vsh_changed;
 
     PshUniformValues psh_values;
     pgraph_glsl_set_psh_uniform_values(pg, binding->psh.uniform_locs,
                                        &psh_values);
+    if (binding->state.psh.uber_combiners) {
+        pgraph_glsl_set_psh_ubershader_uniform_values(
+            &r->shader_state.state.psh, binding->psh.uniform_locs,
+            &psh_values);
+    }
     for (int i = 0; i < 4; i++) {
         assert(r->texture_bindings[i] != NULL);
         float scale = r->texture_bindings[i]->key.scale;
@@ -474,25 +888,118 @@ static void update_shader_uniforms(PGRAPHState *pg)
 
         psh_values.texScale[i] = scale;
     }
-    apply_uniform_updates(&binding->psh.module_info->uniforms, PshUniformInfo,
-                          binding->psh.uniform_locs, &psh_values,
-                          PshUniform__COUNT);
+    r->uniforms_changed[1] |= apply_uniform_updates(
+        layouts[1], PshUniformInfo, binding->psh.uniform_locs, &psh_values,
+        PshUniform__COUNT);
 
-    for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
-        uint64_t hash =
-            fast_hash(layouts[i]->allocation, layouts[i]->total_size);
-        r->uniforms_changed |= (hash != r->uniform_buffer_hashes[i]);
-        r->uniform_buffer_hashes[i] = hash;
-    }
-
-    nv2a_profile_inc_counter(r->uniforms_changed ?
+    nv2a_profile_inc_counter((r->uniforms_changed[0] ||
+                              r->uniforms_changed[1]) ?
                                  NV2A_PROF_SHADER_UBO_DIRTY :
                                  NV2A_PROF_SHADER_UBO_NOTDIRTY);
 
     NV2A_VK_DGROUP_END();
 }
 
-void pgraph_vk_bind_shaders(PGRAPHState *pg)
+void pgraph_vk_reset_uniform_tracking(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    for (int i = 0; i < ARRAY_SIZE(r->uniform_layouts); i++) {
+        r->uniform_layouts[i] = NULL;
+    }
+}
+
+/*
+ * Binding that draws the current state with an ubershader, which reads the
+ * register combiners and fixed function state from uniforms, for use while
+ * the specialized pixel shader compiles. Returns NULL if disabled, if the
+ * state needs a specialized shader or if the ubershader is not ready either.
+ */
+static ShaderBinding *get_ubershader_binding(PGRAPHVkState *r)
+{
+    r->ubershader_binding = NULL;
+
+    if (g_config.perf.async_shader_compile !=
+        CONFIG_PERF_ASYNC_SHADER_COMPILE_UBERSHADER) {
+        return NULL;
+    }
+
+    ShaderState state;
+    memcpy(&state, &r->shader_state.state, sizeof(state));
+    if (!pgraph_glsl_set_psh_ubershader_state(&r->shader_state.state.psh,
+                                              &state.psh)) {
+        return NULL;
+    }
+
+    unsigned int variant = pgraph_glsl_get_psh_ubershader_variant(&state.psh);
+    if (!r->ubershader_modules[variant]) {
+        ShaderCompileJob *job = r->ubershader_jobs[variant];
+        if (!job) {
+            /* Switched to ubershaders after init */
+            queue_ubershader_job(r, variant);
+            return NULL;
+        }
+        if (!qatomic_load_acquire(&job->complete)) {
+            return NULL;
+        }
+        r->ubershader_modules[variant] =
+            get_and_ref_shader_module_for_key(r, &job->keys[2], job->spirv[2]);
+        job->spirv[2] = NULL;
+        free_shader_compile_job(job);
+        r->ubershader_jobs[variant] = NULL;
+    }
+
+    ShaderBinding *binding = get_shader_binding_for_state(
+        r, &state, fast_hash((void *)&state, sizeof(state)));
+    r->ubershader_binding = binding;
+    if (binding->compile_job &&
+        !complete_shader_compile_job(r, binding, false)) {
+        return NULL;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SHADER_UBERSHADER);
+    return binding;
+}
+
+static void init_ubershaders(PGRAPHVkState *r)
+{
+    if (g_config.perf.async_shader_compile !=
+        CONFIG_PERF_ASYNC_SHADER_COMPILE_UBERSHADER) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < PSH_UBERSHADER_NUM_VARIANTS; i++) {
+        queue_ubershader_job(r, i);
+    }
+}
+
+static void finalize_ubershaders(PGRAPHVkState *r)
+{
+    /* Drop the jobs no worker has taken yet, then wait for the rest */
+    qemu_mutex_lock(&r->shader_compile_lock);
+    ShaderCompileJob *job;
+    while ((job = QSIMPLEQ_FIRST(&r->shader_prebuild_queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&r->shader_prebuild_queue, entry);
+        r->ubershader_jobs[pgraph_glsl_get_psh_ubershader_variant(
+            &job->keys[2].psh.state)] = NULL;
+        free_shader_compile_job(job);
+    }
+    qemu_mutex_unlock(&r->shader_compile_lock);
+
+    for (unsigned int i = 0; i < PSH_UBERSHADER_NUM_VARIANTS; i++) {
+        if (r->ubershader_jobs[i]) {
+            qemu_event_wait(&r->ubershader_jobs[i]->complete_event);
+            free_shader_compile_job(r->ubershader_jobs[i]);
+            r->ubershader_jobs[i] = NULL;
+        }
+        if (r->ubershader_modules[i]) {
+            pgraph_vk_unref_shader_module(r, r->ubershader_modules[i]);
+            r->ubershader_modules[i] = NULL;
+        }
+    }
+}
+
+bool pgraph_vk_bind_shaders(PGRAPHState *pg)
 {
     NV2A_VK_DGROUP_BEGIN("%s", __func__);
 
@@ -500,21 +1007,42 @@ void pgraph_vk_bind_shaders(PGRAPHState *pg)
 
     r->shader_bindings_changed = false;
 
-    if (!r->shader_binding ||
-        pgraph_glsl_check_shader_state_dirty(pg, &r->shader_binding->state)) {
-        ShaderState new_state = pgraph_glsl_get_shader_state(pg);
-        if (!r->shader_binding || memcmp(&r->shader_binding->state, &new_state,
-                                         sizeof(ShaderState))) {
-            r->shader_binding = get_shader_binding_for_state(r, &new_state);
+    if (pgraph_glsl_update_shader_state(pg, &r->shader_state) ||
+        (!r->shader_binding && !r->pending_shader_binding)) {
+        r->pending_shader_binding = get_shader_binding_for_state(
+            r, &r->shader_state.state, r->shader_state.hash);
+    } else if (!r->pending_shader_binding) {
+        nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND_NOTDIRTY);
+    }
+
+    /* Kept pending until its modules are ready, drawing with the ubershader */
+    if (r->pending_shader_binding) {
+        ShaderBinding *binding = r->pending_shader_binding;
+        bool wait = g_config.perf.async_shader_compile ==
+                    CONFIG_PERF_ASYNC_SHADER_COMPILE_WAIT;
+        if (binding->compile_job &&
+            !complete_shader_compile_job(r, binding, wait)) {
+            nv2a_profile_inc_counter(NV2A_PROF_SHADER_COMPILE_PENDING);
+            binding = get_ubershader_binding(r);
+            if (!binding) {
+                NV2A_VK_DGROUP_END();
+                return false;
+            }
+        } else {
+            r->pending_shader_binding = NULL;
+            r->ubershader_binding = NULL;
+        }
+        if (r->shader_binding != binding) {
+            r->shader_binding = binding;
             r->shader_bindings_changed = true;
         }
-    } else {
-        nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND_NOTDIRTY);
     }
 
     update_shader_uniforms(pg);
 
     NV2A_VK_DGROUP_END();
+
+    return true;
 }
 
 void pgraph_vk_init_shaders(PGRAPHState *pg)
@@ -526,6 +1054,10 @@ void pgraph_vk_init_shaders(PGRAPHState *pg)
     create_descriptor_set_layout(pg);
     create_descriptor_sets(pg);
     shader_cache_init(pg);
+    shader_compile_pool_init(r);
+    pgraph_glsl_reset_shader_state_tracker(&r->shader_state);
+    pgraph_vk_init_disk_cache(pg);
+    init_ubershaders(r);
 
     r->use_push_constants_for_uniform_attrs =
         (r->device_props.limits.maxPushConstantsSize >=
@@ -534,7 +1066,12 @@ void pgraph_vk_init_shaders(PGRAPHState *pg)
 
 void pgraph_vk_finalize_shaders(PGRAPHState *pg)
 {
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    finalize_ubershaders(r);
+    pgraph_vk_finalize_disk_cache(pg);
     shader_cache_finalize(pg);
+    shader_compile_pool_finalize(r);
     destroy_descriptor_sets(pg);
     destroy_descriptor_set_layout(pg);
     destroy_descriptor_pool(pg);
@@ -130,13 +130,34 @@ static bool check_surface_overlaps_range(const SurfaceBinding *surface,
     return !(surface->vram_addr >= range_end || range_start >= surface_end);
 }
 
+static SurfaceBinding *surface_tree_first(PGRAPHVkState *r, hwaddr start,
+                                          hwaddr last)
+{
+    IntervalTreeNode *node =
+        interval_tree_iter_first(&r->surface_tree, start, last);
+    return node ? container_of(node, SurfaceBinding, itree) : NULL;
+}
+
+static SurfaceBinding *surface_tree_next(SurfaceBinding *surface, hwaddr start,
+                                         hwaddr last)
+{
+    IntervalTreeNode *node = interval_tree_iter_next(&surface->itree, start,
+                                                     last);
+    return node ? container_of(node, SurfaceBinding, itree) : NULL;
+}
+
 void pgraph_vk_download_surfaces_in_range_if_dirty(PGRAPHState *pg,
                                                    hwaddr start, hwaddr size)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
-    SurfaceBinding *surface;
 
-    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+    if (!size) {
+        return;
+    }
+
+    hwaddr last = start + size - 1;
+    for (SurfaceBinding *surface = surface_tree_first(r, start, last); surface;
+         surface = surface_tree_next(surface, start, last)) {
         if (check_surface_overlaps_range(surface, start, size)) {
             pgraph_vk_surface_download_if_dirty(
                 container_of(pg, NV2AState, pgraph), surface);
@@ -543,8 +564,9 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
     bool wait_for_downloads = false;
 
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+    hwaddr last = addr + MAX(len, 1) - 1;
+    for (SurfaceBinding *surface = surface_tree_first(r, addr, last); surface;
+         surface = surface_tree_next(surface, addr, last)) {
         if (!check_surface_overlaps_range(surface, addr, len)) {
             continue;
         }
@@ -654,6 +676,7 @@ static void invalidate_surface(NV2AState *d, SurfaceBinding *surface)
 
     unregister_cpu_access_callback(d, surface);
 
+    interval_tree_remove(&surface->itree, &r->surface_tree);
     QTAILQ_REMOVE(&r->surfaces, surface, entry);
     QTAILQ_INSERT_HEAD(&r->invalid_surfaces, surface, entry);
 }
@@ -670,8 +693,14 @@ static void invalidate_overlapping_surfaces(NV2AState *d,
 {
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
+    hwaddr start = surface->vram_addr;
+    hwaddr last = start + MAX(surface->size, 1) - 1;
+
     SurfaceBinding *other_surface, *next_surface;
-    QTAILQ_FOREACH_SAFE (other_surface, &r->surfaces, entry, next_surface) {
+    for (other_surface = surface_tree_first(r, start, last); other_surface;
+         other_surface = next_surface) {
+        /* Find the successor before other_surface leaves the tree */
+        next_surface = surface_tree_next(other_surface, start, last);
         if (check_surfaces_overlap(surface, other_surface)) {
             trace_nv2a_pgraph_surface_evict_overlapping(
                 other_surface->vram_addr, other_surface->width,
@@ -692,14 +721,19 @@ static void surface_put(NV2AState *d, SurfaceBinding *surface)
     register_cpu_access_callback(d, surface);
 
     QTAILQ_INSERT_HEAD(&r->surfaces, surface, entry);
+
+    /* Zero-sized surfaces still occupy their base address for lookups */
+    surface->itree.start = surface->vram_addr;
+    surface->itree.last = surface->vram_addr + MAX(surface->size, 1) - 1;
+    interval_tree_insert(&surface->itree, &r->surface_tree);
 }
 
 SurfaceBinding *pgraph_vk_surface_get(NV2AState *d, hwaddr addr)
 {
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
+    for (SurfaceBinding *surface = surface_tree_first(r, addr, addr); surface;
+         surface = surface_tree_next(surface, addr, addr)) {
         if (surface->vram_addr == addr) {
             return surface;
         }
@@ -712,8 +746,8 @@ SurfaceBinding *pgraph_vk_surface_get_within(NV2AState *d, hwaddr addr)
 {
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
+    for (SurfaceBinding *surface = surface_tree_first(r, addr, addr); surface;
+         surface = surface_tree_next(surface, addr, addr)) {
         if (addr >= surface->vram_addr &&
             addr < (surface->vram_addr + surface->size)) {
             return surface;
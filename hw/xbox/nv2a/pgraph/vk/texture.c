@@ -24,12 +24,13 @@
  */
 
 #include "qemu/osdep.h"
-#include "hw/xbox/nv2a/pgraph/s3tc.h"
-#include "hw/xbox/nv2a/pgraph/swizzle.h"
 #include "qemu/fast-hash.h"
 #include "qemu/lru.h"
 #include "renderer.h"
 
+/* Device memory held by cached textures before older ones are evicted */
+#define TEXTURE_CACHE_MAX_SIZE (512 * MiB)
+
 static void texture_cache_release_node_resources(PGRAPHVkState *r, TextureBinding *snode);
 
 static const VkImageType dimensionality_to_vk_image_type[] = {
@@ -51,101 +52,90 @@ static VkSamplerAddressMode lookup_texture_address_mode(int idx)
     return pgraph_texture_addr_vk_map[idx];
 }
 
-// FIXME: Move to common
-// FIXME: We can shrink the size of this structure
-// FIXME: Use simple allocator
-typedef struct TextureLevel {
-    unsigned int width, height, depth;
-    hwaddr vram_addr;
-    void *decoded_data;
-    size_t decoded_size;
-} TextureLevel;
-
-typedef struct TextureLayer {
-    TextureLevel levels[16];
-} TextureLayer;
-
-typedef struct TextureLayout {
-    TextureLayer layers[6];
-} TextureLayout;
-
-// FIXME: Move to common
-static enum S3TC_DECOMPRESS_FORMAT kelvin_format_to_s3tc_format(int color_format)
+enum TextureBcImageKind {
+    TEXTURE_BC_IMAGE_2D,
+    TEXTURE_BC_IMAGE_CUBE,
+    TEXTURE_BC_IMAGE_3D,
+};
+
+static const VkFormat s3tc_to_vk_bc_format[] = {
+    VK_FORMAT_BC1_RGBA_UNORM_BLOCK,
+    VK_FORMAT_BC2_UNORM_BLOCK,
+    VK_FORMAT_BC3_UNORM_BLOCK,
+};
+
+static int get_s3tc_format_index(unsigned int color_format)
 {
     switch (color_format) {
     case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5:
-        return S3TC_DECOMPRESS_FORMAT_DXT1;
+        return 0;
     case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT23_A8R8G8B8:
-        return S3TC_DECOMPRESS_FORMAT_DXT3;
+        return 1;
     case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT45_A8R8G8B8:
-        return S3TC_DECOMPRESS_FORMAT_DXT5;
+        return 2;
     default:
-        assert(!"Invalid texture color format");
+        return -1;
     }
 }
 
-// FIXME: Move to common
-static void memcpy_image(void *dst, void *src, int min_stride, int dst_stride, int src_stride, int height)
+/*
+ * BC format that an S3TC texture can be uploaded in without decompressing it,
+ * or VK_FORMAT_UNDEFINED if the device cannot sample it for this image type.
+ */
+static VkFormat get_native_bc_format(PGRAPHVkState *r, const TextureShape *s)
 {
-    uint8_t *dst_ptr = (uint8_t *)dst;
-    uint8_t *src_ptr = (uint8_t *)src;
+    int format_idx = get_s3tc_format_index(s->color_format);
+    if (format_idx < 0 || s->border) {
+        return VK_FORMAT_UNDEFINED;
+    }
 
-    for (int i = 0; i < height; i++) {
-        memcpy(dst_ptr, src_ptr, min_stride);
-        src_ptr += src_stride;
-        dst_ptr += dst_stride;
+    enum TextureBcImageKind kind = TEXTURE_BC_IMAGE_2D;
+    if (s->dimensionality == 3) {
+        kind = TEXTURE_BC_IMAGE_3D;
+    } else if (s->cubemap) {
+        kind = TEXTURE_BC_IMAGE_CUBE;
     }
+    return r->texture_bc_supported[format_idx][kind] ?
+               s3tc_to_vk_bc_format[format_idx] :
+               VK_FORMAT_UNDEFINED;
 }
 
-// FIXME: Move to common
-static size_t get_cubemap_layer_size(PGRAPHState *pg, TextureShape s)
+static void init_bc_texture_support(PGRAPHVkState *r)
 {
-    BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
-    bool is_compressed =
-        pgraph_is_texture_format_compressed(pg, s.color_format);
-    unsigned int block_size;
-
-    unsigned int w = s.width, h = s.height;
-    size_t length = 0;
-
-    if (!f.linear && s.border) {
-        w = MAX(16, w * 2);
-        h = MAX(16, h * 2);
-    }
+    memset(r->texture_bc_supported, 0, sizeof(r->texture_bc_supported));
 
-    if (is_compressed) {
-        block_size =
-            s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5 ?
-                8 :
-                16;
+    if (!r->enabled_physical_device_features.textureCompressionBC) {
+        return;
     }
 
-    for (int level = 0; level < s.levels; level++) {
-        if (is_compressed) {
-            length += w / 4 * h / 4 * block_size;
-        } else {
-            length += w * h * f.bytes_per_pixel;
+    for (int i = 0; i < ARRAY_SIZE(s3tc_to_vk_bc_format); i++) {
+        for (int kind = 0; kind < ARRAY_SIZE(r->texture_bc_supported[i]);
+             kind++) {
+            VkImageFormatProperties props;
+            VkResult result = vkGetPhysicalDeviceImageFormatProperties(
+                r->physical_device, s3tc_to_vk_bc_format[i],
+                kind == TEXTURE_BC_IMAGE_3D ? VK_IMAGE_TYPE_3D :
+                                              VK_IMAGE_TYPE_2D,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                kind == TEXTURE_BC_IMAGE_CUBE ?
+                    VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT :
+                    0,
+                &props);
+            r->texture_bc_supported[i][kind] = result == VK_SUCCESS;
         }
-
-        w /= 2;
-        h /= 2;
     }
-
-    return ROUND_UP(length, NV2A_CUBEMAP_FACE_ALIGNMENT);
 }
 
-// FIXME: Move to common
-// FIXME: More refactoring
-// FIXME: Possible parallelization of decoding
 // FIXME: Bounds checking
-static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
+static TextureDecode *decode_texture(PGRAPHState *pg, const TextureKey *key)
 {
     NV2AState *d = container_of(pg, NV2AState, pgraph);
-    TextureShape s = pgraph_get_texture_shape(pg, texture_idx);
+    TextureShape s = key->state;
     BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
 
-    NV2A_VK_DGROUP_BEGIN("Texture %d: cubemap=%d, dimensionality=%d, color_format=0x%x, levels=%d, width=%d, height=%d, depth=%d border=%d, min_mipmap_level=%d, max_mipmap_level=%d, pitch=%d",
-        texture_idx,
+    NV2A_VK_DGROUP_BEGIN("Texture %" HWADDR_PRIx ": cubemap=%d, dimensionality=%d, color_format=0x%x, levels=%d, width=%d, height=%d, depth=%d border=%d, min_mipmap_level=%d, max_mipmap_level=%d, pitch=%d",
+        key->texture_vram_offset,
         s.cubemap,
         s.dimensionality,
         s.color_format,
@@ -162,6 +152,8 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
     // Sanity checks on below assumptions
     if (f.linear) {
         assert(s.dimensionality == 2);
+        assert(s.pitch % f.bytes_per_pixel == 0 && "Can't handle strides unaligned to pixels");
+        assert(s.levels == 1);
     }
     if (s.cubemap) {
         assert(s.dimensionality == 2);
@@ -169,314 +161,73 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
     }
     assert(s.dimensionality > 1);
 
-    const hwaddr texture_vram_offset = pgraph_get_texture_phys_addr(pg, texture_idx);
-    void *texture_data_ptr = (char *)d->vram_ptr + texture_vram_offset;
-
-    size_t texture_palette_data_size;
-    const hwaddr texture_palette_vram_offset =
-        pgraph_get_texture_palette_phys_addr_length(pg, texture_idx,
-                                                    &texture_palette_data_size);
-    void *palette_data_ptr = (char *)d->vram_ptr + texture_palette_vram_offset;
-
-    unsigned int adjusted_width = s.width, adjusted_height = s.height,
-                 adjusted_pitch = s.pitch, adjusted_depth = s.depth;
-
-    if (!f.linear && s.border) {
-        adjusted_width = MAX(16, adjusted_width * 2);
-        adjusted_height = MAX(16, adjusted_height * 2);
-        adjusted_pitch = adjusted_width * (s.pitch / s.width);
-        adjusted_depth = MAX(16, s.depth * 2);
-    }
-
-    TextureLayout *layout = g_malloc0(sizeof(TextureLayout));
-
-    if (f.linear) {
-        assert(s.pitch % f.bytes_per_pixel == 0 && "Can't handle strides unaligned to pixels");
-
-        size_t converted_size;
-        uint8_t *converted = pgraph_convert_texture_data(
-            s, texture_data_ptr, palette_data_ptr, adjusted_width,
-            adjusted_height, 1, adjusted_pitch, 0, &converted_size);
-
-        if (!converted) {
-            int dst_stride = adjusted_width * f.bytes_per_pixel;
-            assert(adjusted_width <= s.width);
-            converted_size = dst_stride * adjusted_height;
-            converted = g_malloc(converted_size);
-            memcpy_image(converted, texture_data_ptr, adjusted_width * f.bytes_per_pixel, dst_stride,
-                         adjusted_pitch, adjusted_height);
-        }
-
-        assert(s.levels == 1);
-        layout->layers[0].levels[0] = (TextureLevel){
-            .width = adjusted_width,
-            .height = adjusted_height,
-            .depth = 1,
-            .decoded_size = converted_size,
-            .decoded_data = converted,
-        };
-
-        NV2A_VK_DGROUP_END();
-        return layout;
-    }
+    void *texture_data_ptr = (char *)d->vram_ptr + key->texture_vram_offset;
+    void *palette_data_ptr = (char *)d->vram_ptr + key->palette_vram_offset;
 
-    bool is_compressed = pgraph_is_texture_format_compressed(pg, s.color_format);
-    size_t block_size = 0;
-    if (is_compressed) {
-        bool is_dxt1 =
-            s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5;
-        block_size = is_dxt1 ? 8 : 16;
-    }
-
-    if (s.dimensionality == 2) {
-        hwaddr layer_size = s.cubemap ? get_cubemap_layer_size(pg, s) : 0;
-        const int num_layers = s.cubemap ? 6 : 1;
-        for (int layer = 0; layer < num_layers; layer++) {
-            unsigned int width = adjusted_width, height = adjusted_height;
-            texture_data_ptr = (char *)d->vram_ptr + texture_vram_offset +
-                               layer * layer_size;
-
-            for (int level = 0; level < s.levels; level++) {
-                NV2A_VK_DPRINTF("Layer %d Level %d @ %x", layer, level, (int)((char*)texture_data_ptr - (char*)d->vram_ptr));
-
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                if (is_compressed) {
-                    // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
-                    unsigned int tex_width = width, tex_height = height;
-                    unsigned int physical_width = (width + 3) & ~3,
-                                 physical_height = (height + 3) & ~3;
-
-                    size_t converted_size = width * height * 4;
-                    uint8_t *converted = s3tc_decompress_2d(
-                        kelvin_format_to_s3tc_format(s.color_format),
-                        texture_data_ptr, width, height);
-                    assert(converted);
-
-                    if (s.cubemap && adjusted_width != s.width) {
-                        // FIXME: Consider preserving the border.
-                        // There does not seem to be a way to reference the border
-                        // texels in a cubemap, so they are discarded.
-
-                        // glPixelStorei(GL_UNPACK_SKIP_PIXELS, 4);
-                        // glPixelStorei(GL_UNPACK_SKIP_ROWS, 4);
-                        tex_width = s.width;
-                        tex_height = s.height;
-                        // if (physical_width == width) {
-                        //     glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
-                        // }
-
-                        // FIXME: Crop by 4 pixels on each side
-                    }
-
-                    layout->layers[layer].levels[level] = (TextureLevel){
-                        .width = tex_width,
-                        .height = tex_height,
-                        .depth = 1,
-                        .decoded_size = converted_size,
-                        .decoded_data = converted,
-                    };
-
-                    texture_data_ptr +=
-                        physical_width / 4 * physical_height / 4 * block_size;
-                } else {
-                    unsigned int pitch = width * f.bytes_per_pixel;
-                    unsigned int tex_width = width, tex_height = height;
-
-                    size_t converted_size = height * pitch;
-                    uint8_t *unswizzled = (uint8_t*)g_malloc(height * pitch);
-                    unswizzle_rect(texture_data_ptr, width, height,
-                                   unswizzled, pitch, f.bytes_per_pixel);
-
-                    uint8_t *converted = pgraph_convert_texture_data(
-                        s, unswizzled, palette_data_ptr, width, height, 1,
-                        pitch, 0, &converted_size);
-
-                    if (converted) {
-                        g_free(unswizzled);
-                    } else {
-                        converted = unswizzled;
-                    }
-
-                    if (s.cubemap && adjusted_width != s.width) {
-                        // FIXME: Consider preserving the border.
-                        // There does not seem to be a way to reference the border
-                        // texels in a cubemap, so they are discarded.
-                        // glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
-                        tex_width = s.width;
-                        tex_height = s.height;
-                        // pixel_data += 4 * f.bytes_per_pixel + 4 * pitch;
-
-                        // FIXME: Crop by 4 pixels on each side
-                    }
-
-                    layout->layers[layer].levels[level] = (TextureLevel){
-                        .width = tex_width,
-                        .height = tex_height,
-                        .depth = 1,
-                        .decoded_size = converted_size,
-                        .decoded_data = converted,
-                    };
-
-                    texture_data_ptr += width * height * f.bytes_per_pixel;
-                }
-
-                width /= 2;
-                height /= 2;
-            }
-        }
-    } else if (s.dimensionality == 3) {
-        assert(!f.linear);
-        unsigned int width = adjusted_width, height = adjusted_height,
-                     depth = adjusted_depth;
-
-        for (int level = 0; level < s.levels; level++) {
-            if (is_compressed) {
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                unsigned int physical_width = (width + 3) & ~3,
-                             physical_height = (height + 3) & ~3;
-                depth = MAX(depth, 1);
-
-                size_t converted_size = width * height * depth * 4;
-                uint8_t *converted = s3tc_decompress_3d(
-                    kelvin_format_to_s3tc_format(s.color_format),
-                    texture_data_ptr, width, height, depth);
-                assert(converted);
-
-                layout->layers[0].levels[level] = (TextureLevel){
-                    .width = width,
-                    .height = height,
-                    .depth = depth,
-                    .decoded_size = converted_size,
-                    .decoded_data = converted,
-                };
-
-                texture_data_ptr += physical_width / 4 * physical_height / 4 * depth * block_size;
-            } else {
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                depth = MAX(depth, 1);
-
-                unsigned int row_pitch = width * f.bytes_per_pixel;
-                unsigned int slice_pitch = row_pitch * height;
-
-                size_t unswizzled_size = slice_pitch * depth;
-                uint8_t *unswizzled = g_malloc(unswizzled_size);
-                unswizzle_box(texture_data_ptr, width, height, depth,
-                              unswizzled, row_pitch, slice_pitch,
-                              f.bytes_per_pixel);
-
-                size_t converted_size;
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data_ptr, width, height, depth,
-                    row_pitch, slice_pitch, &converted_size);
-
-                if (converted) {
-                    g_free(unswizzled);
-                } else {
-                    converted = unswizzled;
-                    converted_size = unswizzled_size;
-                }
-
-                layout->layers[0].levels[level] = (TextureLevel){
-                    .width = width,
-                    .height = height,
-                    .depth = depth,
-                    .decoded_size = converted_size,
-                    .decoded_data = converted,
-                };
-
-                texture_data_ptr += width * height * depth * f.bytes_per_pixel;
-            }
-
-            width /= 2;
-            height /= 2;
-            depth /= 2;
-        }
-    }
+    bool keep_compressed =
+        get_native_bc_format(pg->vk_renderer_state, &s) != VK_FORMAT_UNDEFINED;
+    TextureDecode *td = pgraph_decode_texture(pg, s, texture_data_ptr,
+                                              palette_data_ptr, keep_compressed);
 
     NV2A_VK_DGROUP_END();
-    return layout;
+    return td;
 }
 
-struct pgraph_texture_possibly_dirty_struct {
-    hwaddr addr, end;
-};
-
 static void mark_textures_possibly_dirty_visitor(Lru *lru, LruNode *node, void *opaque)
 {
-    struct pgraph_texture_possibly_dirty_struct *test = opaque;
+    TexturePageRange *pages = opaque;
 
     TextureBinding *tnode = container_of(node, TextureBinding, node);
     if (tnode->possibly_dirty) {
         return;
     }
 
-    uintptr_t k_tex_addr = tnode->key.texture_vram_offset;
-    uintptr_t k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
-    bool overlapping = !(test->addr > k_tex_end || k_tex_addr > test->end);
+    tnode->possibly_dirty |=
+        pgraph_texture_page_ranges_overlap(tnode->texture_pages, *pages) ||
+        pgraph_texture_page_ranges_overlap(tnode->palette_pages, *pages);
+}
 
-    if (tnode->key.palette_length > 0) {
-        uintptr_t k_pal_addr = tnode->key.palette_vram_offset;
-        uintptr_t k_pal_end = k_pal_addr + tnode->key.palette_length - 1;
-        overlapping |= !(test->addr > k_pal_end || k_pal_addr > test->end);
-    }
+static void mark_textures_possibly_dirty(void *opaque, TexturePageRange pages)
+{
+    PGRAPHVkState *r = opaque;
 
-    tnode->possibly_dirty |= overlapping;
+    lru_visit_active(&r->texture_cache,
+                     mark_textures_possibly_dirty_visitor,
+                     &pages);
 }
 
 void pgraph_vk_mark_textures_possibly_dirty(NV2AState *d,
     hwaddr addr, hwaddr size)
 {
-    hwaddr end = TARGET_PAGE_ALIGN(addr + size) - 1;
-    addr &= TARGET_PAGE_MASK;
-    assert(end <= memory_region_size(d->vram));
-
-    struct pgraph_texture_possibly_dirty_struct test = {
-        .addr = addr,
-        .end = end,
-    };
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
-    lru_visit_active(&d->pgraph.vk_renderer_state->texture_cache,
-                     mark_textures_possibly_dirty_visitor,
-                     &test);
-}
+    assert(addr + size <= memory_region_size(d->vram));
 
-static bool check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
-{
-    hwaddr end = TARGET_PAGE_ALIGN(addr + size);
-    addr &= TARGET_PAGE_MASK;
-    assert(end < memory_region_size(d->vram));
-    return memory_region_test_and_clear_dirty(d->vram, addr, end - addr,
-                                              DIRTY_MEMORY_NV2A_TEX);
+    /* Contents may have changed without going through the dirty bitmap */
+    TexturePageRange pages = pgraph_texture_page_range(addr, size);
+    pgraph_texture_page_hashes_invalidate(&r->texture_page_hashes, pages);
+    mark_textures_possibly_dirty(r, pages);
 }
 
 // Check if any of the pages spanned by the a texture are dirty.
 static bool check_texture_possibly_dirty(NV2AState *d,
-                                         hwaddr texture_vram_offset,
-                                         unsigned int length,
-                                         hwaddr palette_vram_offset,
-                                         unsigned int palette_length)
+                                         TexturePageRange texture_pages,
+                                         TexturePageRange palette_pages)
 {
-    bool possibly_dirty = false;
-    if (check_texture_dirty(d, texture_vram_offset, length)) {
-        possibly_dirty = true;
-        pgraph_vk_mark_textures_possibly_dirty(d, texture_vram_offset, length);
-    }
-    if (palette_length && check_texture_dirty(d, palette_vram_offset,
-                                                     palette_length)) {
-        possibly_dirty = true;
-        pgraph_vk_mark_textures_possibly_dirty(d, palette_vram_offset,
-                                            palette_length);
-    }
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+
+    bool possibly_dirty = pgraph_texture_page_hashes_sync(
+        &r->texture_page_hashes, d->vram, texture_pages,
+        mark_textures_possibly_dirty, r);
+    possibly_dirty |= pgraph_texture_page_hashes_sync(
+        &r->texture_page_hashes, d->vram, palette_pages,
+        mark_textures_possibly_dirty, r);
     return possibly_dirty;
 }
 
 // FIXME: Make sure we update sampler when data matches. Should we add filtering
 // options to the textureshape?
-static void upload_texture_image(PGRAPHState *pg, int texture_idx,
-                                 TextureBinding *binding)
+static void upload_texture_image(PGRAPHState *pg, TextureBinding *binding)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
     TextureShape *state = &binding->key.state;
@@ -484,31 +235,50 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
 
     nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
 
-    g_autofree TextureLayout *layout = get_texture_layout(pg, texture_idx);
-    const int num_layers = state->cubemap ? 6 : 1;
+    TextureDecode *td = decode_texture(pg, &binding->key);
+    const int num_layers = td->num_faces;
+    const int num_levels = td->num_levels;
+
+    // Levels are placed at offsets aligned for any texel or block size
+    const VkDeviceSize level_alignment = 16;
 
     // Calculate decoded texture data size
     size_t texture_data_size = 0;
     for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
-        TextureLayer *layer = &layout->layers[layer_idx];
-        for (int level_idx = 0; level_idx < state->levels; level_idx++) {
-            size_t size = layer->levels[level_idx].decoded_size;
+        for (int level_idx = 0; level_idx < num_levels; level_idx++) {
+            size_t size = td->levels[layer_idx][level_idx].size;
             assert(size);
-            texture_data_size += size;
+            texture_data_size += ROUND_UP(size, level_alignment);
         }
     }
 
-    assert(texture_data_size <=
-           r->storage_buffers[BUFFER_STAGING_SRC].buffer_size);
-
-    // Copy texture data to mapped device buffer
-    uint8_t *mapped_memory_ptr;
-
-    VK_CHECK(vmaMapMemory(r->allocator,
-                          r->storage_buffers[BUFFER_STAGING_SRC].allocation,
-                          (void *)&mapped_memory_ptr));
+    /*
+     * The copy is normally recorded into the frame's command buffer from a
+     * per-frame staging region, so only draws after it wait for the upload.
+     * Textures too large for a region go through a one-off submission.
+     */
+    StorageBuffer *staging = &r->storage_buffers[BUFFER_TEXTURE_STAGING];
+    bool use_frame_staging = texture_data_size <= staging->buffer_size;
+
+    uint8_t *mapped_memory_ptr = NULL;
+    VkDeviceSize staging_start = 0;
+
+    if (use_frame_staging) {
+        if (!pgraph_vk_buffer_has_space_for(pg, BUFFER_TEXTURE_STAGING,
+                                            texture_data_size,
+                                            level_alignment)) {
+            pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
+        }
+        staging_start = staging->region_offset +
+                        ROUND_UP(staging->buffer_offset, level_alignment);
+    } else {
+        staging = &r->storage_buffers[BUFFER_STAGING_SRC];
+        assert(texture_data_size <= staging->buffer_size);
+        VK_CHECK(vmaMapMemory(r->allocator, staging->allocation,
+                              (void *)&mapped_memory_ptr));
+    }
 
-    int num_regions = num_layers * state->levels;
+    int num_regions = num_layers * num_levels;
     g_autofree VkBufferImageCopy *regions =
         g_malloc0_n(num_regions, sizeof(VkBufferImageCopy));
 
@@ -516,15 +286,32 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
     VkDeviceSize buffer_offset = 0;
 
     for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
-        TextureLayer *layer = &layout->layers[layer_idx];
         NV2A_VK_DPRINTF("Layer %d", layer_idx);
-        for (int level_idx = 0; level_idx < state->levels; level_idx++) {
-            TextureLevel *level = &layer->levels[level_idx];
+        for (int level_idx = 0; level_idx < num_levels; level_idx++) {
+            TextureDecodeLevel *level = &td->levels[layer_idx][level_idx];
+            unsigned int width = level->width, height = level->height;
+            if (state->cubemap && state->border) {
+                // FIXME: Consider preserving the border.
+                // There does not seem to be a way to reference the border
+                // texels in a cubemap, so they are discarded.
+                // FIXME: Crop by 4 pixels on each side
+                width = state->width;
+                height = state->height;
+            }
+            if (use_frame_staging) {
+                void *data = level->data;
+                VkDeviceSize size = level->size;
+                buffer_offset = pgraph_vk_append_to_buffer(
+                    pg, BUFFER_TEXTURE_STAGING, &data, &size, 1,
+                    level_alignment);
+            } else {
+                buffer_offset = ROUND_UP(buffer_offset, level_alignment);
+                memcpy(mapped_memory_ptr + buffer_offset, level->data,
+                       level->size);
+            }
             NV2A_VK_DPRINTF(" - Level %d, w=%d h=%d d=%d @ %08" HWADDR_PRIx,
-                            level_idx, level->width, level->height,
-                            level->depth, buffer_offset);
-            memcpy(mapped_memory_ptr + buffer_offset, level->decoded_data,
-                   level->decoded_size);
+                            level_idx, width, height, level->depth,
+                            buffer_offset);
             *region = (VkBufferImageCopy){
                 .bufferOffset = buffer_offset,
                 .bufferRowLength = 0, // Tightly packed
@@ -534,24 +321,26 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
                 .imageSubresource.baseArrayLayer = layer_idx,
                 .imageSubresource.layerCount = 1,
                 .imageOffset = (VkOffset3D){ 0, 0, 0 },
-                .imageExtent =
-                    (VkExtent3D){ level->width, level->height, level->depth },
+                .imageExtent = (VkExtent3D){ width, height, level->depth },
             };
-            buffer_offset += level->decoded_size;
+            buffer_offset += level->size;
             region++;
         }
     }
-    assert(buffer_offset <= r->storage_buffers[BUFFER_STAGING_SRC].buffer_size);
 
-    vmaFlushAllocation(r->allocator,
-                       r->storage_buffers[BUFFER_STAGING_SRC].allocation, 0,
-                       VK_WHOLE_SIZE);
+    VkDeviceSize staging_size = buffer_offset - staging_start;
+    assert(staging_size <= texture_data_size);
 
-    vmaUnmapMemory(r->allocator,
-                   r->storage_buffers[BUFFER_STAGING_SRC].allocation);
+    vmaFlushAllocation(r->allocator, staging->allocation, staging_start,
+                       staging_size);
 
-    // FIXME: Use nondraw. Need to fill and copy tex buffer at once
-    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+    VkCommandBuffer cmd;
+    if (use_frame_staging) {
+        cmd = pgraph_vk_begin_nondraw_commands(pg);
+    } else {
+        vmaUnmapMemory(r->allocator, staging->allocation);
+        cmd = pgraph_vk_begin_single_time_commands(pg);
+    }
     pgraph_vk_begin_debug_marker(r, cmd, RGBA_GREEN, __func__);
 
     VkBufferMemoryBarrier host_barrier = {
@@ -560,8 +349,9 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
         .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .buffer = r->storage_buffers[BUFFER_STAGING_SRC].buffer,
-        .size = VK_WHOLE_SIZE
+        .buffer = staging->buffer,
+        .offset = staging_start,
+        .size = staging_size,
     };
     vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_HOST_BIT,
                          VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
@@ -572,26 +362,25 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
                                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
     binding->current_layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 
-    vkCmdCopyBufferToImage(cmd, r->storage_buffers[BUFFER_STAGING_SRC].buffer,
-                           binding->image, binding->current_layout,
-                           num_regions, regions);
+    vkCmdCopyBufferToImage(cmd, staging->buffer, binding->image,
+                           binding->current_layout, num_regions, regions);
 
     pgraph_vk_transition_image_layout(pg, cmd, binding->image, vkf.vk_format,
                                       binding->current_layout,
                                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
     binding->current_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_4);
     pgraph_vk_end_debug_marker(r, cmd);
-    pgraph_vk_end_single_time_commands(pg, cmd);
-
-    // Release decoded texture data
-    for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
-        TextureLayer *layer = &layout->layers[layer_idx];
-        for (int level_idx = 0; level_idx < state->levels; level_idx++) {
-            g_free(layer->levels[level_idx].decoded_data);
-        }
+    if (use_frame_staging) {
+        pgraph_vk_end_nondraw_commands(pg, cmd);
+        // Keep the image alive until this command buffer has executed
+        binding->submit_time = r->submit_count;
+    } else {
+        nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_4);
+        pgraph_vk_end_single_time_commands(pg, cmd);
     }
+
+    pgraph_free_texture_decode(td);
 }
 
 static void copy_zeta_surface_to_texture(PGRAPHState *pg, SurfaceBinding *surface,
@@ -1076,6 +865,11 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     NV2AState *d = container_of(pg, NV2AState, pgraph);
     PGRAPHVkState *r = pg->vk_renderer_state;
     TextureShape state = pgraph_get_texture_shape(pg, texture_idx); // FIXME: Check for pad issues
+    if (pgraph_is_texture_palette_lookup_enabled(pg, texture_idx)) {
+        state = pgraph_get_texture_index_shape(state);
+    } else if (pgraph_is_texture_yuv_conversion_enabled(pg, texture_idx)) {
+        state = pgraph_get_texture_yuv_shape(state);
+    }
     BasicColorFormatInfo f_basic = kelvin_color_format_info_map[state.color_format];
 
     const hwaddr texture_vram_offset = pgraph_get_texture_phys_addr(pg, texture_idx);
@@ -1163,19 +957,19 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
 
     if (!surface_to_texture && !possibly_dirty_checked) {
         possibly_dirty |= check_texture_possibly_dirty(
-            d, texture_vram_offset, texture_length, texture_palette_vram_offset,
-            texture_palette_data_size);
+            d, snode->texture_pages, snode->palette_pages);
     }
 
     // Calculate hash of texture data, if necessary
-    void *texture_data = (char*)d->vram_ptr + texture_vram_offset;
-    void *palette_data = (char*)d->vram_ptr + texture_palette_vram_offset;
-
     uint64_t content_hash = 0;
     if (!surface_to_texture && possibly_dirty) {
-        content_hash = fast_hash(texture_data, texture_length);
+        content_hash = pgraph_texture_page_hashes_hash(
+            &r->texture_page_hashes, d->vram_ptr, texture_vram_offset,
+            texture_length);
         if (is_indexed) {
-            content_hash ^= fast_hash(palette_data, texture_palette_data_size);
+            content_hash ^= pgraph_texture_page_hashes_hash(
+                &r->texture_page_hashes, d->vram_ptr,
+                texture_palette_vram_offset, texture_palette_data_size);
         }
     }
 
@@ -1187,7 +981,7 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
             }
         } else {
             if (possibly_dirty && content_hash != snode->hash) {
-                upload_texture_image(pg, texture_idx, snode);
+                upload_texture_image(pg, snode);
                 snode->hash = content_hash;
             }
         }
@@ -1204,6 +998,10 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     snode->hash = content_hash;
 
     VkColorFormatInfo vkf = kelvin_color_format_vk_map[state.color_format];
+    VkFormat bc_format = get_native_bc_format(r, &state);
+    if (bc_format != VK_FORMAT_UNDEFINED) {
+        vkf.vk_format = bc_format;
+    }
     assert(vkf.vk_format != 0);
     assert(0 < state.dimensionality);
     assert(state.dimensionality < ARRAY_SIZE(dimensionality_to_vk_image_type));
@@ -1236,9 +1034,11 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
         .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
     };
 
+    VmaAllocationInfo alloc_info;
     VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
                             &alloc_create_info, &snode->image,
-                            &snode->allocation, NULL));
+                            &snode->allocation, &alloc_info));
+    lru_set_node_size(&r->texture_cache, &snode->node, alloc_info.size);
 
     VkImageViewCreateInfo image_view_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -1381,13 +1181,131 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     if (surface_to_texture) {
         copy_surface_to_texture(pg, surface, snode);
     } else {
-        upload_texture_image(pg, texture_idx, snode);
+        upload_texture_image(pg, snode);
         snode->draw_time = 0;
     }
 
     NV2A_VK_DGROUP_END();
 }
 
+/*
+ * Bind the palette of an I8 texture that is resolved in the fragment shader.
+ * Palettes are cached with the textures, keyed by their location in VRAM, so a
+ * palette change only re-uploads the palette.
+ */
+static void create_palette_texture(PGRAPHState *pg, int texture_idx)
+{
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    size_t palette_length;
+    hwaddr palette_vram_offset = pgraph_get_texture_palette_phys_addr_length(
+        pg, texture_idx, &palette_length);
+
+    TextureKey key;
+    memset(&key, 0, sizeof(key));
+    key.state = pgraph_get_texture_palette_shape(palette_length);
+    key.texture_vram_offset = palette_vram_offset;
+    key.texture_length = palette_length;
+    key.scale = 1;
+
+    uint64_t key_hash = fast_hash((void *)&key, sizeof(key));
+    LruNode *node = lru_lookup(&r->texture_cache, key_hash, &key);
+    TextureBinding *snode = container_of(node, TextureBinding, node);
+    r->palette_bindings[texture_idx] = snode;
+
+    bool binding_found = snode->image != VK_NULL_HANDLE;
+    bool possibly_dirty = !binding_found || snode->possibly_dirty;
+    possibly_dirty |= check_texture_possibly_dirty(d, snode->texture_pages,
+                                                   snode->palette_pages);
+    if (!possibly_dirty) {
+        return;
+    }
+
+    uint64_t content_hash = pgraph_texture_page_hashes_hash(
+        &r->texture_page_hashes, d->vram_ptr, palette_vram_offset,
+        palette_length);
+    snode->possibly_dirty = false;
+
+    if (binding_found) {
+        if (content_hash != snode->hash) {
+            upload_texture_image(pg, snode);
+            snode->hash = content_hash;
+        }
+        return;
+    }
+
+    memcpy(&snode->key, &key, sizeof(key));
+    snode->current_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    snode->hash = content_hash;
+    snode->draw_time = 0;
+
+    VkColorFormatInfo vkf = kelvin_color_format_vk_map[key.state.color_format];
+
+    VkImageCreateInfo image_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent.width = key.state.width,
+        .extent.height = 1,
+        .extent.depth = 1,
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .format = vkf.vk_format,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VmaAllocationCreateInfo alloc_create_info = {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+
+    VmaAllocationInfo alloc_info;
+    VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
+                            &alloc_create_info, &snode->image,
+                            &snode->allocation, &alloc_info));
+    lru_set_node_size(&r->texture_cache, &snode->node, alloc_info.size);
+
+    VkImageViewCreateInfo image_view_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = snode->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = vkf.vk_format,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.baseMipLevel = 0,
+        .subresourceRange.levelCount = 1,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = 1,
+        .components = vkf.component_map,
+    };
+
+    VK_CHECK(vkCreateImageView(r->device, &image_view_create_info, NULL,
+                               &snode->image_view));
+
+    VkSamplerCreateInfo sampler_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .anisotropyEnable = VK_FALSE,
+        .borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+        .unnormalizedCoordinates = VK_FALSE,
+        .compareEnable = VK_FALSE,
+        .compareOp = VK_COMPARE_OP_ALWAYS,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    };
+
+    VK_CHECK(vkCreateSampler(r->device, &sampler_create_info, NULL,
+                             &snode->sampler));
+
+    set_texture_label(pg, snode);
+    upload_texture_image(pg, snode);
+}
+
 static bool check_textures_dirty(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -1406,6 +1324,9 @@ static void update_timestamps(PGRAPHVkState *r)
         if (r->texture_bindings[i]) {
             r->texture_bindings[i]->submit_time = r->submit_count;
         }
+        if (r->palette_bindings[i]) {
+            r->palette_bindings[i]->submit_time = r->submit_count;
+        }
     }
 }
 
@@ -1429,12 +1350,17 @@ void pgraph_vk_bind_textures(NV2AState *d)
     }
 
     for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        r->palette_bindings[i] = &r->dummy_texture;
+
         if (!pgraph_is_texture_enabled(pg, i)) {
             r->texture_bindings[i] = &r->dummy_texture;
             continue;
         }
 
         create_texture(pg, i);
+        if (pgraph_is_texture_palette_lookup_enabled(pg, i)) {
+            create_palette_texture(pg, i);
+        }
 
         pg->texture_dirty[i] = false; // FIXME: Move to renderer?
     }
@@ -1447,6 +1373,12 @@ void pgraph_vk_bind_textures(NV2AState *d)
 static void texture_cache_entry_init(Lru *lru, LruNode *node, const void *state)
 {
     TextureBinding *snode = container_of(node, TextureBinding, node);
+    const TextureKey *key = state;
+
+    snode->texture_pages = pgraph_texture_page_range(key->texture_vram_offset,
+                                                     key->texture_length);
+    snode->palette_pages = pgraph_texture_page_range(key->palette_vram_offset,
+                                                     key->palette_length);
 
     snode->image = VK_NULL_HANDLE;
     snode->allocation = VK_NULL_HANDLE;
@@ -1477,7 +1409,8 @@ static bool texture_cache_entry_pre_evict(Lru *lru, LruNode *node)
 
     // Currently bound
     for (int i = 0; i < ARRAY_SIZE(r->texture_bindings); i++) {
-        if (r->texture_bindings[i] == snode) {
+        if (r->texture_bindings[i] == snode ||
+            r->palette_bindings[i] == snode) {
             return false;
         }
     }
@@ -1487,6 +1420,12 @@ static bool texture_cache_entry_pre_evict(Lru *lru, LruNode *node)
         return false;
     }
 
+    // Used by a submitted frame which may still be executing
+    if (snode->submit_time >= r->completed_submit_count &&
+        snode->submit_time < r->submit_count) {
+        return false;
+    }
+
     return true;
 }
 
@@ -1508,6 +1447,7 @@ static void texture_cache_init(PGRAPHVkState *r)
 {
     const size_t texture_cache_size = 1024;
     lru_init(&r->texture_cache);
+    r->texture_cache.max_size = TEXTURE_CACHE_MAX_SIZE;
     r->texture_cache_entries = g_malloc_n(texture_cache_size, sizeof(TextureBinding));
     assert(r->texture_cache_entries != NULL);
     for (int i = 0; i < texture_cache_size; i++) {
@@ -1522,6 +1462,7 @@ static void texture_cache_init(PGRAPHVkState *r)
 static void texture_cache_finalize(PGRAPHVkState *r)
 {
     lru_flush(&r->texture_cache);
+    lru_destroy(&r->texture_cache);
     g_free(r->texture_cache_entries);
     r->texture_cache_entries = NULL;
 }
@@ -1549,6 +1490,10 @@ void pgraph_vk_init_textures(PGRAPHState *pg)
     texture_cache_init(r);
     create_dummy_texture(pg);
 
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
+    pgraph_texture_page_hashes_init(&r->texture_page_hashes,
+                                    memory_region_size(d->vram));
+
     r->texture_format_properties = g_malloc0_n(
         ARRAY_SIZE(kelvin_color_format_vk_map), sizeof(VkFormatProperties));
     for (int i = 0; i < ARRAY_SIZE(kelvin_color_format_vk_map); i++) {
@@ -1556,6 +1501,8 @@ void pgraph_vk_init_textures(PGRAPHState *pg)
             r->physical_device, kelvin_color_format_vk_map[i].vk_format,
             &r->texture_format_properties[i]);
     }
+
+    init_bc_texture_support(r);
 }
 
 void pgraph_vk_finalize_textures(PGRAPHState *pg)
@@ -1566,10 +1513,12 @@ void pgraph_vk_finalize_textures(PGRAPHState *pg)
 
     for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
         r->texture_bindings[i] = NULL;
+        r->palette_bindings[i] = NULL;
     }
 
     destroy_dummy_texture(r);
     texture_cache_finalize(r);
+    pgraph_texture_page_hashes_finalize(&r->texture_page_hashes);
 
     assert(r->texture_cache.num_used == 0);
 
@@ -42,6 +42,16 @@ VkDeviceSize pgraph_vk_update_vertex_inline_buffer(PGRAPHState *pg, void **data,
                                       sizes, count, 1);
 }
 
+bool pgraph_vk_is_vertex_ram_buffer_stale(PGRAPHVkState *r, hwaddr offset,
+                                          VkDeviceSize size)
+{
+    size_t start_bit = offset / TARGET_PAGE_SIZE;
+    size_t end_bit = MIN(TARGET_PAGE_ALIGN(offset + size) / TARGET_PAGE_SIZE,
+                         r->bitmap_size);
+
+    return find_next_bit(r->stale_bitmap, end_bit, start_bit) < end_bit;
+}
+
 void pgraph_vk_update_vertex_ram_buffer(PGRAPHState *pg, hwaddr offset,
                                         void *data, VkDeviceSize size)
 {
@@ -55,15 +65,53 @@ void pgraph_vk_update_vertex_ram_buffer(PGRAPHState *pg, hwaddr offset,
 
     if (find_next_bit(r->uploaded_bitmap, start_bit + nbits, start_bit) <
         end_bit) {
-        // Vertex data changed while building the draw list. Finish drawing
-        // before updating RAM buffer.
-        pgraph_vk_finish(pg, VK_FINISH_REASON_VERTEX_BUFFER_DIRTY);
+        // Vertex data changed while building the draw list. Earlier draws
+        // still read the old contents, so leave the RAM buffer alone and have
+        // later draws copy these pages to the inline buffer until the next
+        // draw list.
+        nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1_STALE);
+        bitmap_set(r->stale_bitmap, start_bit, nbits);
+        return;
+    }
+
+    uint8_t *dst = r->storage_buffers[BUFFER_VERTEX_RAM].mapped + offset;
+
+    // Submitted frames read the RAM buffer directly, so the last one to read
+    // these pages must complete before they are overwritten with different
+    // data.
+    bool in_flight = false;
+    uint32_t last_submit = 0;
+    for (size_t i = start_bit; i < MIN(end_bit, r->bitmap_size); i++) {
+        uint32_t submit = r->page_submit_times[i];
+        if (submit >= r->completed_submit_count && submit < r->submit_count) {
+            in_flight = true;
+            last_submit = MAX(last_submit, submit);
+        }
+    }
+    if (in_flight && memcmp(dst, data, size)) {
+        pgraph_vk_wait_for_submit(r, last_submit);
     }
 
     nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1);
-    memcpy(r->storage_buffers[BUFFER_VERTEX_RAM].mapped + offset, data, size);
+    memcpy(dst, data, size);
 
     bitmap_set(r->uploaded_bitmap, start_bit, nbits);
+    bitmap_clear(r->stale_bitmap, start_bit, nbits);
+}
+
+void pgraph_vk_mark_vertex_ram_buffer_used(PGRAPHVkState *r, hwaddr offset,
+                                          VkDeviceSize size)
+{
+    size_t start_bit = offset / TARGET_PAGE_SIZE;
+    size_t end_bit = MIN(TARGET_PAGE_ALIGN(offset + size) / TARGET_PAGE_SIZE,
+                         r->bitmap_size);
+
+    // Later changes to these pages in this draw list must not overwrite what
+    // earlier draws read
+    bitmap_set(r->uploaded_bitmap, start_bit, end_bit - start_bit);
+    for (size_t i = start_bit; i < end_bit; i++) {
+        r->page_submit_times[i] = r->submit_count;
+    }
 }
 
 static void update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size)
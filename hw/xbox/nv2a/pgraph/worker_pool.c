@@ -0,0 +1,132 @@
+/*
+ * Geforce NV2A PGRAPH worker pool
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "worker_pool.h"
+
+static void run_jobs(PGRAPHWorkerPool *pool)
+{
+    int index;
+    while ((index = qatomic_fetch_inc(&pool->next_job)) < pool->num_jobs) {
+        pool->func(pool->opaque, index);
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    PGRAPHWorkerPool *pool = arg;
+    unsigned int generation = 0;
+
+    qemu_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->generation == generation && !pool->shutdown) {
+            qemu_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        generation = pool->generation;
+        qemu_mutex_unlock(&pool->lock);
+
+        run_jobs(pool);
+
+        qemu_mutex_lock(&pool->lock);
+        if (--pool->num_busy == 0) {
+            qemu_cond_signal(&pool->done_cond);
+        }
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/*
+ * Run func(opaque, i) for i in [0, num_jobs) across the worker pool and the
+ * calling thread, returning once every job has completed.
+ */
+void pgraph_worker_pool_run(PGRAPHWorkerPool *pool, int num_jobs,
+                            PGRAPHJobFunc func, void *opaque)
+{
+    if (num_jobs <= 0) {
+        return;
+    }
+
+    if (num_jobs == 1 || pool->num_threads == 0) {
+        for (int i = 0; i < num_jobs; i++) {
+            func(opaque, i);
+        }
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    pool->func = func;
+    pool->opaque = opaque;
+    pool->num_jobs = num_jobs;
+    pool->next_job = 0;
+    pool->num_busy = pool->num_threads;
+    pool->generation++;
+    qemu_cond_broadcast(&pool->work_cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    run_jobs(pool);
+
+    qemu_mutex_lock(&pool->lock);
+    while (pool->num_busy > 0) {
+        qemu_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void pgraph_worker_pool_init(PGRAPHWorkerPool *pool, const char *name,
+                             int num_threads)
+{
+    qemu_mutex_init(&pool->lock);
+    qemu_cond_init(&pool->work_cond);
+    qemu_cond_init(&pool->done_cond);
+    pool->generation = 0;
+    pool->num_busy = 0;
+    pool->shutdown = false;
+
+    pool->num_threads = num_threads;
+    pool->threads = g_malloc_n(MAX(1, pool->num_threads), sizeof(QemuThread));
+    for (int i = 0; i < pool->num_threads; i++) {
+        g_autofree char *thread_name = g_strdup_printf("%s%d", name, i);
+        qemu_thread_create(&pool->threads[i], thread_name, worker_thread, pool,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+void pgraph_worker_pool_finalize(PGRAPHWorkerPool *pool)
+{
+    qemu_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    qemu_cond_broadcast(&pool->work_cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        qemu_thread_join(&pool->threads[i]);
+    }
+    g_free(pool->threads);
+    pool->threads = NULL;
+
+    qemu_cond_destroy(&pool->done_cond);
+    qemu_cond_destroy(&pool->work_cond);
+    qemu_mutex_destroy(&pool->lock);
+}
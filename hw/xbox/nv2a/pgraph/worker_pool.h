@@ -0,0 +1,50 @@
+/*
+ * Geforce NV2A PGRAPH worker pool
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_WORKER_POOL_H
+#define HW_XBOX_NV2A_PGRAPH_WORKER_POOL_H
+
+#include "qemu/thread.h"
+
+typedef void (*PGRAPHJobFunc)(void *opaque, int index);
+
+typedef struct PGRAPHWorkerPool {
+    QemuThread *threads;
+    int num_threads;
+
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    unsigned int generation;
+    int num_busy;
+    bool shutdown;
+
+    PGRAPHJobFunc func;
+    void *opaque;
+    int num_jobs;
+    int next_job;
+} PGRAPHWorkerPool;
+
+void pgraph_worker_pool_init(PGRAPHWorkerPool *pool, const char *name,
+                             int num_threads);
+void pgraph_worker_pool_finalize(PGRAPHWorkerPool *pool);
+void pgraph_worker_pool_run(PGRAPHWorkerPool *pool, int num_jobs,
+                            PGRAPHJobFunc func, void *opaque);
+
+#endif
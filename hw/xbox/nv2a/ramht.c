@@ -0,0 +1,101 @@
+/*
+ * QEMU Geforce NV2A RAMHT object handle lookup
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+
+#include "ramht.h"
+#include "nv2a_regs.h"
+
+static uint32_t get_le32(const uint8_t *b)
+{
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+uint32_t ramht_hash(uint32_t ramht_size, unsigned int channel_id,
+                    uint32_t handle)
+{
+    /* XXX: Think this is different to what nouveau calculates... */
+    unsigned int bits = __builtin_ctz(ramht_size)-1;
+
+    uint32_t hash = 0;
+    while (handle) {
+        hash ^= (handle & ((1 << bits) - 1));
+        handle >>= bits;
+    }
+
+    hash ^= channel_id << (bits - 4);
+
+    return hash;
+}
+
+void ramht_cache_invalidate(RAMHTCache *cache)
+{
+    for (int i = 0; i < RAMHT_CACHE_SIZE; i++) {
+        cache->entries[i].valid = false;
+    }
+}
+
+RAMHTEntry ramht_cache_lookup(RAMHTCache *cache, const RAMHTTable *table,
+                              unsigned int channel_id, uint32_t handle)
+{
+    assert(table->address < table->ramin_size);
+
+    /* Drop cached handles if the guest wrote to the hash table */
+    uint32_t watched_size = table->ramin_size - table->address;
+    if (table->size < watched_size) {
+        watched_size = table->size;
+    }
+    if (cache->test_and_clear_dirty(cache->opaque, table->address,
+                                    watched_size)) {
+        ramht_cache_invalidate(cache);
+    }
+
+    RAMHTCacheEntry *cached =
+        &cache->entries[(handle ^ (handle >> 8) ^ (handle >> 16) ^
+                         channel_id) % RAMHT_CACHE_SIZE];
+
+    if (cached->valid && cached->handle == handle &&
+        cached->channel_id == channel_id) {
+        return cached->entry;
+    }
+
+    uint32_t hash = ramht_hash(table->size, channel_id, handle);
+    assert(hash * 8 < table->size);
+    assert(table->address + hash * 8 < table->ramin_size);
+
+    const uint8_t *entry_ptr = table->ramin + table->address + hash * 8;
+
+    uint32_t entry_handle = get_le32(entry_ptr);
+    uint32_t entry_context = get_le32(entry_ptr + 4);
+
+    *cached = (RAMHTCacheEntry){
+        .handle = handle,
+        .channel_id = channel_id,
+        .valid = true,
+        .entry = {
+            .handle = entry_handle,
+            .instance = (entry_context & NV_RAMHT_INSTANCE) << 4,
+            .engine = (entry_context & NV_RAMHT_ENGINE) >> 16,
+            .channel_id = (entry_context & NV_RAMHT_CHID) >> 24,
+            .valid = entry_context & NV_RAMHT_STATUS,
+        },
+    };
+
+    return cached->entry;
+}
@@ -0,0 +1,77 @@
+/*
+ * QEMU Geforce NV2A RAMHT object handle lookup
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_RAMHT_H
+#define HW_XBOX_NV2A_RAMHT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The pusher resolves object handles through the hash table the guest keeps
+ * in RAMIN, caching what it found. The guest may rebind a handle at any time,
+ * including while the pusher is working through a pushbuffer, so every lookup
+ * first asks the owner whether the table was written since the last one.
+ *
+ * Nothing here depends on the rest of QEMU, so the cache can be tested on its
+ * own.
+ */
+
+typedef struct RAMHTEntry {
+    uint32_t handle;
+    uint32_t instance;
+    unsigned int engine; /* enum FIFOEngine */
+    unsigned int channel_id : 5;
+    bool valid;
+} RAMHTEntry;
+
+#define RAMHT_CACHE_SIZE 64 /* Direct mapped */
+
+typedef struct RAMHTCacheEntry {
+    uint32_t handle;
+    unsigned int channel_id;
+    bool valid;
+    RAMHTEntry entry;
+} RAMHTCacheEntry;
+
+typedef struct RAMHTCache {
+    RAMHTCacheEntry entries[RAMHT_CACHE_SIZE];
+
+    /* Returns true if [offset, offset + size) of RAMIN was written since the
+     * previous call, clearing the record */
+    bool (*test_and_clear_dirty)(void *opaque, uint32_t offset, uint32_t size);
+    void *opaque;
+} RAMHTCache;
+
+/* The hash table as currently configured in NV_PFIFO_RAMHT */
+typedef struct RAMHTTable {
+    const uint8_t *ramin;
+    uint32_t ramin_size;
+    uint32_t address;
+    uint32_t size;
+} RAMHTTable;
+
+uint32_t ramht_hash(uint32_t ramht_size, unsigned int channel_id,
+                    uint32_t handle);
+void ramht_cache_invalidate(RAMHTCache *cache);
+RAMHTEntry ramht_cache_lookup(RAMHTCache *cache, const RAMHTTable *table,
+                              unsigned int channel_id, uint32_t handle);
+
+#endif
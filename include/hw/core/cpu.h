@@ -31,6 +31,7 @@
 #include "qapi/qapi-types-machine.h"
 #include "qapi/qapi-types-run-state.h"
 #include "qemu/bitmap.h"
+#include "qemu/interval-tree.h"
 #include "qemu/rcu_queue.h"
 #include "qemu/queue.h"
 #include "qemu/lockcnt.h"
@@ -361,7 +362,7 @@ typedef struct MemAccessCallback {
     hwaddr len;
     MemAccessCallbackFunc func;
     void *opaque;
-    QTAILQ_ENTRY(MemAccessCallback) entry;
+    IntervalTreeNode itree; /* Keyed by ram_addr range */
 } MemAccessCallback;
 #endif
 
@@ -546,7 +547,7 @@ struct CPUState {
     QTAILQ_HEAD(, CPUWatchpoint) watchpoints;
     CPUWatchpoint *watchpoint_hit;
 
-    QTAILQ_HEAD(, MemAccessCallback) mem_access_callbacks;
+    IntervalTreeRoot mem_access_callbacks;
 
     void *opaque;
 
@@ -27,24 +27,44 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include "qemu/host-utils.h"
 #include "qemu/queue.h"
 
-#define LRU_NUM_BINS (1<<16)
-
 typedef struct LruNode {
 	QTAILQ_ENTRY(LruNode) next_global;
-	QTAILQ_ENTRY(LruNode) next_bin;
 	uint64_t hash;
+	size_t size;
+	bool in_use;
+	bool pinned;
 } LruNode;
 
 typedef struct Lru Lru;
 
+/*
+ * Nodes are preallocated by the user and handed over with lru_add_free. In-use
+ * nodes are indexed by an open addressing hash table that is kept at most half
+ * full, and each node lives on exactly one of three lists:
+ *
+ *   free    Unused nodes, handed out before anything is evicted
+ *   global  In-use nodes, most recently used first
+ *   pinned  In-use nodes that refused eviction, skipped until `global` runs
+ *           out of candidates or they are looked up again
+ */
 struct Lru {
+	LruNode **table;
+	unsigned int table_mask;
+	QTAILQ_HEAD(, LruNode) free;
 	QTAILQ_HEAD(, LruNode) global;
-	QTAILQ_HEAD(, LruNode) bins[LRU_NUM_BINS];
+	QTAILQ_HEAD(, LruNode) pinned;
 	int num_used;
 	int num_free;
 
+	/* Sum of node sizes, see lru_set_node_size. */
+	size_t used_size;
+
+	/* Optional. Evict nodes to keep `used_size` within this many bytes. */
+	size_t max_size;
+
 	/* Initialize a node. */
 	void (*init_node)(Lru *lru, LruNode *node, const void *key);
 
@@ -61,42 +81,118 @@ struct Lru {
 static inline
 void lru_init(Lru *lru)
 {
+	lru->table = NULL;
+	lru->table_mask = 0;
+	QTAILQ_INIT(&lru->free);
 	QTAILQ_INIT(&lru->global);
-	for (unsigned int i = 0; i < LRU_NUM_BINS; i++) {
-		QTAILQ_INIT(&lru->bins[i]);
-	}
+	QTAILQ_INIT(&lru->pinned);
 	lru->init_node = NULL;
 	lru->compare_nodes = NULL;
 	lru->pre_node_evict = NULL;
 	lru->post_node_evict = NULL;
 	lru->num_free = 0;
 	lru->num_used = 0;
+	lru->used_size = 0;
+	lru->max_size = 0;
 }
 
+/* Frees the hash table. Nodes remain owned by the user. */
 static inline
-void lru_add_free(Lru *lru, LruNode *node)
+void lru_destroy(Lru *lru)
 {
-	node->next_bin.tqe_circ.tql_prev = NULL;
-	QTAILQ_INSERT_TAIL(&lru->global, node, next_global);
-	lru->num_free += 1;
+	g_free(lru->table);
+	lru->table = NULL;
+	lru->table_mask = 0;
+}
+
+static inline
+unsigned int lru_hash_to_slot(Lru *lru, uint64_t hash)
+{
+	return (hash * 0x9e3779b97f4a7c15ULL) >> 32 & lru->table_mask;
+}
+
+static inline
+void lru_table_insert(Lru *lru, LruNode *node)
+{
+	unsigned int slot = lru_hash_to_slot(lru, node->hash);
+
+	while (lru->table[slot]) {
+		slot = (slot + 1) & lru->table_mask;
+	}
+	lru->table[slot] = node;
+}
+
+static inline
+void lru_table_remove(Lru *lru, LruNode *node)
+{
+	unsigned int hole = lru_hash_to_slot(lru, node->hash);
+
+	while (lru->table[hole] != node) {
+		assert(lru->table[hole] != NULL);
+		hole = (hole + 1) & lru->table_mask;
+	}
+
+	/* Shift later entries of the probe sequence back instead of leaving a
+	 * tombstone */
+	for (unsigned int slot = (hole + 1) & lru->table_mask; lru->table[slot];
+	     slot = (slot + 1) & lru->table_mask) {
+		unsigned int home = lru_hash_to_slot(lru, lru->table[slot]->hash);
+		if (((slot - home) & lru->table_mask) >=
+			((slot - hole) & lru->table_mask)) {
+			lru->table[hole] = lru->table[slot];
+			hole = slot;
+		}
+	}
+	lru->table[hole] = NULL;
 }
 
 static inline
-unsigned int lru_hash_to_bin(Lru *lru, uint64_t hash)
+void lru_table_resize(Lru *lru, unsigned int num_slots)
 {
-	return hash % LRU_NUM_BINS;
+	LruNode *iter;
+
+	g_free(lru->table);
+	lru->table = g_new0(LruNode *, num_slots);
+	lru->table_mask = num_slots - 1;
+
+	QTAILQ_FOREACH(iter, &lru->global, next_global) {
+		lru_table_insert(lru, iter);
+	}
+	QTAILQ_FOREACH(iter, &lru->pinned, next_global) {
+		lru_table_insert(lru, iter);
+	}
 }
 
 static inline
-unsigned int lru_get_node_bin(Lru *lru, LruNode *node)
+void lru_add_free(Lru *lru, LruNode *node)
 {
-	return lru_hash_to_bin(lru, node->hash);
+	node->size = 0;
+	node->in_use = false;
+	node->pinned = false;
+	QTAILQ_INSERT_TAIL(&lru->free, node, next_global);
+	lru->num_free += 1;
+
+	unsigned int num_nodes = lru->num_free + lru->num_used;
+	if (!lru->table || num_nodes * 2 > lru->table_mask + 1) {
+		lru_table_resize(lru, pow2ceil(MAX(num_nodes * 2, 16)));
+	}
 }
 
 static inline
 bool lru_is_node_in_use(Lru *lru, LruNode *node)
 {
-	return QTAILQ_IN_USE(node, next_bin);
+	return node->in_use;
+}
+
+static inline
+void lru_unlink_node(Lru *lru, LruNode *node)
+{
+	if (node->pinned) {
+		QTAILQ_REMOVE(&lru->pinned, node, next_global);
+		node->pinned = false;
+	} else {
+		QTAILQ_REMOVE(&lru->global, node, next_global);
+	}
 }
 
 static inline
@@ -106,32 +202,70 @@ void lru_evict_node(Lru *lru, LruNode *node)
 		return;
 	}
 
-	unsigned int bin = lru_get_node_bin(lru, node);
-	QTAILQ_REMOVE(&lru->bins[bin], node, next_bin);
+	lru_table_remove(lru, node);
+	lru_unlink_node(lru, node);
+	node->in_use = false;
 	if (lru->post_node_evict) {
 		lru->post_node_evict(lru, node);
 	}
 
+	lru->used_size -= node->size;
+	node->size = 0;
+	QTAILQ_INSERT_HEAD(&lru->free, node, next_global);
+
 	lru->num_used -= 1;
 	lru->num_free += 1;
 }
 
+/* Returns pinned nodes to the cold end of the list for another chance */
 static inline
-LruNode *lru_try_evict_one(Lru *lru)
+void lru_unpin_all(Lru *lru)
 {
-	LruNode *found;
+	LruNode *iter;
 
-	QTAILQ_FOREACH_REVERSE(found, &lru->global, next_global) {
-		if (lru_is_node_in_use(lru, found)
-			&& (!lru->pre_node_evict || lru->pre_node_evict(lru, found))) {
-			lru_evict_node(lru, found);
-			return found;
+	while ((iter = QTAILQ_FIRST(&lru->pinned))) {
+		QTAILQ_REMOVE(&lru->pinned, iter, next_global);
+		iter->pinned = false;
+		QTAILQ_INSERT_TAIL(&lru->global, iter, next_global);
+	}
+}
+
+static inline
+LruNode *lru_try_evict_one_except(Lru *lru, LruNode *except)
+{
+	LruNode *found, *prev;
+
+	for (int pass = 0; pass < 2; pass++) {
+		QTAILQ_FOREACH_REVERSE_SAFE(found, &lru->global, next_global, prev) {
+			if (found == except) {
+				continue;
+			}
+			if (!lru->pre_node_evict || lru->pre_node_evict(lru, found)) {
+				lru_evict_node(lru, found);
+				return found;
+			}
+
+			/* Park it so later evictions do not scan it again */
+			QTAILQ_REMOVE(&lru->global, found, next_global);
+			QTAILQ_INSERT_HEAD(&lru->pinned, found, next_global);
+			found->pinned = true;
 		}
+
+		if (QTAILQ_EMPTY(&lru->pinned)) {
+			break;
+		}
+		lru_unpin_all(lru);
 	}
 
 	return NULL;
 }
 
+static inline
+LruNode *lru_try_evict_one(Lru *lru)
+{
+	return lru_try_evict_one_except(lru, NULL);
+}
+
 static inline
 LruNode *lru_evict_one(Lru *lru)
 {
@@ -145,28 +279,44 @@ LruNode *lru_evict_one(Lru *lru)
 static inline
 LruNode *lru_get_one_free(Lru *lru)
 {
-	LruNode *found;
+	LruNode *found = QTAILQ_FIRST(&lru->free);
 
-	QTAILQ_FOREACH_REVERSE(found, &lru->global, next_global) {
-		if (!lru_is_node_in_use(lru, found)) {
-			return found;
-		}
+	if (found) {
+		return found;
 	}
 
 	return lru_evict_one(lru);
 }
 
+/* Records the memory held by an in-use node and evicts other nodes, least
+ * recently used first, until the cache is back within `max_size`.
+ */
+static inline
+void lru_set_node_size(Lru *lru, LruNode *node, size_t size)
+{
+	assert(lru_is_node_in_use(lru, node));
+
+	lru->used_size = lru->used_size - node->size + size;
+	node->size = size;
+
+	while (lru->max_size && lru->used_size > lru->max_size &&
+		   lru_try_evict_one_except(lru, node)) {
+	}
+}
+
 static inline
 bool lru_contains_hash(Lru *lru, uint64_t hash)
 {
-	unsigned int bin = lru_hash_to_bin(lru, hash);
-	LruNode *iter;
+	if (!lru->table) {
+		return false;
+	}
 
-	QTAILQ_FOREACH(iter, &lru->bins[bin], next_bin) {
-        if (iter->hash == hash) {
-            return true;
-        }
-    }
+	for (unsigned int slot = lru_hash_to_slot(lru, hash); lru->table[slot];
+	     slot = (slot + 1) & lru->table_mask) {
+		if (lru->table[slot]->hash == hash) {
+			return true;
+		}
+	}
 
 	return false;
 }
@@ -174,33 +324,35 @@ bool lru_contains_hash(Lru *lru, uint64_t hash)
 static inline
 LruNode *lru_lookup(Lru *lru, uint64_t hash, const void *key)
 {
-	unsigned int bin = lru_hash_to_bin(lru, hash);
-	LruNode *iter, *found = NULL;
-
-	QTAILQ_FOREACH(iter, &lru->bins[bin], next_bin) {
-        if ((iter->hash == hash) && !lru->compare_nodes(lru, iter, key)) {
-            found = iter;
-            break;
-        }
-    }
+	LruNode *found = NULL;
+
+	for (unsigned int slot = lru_hash_to_slot(lru, hash); lru->table[slot];
+	     slot = (slot + 1) & lru->table_mask) {
+		LruNode *iter = lru->table[slot];
+		if ((iter->hash == hash) && !lru->compare_nodes(lru, iter, key)) {
+			found = iter;
+			break;
+		}
+	}
 
 	if (found) {
-		QTAILQ_REMOVE(&lru->bins[bin], found, next_bin);
+		lru_unlink_node(lru, found);
 	} else {
 		found = lru_get_one_free(lru);
+		QTAILQ_REMOVE(&lru->free, found, next_global);
 		found->hash = hash;
+		found->in_use = true;
 		if (lru->init_node) {
 			lru->init_node(lru, found, key);
 		}
 		assert(found->hash == hash);
+		lru_table_insert(lru, found);
 
 		lru->num_used += 1;
 		lru->num_free -= 1;
 	}
 
-	QTAILQ_REMOVE(&lru->global, found, next_global);
 	QTAILQ_INSERT_HEAD(&lru->global, found, next_global);
-	QTAILQ_INSERT_HEAD(&lru->bins[bin], found, next_bin);
 
 	return found;
 }
@@ -210,17 +362,11 @@ void lru_flush(Lru *lru)
 {
 	LruNode *iter, *iter_next;
 
-	for (unsigned int bin = 0; bin < LRU_NUM_BINS; bin++) {
-		QTAILQ_FOREACH_SAFE(iter, &lru->bins[bin], next_bin, iter_next) {
-			bool can_evict = true;
-			if (lru->pre_node_evict) {
-				can_evict = lru->pre_node_evict(lru, iter);
-			}
-			if (can_evict) {
-				lru_evict_node(lru, iter);
-				QTAILQ_REMOVE(&lru->global, iter, next_global);
-				QTAILQ_INSERT_TAIL(&lru->global, iter, next_global);
-			}
+	lru_unpin_all(lru);
+
+	QTAILQ_FOREACH_SAFE(iter, &lru->global, next_global, iter_next) {
+		if (!lru->pre_node_evict || lru->pre_node_evict(lru, iter)) {
+			lru_evict_node(lru, iter);
 		}
 	}
 }
@@ -232,10 +378,11 @@ void lru_visit_active(Lru *lru, LruNodeVisitorFunc visitor_func, void *opaque)
 {
 	LruNode *iter, *iter_next;
 
-	for (unsigned int bin = 0; bin < LRU_NUM_BINS; bin++) {
-		QTAILQ_FOREACH_SAFE(iter, &lru->bins[bin], next_bin, iter_next) {
-			visitor_func(lru, iter, opaque);
-		}
+	QTAILQ_FOREACH_SAFE(iter, &lru->global, next_global, iter_next) {
+		visitor_func(lru, iter, opaque);
+	}
+	QTAILQ_FOREACH_SAFE(iter, &lru->pinned, next_global, iter_next) {
+		visitor_func(lru, iter, opaque);
 	}
 }
 
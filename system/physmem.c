@@ -844,34 +844,42 @@ AddressSpace *cpu_get_address_space(CPUState *cpu, int asidx)
 
 #ifdef XBOX
 
-static inline bool access_callback_address_matches(MemAccessCallback *cb,
-                                                   hwaddr addr, hwaddr len)
+int mem_access_callback_address_matches(CPUState *cpu, hwaddr addr, hwaddr len)
 {
-    hwaddr watch_end = cb->addr + cb->len - 1;
-    hwaddr access_end = addr + len - 1;
+    if (interval_tree_iter_first(&cpu->mem_access_callbacks, addr,
+                                 addr + len - 1)) {
+        return BP_MEM_READ | BP_MEM_WRITE;
+    }
 
-    return !(addr > watch_end || cb->addr > access_end);
+    return 0;
 }
 
-int mem_access_callback_address_matches(CPUState *cpu, hwaddr addr, hwaddr len)
+/*
+ * Drop the TLB entries covering a watched range so the next access refills
+ * them with (or without) the watchpoint flag. The range is known only by
+ * ram_addr, so entries are matched by host address rather than flushed by
+ * guest virtual page.
+ */
+static void mem_access_callback_flush_tlb(MemAccessCallback *cb)
 {
-    int ret = 0;
+    ram_addr_t start = cb->addr & TARGET_PAGE_MASK;
+    ram_addr_t end = TARGET_PAGE_ALIGN(cb->addr + cb->len);
+    uintptr_t host;
+    CPUState *cpu;
 
-    MemAccessCallback *cb;
-    QTAILQ_FOREACH(cb, &cpu->mem_access_callbacks, entry) {
-        if (access_callback_address_matches(cb, addr, len)) {
-            ret |= BP_MEM_READ | BP_MEM_WRITE;
-        }
+    RCU_READ_LOCK_GUARD();
+    host = (uintptr_t)qemu_map_ram_ptr(NULL, start);
+    CPU_FOREACH(cpu) {
+        tlb_flush_host_range(cpu, host, end - start);
     }
-
-    return ret;
 }
 
 static void do_mem_access_callback_insert(CPUState *cpu, run_on_cpu_data data)
 
 {
     MemAccessCallback *cb = (MemAccessCallback *)data.host_ptr;
-    QTAILQ_INSERT_TAIL(&cpu->mem_access_callbacks, cb, entry);
+    interval_tree_insert(&cb->itree, &cpu->mem_access_callbacks);
+    mem_access_callback_flush_tlb(cb);
 }
 
 MemAccessCallback *mem_access_callback_insert(CPUState *cpu, MemoryRegion *mr,
@@ -887,13 +895,12 @@ MemAccessCallback *mem_access_callback_insert(CPUState *cpu, MemoryRegion *mr,
     cb->len = len;
     cb->func = func;
     cb->opaque = opaque;
+    cb->itree.start = cb->addr;
+    cb->itree.last = cb->addr + len - 1;
 
     async_safe_run_on_cpu(cpu, do_mem_access_callback_insert,
                           RUN_ON_CPU_HOST_PTR(cb));
 
-    // FIXME: flush only applicable pages
-    tlb_flush_all_cpus_synced(cpu);
-
     return cb;
 }
 
@@ -901,7 +908,8 @@ static void do_mem_access_callback_remove_by_ref(CPUState *cpu,
                                                  run_on_cpu_data data)
 {
     MemAccessCallback *cb = (MemAccessCallback *)data.host_ptr;
-    QTAILQ_REMOVE(&cpu->mem_access_callbacks, cb, entry);
+    interval_tree_remove(&cb->itree, &cpu->mem_access_callbacks);
+    mem_access_callback_flush_tlb(cb);
     g_free(cb);
 }
 
@@ -913,9 +921,6 @@ void mem_access_callback_remove_by_ref(CPUState *cpu, MemAccessCallback *cb)
 
     async_safe_run_on_cpu(cpu, do_mem_access_callback_remove_by_ref,
                           RUN_ON_CPU_HOST_PTR(cb));
-
-    // FIXME: flush only applicable pages
-    tlb_flush_all_cpus_synced(cpu);
 }
 
 void mem_check_access_callback_vaddr(CPUState *cpu,
@@ -930,16 +935,19 @@ void mem_check_access_callback_vaddr(CPUState *cpu,
 void mem_check_access_callback_ramaddr(CPUState *cpu,
                                        hwaddr ram_addr, vaddr len, int flags)
 {
-    MemAccessCallback *cb;
-    QTAILQ_FOREACH(cb, &cpu->mem_access_callbacks, entry) {
-        if (access_callback_address_matches(cb, ram_addr, len)) {
-            ram_addr_t ram_addr_base = memory_region_get_ram_addr(cb->mr);
-            assert(ram_addr_base != RAM_ADDR_INVALID);
-            ram_addr_t hit_addr = MAX(ram_addr, cb->addr);
-            hwaddr mr_offset = hit_addr - ram_addr_base;
-            bool is_write = (flags & BP_MEM_WRITE) != 0;
-            cb->func(cb->opaque, cb->mr, mr_offset, len, is_write);
-        }
+    hwaddr last = ram_addr + len - 1;
+    IntervalTreeNode *node;
+
+    for (node = interval_tree_iter_first(&cpu->mem_access_callbacks, ram_addr,
+                                         last);
+         node; node = interval_tree_iter_next(node, ram_addr, last)) {
+        MemAccessCallback *cb = container_of(node, MemAccessCallback, itree);
+        ram_addr_t ram_addr_base = memory_region_get_ram_addr(cb->mr);
+        assert(ram_addr_base != RAM_ADDR_INVALID);
+        ram_addr_t hit_addr = MAX(ram_addr, cb->addr);
+        hwaddr mr_offset = hit_addr - ram_addr_base;
+        bool is_write = (flags & BP_MEM_WRITE) != 0;
+        cb->func(cb->opaque, cb->mr, mr_offset, len, is_write);
     }
 }
 
@@ -1059,11 +1067,13 @@ bool physical_memory_is_clean(ram_addr_t addr)
 {
     bool nv2a = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A);
     bool nv2a_tex = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A_TEX);
+    bool nv2a_capture =
+        physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A_CAPTURE);
     bool vga = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_VGA);
     bool code = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_CODE);
     bool migration =
         physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_MIGRATION);
-    return !(nv2a && nv2a_tex && vga && code && migration);
+    return !(nv2a && nv2a_tex && nv2a_capture && vga && code && migration);
 }
 
 static bool physical_memory_all_dirty(ram_addr_t start, ram_addr_t length,
@@ -1119,6 +1129,10 @@ uint8_t physical_memory_range_includes_clean(ram_addr_t start,
         !physical_memory_all_dirty(start, length, DIRTY_MEMORY_NV2A_TEX)) {
         ret |= (1 << DIRTY_MEMORY_NV2A_TEX);
     }
+    if (mask & (1 << DIRTY_MEMORY_NV2A_CAPTURE) &&
+        !physical_memory_all_dirty(start, length, DIRTY_MEMORY_NV2A_CAPTURE)) {
+        ret |= (1 << DIRTY_MEMORY_NV2A_CAPTURE);
+    }
     if (mask & (1 << DIRTY_MEMORY_VGA) &&
         !physical_memory_all_dirty(start, length, DIRTY_MEMORY_VGA)) {
         ret |= (1 << DIRTY_MEMORY_VGA);
@@ -1198,6 +1212,11 @@ void physical_memory_set_dirty_range(ram_addr_t start, ram_addr_t length,
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_NV2A_TEX]->blocks[idx],
                                   offset, next - page);
             }
+            if (unlikely(mask & (1 << DIRTY_MEMORY_NV2A_CAPTURE))) {
+                bitmap_set_atomic(
+                    blocks[DIRTY_MEMORY_NV2A_CAPTURE]->blocks[idx],
+                    offset, next - page);
+            }
 
             page = next;
             idx++;
@@ -1267,6 +1286,8 @@ static void physical_memory_clear_dirty_range(ram_addr_t addr, ram_addr_t length
     physical_memory_test_and_clear_dirty(addr, length, DIRTY_MEMORY_CODE);
     physical_memory_test_and_clear_dirty(addr, length, DIRTY_MEMORY_NV2A);
     physical_memory_test_and_clear_dirty(addr, length, DIRTY_MEMORY_NV2A_TEX);
+    physical_memory_test_and_clear_dirty(addr, length,
+                                         DIRTY_MEMORY_NV2A_CAPTURE);
 }
 
 DirtyBitmapSnapshot *physical_memory_snapshot_and_clear_dirty
@@ -1384,6 +1405,8 @@ uint64_t physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                     qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_NV2A][idx][offset], temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_NV2A_TEX][idx][offset], temp);
+                    qatomic_or(&blocks[DIRTY_MEMORY_NV2A_CAPTURE][idx][offset],
+                               temp);
 
                     if (global_dirty_tracking) {
                         qatomic_or(
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+#include "qemu/osdep.h"
+#include "qemu/lru.h"
+#include "qemu/timer.h"
+
+#define NUM_LOOKUPS (1024 * 1024)
+#define NODE_SIZE 4096
+
+enum lru_op {
+    OP_HIT,
+    OP_MISS,
+    OP_MIXED,
+    OP_SIZED,
+    OP_PINNED,
+};
+
+struct benchmark {
+    const char * const name;
+    enum lru_op op;
+};
+
+static const struct benchmark benchmarks[] = {
+    { .name = "Hit", .op = OP_HIT },
+    { .name = "Miss", .op = OP_MISS },
+    { .name = "Mixed", .op = OP_MIXED },
+    { .name = "Sized", .op = OP_SIZED },
+    { .name = "Pinned", .op = OP_PINNED },
+};
+
+typedef struct BenchNode {
+    LruNode node;
+    uint64_t key;
+} BenchNode;
+
+static void bench_node_init(Lru *lru, LruNode *node, const void *key)
+{
+    BenchNode *bnode = container_of(node, BenchNode, node);
+    bnode->key = *(const uint64_t *)key;
+}
+
+static bool bench_node_compare(Lru *lru, LruNode *node, const void *key)
+{
+    BenchNode *bnode = container_of(node, BenchNode, node);
+    return bnode->key != *(const uint64_t *)key;
+}
+
+/* Refuse to evict one in sixteen nodes, like textures bound to a draw */
+static bool bench_node_pre_evict(Lru *lru, LruNode *node)
+{
+    BenchNode *bnode = container_of(node, BenchNode, node);
+    return bnode->key % 16;
+}
+
+static uint64_t *make_keys(const struct benchmark *bench, size_t capacity)
+{
+    uint64_t *keys = g_new(uint64_t, NUM_LOOKUPS);
+    uint64_t num_keys;
+
+    switch (bench->op) {
+    case OP_HIT:
+    case OP_MIXED:
+        num_keys = capacity / 2;
+        break;
+    case OP_MISS:
+    case OP_SIZED:
+    case OP_PINNED:
+        num_keys = capacity * 4;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    for (size_t i = 0; i < NUM_LOOKUPS; i++) {
+        if (bench->op == OP_MIXED && g_random_int_range(0, 10) == 0) {
+            /* Cold key outside the hot set */
+            keys[i] = num_keys + g_random_int_range(0, capacity * 4);
+        } else {
+            keys[i] = g_random_int_range(0, num_keys);
+        }
+    }
+
+    return keys;
+}
+
+static int64_t run_benchmark(const struct benchmark *bench, size_t capacity)
+{
+    BenchNode *nodes = g_new0(BenchNode, capacity);
+    uint64_t *keys = make_keys(bench, capacity);
+    Lru lru;
+
+    lru_init(&lru);
+    for (size_t i = 0; i < capacity; i++) {
+        lru_add_free(&lru, &nodes[i].node);
+    }
+    lru.init_node = bench_node_init;
+    lru.compare_nodes = bench_node_compare;
+    if (bench->op == OP_PINNED) {
+        lru.pre_node_evict = bench_node_pre_evict;
+    }
+    if (bench->op == OP_SIZED) {
+        /* The byte budget, not the node count, limits the cache */
+        lru.max_size = capacity / 4 * NODE_SIZE;
+    }
+
+    int64_t start_ns = get_clock();
+    for (size_t i = 0; i < NUM_LOOKUPS; i++) {
+        LruNode *node = lru_lookup(&lru, keys[i], &keys[i]);
+        if (bench->op == OP_SIZED && !node->size) {
+            lru_set_node_size(&lru, node, NODE_SIZE);
+        }
+    }
+    int64_t ns = get_clock() - start_ns;
+
+    lru_flush(&lru);
+    lru_destroy(&lru);
+    g_free(keys);
+    g_free(nodes);
+
+    return ns;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t sizes[] = {
+        256,
+        1024,
+        1024 * 16,
+        1024 * 128,
+    };
+
+    printf("# Results' breakdown: Op and #Nodes. Units: Mops/s\n");
+    printf("%10s ", "Op");
+    for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+        printf("%9zu ", sizes[i]);
+    }
+    printf("\n");
+
+    for (int k = 0; k < ARRAY_SIZE(benchmarks); k++) {
+        const struct benchmark *bench = &benchmarks[k];
+
+        printf("%10s ", bench->name);
+        for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+            /* warm-up run */
+            run_benchmark(bench, sizes[i]);
+
+            int64_t total_ns = 0;
+            int64_t n_runs = 0;
+            while (total_ns < 2e8 || n_runs < 5) {
+                total_ns += run_benchmark(bench, sizes[i]);
+                n_runs++;
+            }
+            double ns_per_run = (double)total_ns / n_runs;
+
+            /* Throughput, in Mops/s */
+            printf("%9.2f ", NUM_LOOKUPS / ns_per_run * 1e3);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * Replay a short NV2A capture and check the report it produces.
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture-file.h"
+
+/* Stand-in for pgraph/profile.c, which needs the rest of QEMU */
+const char *nv2a_profile_get_counter_name(unsigned int cnt)
+{
+    static char names[NV2A_PROF__COUNT][16];
+
+    assert(cnt < NV2A_PROF__COUNT);
+    snprintf(names[cnt], sizeof(names[cnt]), "counter%u", cnt);
+    return names[cnt];
+}
+
+#define NUM_FRAMES 3
+#define VRAM_SIZE (64 * 1024 * 1024)
+#define RAMIN_SIZE (1024 * 1024)
+
+#define NV097_SET_BEGIN_END 0x000017fc
+#define NV097_FLIP_STALL 0x00000130
+
+static uint32_t method_header(uint32_t method, uint32_t count)
+{
+    return (count << 18) | method;
+}
+
+/* A capture of NUM_FRAMES frames, each a draw, a PGRAPH write and a flip */
+static void write_capture(FILE *f)
+{
+    NV2ACaptureHeader header = {
+        .magic = NV2A_CAPTURE_MAGIC,
+        .version = NV2A_CAPTURE_VERSION,
+        .vram_size = VRAM_SIZE,
+        .ramin_size = RAMIN_SIZE,
+        .snapshot_name = "nv2a-trace-test",
+    };
+    assert(nv2a_capture_write_header(f, &header));
+
+    for (uint32_t frame = 0; frame < NUM_FRAMES; frame++) {
+        uint32_t page[1024];
+        uint32_t offset = frame * sizeof(page);
+        for (int i = 0; i < 1024; i++) {
+            page[i] = frame * 1024 + i;
+        }
+        assert(nv2a_capture_write_packet(f, NV2A_CAPTURE_VRAM, &offset,
+                                         sizeof(offset), page, sizeof(page)));
+
+        uint32_t begin = method_header(NV097_SET_BEGIN_END, 1);
+        uint32_t mode = 5;
+        assert(nv2a_capture_write_packet(f, NV2A_CAPTURE_METHOD, &begin,
+                                         sizeof(begin), &mode, sizeof(mode)));
+
+        uint32_t write[2] = { 0x400100, frame };
+        assert(nv2a_capture_write_packet(f, NV2A_CAPTURE_PGRAPH_WRITE, write,
+                                         sizeof(write), NULL, 0));
+
+        uint32_t flip = method_header(NV097_FLIP_STALL, 1);
+        uint32_t zero = 0;
+        assert(nv2a_capture_write_packet(f, NV2A_CAPTURE_METHOD, &flip,
+                                         sizeof(flip), &zero, sizeof(zero)));
+    }
+}
+
+/* Reads every packet back, reporting a frame at each flip like nv2a does */
+static NV2ACaptureReadResult replay_capture(FILE *f, NV2AReplayReport *report)
+{
+    NV2ACapturePacket packet = { 0 };
+    NV2ACaptureReadResult result;
+    int counters[NV2A_PROF__COUNT];
+    unsigned int num_vram_packets = 0;
+
+    while ((result = nv2a_capture_read_packet(f, &packet)) ==
+           NV2A_CAPTURE_READ_OK) {
+        switch (packet.type) {
+        case NV2A_CAPTURE_VRAM:
+            assert(packet.num_words == 1025);
+            assert(packet.words[0] == num_vram_packets * 4096);
+            assert(packet.words[1] == num_vram_packets * 1024);
+            assert(packet.words[1024] == num_vram_packets * 1024 + 1023);
+            num_vram_packets++;
+            break;
+        case NV2A_CAPTURE_PGRAPH_WRITE:
+            assert(packet.num_words == 2);
+            assert(packet.words[1] == report->num_frames);
+            break;
+        case NV2A_CAPTURE_METHOD:
+            assert(packet.num_words == 2);
+            if ((packet.words[0] & 0x1ffc) == NV097_FLIP_STALL) {
+                for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+                    counters[i] = report->num_frames + i;
+                }
+                nv2a_replay_report_frame(report, 16.0, counters);
+            }
+            break;
+        default:
+            assert(!"unexpected packet type");
+        }
+    }
+
+    nv2a_capture_packet_free(&packet);
+    return result;
+}
+
+static void test_replay(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    FILE *f = tmpfile();
+    FILE *csv = tmpfile();
+    assert(f && csv);
+    write_capture(f);
+    rewind(f);
+
+    NV2ACaptureHeader header;
+    assert(nv2a_capture_read_header(f, &header));
+    assert(header.vram_size == VRAM_SIZE);
+    assert(header.ramin_size == RAMIN_SIZE);
+    assert(!strcmp(header.snapshot_name, "nv2a-trace-test"));
+
+    NV2AReplayReport report;
+    nv2a_replay_report_begin(&report, csv);
+    assert(replay_capture(f, &report) == NV2A_CAPTURE_READ_END);
+    assert(report.num_frames == NUM_FRAMES);
+    for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+        assert(report.counter_totals[i] == 0 + 1 + 2 + NUM_FRAMES * i);
+    }
+
+    /* One header row naming every counter, then one row per frame */
+    rewind(csv);
+    char line[4096];
+    assert(fgets(line, sizeof(line), csv));
+    assert(!strncmp(line, "frame,ms,counter0,counter1,", 27));
+    int num_columns = 1;
+    for (char *c = line; *c; c++) {
+        num_columns += *c == ',';
+    }
+    assert(num_columns == 2 + NV2A_PROF__COUNT);
+
+    for (unsigned int frame = 0; frame < NUM_FRAMES; frame++) {
+        char expected[64];
+        snprintf(expected, sizeof(expected), "%u,16.000,%u,%u,", frame, frame,
+                 frame + 1);
+        assert(fgets(line, sizeof(line), csv));
+        assert(!strncmp(line, expected, strlen(expected)));
+    }
+    assert(!fgets(line, sizeof(line), csv));
+
+    fclose(csv);
+    fclose(f);
+    fprintf(stderr, "ok!\n");
+}
+
+static void test_truncated(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    FILE *f = tmpfile();
+    assert(f);
+    write_capture(f);
+
+    /* A packet cut off in its payload, as left by a full disk */
+    uint32_t tag[2] = { NV2A_CAPTURE_VRAM, 8192 };
+    assert(fwrite(tag, sizeof(tag), 1, f) == 1);
+    assert(fwrite(tag, sizeof(tag), 1, f) == 1);
+    rewind(f);
+
+    NV2ACaptureHeader header;
+    assert(nv2a_capture_read_header(f, &header));
+
+    FILE *csv = tmpfile();
+    NV2AReplayReport report;
+    nv2a_replay_report_begin(&report, csv);
+    assert(replay_capture(f, &report) == NV2A_CAPTURE_READ_INVALID);
+    assert(report.num_frames == NUM_FRAMES);
+
+    fclose(csv);
+    fclose(f);
+    fprintf(stderr, "ok!\n");
+}
+
+static void test_bad_header(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    NV2ACaptureHeader header = {
+        .magic = NV2A_CAPTURE_MAGIC,
+        .version = NV2A_CAPTURE_VERSION + 1,
+    };
+    FILE *f = tmpfile();
+    assert(f);
+    assert(nv2a_capture_write_header(f, &header));
+    rewind(f);
+    assert(!nv2a_capture_read_header(f, &header));
+    fclose(f);
+
+    /* Too short to hold a header */
+    f = tmpfile();
+    assert(f);
+    assert(fwrite(&header, 4, 1, f) == 1);
+    rewind(f);
+    assert(!nv2a_capture_read_header(f, &header));
+    fclose(f);
+
+    fprintf(stderr, "ok!\n");
+}
+
+int main(int argc, char *argv[])
+{
+    test_replay();
+    test_truncated();
+    test_bad_header();
+    return 0;
+}
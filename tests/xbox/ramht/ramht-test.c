@@ -0,0 +1,178 @@
+/*
+ * Check that the pusher's handle cache follows guest writes to RAMHT.
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ramht.h"
+#include "nv2a_regs.h"
+
+#define RAMIN_SIZE (1024 * 1024)
+#define RAMHT_ADDRESS 0x10000
+#define RAMHT_SIZE 0x1000
+
+static uint8_t ramin[RAMIN_SIZE];
+
+/* Stand-in for the DIRTY_MEMORY_NV2A bitmap, one flag per word */
+static bool dirty[RAMIN_SIZE / 4];
+static int num_dirty_checks;
+
+static bool test_and_clear_dirty(void *opaque, uint32_t offset, uint32_t size)
+{
+    bool any = false;
+
+    num_dirty_checks++;
+    for (uint32_t i = offset / 4; i < (offset + size) / 4; i++) {
+        any |= dirty[i];
+        dirty[i] = false;
+    }
+    return any;
+}
+
+static void put_le32(uint8_t *b, uint32_t v)
+{
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+}
+
+/* A guest CPU write to RAMIN, which the dirty log sees */
+static void guest_write(uint32_t offset, uint32_t value)
+{
+    put_le32(&ramin[offset], value);
+    dirty[offset / 4] = true;
+}
+
+static void guest_bind(unsigned int channel_id, uint32_t handle,
+                       uint32_t instance)
+{
+    uint32_t offset =
+        RAMHT_ADDRESS + ramht_hash(RAMHT_SIZE, channel_id, handle) * 8;
+
+    guest_write(offset, handle);
+    guest_write(offset + 4, NV_RAMHT_STATUS | (channel_id << 24) |
+                            NV_RAMHT_ENGINE_GRAPHICS | (instance >> 4));
+}
+
+static const RAMHTTable table = {
+    .ramin = ramin,
+    .ramin_size = RAMIN_SIZE,
+    .address = RAMHT_ADDRESS,
+    .size = RAMHT_SIZE,
+};
+
+static void init_cache(RAMHTCache *cache)
+{
+    memset(ramin, 0, sizeof(ramin));
+    memset(dirty, 0, sizeof(dirty));
+    num_dirty_checks = 0;
+
+    *cache = (RAMHTCache){
+        .test_and_clear_dirty = test_and_clear_dirty,
+    };
+    ramht_cache_invalidate(cache);
+}
+
+static void test_rebind_during_run(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    RAMHTCache cache;
+    init_cache(&cache);
+    guest_bind(0, 0x97, 0x1230);
+    guest_bind(0, 0x62, 0x4560);
+
+    /*
+     * One pusher run over a pushbuffer that binds the same handle three
+     * times, with the guest rebinding it to another object after the second
+     * SET_OBJECT has been pushed. There is no DMA_PUT write or new run in
+     * between, only the next lookup.
+     */
+    uint32_t pushbuffer[] = { 0x97, 0x62, 0x97, 0, 0x97, 0x62 };
+    uint32_t expected[] = { 0x1230, 0x4560, 0x1230, 0, 0x7890, 0x4560 };
+
+    for (int i = 0; i < sizeof(pushbuffer) / sizeof(pushbuffer[0]); i++) {
+        if (!pushbuffer[i]) {
+            guest_bind(0, 0x97, 0x7890);
+            continue;
+        }
+        RAMHTEntry entry = ramht_cache_lookup(&cache, &table, 0, pushbuffer[i]);
+        assert(entry.valid);
+        assert(entry.handle == pushbuffer[i]);
+        assert(entry.engine == 1);
+        assert(entry.instance == expected[i]);
+    }
+    assert(num_dirty_checks == 5);
+
+    fprintf(stderr, "ok!\n");
+}
+
+static void test_clean_table_is_cached(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    RAMHTCache cache;
+    init_cache(&cache);
+    guest_bind(0, 0x39, 0x2000);
+    assert(ramht_cache_lookup(&cache, &table, 0, 0x39).instance == 0x2000);
+
+    /* Changed behind the dirty log's back, so the cached entry is kept */
+    uint32_t offset = RAMHT_ADDRESS + ramht_hash(RAMHT_SIZE, 0, 0x39) * 8;
+    put_le32(&ramin[offset + 4], 0);
+    assert(ramht_cache_lookup(&cache, &table, 0, 0x39).instance == 0x2000);
+
+    /* Writes elsewhere in RAMIN keep it too */
+    guest_write(RAMHT_ADDRESS + RAMHT_SIZE, 0xffffffff);
+    assert(ramht_cache_lookup(&cache, &table, 0, 0x39).instance == 0x2000);
+    guest_write(RAMHT_ADDRESS - 4, 0xffffffff);
+    assert(ramht_cache_lookup(&cache, &table, 0, 0x39).instance == 0x2000);
+
+    /* The same handle on another channel is a separate entry */
+    guest_bind(1, 0x39, 0x3000);
+    assert(ramht_cache_lookup(&cache, &table, 1, 0x39).instance == 0x3000);
+
+    fprintf(stderr, "ok!\n");
+}
+
+static void test_unbind(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    RAMHTCache cache;
+    init_cache(&cache);
+    guest_bind(0, 0x44, 0x5000);
+    assert(ramht_cache_lookup(&cache, &table, 0, 0x44).valid);
+
+    uint32_t offset = RAMHT_ADDRESS + ramht_hash(RAMHT_SIZE, 0, 0x44) * 8;
+    guest_write(offset + 4, 0);
+    assert(!ramht_cache_lookup(&cache, &table, 0, 0x44).valid);
+
+    fprintf(stderr, "ok!\n");
+}
+
+int main(int argc, char *argv[])
+{
+    test_rebind_during_run();
+    test_clean_table_is_cached();
+    test_unbind();
+    return 0;
+}
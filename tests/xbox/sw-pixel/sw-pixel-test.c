@@ -0,0 +1,400 @@
+/*
+ * Check the software renderer's rasterizer, texture sampling and combiners.
+ *
+ * Copyright (c) 2025 xemu contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hw/xbox/nv2a/pgraph/psh_regs.h"
+#include "hw/xbox/nv2a/pgraph/sw/pixel.h"
+
+#define SIZE 8
+
+#define BLEND_EQN_ADD 2
+
+/* 2x2 base level, red in the least significant byte */
+static const uint32_t texels0[] = {
+    0xFF0000FF, 0xFF00FF00, /* Red, green */
+    0xFFFF0000, 0x00FFFFFF, /* Blue, transparent white */
+};
+static const uint32_t texels1[] = { 0x80808080 };
+
+static SwTexture texture;
+
+static void init_texture(void)
+{
+    texture = (SwTexture){
+        .num_faces = 1,
+        .num_levels = 2,
+    };
+    texture.levels[0][0] = (SwTextureLevel){ 2, 2, texels0 };
+    texture.levels[0][1] = (SwTextureLevel){ 1, 1, texels1 };
+}
+
+static SwSampler make_sampler(void)
+{
+    return (SwSampler){
+        .texture = &texture,
+        .min_filter = NV_PGRAPH_TEXFILTER0_MIN_BOX_NEARESTLOD,
+        .mag_filter = NV_PGRAPH_TEXFILTER0_MAG_BOX_LOD0,
+        .addr_u = NV_PGRAPH_TEXADDRESS0_ADDRU_WRAP,
+        .addr_v = NV_PGRAPH_TEXADDRESS0_ADDRU_WRAP,
+        .max_lod = 1.0f,
+        .border_color = { 0.0f, 0.0f, 0.0f, 0.5f },
+    };
+}
+
+static void assert_color(const float c[4], float r, float g, float b, float a)
+{
+    const float eps = 1.0f / 512.0f;
+    assert(fabsf(c[0] - r) < eps);
+    assert(fabsf(c[1] - g) < eps);
+    assert(fabsf(c[2] - b) < eps);
+    assert(fabsf(c[3] - a) < eps);
+}
+
+static void sample(const SwSampler *s, float u, float v, const float *ddx,
+                   const float *ddy, float out[4])
+{
+    float coord[3] = { u, v, 0.0f };
+    pgraph_sw_sample_texture(s, coord, ddx, ddy, out);
+}
+
+static void test_sample_texture(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    init_texture();
+    SwSampler s = make_sampler();
+    float c[4];
+
+    /* Nearest at texel centers */
+    sample(&s, 0.25f, 0.25f, NULL, NULL, c);
+    assert_color(c, 1.0f, 0.0f, 0.0f, 1.0f);
+    sample(&s, 0.75f, 0.25f, NULL, NULL, c);
+    assert_color(c, 0.0f, 1.0f, 0.0f, 1.0f);
+    sample(&s, 0.25f, 0.75f, NULL, NULL, c);
+    assert_color(c, 0.0f, 0.0f, 1.0f, 1.0f);
+
+    /* Addressing past the edge */
+    sample(&s, 1.25f, 0.25f, NULL, NULL, c);
+    assert_color(c, 1.0f, 0.0f, 0.0f, 1.0f);
+    s.addr_u = NV_PGRAPH_TEXADDRESS0_ADDRU_CLAMP_TO_EDGE;
+    sample(&s, 1.25f, 0.25f, NULL, NULL, c);
+    assert_color(c, 0.0f, 1.0f, 0.0f, 1.0f);
+    s.addr_u = NV_PGRAPH_TEXADDRESS0_ADDRU_BORDER;
+    sample(&s, 1.25f, 0.25f, NULL, NULL, c);
+    assert_color(c, 0.0f, 0.0f, 0.0f, 0.5f);
+    s.addr_u = NV_PGRAPH_TEXADDRESS0_ADDRU_WRAP;
+
+    /* Bilinear between all four texels */
+    s.mag_filter = NV_PGRAPH_TEXFILTER0_MAG_TENT_LOD0;
+    sample(&s, 0.5f, 0.5f, NULL, NULL, c);
+    assert_color(c, 0.5f, 0.5f, 0.5f, 0.75f);
+
+    /* Two texels per pixel selects the second level */
+    float ddx[2] = { 1.0f, 0.0f }, ddy[2] = { 0.0f, 0.0f };
+    sample(&s, 0.25f, 0.25f, ddx, ddy, c);
+    assert_color(c, 128 / 255.0f, 128 / 255.0f, 128 / 255.0f, 128 / 255.0f);
+
+    /* Unless the LOD clamp keeps the base level */
+    s.max_lod = 0.0f;
+    sample(&s, 0.25f, 0.25f, ddx, ddy, c);
+    assert_color(c, 1.0f, 0.0f, 0.0f, 1.0f);
+
+    /* Rect textures are addressed in texels */
+    s = make_sampler();
+    s.rect = true;
+    sample(&s, 1.5f, 0.5f, NULL, NULL, c);
+    assert_color(c, 0.0f, 1.0f, 0.0f, 1.0f);
+
+    fprintf(stderr, "ok!\n");
+}
+
+/* One stage computing R0 = T0 * V0, with texture 0 projected */
+static void init_modulate_combiner(SwCombinerState *cs)
+{
+    memset(cs, 0, sizeof(*cs));
+    cs->num_stages = 1;
+    cs->rgb_inputs[0] = (PS_REGISTER_T0 << 24) | (PS_REGISTER_V0 << 16);
+    cs->rgb_outputs[0] = PS_REGISTER_R0 << 4;
+    cs->alpha_inputs[0] = ((PS_REGISTER_T0 | PS_CHANNEL_ALPHA) << 24) |
+                          ((PS_REGISTER_V0 | PS_CHANNEL_ALPHA) << 16);
+    cs->alpha_outputs[0] = PS_REGISTER_R0 << 4;
+    cs->tex_mode[0] = PS_TEXTUREMODES_PROJECT2D;
+    cs->samplers[0] = make_sampler();
+}
+
+static void set_varyings(float *var, float u, float v)
+{
+    memset(var, 0, SW_NUM_VARYINGS * sizeof(float));
+    for (int i = 0; i < 4; i++) {
+        var[SW_VAR_D0 + i] = 0.5f;
+    }
+    var[SW_VAR_T0 + 0] = u;
+    var[SW_VAR_T0 + 1] = v;
+    var[SW_VAR_T0 + 3] = 1.0f;
+}
+
+static void test_combiner(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    init_texture();
+    SwCombinerState cs;
+    init_modulate_combiner(&cs);
+
+    float var[SW_NUM_VARYINGS], zero[SW_NUM_VARYINGS] = { 0 };
+    float pos[2] = { 0.5f, 0.5f };
+    float c[4];
+
+    /* Without the final combiner R0 is the output */
+    set_varyings(var, 0.75f, 0.25f);
+    assert(pgraph_sw_shade_fragment(&cs, var, zero, zero, pos, c));
+    assert_color(c, 0.0f, 0.5f, 0.0f, 0.5f);
+
+    /* Projection divides by q */
+    set_varyings(var, 1.5f, 0.5f);
+    var[SW_VAR_T0 + 3] = 2.0f;
+    assert(pgraph_sw_shade_fragment(&cs, var, zero, zero, pos, c));
+    assert_color(c, 0.0f, 0.5f, 0.0f, 0.5f);
+
+    /* Fog blended in by the final combiner, lerp(FOG, R0, FOG.a) */
+    cs.final_enabled = true;
+    cs.final_inputs_0 = ((PS_REGISTER_FOG | PS_CHANNEL_ALPHA) << 24) |
+                        (PS_REGISTER_R0 << 16) | (PS_REGISTER_FOG << 8) |
+                        PS_REGISTER_ZERO;
+    cs.final_inputs_1 = (PS_REGISTER_R0 | PS_CHANNEL_ALPHA) << 8;
+    cs.fog_color[0] = 1.0f;
+    set_varyings(var, 0.75f, 0.25f);
+    var[SW_VAR_FOG] = 0.25f;
+    assert(pgraph_sw_shade_fragment(&cs, var, zero, zero, pos, c));
+    assert_color(c, 0.75f, 0.125f, 0.0f, 0.5f);
+
+    /* Alpha kill discards on a transparent texel only */
+    cs.samplers[0].alpha_kill = true;
+    set_varyings(var, 0.75f, 0.75f);
+    assert(!pgraph_sw_shade_fragment(&cs, var, zero, zero, pos, c));
+    set_varyings(var, 0.25f, 0.75f);
+    assert(pgraph_sw_shade_fragment(&cs, var, zero, zero, pos, c));
+
+    fprintf(stderr, "ok!\n");
+}
+
+static uint8_t color_data[SIZE * SIZE * 4];
+static uint8_t zeta_data[SIZE * SIZE * 4];
+
+static SwSurface color = {
+    .bound = true,
+    .width = SIZE,
+    .height = SIZE,
+    .pitch = SIZE * 4,
+    .bytes_per_pixel = 4,
+    .format = NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8,
+    .data = color_data,
+};
+
+static SwSurface zeta = {
+    .bound = true,
+    .width = SIZE,
+    .height = SIZE,
+    .pitch = SIZE * 4,
+    .bytes_per_pixel = 4,
+    .format = NV097_SET_SURFACE_FORMAT_ZETA_Z24S8,
+    .data = zeta_data,
+};
+
+static uint32_t read_pixel(const SwSurface *s, int x, int y)
+{
+    const uint8_t *p = s->data + y * s->pitch + x * 4;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Draws the output of V0 without depth or stencil */
+static void init_draw_state(SwDrawState *ds)
+{
+    memset(ds, 0, sizeof(*ds));
+    ds->aa_x = ds->aa_y = 1;
+    ds->scissor_x1 = ds->scissor_y1 = SIZE;
+    ds->width = ds->height = SIZE;
+    ds->window_clip[0] = (SwClipRegion){ 0, 0, SIZE, SIZE };
+    ds->zeta_format = NV097_SET_SURFACE_FORMAT_ZETA_Z24S8;
+    ds->clip_max = 0xFFFFFF;
+    ds->write_r = ds->write_g = ds->write_b = ds->write_a = true;
+    ds->smooth_shading = true;
+    ds->combiner.final_enabled = true;
+    ds->combiner.final_inputs_0 = PS_REGISTER_V0;
+    ds->combiner.final_inputs_1 = (PS_REGISTER_V0 | PS_CHANNEL_ALPHA) << 8;
+
+    memset(color_data, 0, sizeof(color_data));
+}
+
+/* Positions are in unscaled pixels, with a constant depth and color */
+static uint64_t draw_triangle(const SwDrawState *ds, const float xy[3][2],
+                              float z, float r, float g, float b, float a)
+{
+    float var[SW_NUM_VARYINGS] = { r, g, b, a };
+    float pos[3][4];
+    SwRasterVertex rv[3];
+    for (int i = 0; i < 3; i++) {
+        pos[i][0] = xy[i][0];
+        pos[i][1] = xy[i][1];
+        pos[i][2] = z;
+        pos[i][3] = 1.0f;
+        rv[i] = (SwRasterVertex){
+            .x = xy[i][0] * ds->aa_x,
+            .y = xy[i][1] * ds->aa_y,
+            .inv_w = 1.0f,
+            .var = var,
+        };
+    }
+
+    SwPlane plane;
+    float mz;
+    pgraph_sw_calc_depth_plane(ds, pos[0], pos[1], pos[2], &plane, &mz);
+
+    SwTriangle t;
+    uint64_t samples = 0;
+    if (pgraph_sw_setup_triangle(ds, &rv[0], &rv[1], &rv[2], &plane, mz, &t)) {
+        pgraph_sw_rasterize_triangle(ds, &color, &zeta, &t, 0, 0, ds->width - 1,
+                                     ds->height - 1, &samples);
+    }
+    return samples;
+}
+
+static void test_rasterize_coverage(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    SwDrawState ds;
+    init_draw_state(&ds);
+
+    /* Pixel centers on the long edge follow the top-left rule */
+    static const float tri[3][2] = { { 1, 1 }, { 7.5f, 1 }, { 1, 7.5f } };
+    static const char *golden[SIZE] = {
+        "........",
+        ".######.",
+        ".#####..",
+        ".####...",
+        ".###....",
+        ".##.....",
+        ".#......",
+        "........",
+    };
+    assert(draw_triangle(&ds, tri, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f) == 21);
+    for (int y = 0; y < SIZE; y++) {
+        for (int x = 0; x < SIZE; x++) {
+            uint32_t expected = golden[y][x] == '#' ? 0xFFFFFFFF : 0;
+            assert(read_pixel(&color, x, y) == expected);
+        }
+    }
+
+    /* Nothing is drawn outside the scissor rectangle */
+    init_draw_state(&ds);
+    ds.scissor_x0 = 7;
+    assert(draw_triangle(&ds, tri, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f) == 0);
+
+    /* Or inside an exclusive window clip region */
+    init_draw_state(&ds);
+    ds.window_clip_exclusive = true;
+    assert(draw_triangle(&ds, tri, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f) == 0);
+
+    fprintf(stderr, "ok!\n");
+}
+
+static void test_rasterize_shared_edge(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    SwDrawState ds;
+    init_draw_state(&ds);
+    ds.blend = true;
+    ds.blend_eqn = BLEND_EQN_ADD;
+    ds.blend_sfactor = NV_PGRAPH_BLEND_SFACTOR_ONE;
+    ds.blend_dfactor = NV_PGRAPH_BLEND_DFACTOR_ONE;
+
+    /* A quad split along its diagonal covers every pixel exactly once */
+    static const float tri0[3][2] = { { 0, 0 }, { SIZE, 0 }, { SIZE, SIZE } };
+    static const float tri1[3][2] = { { 0, 0 }, { SIZE, SIZE }, { 0, SIZE } };
+    uint64_t samples = draw_triangle(&ds, tri0, 0.0f, 0.25f, 0.25f, 0.25f,
+                                     0.25f);
+    samples += draw_triangle(&ds, tri1, 0.0f, 0.25f, 0.25f, 0.25f, 0.25f);
+    assert(samples == SIZE * SIZE);
+    for (int y = 0; y < SIZE; y++) {
+        for (int x = 0; x < SIZE; x++) {
+            assert(read_pixel(&color, x, y) == 0x40404040);
+        }
+    }
+
+    fprintf(stderr, "ok!\n");
+}
+
+static void test_depth_test(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    SwDrawState ds;
+    init_draw_state(&ds);
+    ds.depth_test = ds.depth_write = true;
+    ds.depth_func = NV_PGRAPH_CONTROL_0_ZFUNC_LESS;
+    for (int i = 0; i < SIZE * SIZE; i++) {
+        static const uint8_t clear[4] = { 0x5A, 0xFF, 0xFF, 0xFF };
+        memcpy(&zeta_data[i * 4], clear, 4);
+    }
+
+    static const float tri0[3][2] = { { 0, 0 }, { SIZE, 0 }, { SIZE, SIZE } };
+    static const float tri1[3][2] = { { 0, 0 }, { SIZE, SIZE }, { 0, SIZE } };
+    static const float full[3][2] = { { 0, 0 }, { 2 * SIZE, 0 },
+                                      { 0, 2 * SIZE } };
+    assert(draw_triangle(&ds, tri0, 1000.0f, 1.0f, 0.0f, 0.0f, 1.0f) == 36);
+
+    /* Farther geometry only lands where nothing was drawn */
+    assert(draw_triangle(&ds, full, 2000.0f, 0.0f, 1.0f, 0.0f, 1.0f) == 28);
+
+    /* Nearer geometry wins, the diagonal belongs to the first triangle */
+    assert(draw_triangle(&ds, tri1, 500.0f, 0.0f, 0.0f, 1.0f, 1.0f) == 28);
+
+    for (int y = 0; y < SIZE; y++) {
+        for (int x = 0; x < SIZE; x++) {
+            uint32_t z = read_pixel(&zeta, x, y);
+            assert((z & 0xFF) == 0x5A);
+            if (x < y) {
+                assert(read_pixel(&color, x, y) == 0xFF0000FF);
+                assert(z >> 8 == 500);
+            } else {
+                assert(read_pixel(&color, x, y) == 0xFFFF0000);
+                assert(z >> 8 == 1000);
+            }
+        }
+    }
+
+    fprintf(stderr, "ok!\n");
+}
+
+int main(int argc, char *argv[])
+{
+    test_sample_texture();
+    test_combiner();
+    test_rasterize_coverage();
+    test_rasterize_shared_edge();
+    test_depth_test();
+    return 0;
+}
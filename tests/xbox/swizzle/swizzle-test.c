@@ -17,6 +17,7 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -24,6 +25,27 @@
 #include <unistd.h>
 #include <time.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include "host/cpuinfo.h"
+
+/* Stand-in for util/cpuinfo-i386.c, which needs the rest of QEMU */
+unsigned cpuinfo;
+
+unsigned cpuinfo_init(void)
+{
+    unsigned info = CPUINFO_ALWAYS;
+
+    __builtin_cpu_init();
+    info |= __builtin_cpu_supports("sse2") ? CPUINFO_SSE2 : 0;
+    info |= __builtin_cpu_supports("avx2") ? CPUINFO_AVX2 : 0;
+    cpuinfo = info;
+
+    return info;
+}
+#endif
+
+bool test_swizzle_next_accel(void);
+
 #define X_METHODS \
     X(A)
     // X(B)
@@ -67,12 +89,48 @@ const Method methods[] = {
 };
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-int widths[] = { 1, 2, 4, 8, 16, 32 };
-int heights[] = { 1, 2, 4, 8, 16, 32 };
+int widths[] = { 1, 2, 4, 8, 16, 32, 64 };
+int heights[] = { 1, 2, 4, 8, 16, 32, 64 };
 int depths[] = { 1, 2, 4, 8, 16, 32 };
 int bpps[] = { 1, 2, 3, 4 };
 
+/* Straightforward bit interleave, independent of the masks in swizzle.c */
+static size_t reference_offset(int x, int y, int z, int width, int height,
+                               int depth)
+{
+    size_t offset = 0;
+    int out_bit = 0;
+
+    for (int bit = 1; bit < width || bit < height || bit < depth; bit <<= 1) {
+        if (bit < width) {
+            offset |= (size_t)((x & bit) != 0) << out_bit++;
+        }
+        if (bit < height) {
+            offset |= (size_t)((y & bit) != 0) << out_bit++;
+        }
+        if (bit < depth) {
+            offset |= (size_t)((z & bit) != 0) << out_bit++;
+        }
+    }
+
+    return offset;
+}
+
+static void reference_swizzle(const uint8_t *src_buf, int width, int height,
+                              int depth, uint8_t *dst_buf, size_t row_pitch,
+                              size_t slice_pitch, int bpp)
+{
+    for (int z = 0; z < depth; z++)
+    for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++) {
+        size_t offset = reference_offset(x, y, z, width, height, depth);
+        memcpy(dst_buf + offset * bpp,
+               src_buf + z * slice_pitch + y * row_pitch + x * bpp, bpp);
+    }
+}
+
 static void crosscheck(void)
 {
     assert(ARRAY_SIZE(methods) > 0);
@@ -103,6 +161,13 @@ static void crosscheck(void)
         methods[0].swizzle(original_data, width, height, depth, swizzled_data_A,
                            row_pitch, slice_pitch, bpp);
 
+        void *swizzled_data_ref = malloc(size_bytes);
+        memcpy(swizzled_data_ref, original_data, size_bytes);
+        reference_swizzle(original_data, width, height, depth,
+                          swizzled_data_ref, row_pitch, slice_pitch, bpp);
+        assert(!memcmp(swizzled_data_A, swizzled_data_ref, size_bytes));
+        free(swizzled_data_ref);
+
         void *unswizzled_data_A = malloc(size_bytes);
         memcpy(unswizzled_data_A, original_data, size_bytes);
         methods[0].unswizzle(swizzled_data_A, width, height, depth,
@@ -147,71 +212,95 @@ static int compare_ints(const void *a, const void *b)
     return *(int*)a - *(int*)b;
 }
 
-static void bench(void)
+static void bench_one(const Method *method, bool unswizzle, int width,
+                      int height, int depth, int bpp)
 {
-    fprintf(stderr, "%s...", __func__);
-
-    int width = 256;
-    int height = 256;
-    int depth = 256;
-    int bpp = 4;
-
     size_t row_pitch = width * bpp;
     size_t slice_pitch = row_pitch * height;
     size_t size_bytes = slice_pitch * depth;
-    size_t size_mib = size_bytes / (1024*1024);
-    fprintf(stderr, "with w: %d, h: %d, d: %d, bpp: %d, "
-                    "size: %zu MiB, iterations: %d\n",
-                    width, height, depth, bpp, size_mib, NUM_ITERATIONS);
 
-    void *original_data = malloc(size_bytes);
-    memset(original_data, 0, size_bytes);
+    void *linear_data = malloc(size_bytes);
+    memset(linear_data, 0, size_bytes);
 
     void *swizzled_data = malloc(size_bytes);
     memset(swizzled_data, 0, size_bytes);
 
+    fprintf(stderr, "[%6s] %9s w: %4d, h: %4d, d: %3d, bpp: %d  ",
+            method->name, unswizzle ? "unswizzle" : "swizzle", width, height,
+            depth, bpp);
 
-    for (int method_idx = 0; method_idx < ARRAY_SIZE(methods); method_idx++) {
-        const Method * const method = &methods[method_idx];
-        fprintf(stderr, "[%6s] ", method->name);
-
-        int samples[NUM_ITERATIONS];
-        int sum = 0;
-
-        for (int iter = 0; iter < NUM_ITERATIONS; iter++ ) {
-            struct timespec start, end;
-
-            clock_gettime(CLOCK_MONOTONIC, &start);
-            method->swizzle(original_data, width, height, depth, swizzled_data, row_pitch, slice_pitch, bpp);
-            clock_gettime(CLOCK_MONOTONIC, &end);
+    int samples[NUM_ITERATIONS];
+    int sum = 0;
 
-            uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
-            uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++ ) {
+        struct timespec start, end;
 
-            samples[iter] = (end_ns - start_ns) / 1000;
-            sum += samples[iter];
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (unswizzle) {
+            method->unswizzle(swizzled_data, width, height, depth, linear_data,
+                              row_pitch, slice_pitch, bpp);
+        } else {
+            method->swizzle(linear_data, width, height, depth, swizzled_data,
+                            row_pitch, slice_pitch, bpp);
         }
+        clock_gettime(CLOCK_MONOTONIC, &end);
 
-        qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
+        uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
+        uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
 
-        int min = samples[0],
-            max = samples[ARRAY_SIZE(samples) - 1],
-            avg = sum / ARRAY_SIZE(samples),
-            med = samples[ARRAY_SIZE(samples) / 2];
-        fprintf(stderr, "min: %6d us, max: %6d us, avg: %6d us, med: %6d us  -- %.2g GiB/s\n",
-                min, max, avg, med, (size_mib / 1024.0) / (med / 1000000.0));
+        samples[iter] = (end_ns - start_ns) / 1000;
+        sum += samples[iter];
     }
 
+    qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
+
+    int min = samples[0],
+        max = samples[ARRAY_SIZE(samples) - 1],
+        avg = sum / ARRAY_SIZE(samples),
+        med = samples[ARRAY_SIZE(samples) / 2];
+    double size_gib = size_bytes / (1024.0 * 1024.0 * 1024.0);
+    fprintf(stderr, "min: %6d us, max: %6d us, avg: %6d us, med: %6d us  -- %.2g GiB/s\n",
+            min, max, avg, med, size_gib / (MAX(med, 1) / 1000000.0));
+
     free(swizzled_data);
-    free(original_data);
+    free(linear_data);
+}
+
+static const struct {
+    int width, height, depth;
+} bench_sizes[] = {
+    { 64, 64, 1 },
+    { 256, 256, 1 },
+    { 1024, 1024, 1 },
+    { 4096, 4096, 1 },
+    { 256, 256, 256 },
+};
+
+static void bench(void)
+{
+    fprintf(stderr, "%s... iterations: %d\n", __func__, NUM_ITERATIONS);
+
+    for (int size_idx = 0; size_idx < ARRAY_SIZE(bench_sizes); size_idx++)
+    for (int bpp_idx = 0; bpp_idx < ARRAY_SIZE(bpps); bpp_idx++)
+    for (int method_idx = 0; method_idx < ARRAY_SIZE(methods); method_idx++)
+    for (int unswizzle = 0; unswizzle < 2; unswizzle++) {
+        bench_one(&methods[method_idx], unswizzle, bench_sizes[size_idx].width,
+                  bench_sizes[size_idx].height, bench_sizes[size_idx].depth,
+                  bpps[bpp_idx]);
+    }
 }
 
 int main(int argc, char const *argv[])
 {
     srand(1337);
 
-    crosscheck();
-    bench();
+    /* Run everything once per accelerated implementation, best first */
+    int accel = 0;
+    do {
+        fprintf(stderr, "accel %d:\n", accel++);
+        crosscheck();
+        bench();
+    } while (test_swizzle_next_accel());
 
     return 0;
 }
@@ -67,6 +67,13 @@ void MainMenuGeneralView::Draw()
 
     Toggle("Cache shaders to disk", &g_config.perf.cache_shaders,
            "Reduce stutter in games by caching previously generated shaders");
+    ChevronCombo("Shader compilation", &g_config.perf.async_shader_compile,
+                 "Wait\0"
+                 "Skip draws\0"
+                 "Use ubershader\0",
+                 "Wait for new shaders to compile, skip draws that use them, "
+                 "or draw them with a generic pixel shader until compilation "
+                 "finishes in the background (Vulkan)");
 
     SectionTitle("Miscellaneous");
     Toggle("Skip startup animation", &g_config.general.skip_boot_anim,
@@ -743,6 +750,7 @@ void MainMenuDisplayView::Draw()
     ChevronCombo("Backend", &g_config.display.renderer,
                  "Null\0"
                  "OpenGL\0"
+                 "Software\0"
 #ifdef CONFIG_VULKAN
                  "Vulkan\0"
 #endif
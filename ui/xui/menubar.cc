@@ -35,6 +35,12 @@ extern float g_main_menu_height; // FIXME
 bool g_capture_renderdoc_frame = false;
 #endif
 
+#define NV2A_TRACE_CAPTURE_FRAMES 300
+
+static const SDL_DialogFileFilter nv2a_trace_filters[] = {
+    { "NV2A Trace Files (*.nv2t)", "nv2t" },
+};
+
 #if defined(__APPLE__)
 #define SHORTCUT_MENU_TEXT(c) "Cmd+" #c
 #else
@@ -178,6 +184,7 @@ void ShowMainMenu()
             ImGui::Combo("Backend", &g_config.display.renderer,
                  "Null\0"
                  "OpenGL\0"
+                 "Software\0"
 #ifdef CONFIG_VULKAN
                  "Vulkan\0"
 #endif
@@ -220,6 +227,18 @@ void ShowMainMenu()
             ImGui::MenuItem("Monitor", "~", &monitor_window.is_open);
             ImGui::MenuItem("Audio", NULL, &apu_window.m_is_open);
             ImGui::MenuItem("Video", NULL, &video_window.m_is_open);
+            if (ImGui::MenuItem("NV2A: Capture Trace...")) {
+                ShowSaveFileDialog(nv2a_trace_filters, 1, NULL,
+                                   [](const char *path) {
+                    nv2a_dbg_capture_frames(path, NV2A_TRACE_CAPTURE_FRAMES);
+                });
+            }
+            if (ImGui::MenuItem("NV2A: Replay Trace...")) {
+                ShowOpenFileDialog(nv2a_trace_filters, 1, NULL,
+                                   [](const char *path) {
+                    nv2a_dbg_replay(path);
+                });
+            }
 #ifdef CONFIG_RENDERDOC
             if (nv2a_dbg_renderdoc_available()) {
                 ImGui::MenuItem("RenderDoc: Capture", NULL, &g_capture_renderdoc_frame);